@@ -0,0 +1,180 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <string>
+#include <unordered_map>
+#include <functional>
+#include <new>
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+
+#include "blockpool.hpp"
+
+/*
+    单调分配区：请求期间的临时数据只分配不释放，请求结束时整体Reset
+    1、内存块取自BlockPool，走当前工作线程的块缓存，稳定状态下不进入malloc
+    2、超过一块的分配单独new，Reset时一并释放
+    3、只应由持有它的请求使用，不做同步
+*/
+class Arena final {
+public:
+    Arena();
+    ~Arena();
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* Allocate(size_t size, size_t align = alignof(max_align_t));
+    //归还全部内存块，之前分配的内存全部失效
+    void Reset();
+    //已占用的块字节数
+    size_t BlockBytes() const;
+
+private:
+    //块头，位于每个块的起始处
+    struct BlockHead {
+        BlockHead* next;
+        size_t cap;
+    };
+
+    void* Grow_(size_t size, size_t align);
+    static uintptr_t AlignUp_(uintptr_t addr, size_t align);
+
+    BlockHead* head_;
+    char* cur_;
+    char* end_;
+    size_t blockBytes_;
+};
+
+Arena::Arena() : head_(nullptr), cur_(nullptr), end_(nullptr), blockBytes_(0) {}
+
+Arena::~Arena() {
+    Reset();
+}
+
+uintptr_t Arena::AlignUp_(uintptr_t addr, size_t align) {
+    assert((align & (align - 1)) == 0);
+    return (addr + align - 1) & ~static_cast<uintptr_t>(align - 1);
+}
+
+void* Arena::Allocate(size_t size, size_t align) {
+    if(cur_ != nullptr) {
+        uintptr_t addr = AlignUp_(reinterpret_cast<uintptr_t>(cur_), align);
+        if(addr + size <= reinterpret_cast<uintptr_t>(end_)) {
+            cur_ = reinterpret_cast<char*>(addr + size);
+            return reinterpret_cast<void*>(addr);
+        }
+    }
+    return Grow_(size, align);
+}
+
+void* Arena::Grow_(size_t size, size_t align) {
+    size_t need = sizeof(BlockHead) + align + size;
+    BlockHead* block = nullptr;
+    if(need <= BlockPool::BLOCK_SIZE) {
+        block = reinterpret_cast<BlockHead*>(BlockPool::GetInstance()->Alloc());
+        block->cap = BlockPool::BLOCK_SIZE;
+    }
+    else {
+        block = reinterpret_cast<BlockHead*>(new char[need]);
+        block->cap = need;
+    }
+    block->next = head_;
+    head_ = block;
+    blockBytes_ += block->cap;
+
+    char* data = reinterpret_cast<char*>(block);
+    uintptr_t addr = AlignUp_(reinterpret_cast<uintptr_t>(data + sizeof(BlockHead)), align);
+    cur_ = reinterpret_cast<char*>(addr + size);
+    end_ = data + block->cap;
+    return reinterpret_cast<void*>(addr);
+}
+
+void Arena::Reset() {
+    while(head_) {
+        BlockHead* next = head_->next;
+        if(head_->cap == BlockPool::BLOCK_SIZE) {
+            BlockPool::GetInstance()->Free(reinterpret_cast<char*>(head_));
+        }
+        else {
+            delete[] reinterpret_cast<char*>(head_);
+        }
+        head_ = next;
+    }
+    cur_ = end_ = nullptr;
+    blockBytes_ = 0;
+}
+
+size_t Arena::BlockBytes() const {
+    return blockBytes_;
+}
+
+/*
+    绑定Arena的标准分配器
+    未绑定Arena时退化为operator new/delete；拷贝构造容器时新容器回到堆上，
+    保证拷贝出请求（如交给后台任务）后不再引用原请求的Arena
+*/
+template<typename T>
+class ArenaAllocator {
+public:
+    typedef T value_type;
+
+    ArenaAllocator() noexcept : arena_(nullptr) {}
+    explicit ArenaAllocator(Arena* arena) noexcept : arena_(arena) {}
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) noexcept : arena_(other.GetArena()) {}
+
+    T* allocate(size_t n) {
+        if(arena_ == nullptr) {
+            return static_cast<T*>(::operator new(n * sizeof(T)));
+        }
+        return static_cast<T*>(arena_->Allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, size_t) noexcept {
+        //Arena内存在Reset时统一归还
+        if(arena_ == nullptr) {
+            ::operator delete(p);
+        }
+    }
+
+    ArenaAllocator select_on_container_copy_construction() const {
+        return ArenaAllocator();
+    }
+
+    Arena* GetArena() const noexcept {
+        return arena_;
+    }
+
+private:
+    Arena* arena_;
+};
+
+template<typename T, typename U>
+bool operator==(const ArenaAllocator<T>& lhs, const ArenaAllocator<U>& rhs) noexcept {
+    return lhs.GetArena() == rhs.GetArena();
+}
+
+template<typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& lhs, const ArenaAllocator<U>& rhs) noexcept {
+    return !(lhs == rhs);
+}
+
+typedef std::basic_string<char, std::char_traits<char>, ArenaAllocator<char>> ArenaString;
+
+//FNV-1a，std::hash只特化了std::string
+struct ArenaStringHash {
+    size_t operator()(const ArenaString& str) const noexcept {
+        uint64_t hash = 14695981039346656037ULL;
+        for(char ch : str) {
+            hash ^= static_cast<unsigned char>(ch);
+            hash *= 1099511628211ULL;
+        }
+        return static_cast<size_t>(hash);
+    }
+};
+
+typedef std::unordered_map<ArenaString, ArenaString, ArenaStringHash, std::equal_to<ArenaString>,
+                           ArenaAllocator<std::pair<const ArenaString, ArenaString>>> ArenaStringMap;
+
+#endif
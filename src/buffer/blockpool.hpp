@@ -0,0 +1,131 @@
+#ifndef BLOCKPOOL_HPP
+#define BLOCKPOOL_HPP
+
+#include <vector>
+#include <mutex>
+#include <algorithm>
+#include <assert.h>
+
+/*
+    固定大小内存块池
+    1、每个线程先从本线程缓存取还，不加锁
+    2、线程缓存超过上限时成批归还全局空闲链，取空时成批从全局补充
+    3、全局空闲链超过上限的块直接释放
+*/
+class BlockPool final {
+public:
+    static const size_t BLOCK_SIZE = 4096;
+
+    static BlockPool* GetInstance();
+
+    char* Alloc();
+    void Free(char* block);
+
+private:
+    //线程本地缓存，线程退出时归还全局
+    struct LocalCache {
+        LocalCache();
+        ~LocalCache();
+        std::vector<char*> blocks;
+    };
+
+    BlockPool() = default;
+    ~BlockPool() = default;
+
+    //当前线程缓存，线程退出析构后返回nullptr
+    static LocalCache* GetLocal_();
+    void Refill_(LocalCache* local);
+    void Drain_(LocalCache* local, size_t keep);
+
+    static const size_t LOCAL_MAX = 64;
+    static const size_t BATCH = 32;
+    static const size_t GLOBAL_MAX = 4096;
+
+    std::mutex mtx_;
+    std::vector<char*> global_;
+};
+
+const size_t BlockPool::BLOCK_SIZE;
+const size_t BlockPool::LOCAL_MAX;
+const size_t BlockPool::BATCH;
+const size_t BlockPool::GLOBAL_MAX;
+
+BlockPool* BlockPool::GetInstance() {
+    //不析构：静态对象中的Buffer在进程退出时仍可归还内存块
+    static BlockPool* pool = new BlockPool();
+    return pool;
+}
+
+BlockPool::LocalCache::LocalCache() {
+    blocks.reserve(LOCAL_MAX);
+}
+
+BlockPool::LocalCache::~LocalCache() {
+    BlockPool::GetInstance()->Drain_(this, 0);
+}
+
+BlockPool::LocalCache* BlockPool::GetLocal_() {
+    //0-未构造 1-可用 2-已析构
+    static thread_local int state = 0;
+    if(state == 2) {
+        return nullptr;
+    }
+    static thread_local struct Holder {
+        Holder() { state = 1; }
+        ~Holder() { state = 2; }
+        LocalCache cache;
+    } holder;
+    return &holder.cache;
+}
+
+char* BlockPool::Alloc() {
+    LocalCache* local = GetLocal_();
+    if(local == nullptr) {
+        return new char[BLOCK_SIZE];
+    }
+    if(local->blocks.empty()) {
+        Refill_(local);
+    }
+    if(local->blocks.empty()) {
+        return new char[BLOCK_SIZE];
+    }
+    char* block = local->blocks.back();
+    local->blocks.pop_back();
+    return block;
+}
+
+void BlockPool::Free(char* block) {
+    assert(block);
+    LocalCache* local = GetLocal_();
+    if(local == nullptr) {
+        delete[] block;
+        return;
+    }
+    if(local->blocks.size() >= LOCAL_MAX) {
+        Drain_(local, LOCAL_MAX - BATCH);
+    }
+    local->blocks.push_back(block);
+}
+
+void BlockPool::Refill_(LocalCache* local) {
+    std::lock_guard<std::mutex> locker(mtx_);
+    size_t count = std::min(BATCH, global_.size());
+    local->blocks.insert(local->blocks.end(), global_.end() - count, global_.end());
+    global_.resize(global_.size() - count);
+}
+
+void BlockPool::Drain_(LocalCache* local, size_t keep) {
+    std::lock_guard<std::mutex> locker(mtx_);
+    while(local->blocks.size() > keep) {
+        char* block = local->blocks.back();
+        local->blocks.pop_back();
+        if(global_.size() < GLOBAL_MAX) {
+            global_.push_back(block);
+        }
+        else {
+            delete[] block;
+        }
+    }
+}
+
+#endif
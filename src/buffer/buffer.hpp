@@ -6,19 +6,37 @@
 #include <unistd.h>  // write
 #include <sys/uio.h> //readv
 #include <vector> //readv
-#include <atomic>
+#include <string>
+#include <algorithm>
+#include <stdint.h>
 #include <assert.h>
 
+#include "blockpool.hpp"
+
+/*
+    由内存块链组成的缓冲区
+    1、块从BlockPool按需取用，缓冲区读空即全部归还，空闲连接不占块
+    2、增长时追加新块，不搬移已有数据；readv/writev直接使用各块的iovec
+    3、Peek需要连续视图时才把跨块的可读数据合并到一块
+    单一所有者使用，读写位置不做同步
+*/
 class Buffer {
 public:
-    Buffer(int initBuffSize = 1024);
-    ~Buffer() = default;
+    static const size_t BLOCK_SIZE = BlockPool::BLOCK_SIZE;
+
+    Buffer();
+    ~Buffer();
+    Buffer(const Buffer&) = delete;
+    Buffer& operator=(const Buffer&) = delete;
 
-    size_t WritableBytes() const;       
+    //末块中BeginWrite处连续可写的字节数
+    size_t WritableBytes() const;
     size_t ReadableBytes() const ;
     size_t PrependableBytes() const;
 
-    const char* Peek() const;
+    //返回连续的可读数据，数据跨块时先合并
+    const char* Peek();
+    //保证BeginWrite处至少len字节连续可写
     void EnsureWriteable(size_t len);
     void HasWritten(size_t len);
 
@@ -28,7 +46,6 @@ public:
     void RetrieveAll() ;
     std::string RetrieveAllToStr();
 
-    const char* BeginWriteConst() const;
     char* BeginWrite();
 
     void Append(const std::string& str);
@@ -36,39 +53,83 @@ public:
     void Append(const void* data, size_t len);
     void Append(const Buffer& buff);
 
+    //前maxLen字节可读数据的iovec，最多maxCnt段，返回段数
+    int ReadableIov(struct iovec* iov, int maxCnt, size_t maxLen = SIZE_MAX) const;
+
     ssize_t ReadFd(int fd, int* Errno);
     ssize_t WriteFd(int fd, int* Errno);
 
 private:
-    char* BeginPtr_();
-    const char* BeginPtr_() const;
-    void MakeSpace_(size_t len);
-
-    std::vector<char> buffer_;
-    std::atomic<std::size_t> readPos_;
-    std::atomic<std::size_t> writePos_;
+    struct Chunk {
+        char* data;
+        size_t cap;
+        size_t begin;   //可读起点
+        size_t end;     //可读终点，亦为可写起点
+    };
+
+    //追加一个至少len字节的空块
+    void AddChunk_(size_t len);
+    void FreeChunk_(Chunk& chunk);
+    //把跨块的可读数据合并到一块
+    void Coalesce_();
+    void ReleaseAll_();
+
+    //单次readv最多使用的新块数
+    static const int READ_CHUNKS = 16;
+
+    std::vector<Chunk> chunks_;
+    size_t readable_;
 };
 
-Buffer::Buffer(int initBuffSize) : buffer_(initBuffSize), readPos_(0), writePos_(0) {}
+const size_t Buffer::BLOCK_SIZE;
+
+Buffer::Buffer() : readable_(0) {}
+
+Buffer::~Buffer() {
+    ReleaseAll_();
+}
 
 size_t Buffer::ReadableBytes() const {
-    return writePos_ - readPos_;
+    return readable_;
 }
 size_t Buffer::WritableBytes() const {
-    return buffer_.size() - writePos_;
+    return chunks_.empty() ? 0 : chunks_.back().cap - chunks_.back().end;
 }
 
 size_t Buffer::PrependableBytes() const {
-    return readPos_;
+    return chunks_.empty() ? 0 : chunks_.front().begin;
 }
 
-const char* Buffer::Peek() const {
-    return BeginPtr_() + readPos_;
+const char* Buffer::Peek() {
+    if(chunks_.empty()) {
+        return "";
+    }
+    if(readable_ > chunks_.front().end - chunks_.front().begin) {
+        Coalesce_();
+    }
+    return chunks_.front().data + chunks_.front().begin;
 }
 
 void Buffer::Retrieve(size_t len) {
     assert(len <= ReadableBytes());
-    readPos_ += len;
+    readable_ -= len;
+    if(readable_ == 0) {
+        ReleaseAll_();
+        return;
+    }
+    //读完的前部块立即归还
+    size_t drop = 0;
+    while(len > 0) {
+        Chunk& chunk = chunks_[drop];
+        size_t n = std::min(len, chunk.end - chunk.begin);
+        chunk.begin += n;
+        len -= n;
+        if(chunk.begin == chunk.end) {
+            FreeChunk_(chunk);
+            ++drop;
+        }
+    }
+    chunks_.erase(chunks_.begin(), chunks_.begin() + drop);
 }
 
 void Buffer::RetrieveUntil(const char* end) {
@@ -77,28 +138,33 @@ void Buffer::RetrieveUntil(const char* end) {
 }
 
 void Buffer::RetrieveAll() {
-    bzero(&buffer_[0], buffer_.size());
-    readPos_ = 0;
-    writePos_ = 0;
+    readable_ = 0;
+    ReleaseAll_();
 }
 
 std::string Buffer::RetrieveAllToStr() {
-    std::string str(Peek(), ReadableBytes());
+    std::string str;
+    str.reserve(readable_);
+    for(const auto& chunk : chunks_) {
+        str.append(chunk.data + chunk.begin, chunk.end - chunk.begin);
+    }
     RetrieveAll();
     return str;
 }
 
-const char* Buffer::BeginWriteConst() const {
-    return BeginPtr_() + writePos_;
-}
-
 char* Buffer::BeginWrite() {
-    return BeginPtr_() + writePos_;
+    assert(!chunks_.empty());
+    return chunks_.back().data + chunks_.back().end;
 }
 
 void Buffer::HasWritten(size_t len) {
-    writePos_ += len;
-} 
+    assert(len <= WritableBytes());
+    if(len == 0) {
+        return;
+    }
+    chunks_.back().end += len;
+    readable_ += len;
+}
 
 void Buffer::Append(const std::string& str) {
     Append(str.data(), str.length());
@@ -111,78 +177,144 @@ void Buffer::Append(const void* data, size_t len) {
 
 void Buffer::Append(const char* str, size_t len) {
     assert(str);
-    EnsureWriteable(len);
-    std::copy(str, str + len, BeginWrite());
-    HasWritten(len);
+    //写满末块后续写新块，不要求整段连续
+    while(len > 0) {
+        if(WritableBytes() == 0) {
+            AddChunk_(BLOCK_SIZE);
+        }
+        size_t n = std::min(len, WritableBytes());
+        memcpy(BeginWrite(), str, n);
+        HasWritten(n);
+        str += n;
+        len -= n;
+    }
 }
 
 void Buffer::Append(const Buffer& buff) {
-    Append(buff.Peek(), buff.ReadableBytes());
+    for(const auto& chunk : buff.chunks_) {
+        Append(chunk.data + chunk.begin, chunk.end - chunk.begin);
+    }
 }
 
 void Buffer::EnsureWriteable(size_t len) {
     if(WritableBytes() < len) {
-        MakeSpace_(len);
+        AddChunk_(len);
     }
     assert(WritableBytes() >= len);
 }
 
+int Buffer::ReadableIov(struct iovec* iov, int maxCnt, size_t maxLen) const {
+    int cnt = 0;
+    for(size_t i = 0; i < chunks_.size() && cnt < maxCnt && maxLen > 0; ++i) {
+        const Chunk& chunk = chunks_[i];
+        if(chunk.end > chunk.begin) {
+            iov[cnt].iov_base = chunk.data + chunk.begin;
+            iov[cnt].iov_len = std::min(chunk.end - chunk.begin, maxLen);
+            maxLen -= iov[cnt].iov_len;
+            ++cnt;
+        }
+    }
+    return cnt;
+}
+
 ssize_t Buffer::ReadFd(int fd, int* saveErrno) {
-    char buff[65535];
-    struct iovec iov[2];
+    struct iovec iov[READ_CHUNKS + 1];
+    char* fresh[READ_CHUNKS];
+    int iovCnt = 0;
     const size_t writable = WritableBytes();
-    /* 分散读， 保证数据全部读完 */
-    iov[0].iov_base = BeginPtr_() + writePos_;
-    iov[0].iov_len = writable;
-    iov[1].iov_base = buff;
-    iov[1].iov_len = sizeof(buff);
+    /* 分散读：末块剩余空间 + 若干新块，保证数据全部读完 */
+    if(writable > 0) {
+        iov[iovCnt].iov_base = BeginWrite();
+        iov[iovCnt].iov_len = writable;
+        ++iovCnt;
+    }
+    for(int i = 0; i < READ_CHUNKS; ++i) {
+        fresh[i] = BlockPool::GetInstance()->Alloc();
+        iov[iovCnt].iov_base = fresh[i];
+        iov[iovCnt].iov_len = BLOCK_SIZE;
+        ++iovCnt;
+    }
 
-    const ssize_t len = readv(fd, iov, 2);
+    const ssize_t len = readv(fd, iov, iovCnt);
     if(len < 0) {
         *saveErrno = errno;
     }
-    else if(static_cast<size_t>(len) <= writable) {
-        writePos_ += len;
-    }
-    else {
-        writePos_ = buffer_.size();
-        Append(buff, len - writable);
+    size_t left = len > 0 ? len : 0;
+    size_t n = std::min(left, writable);
+    HasWritten(n);
+    left -= n;
+    //读到数据的新块挂入链表，其余归还
+    for(int i = 0; i < READ_CHUNKS; ++i) {
+        if(left == 0) {
+            BlockPool::GetInstance()->Free(fresh[i]);
+            continue;
+        }
+        n = std::min(left, BLOCK_SIZE);
+        chunks_.push_back({fresh[i], BLOCK_SIZE, 0, n});
+        readable_ += n;
+        left -= n;
     }
     return len;
 }
 
 ssize_t Buffer::WriteFd(int fd, int* saveErrno) {
-    size_t readSize = ReadableBytes();
-    ssize_t len = write(fd, Peek(), readSize);
+    struct iovec iov[READ_CHUNKS];
+    int iovCnt = ReadableIov(iov, READ_CHUNKS);
+    ssize_t len = writev(fd, iov, iovCnt);
     if(len < 0) {
         *saveErrno = errno;
         return len;
-    } 
-    readPos_ += len;
+    }
+    Retrieve(len);
     return len;
 }
 
-char* Buffer::BeginPtr_() {
-    return &*buffer_.begin();
+void Buffer::AddChunk_(size_t len) {
+    //末块为空时直接替换，避免留下空块
+    if(!chunks_.empty() && chunks_.back().begin == chunks_.back().end) {
+        FreeChunk_(chunks_.back());
+        chunks_.pop_back();
+    }
+    if(len <= BLOCK_SIZE) {
+        chunks_.push_back({BlockPool::GetInstance()->Alloc(), BLOCK_SIZE, 0, 0});
+    }
+    else {
+        //超大的连续需求不走块池
+        size_t cap = (len + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+        chunks_.push_back({new char[cap], cap, 0, 0});
+    }
+}
+
+void Buffer::FreeChunk_(Chunk& chunk) {
+    if(chunk.cap == BLOCK_SIZE) {
+        BlockPool::GetInstance()->Free(chunk.data);
+    }
+    else {
+        delete[] chunk.data;
+    }
+    chunk.data = nullptr;
 }
 
-const char* Buffer::BeginPtr_() const {
-    return &*buffer_.begin();
+void Buffer::Coalesce_() {
+    Chunk merged = {nullptr, 0, 0, 0};
+    size_t cap = std::max(readable_, BLOCK_SIZE);
+    cap = (cap + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+    merged.data = (cap == BLOCK_SIZE) ? BlockPool::GetInstance()->Alloc() : new char[cap];
+    merged.cap = cap;
+    for(auto& chunk : chunks_) {
+        memcpy(merged.data + merged.end, chunk.data + chunk.begin, chunk.end - chunk.begin);
+        merged.end += chunk.end - chunk.begin;
+        FreeChunk_(chunk);
+    }
+    assert(merged.end == readable_);
+    chunks_.assign(1, merged);
 }
 
-void Buffer::MakeSpace_(size_t len) {
-    if(WritableBytes() + PrependableBytes() < len) {
-        buffer_.resize(writePos_ + len + 1);
-    } 
-    //todo
-    //可能存在压缩空间时丢失多出的数据
-    else {
-        size_t readable = ReadableBytes();
-        std::copy(BeginPtr_() + readPos_, BeginPtr_() + writePos_, BeginPtr_());
-        readPos_ = 0;
-        writePos_ = readPos_ + readable;
-        assert(readable == ReadableBytes());
+void Buffer::ReleaseAll_() {
+    for(auto& chunk : chunks_) {
+        FreeChunk_(chunk);
     }
+    chunks_.clear();
 }
 
-#endif
\ No newline at end of file
+#endif
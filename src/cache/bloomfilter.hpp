@@ -0,0 +1,94 @@
+#ifndef BLOOMFILTER_HPP
+#define BLOOMFILTER_HPP
+
+#include <atomic>
+#include <memory>
+#include <cmath>
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+
+/*
+    布隆过滤器：MayContain为false时一定不存在，为true时可能误判
+    位数组按容量与误判率计算，k个下标由两个64位哈希组合得到（双重哈希）
+    位用原子操作置位，Add与MayContain可并发
+*/
+class BloomFilter final {
+public:
+    BloomFilter(size_t capacity, double fpRate);
+    BloomFilter(const BloomFilter&) = delete;
+    BloomFilter& operator=(const BloomFilter&) = delete;
+
+    void Add(const char* key, size_t len);
+    bool MayContain(const char* key, size_t len) const;
+
+    size_t GetBitCount() const;
+    int GetHashCount() const;
+
+private:
+    static uint64_t Hash_(const char* key, size_t len, uint64_t seed);
+
+    size_t bitCnt_;
+    int hashCnt_;
+    std::unique_ptr<std::atomic<uint64_t>[]> words_;
+};
+
+BloomFilter::BloomFilter(size_t capacity, double fpRate) {
+    assert(capacity > 0 && fpRate > 0 && fpRate < 1);
+    //m = -n*ln(p)/ln(2)^2，k = m/n*ln(2)
+    double bits = -static_cast<double>(capacity) * std::log(fpRate) / (std::log(2.0) * std::log(2.0));
+    size_t wordCnt = static_cast<size_t>(bits / 64) + 1;
+    bitCnt_ = wordCnt * 64;
+    hashCnt_ = static_cast<int>(std::round(static_cast<double>(bitCnt_) / capacity * std::log(2.0)));
+    if(hashCnt_ < 1) {
+        hashCnt_ = 1;
+    }
+    words_.reset(new std::atomic<uint64_t>[wordCnt]);
+    for(size_t i = 0; i < wordCnt; ++i) {
+        words_[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void BloomFilter::Add(const char* key, size_t len) {
+    uint64_t h1 = Hash_(key, len, 0);
+    uint64_t h2 = Hash_(key, len, h1) | 1;
+    for(int i = 0; i < hashCnt_; ++i) {
+        size_t bit = (h1 + i * h2) % bitCnt_;
+        words_[bit / 64].fetch_or(uint64_t(1) << (bit % 64), std::memory_order_relaxed);
+    }
+}
+
+bool BloomFilter::MayContain(const char* key, size_t len) const {
+    uint64_t h1 = Hash_(key, len, 0);
+    uint64_t h2 = Hash_(key, len, h1) | 1;
+    for(int i = 0; i < hashCnt_; ++i) {
+        size_t bit = (h1 + i * h2) % bitCnt_;
+        if((words_[bit / 64].load(std::memory_order_relaxed) & (uint64_t(1) << (bit % 64))) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t BloomFilter::GetBitCount() const {
+    return bitCnt_;
+}
+
+int BloomFilter::GetHashCount() const {
+    return hashCnt_;
+}
+
+uint64_t BloomFilter::Hash_(const char* key, size_t len, uint64_t seed) {
+    //FNV-1a后做一次混合，seed不同得到两个独立的哈希
+    uint64_t hash = 14695981039346656037ULL ^ seed;
+    for(size_t i = 0; i < len; ++i) {
+        hash ^= static_cast<unsigned char>(key[i]);
+        hash *= 1099511628211ULL;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+#endif
@@ -0,0 +1,248 @@
+#ifndef MICROCACHE_HPP
+#define MICROCACHE_HPP
+
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <functional>
+#include <string.h>
+#include <assert.h>
+
+#include "../logger/logger.hpp"
+#include "../buffer/arena.hpp"
+#include "../cfg/runtimeconfig.hpp"
+
+//缓存的动态响应：状态码、最终资源路径（决定Content-type）与响应体
+struct CachedResponse {
+    int code;
+    std::string path;
+    std::string body;
+};
+
+/*
+    动态响应微缓存
+    1、新鲜期内直接命中
+    2、过期后的陈旧期内仍返回陈旧结果，第一个请求负责在后台重新计算
+    3、同一key并发未命中时只有一个请求计算，其余请求挂起等待结果（single-flight）
+    4、新鲜期、陈旧期与容量取自RuntimeConfig快照，可热加载；已缓存条目按写入时的期限过期
+    5、只缓存GET/HEAD；POST（登录、注册）的请求体带密码，结果是认证状态，不能放进key或按key复用
+*/
+class MicroCache final {
+public:
+    //查询结果
+    enum LOOKUP_STATE {
+        CACHE_HIT,      //命中（新鲜，或陈旧且已有人在刷新）
+        CACHE_STALE,    //命中陈旧结果，调用方需在后台刷新后Fill/Abandon
+        CACHE_LEAD,     //未命中，由调用方计算后Fill/Abandon
+        CACHE_WAIT,     //他人正在计算，已登记唤醒回调
+    };
+
+    static MicroCache* GetInstance();
+
+    void Init(bool open, const std::vector<std::string>& varyHeaders, const std::vector<std::string>& paths);
+    bool IsOpen() const;
+    //GET/HEAD且请求目标命中配置的缓存路径前缀
+    bool IsCacheable(const char* method, const char* target) const;
+    //method + target + 选定请求头
+    std::string MakeKey(const ArenaString& method, const ArenaString& target,
+                        const ArenaStringMap& headers) const;
+
+    LOOKUP_STATE Lookup(const std::string& key, std::shared_ptr<const CachedResponse>* result,
+                        std::function<void()> onReady);
+    //计算完成，写入缓存并唤醒等待者
+    void Fill(const std::string& key, std::shared_ptr<const CachedResponse> response);
+    //计算结果不可缓存，唤醒等待者各自计算
+    void Abandon(const std::string& key);
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Entry {
+        std::shared_ptr<const CachedResponse> response;
+        Clock::time_point freshUntil;
+        Clock::time_point staleUntil;
+        bool isLoading = false;
+        std::vector<std::function<void()>> waiters;
+        std::list<std::string>::iterator lruIter;
+    };
+
+    struct Shard {
+        std::mutex mtx;
+        std::unordered_map<std::string, Entry> entries;
+        //表头为最近使用
+        std::list<std::string> lru;
+    };
+
+    MicroCache() = default;
+    ~MicroCache() = default;
+
+    Shard& GetShard_(const std::string& key);
+    //淘汰超出容量的表尾条目，计算中的条目不淘汰
+    void Evict_(Shard& shard);
+    std::vector<std::function<void()>> Complete_(const std::string& key, std::shared_ptr<const CachedResponse> response);
+
+    static const int SHARD_NUM = 16;
+
+    bool isOpen_ = false;
+    std::vector<std::string> varyHeaders_;
+    std::vector<std::string> paths_;
+    Shard shards_[SHARD_NUM];
+};
+
+MicroCache* MicroCache::GetInstance() {
+    static MicroCache cache;
+    return &cache;
+}
+
+void MicroCache::Init(bool open, const std::vector<std::string>& varyHeaders, const std::vector<std::string>& paths) {
+    isOpen_ = open && !paths.empty();
+    varyHeaders_ = varyHeaders;
+    paths_ = paths;
+    if(isOpen_) {
+        const RuntimeConfig* config = RuntimeConfig::Get();
+        LOG_INFO("MicroCache ttl: %dms, stale: %dms, maxEntries: %d", config->microCacheTtlMs,
+                 config->microCacheStaleMs, config->microCacheMaxEntries);
+    }
+}
+
+bool MicroCache::IsOpen() const {
+    return isOpen_;
+}
+
+bool MicroCache::IsCacheable(const char* method, const char* target) const {
+    if(!isOpen_) {
+        return false;
+    }
+    if(strcmp(method, "GET") != 0 && strcmp(method, "HEAD") != 0) {
+        return false;
+    }
+    for(const auto& path : paths_) {
+        if(strncmp(target, path.c_str(), path.size()) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string MicroCache::MakeKey(const ArenaString& method, const ArenaString& target,
+                                const ArenaStringMap& headers) const {
+    std::string key;
+    key.reserve(method.size() + target.size() + 64);
+    key.append(method.data(), method.size());
+    key += ' ';
+    key.append(target.data(), target.size());
+    key += '\n';
+    for(const auto& name : varyHeaders_) {
+        auto iter = headers.find(name.c_str());
+        if(iter != headers.end()) {
+            key.append(iter->second.data(), iter->second.size());
+        }
+        key += '\n';
+    }
+    return key;
+}
+
+MicroCache::LOOKUP_STATE MicroCache::Lookup(const std::string& key, std::shared_ptr<const CachedResponse>* result,
+                                            std::function<void()> onReady) {
+    assert(result);
+    Shard& shard = GetShard_(key);
+    Clock::time_point now = Clock::now();
+    std::lock_guard<std::mutex> locker(shard.mtx);
+    auto iter = shard.entries.find(key);
+    if(iter == shard.entries.end()) {
+        shard.lru.push_front(key);
+        Entry& entry = shard.entries[key];
+        entry.lruIter = shard.lru.begin();
+        entry.isLoading = true;
+        Evict_(shard);
+        return CACHE_LEAD;
+    }
+
+    Entry& entry = iter->second;
+    shard.lru.splice(shard.lru.begin(), shard.lru, entry.lruIter);
+    if(entry.response && now < entry.freshUntil) {
+        *result = entry.response;
+        return CACHE_HIT;
+    }
+    if(entry.response && now < entry.staleUntil) {
+        //陈旧期：仅第一个请求触发重新计算
+        *result = entry.response;
+        if(entry.isLoading) {
+            return CACHE_HIT;
+        }
+        entry.isLoading = true;
+        return CACHE_STALE;
+    }
+    if(entry.isLoading) {
+        entry.waiters.push_back(std::move(onReady));
+        return CACHE_WAIT;
+    }
+    entry.response.reset();
+    entry.isLoading = true;
+    return CACHE_LEAD;
+}
+
+void MicroCache::Fill(const std::string& key, std::shared_ptr<const CachedResponse> response) {
+    assert(response);
+    //回调在锁外执行，等待者可能立即重新查询
+    for(auto& waiter : Complete_(key, std::move(response))) {
+        waiter();
+    }
+}
+
+void MicroCache::Abandon(const std::string& key) {
+    for(auto& waiter : Complete_(key, nullptr)) {
+        waiter();
+    }
+}
+
+std::vector<std::function<void()>> MicroCache::Complete_(const std::string& key,
+                                                         std::shared_ptr<const CachedResponse> response) {
+    std::vector<std::function<void()>> waiters;
+    Shard& shard = GetShard_(key);
+    Clock::time_point now = Clock::now();
+    std::lock_guard<std::mutex> locker(shard.mtx);
+    auto iter = shard.entries.find(key);
+    if(iter == shard.entries.end()) {
+        return waiters;
+    }
+    Entry& entry = iter->second;
+    entry.isLoading = false;
+    waiters.swap(entry.waiters);
+    if(response) {
+        const RuntimeConfig* config = RuntimeConfig::Get();
+        entry.response = std::move(response);
+        entry.freshUntil = now + std::chrono::milliseconds(config->microCacheTtlMs);
+        entry.staleUntil = entry.freshUntil + std::chrono::milliseconds(config->microCacheStaleMs);
+    }
+    else if(!entry.response) {
+        shard.lru.erase(entry.lruIter);
+        shard.entries.erase(iter);
+    }
+    return waiters;
+}
+
+MicroCache::Shard& MicroCache::GetShard_(const std::string& key) {
+    return shards_[std::hash<std::string>()(key) % SHARD_NUM];
+}
+
+void MicroCache::Evict_(Shard& shard) {
+    size_t maxShardEntries = (RuntimeConfig::Get()->microCacheMaxEntries + SHARD_NUM - 1) / SHARD_NUM;
+    auto iter = shard.lru.end();
+    while(shard.entries.size() > maxShardEntries && iter != shard.lru.begin()) {
+        --iter;
+        auto entryIter = shard.entries.find(*iter);
+        assert(entryIter != shard.entries.end());
+        if(entryIter->second.isLoading) {
+            continue;
+        }
+        shard.entries.erase(entryIter);
+        iter = shard.lru.erase(iter);
+    }
+}
+
+#endif
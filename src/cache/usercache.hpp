@@ -0,0 +1,236 @@
+#ifndef USERCACHE_HPP
+#define USERCACHE_HPP
+
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/crypto.h>
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <chrono>
+#include <string.h>
+#include <assert.h>
+
+#include "../logger/logger.hpp"
+#include "../cfg/runtimeconfig.hpp"
+
+/*
+    用户凭据读穿缓存
+    1、username -> 密码摘要（SHA-256(进程随机盐 + 密码)，不保存明文），有效期内登录直接在内存中校验
+    2、查无此用户同样缓存（负缓存，有效期更短），反复登录不存在的用户不再查库
+    3、注册成功后写穿；每个分片按字节预算淘汰最久未用的条目
+    4、有效期与字节预算取自RuntimeConfig快照，可热加载；预算调小后各分片在下次写入时淘汰
+*/
+class UserCache final {
+public:
+    //查询结果
+    enum LOOKUP_STATE {
+        USER_MATCH,     //用户存在且密码一致
+        USER_MISMATCH,  //用户存在但密码不一致
+        USER_UNKNOWN,   //负缓存：用户不存在
+        USER_MISS,      //未缓存或已过期，需要查库
+    };
+
+    static UserCache* GetInstance();
+
+    void Init(bool open);
+    bool IsOpen() const;
+
+    LOOKUP_STATE Lookup(const char* user, const char* pw);
+    //查库或注册得到的用户密码
+    void Put(const char* user, const char* pw);
+    //查库确认用户不存在
+    void PutUnknown(const char* user);
+    //用户数据可能已变化，删除条目
+    void Invalidate(const char* user);
+
+private:
+    typedef std::chrono::steady_clock Clock;
+    static const int DIGEST_LEN = 32;
+    static const int SALT_LEN = 16;
+    static const int SHARD_NUM = 16;
+    //哈希表节点与LRU节点的额外开销估计
+    static const size_t ENTRY_OVERHEAD = 96;
+
+    struct Entry {
+        bool isKnown;
+        unsigned char digest[DIGEST_LEN];
+        Clock::time_point expires;
+        std::list<std::string>::iterator lruIter;
+    };
+
+    struct Shard {
+        std::mutex mtx;
+        std::unordered_map<std::string, Entry> entries;
+        //表头为最近使用
+        std::list<std::string> lru;
+        size_t bytes = 0;
+    };
+
+    UserCache() = default;
+    ~UserCache() = default;
+
+    Shard& GetShard_(const std::string& user);
+    void Store_(const char* user, bool isKnown, const unsigned char* digest);
+    //按字节预算淘汰表尾条目
+    void Evict_(Shard& shard);
+    bool Digest_(const char* pw, unsigned char* digest) const;
+    static size_t EntryBytes_(const std::string& user);
+
+    bool isOpen_ = false;
+    unsigned char salt_[SALT_LEN] = {};
+    Shard shards_[SHARD_NUM];
+};
+
+const int UserCache::DIGEST_LEN;
+const int UserCache::SALT_LEN;
+const int UserCache::SHARD_NUM;
+const size_t UserCache::ENTRY_OVERHEAD;
+
+UserCache* UserCache::GetInstance() {
+    static UserCache cache;
+    return &cache;
+}
+
+void UserCache::Init(bool open) {
+    isOpen_ = open;
+    if(isOpen_ && RAND_bytes(salt_, SALT_LEN) != 1) {
+        LOG_ERROR("UserCache salt error, cache disabled");
+        isOpen_ = false;
+    }
+    if(isOpen_) {
+        const RuntimeConfig* config = RuntimeConfig::Get();
+        LOG_INFO("UserCache ttl: %dms, negativeTtl: %dms, maxKb: %d", config->userCacheTtlMs,
+                 config->userCacheNegativeTtlMs, config->userCacheMaxKb);
+    }
+}
+
+bool UserCache::IsOpen() const {
+    return isOpen_;
+}
+
+UserCache::LOOKUP_STATE UserCache::Lookup(const char* user, const char* pw) {
+    if(!isOpen_) {
+        return USER_MISS;
+    }
+    std::string key(user);
+    Shard& shard = GetShard_(key);
+    Entry entry;
+    {
+        std::lock_guard<std::mutex> locker(shard.mtx);
+        auto iter = shard.entries.find(key);
+        if(iter == shard.entries.end()) {
+            return USER_MISS;
+        }
+        if(Clock::now() >= iter->second.expires) {
+            shard.bytes -= EntryBytes_(key);
+            shard.lru.erase(iter->second.lruIter);
+            shard.entries.erase(iter);
+            return USER_MISS;
+        }
+        shard.lru.splice(shard.lru.begin(), shard.lru, iter->second.lruIter);
+        entry = iter->second;
+    }
+    if(!entry.isKnown) {
+        return USER_UNKNOWN;
+    }
+    //摘要计算放在锁外
+    unsigned char digest[DIGEST_LEN];
+    if(!Digest_(pw, digest)) {
+        return USER_MISS;
+    }
+    return CRYPTO_memcmp(digest, entry.digest, DIGEST_LEN) == 0 ? USER_MATCH : USER_MISMATCH;
+}
+
+void UserCache::Put(const char* user, const char* pw) {
+    if(!isOpen_) {
+        return;
+    }
+    unsigned char digest[DIGEST_LEN];
+    if(!Digest_(pw, digest)) {
+        Invalidate(user);
+        return;
+    }
+    Store_(user, true, digest);
+}
+
+void UserCache::PutUnknown(const char* user) {
+    if(!isOpen_ || RuntimeConfig::Get()->userCacheNegativeTtlMs == 0) {
+        return;
+    }
+    Store_(user, false, nullptr);
+}
+
+void UserCache::Invalidate(const char* user) {
+    if(!isOpen_) {
+        return;
+    }
+    std::string key(user);
+    Shard& shard = GetShard_(key);
+    std::lock_guard<std::mutex> locker(shard.mtx);
+    auto iter = shard.entries.find(key);
+    if(iter != shard.entries.end()) {
+        shard.bytes -= EntryBytes_(key);
+        shard.lru.erase(iter->second.lruIter);
+        shard.entries.erase(iter);
+    }
+}
+
+void UserCache::Store_(const char* user, bool isKnown, const unsigned char* digest) {
+    std::string key(user);
+    Shard& shard = GetShard_(key);
+    std::lock_guard<std::mutex> locker(shard.mtx);
+    auto iter = shard.entries.find(key);
+    if(iter == shard.entries.end()) {
+        shard.lru.push_front(key);
+        iter = shard.entries.emplace(key, Entry()).first;
+        iter->second.lruIter = shard.lru.begin();
+        shard.bytes += EntryBytes_(key);
+    }
+    else {
+        shard.lru.splice(shard.lru.begin(), shard.lru, iter->second.lruIter);
+    }
+    Entry& entry = iter->second;
+    entry.isKnown = isKnown;
+    if(isKnown) {
+        memcpy(entry.digest, digest, DIGEST_LEN);
+    }
+    const RuntimeConfig* config = RuntimeConfig::Get();
+    entry.expires = Clock::now() + std::chrono::milliseconds(isKnown ? config->userCacheTtlMs
+                                                                     : config->userCacheNegativeTtlMs);
+    Evict_(shard);
+}
+
+UserCache::Shard& UserCache::GetShard_(const std::string& user) {
+    return shards_[std::hash<std::string>()(user) % SHARD_NUM];
+}
+
+void UserCache::Evict_(Shard& shard) {
+    size_t maxShardBytes = static_cast<size_t>(RuntimeConfig::Get()->userCacheMaxKb) * 1024 / SHARD_NUM;
+    //至少保留刚写入的表头条目
+    while(shard.bytes > maxShardBytes && shard.lru.size() > 1) {
+        const std::string& key = shard.lru.back();
+        shard.bytes -= EntryBytes_(key);
+        shard.entries.erase(key);
+        shard.lru.pop_back();
+    }
+}
+
+bool UserCache::Digest_(const char* pw, unsigned char* digest) const {
+    EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+    unsigned int len = 0;
+    bool isOk = ctx && EVP_DigestInit_ex(ctx, EVP_sha256(), nullptr) == 1 &&
+                EVP_DigestUpdate(ctx, salt_, SALT_LEN) == 1 &&
+                EVP_DigestUpdate(ctx, pw, strlen(pw)) == 1 &&
+                EVP_DigestFinal_ex(ctx, digest, &len) == 1;
+    EVP_MD_CTX_free(ctx);
+    return isOk && len == DIGEST_LEN;
+}
+
+size_t UserCache::EntryBytes_(const std::string& user) {
+    //键在哈希表与LRU链表中各存一份
+    return sizeof(Entry) + user.size() * 2 + ENTRY_OVERHEAD;
+}
+
+#endif
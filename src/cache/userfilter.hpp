@@ -0,0 +1,235 @@
+#ifndef USERFILTER_HPP
+#define USERFILTER_HPP
+
+#include <mysql/mysql.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "bloomfilter.hpp"
+#include "../logger/logger.hpp"
+#include "../pool/sqlconnpool.hpp"
+#include "../pool/sqlconnRAII.hpp"
+
+/*
+    已注册用户名的布隆过滤器
+    1、启动时流式扫描user表建立，之后定期整表重建，容量按当时行数放大，也借此清掉已删除的用户名
+    2、注册时过滤器判定一定不存在则跳过查重SELECT直接INSERT，由username唯一键兜底（见5）
+    3、注册成功即时加入；重建期间的新用户名同时加入正在建的过滤器
+    4、未建好或重建失败时沿用旧过滤器，从未建好则总是查库
+    5、每次重建先确认username上有单列唯一键，没有则丢弃过滤器，注册总是先查重
+*/
+class UserFilter final {
+public:
+    static UserFilter* GetInstance();
+
+    void Init(bool open, double fpRate, int minCapacity, int rebuildSec);
+    bool IsOpen() const;
+    //重建间隔毫秒，0为不定期重建
+    int GetRebuildMs() const;
+
+    //流式扫描user表重建过滤器，阻塞，应在db执行器或启动时调用
+    bool Rebuild();
+    //用户名一定未注册
+    bool IsDefinitelyFree(const char* user) const;
+    void Add(const char* user);
+
+private:
+    UserFilter() = default;
+    ~UserFilter() = default;
+
+    //user表当前行数，失败返回-1
+    static long long CountUsers_(MYSQL* sql);
+    //user表有只含username一列的唯一索引（含主键）
+    static bool HasUniqueName_(MYSQL* sql);
+
+    bool isOpen_ = false;
+    double fpRate_ = 0.01;
+    int minCapacity_ = 0;
+    int rebuildMs_ = 0;
+
+    //只保护两个指针的读写，过滤器本身可并发访问
+    mutable std::mutex mtx_;
+    std::shared_ptr<BloomFilter> filter_;
+    //重建中的过滤器
+    std::shared_ptr<BloomFilter> building_;
+    //同一时刻只有一次重建
+    std::mutex rebuildMtx_;
+};
+
+UserFilter* UserFilter::GetInstance() {
+    static UserFilter filter;
+    return &filter;
+}
+
+void UserFilter::Init(bool open, double fpRate, int minCapacity, int rebuildSec) {
+    assert(fpRate > 0 && fpRate < 1 && minCapacity > 0 && rebuildSec >= 0);
+    isOpen_ = open;
+    fpRate_ = fpRate;
+    minCapacity_ = minCapacity;
+    rebuildMs_ = rebuildSec * 1000;
+    if(isOpen_) {
+        LOG_INFO("UserFilter fpRate: %g, minCapacity: %d, rebuild: %ds", fpRate, minCapacity, rebuildSec);
+    }
+}
+
+bool UserFilter::IsOpen() const {
+    return isOpen_;
+}
+
+int UserFilter::GetRebuildMs() const {
+    return isOpen_ ? rebuildMs_ : 0;
+}
+
+bool UserFilter::Rebuild() {
+    if(!isOpen_) {
+        return false;
+    }
+    std::lock_guard<std::mutex> rebuildLocker(rebuildMtx_);
+    MYSQL* sql = nullptr;
+    SqlConnRAII sqlRAII(&sql, SqlConnPool::GetInstance());
+    if(!sql) {
+        LOG_ERROR("UserFilter rebuild: no SQL connection");
+        return false;
+    }
+    //跳过查重后重复注册只能靠唯一键拒绝
+    if(!HasUniqueName_(sql)) {
+        LOG_ERROR("UserFilter disabled: user.username has no unique key, register always checks db");
+        std::lock_guard<std::mutex> locker(mtx_);
+        filter_.reset();
+        return false;
+    }
+
+    long long rows = CountUsers_(sql);
+    if(rows < 0) {
+        LOG_ERROR("UserFilter count error: %s", mysql_error(sql));
+        return false;
+    }
+    //留出两倍余量给下次重建前新注册的用户
+    size_t capacity = static_cast<size_t>(rows) * 2;
+    if(capacity < static_cast<size_t>(minCapacity_)) {
+        capacity = minCapacity_;
+    }
+    std::shared_ptr<BloomFilter> building = std::make_shared<BloomFilter>(capacity, fpRate_);
+    {
+        std::lock_guard<std::mutex> locker(mtx_);
+        building_ = building;
+    }
+
+    //use_result逐行从socket读取，不把整张表放进内存
+    bool isOk = mysql_query(sql, "SELECT username FROM user") == 0;
+    MYSQL_RES* res = isOk ? mysql_use_result(sql) : nullptr;
+    long long scanned = 0;
+    if(res) {
+        while(MYSQL_ROW row = mysql_fetch_row(res)) {
+            unsigned long* lens = mysql_fetch_lengths(res);
+            if(row[0]) {
+                building->Add(row[0], lens[0]);
+                ++scanned;
+            }
+        }
+        //fetch_row返回空既可能是读完也可能是出错
+        isOk = mysql_errno(sql) == 0;
+        mysql_free_result(res);
+    }
+    else {
+        isOk = false;
+    }
+
+    std::lock_guard<std::mutex> locker(mtx_);
+    building_.reset();
+    if(!isOk) {
+        LOG_ERROR("UserFilter scan error: %s", mysql_error(sql));
+        return false;
+    }
+    filter_ = building;
+    LOG_INFO("UserFilter rebuilt: %lld users, %zu bits, %d hashes",
+             scanned, building->GetBitCount(), building->GetHashCount());
+    return true;
+}
+
+bool UserFilter::IsDefinitelyFree(const char* user) const {
+    if(!isOpen_) {
+        return false;
+    }
+    std::shared_ptr<BloomFilter> filter;
+    {
+        std::lock_guard<std::mutex> locker(mtx_);
+        filter = filter_;
+    }
+    return filter && !filter->MayContain(user, strlen(user));
+}
+
+void UserFilter::Add(const char* user) {
+    if(!isOpen_) {
+        return;
+    }
+    std::shared_ptr<BloomFilter> filter, building;
+    {
+        std::lock_guard<std::mutex> locker(mtx_);
+        filter = filter_;
+        building = building_;
+    }
+    size_t len = strlen(user);
+    if(filter) {
+        filter->Add(user, len);
+    }
+    if(building) {
+        building->Add(user, len);
+    }
+}
+
+long long UserFilter::CountUsers_(MYSQL* sql) {
+    if(mysql_query(sql, "SELECT COUNT(*) FROM user")) {
+        return -1;
+    }
+    MYSQL_RES* res = mysql_store_result(sql);
+    if(!res) {
+        return -1;
+    }
+    MYSQL_ROW row = mysql_fetch_row(res);
+    long long rows = row && row[0] ? atoll(row[0]) : -1;
+    mysql_free_result(res);
+    return rows;
+}
+
+bool UserFilter::HasUniqueName_(MYSQL* sql) {
+    //列依次为Table、Non_unique、Key_name、Seq_in_index、Column_name
+    if(mysql_query(sql, "SHOW INDEX FROM user")) {
+        LOG_ERROR("UserFilter show index error: %s", mysql_error(sql));
+        return false;
+    }
+    MYSQL_RES* res = mysql_store_result(sql);
+    if(!res || mysql_num_fields(res) < 5) {
+        mysql_free_result(res);
+        return false;
+    }
+    //同一索引的列按Seq_in_index连续返回
+    std::string key;
+    bool isNameOnly = false;
+    bool hasUnique = false;
+    while(MYSQL_ROW row = mysql_fetch_row(res)) {
+        if(!row[1] || !row[2] || !row[3] || !row[4]) {
+            continue;
+        }
+        if(key != row[2]) {
+            hasUnique = hasUnique || isNameOnly;
+            key = row[2];
+            isNameOnly = strcmp(row[1], "0") == 0 && strcmp(row[3], "1") == 0
+                         && strcasecmp(row[4], "username") == 0;
+        }
+        else {
+            //组合唯一键不保证username本身唯一
+            isNameOnly = false;
+        }
+    }
+    hasUnique = hasUnique || isNameOnly;
+    mysql_free_result(res);
+    return hasUnique;
+}
+
+#endif
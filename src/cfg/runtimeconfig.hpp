@@ -0,0 +1,191 @@
+#ifndef RUNTIMECONFIG_HPP
+#define RUNTIMECONFIG_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <assert.h>
+
+#include "ymlconfig.hpp"
+#include "../logger/logger.hpp"
+
+/*
+    可热加载参数的不可变快照，重新加载properties.yml时整体替换
+    1、热路径经Get()做一次原子读取拿到当前快照，同一次处理中各参数来自同一版本，不加锁
+    2、旧快照不回收：读者不计数，无法得知何时读完；快照很小，重新加载次数有限
+    3、线程池、日志、访问日志采样与连接池参数不在快照中，由重新加载流程调用各自的设置接口
+*/
+struct RuntimeConfig {
+    //单个长连接上最多处理的请求数，达到后响应带Connection: close，0为不限
+    int keepAliveMax = 0;
+    int proxyTimeOutMs = 3000;
+    int microCacheTtlMs = 2000;
+    int microCacheStaleMs = 5000;
+    int microCacheMaxEntries = 4096;
+    int userCacheTtlMs = 60000;
+    int userCacheNegativeTtlMs = 5000;
+    int userCacheMaxKb = 16384;
+    //从读入请求到响应发完超过该值的请求记入慢请求环
+    int slowLogThresholdMs = 500;
+
+    RuntimeConfig() = default;
+    explicit RuntimeConfig(const YmlConfig& ymlConfig);
+
+    static const RuntimeConfig* Get() {
+        return current_.load(std::memory_order_acquire);
+    }
+    //发布新快照，之后的Get()读到新值
+    static void Publish(std::unique_ptr<const RuntimeConfig> config);
+    //检查可在运行中生效的配置项，不合法时记录原因并返回false
+    static bool Validate(const YmlConfig& ymlConfig);
+    //重启才生效的配置项：名称 -> 取值，重新加载时比较以提示被忽略的修改
+    static std::map<std::string, std::string> RestartOnly(const YmlConfig& ymlConfig);
+
+private:
+    static const RuntimeConfig DEFAULT_;
+    static std::atomic<const RuntimeConfig*> current_;
+    static std::mutex publishMtx_;
+    static std::vector<std::unique_ptr<const RuntimeConfig>> published_;
+};
+
+const RuntimeConfig RuntimeConfig::DEFAULT_;
+std::atomic<const RuntimeConfig*> RuntimeConfig::current_(&RuntimeConfig::DEFAULT_);
+std::mutex RuntimeConfig::publishMtx_;
+std::vector<std::unique_ptr<const RuntimeConfig>> RuntimeConfig::published_;
+
+RuntimeConfig::RuntimeConfig(const YmlConfig& ymlConfig) {
+    keepAliveMax = ymlConfig.keepAliveMax;
+    proxyTimeOutMs = ymlConfig.proxyTimeOutMs;
+    microCacheTtlMs = ymlConfig.microCacheTtlMs;
+    microCacheStaleMs = ymlConfig.microCacheStaleMs;
+    microCacheMaxEntries = ymlConfig.microCacheMaxEntries;
+    userCacheTtlMs = ymlConfig.userCacheTtlMs;
+    userCacheNegativeTtlMs = ymlConfig.userCacheNegativeTtlMs;
+    userCacheMaxKb = ymlConfig.userCacheMaxKb;
+    slowLogThresholdMs = ymlConfig.slowLogThresholdMs;
+}
+
+void RuntimeConfig::Publish(std::unique_ptr<const RuntimeConfig> config) {
+    assert(config);
+    std::lock_guard<std::mutex> locker(publishMtx_);
+    current_.store(config.get(), std::memory_order_release);
+    published_.push_back(std::move(config));
+}
+
+bool RuntimeConfig::Validate(const YmlConfig& ymlConfig) {
+    const char* error = nullptr;
+    if(ymlConfig.logLevel < 0 || ymlConfig.logLevel > 3) {
+        error = "server.logLevel must be 0~3";
+    }
+    else if(ymlConfig.threadNum <= 0 || ymlConfig.maxThreadNum < 0) {
+        error = "server.threadNum must be positive";
+    }
+    else if(ymlConfig.threadGrowWaitMs < 0 || ymlConfig.threadIdleMs <= 0) {
+        error = "server.threadGrowWaitMs/threadIdleMs out of range";
+    }
+    else if(ymlConfig.maxConn <= 0 || ymlConfig.keepAliveMax < 0) {
+        error = "server.maxConn/keepAliveMax out of range";
+    }
+    else if(ymlConfig.logMaxFileMb <= 0 || ymlConfig.logMaxFiles < 0 ||
+            ymlConfig.logMaxAgeDays < 0 || ymlConfig.logMaxTotalMb < 0) {
+        error = "logRotate out of range";
+    }
+    else if(ymlConfig.sqlMinConn < 0 || ymlConfig.sqlIdleMs <= 0 || ymlConfig.sqlKeepaliveMs <= 0 ||
+            ymlConfig.sqlAcquireTimeoutMs < 0 || ymlConfig.sqlRetryMs <= 0) {
+        error = "mysql.pool out of range";
+    }
+    else if(ymlConfig.proxyTimeOutMs <= 0) {
+        error = "proxy.timeOutMs must be positive";
+    }
+    else if(ymlConfig.microCacheTtlMs <= 0 || ymlConfig.microCacheStaleMs < 0 || ymlConfig.microCacheMaxEntries <= 0) {
+        error = "microCache out of range";
+    }
+    else if(ymlConfig.userCacheTtlMs <= 0 || ymlConfig.userCacheNegativeTtlMs < 0 || ymlConfig.userCacheMaxKb <= 0) {
+        error = "userCache out of range";
+    }
+    else if(ymlConfig.slowLogThresholdMs <= 0) {
+        error = "slowLog.thresholdMs must be positive";
+    }
+    else if(!(ymlConfig.accessLogSampleRate >= 0 && ymlConfig.accessLogSampleRate <= 1)) {
+        error = "accessLog.sampleRate must be 0~1";
+    }
+    for(const auto& item : ymlConfig.accessLogStatusRates) {
+        if(!error && !(item.second >= 0 && item.second <= 1)) {
+            error = "accessLog.statusRates must be 0~1";
+        }
+    }
+    for(const auto& executor : ymlConfig.executors) {
+        if(!error && (executor.threadNum <= 0 || executor.maxThreadNum < 0 || executor.queueMax < 0)) {
+            error = "executors out of range";
+        }
+        //io任务负责重新注册fd与唤醒挂起的请求，被拒绝的连接再也不会被处理，io队列不能设上限
+        else if(!error && executor.name == "io" && executor.queueMax != 0) {
+            error = "executors.io.queueMax must be 0";
+        }
+    }
+    if(error) {
+        LOG_ERROR("Config invalid: %s", error);
+        return false;
+    }
+    return true;
+}
+
+std::map<std::string, std::string> RuntimeConfig::RestartOnly(const YmlConfig& ymlConfig) {
+    std::map<std::string, std::string> fields;
+    auto join = [](const std::vector<std::string>& items) {
+        std::string value;
+        for(const auto& item : items) {
+            value += item;
+            value += ',';
+        }
+        return value;
+    };
+    fields["server.port"] = std::to_string(ymlConfig.serverPort);
+    fields["server.trigMode"] = std::to_string(ymlConfig.trigMode);
+    fields["server.optLinger"] = std::to_string(ymlConfig.optLinger);
+    fields["server.connPoolNum"] = std::to_string(ymlConfig.connPoolNum);
+    fields["server.openLog"] = std::to_string(ymlConfig.openLog);
+    fields["server.logQueSize"] = std::to_string(ymlConfig.logQueSize);
+    fields["server.logBinary"] = std::to_string(ymlConfig.logBinary);
+    fields["server.configWatch"] = std::to_string(ymlConfig.configWatch);
+    fields["mysql"] = std::to_string(ymlConfig.sqlPort) + ',' + (ymlConfig.sqlUser ? *ymlConfig.sqlUser : "") + ',' +
+                      (ymlConfig.sqlPwd ? *ymlConfig.sqlPwd : "") + ',' + (ymlConfig.dbName ? *ymlConfig.dbName : "") +
+                      ',' + std::to_string(ymlConfig.sqlAsync);
+    std::string routes = std::to_string(ymlConfig.proxyPoolSize) + ';';
+    for(const auto& route : ymlConfig.proxyRoutes) {
+        routes += route.prefix + '=' + join(route.upstreams) + ';';
+    }
+    fields["proxy.routes"] = routes;
+    fields["microCache.open"] = std::to_string(ymlConfig.microCacheOpen) + ';' + join(ymlConfig.microCacheVary) +
+                                ';' + join(ymlConfig.microCachePaths);
+    fields["userCache.open"] = std::to_string(ymlConfig.userCacheOpen);
+    fields["userFilter"] = std::to_string(ymlConfig.userFilterOpen) + ',' + std::to_string(ymlConfig.userFilterFpRate) +
+                           ',' + std::to_string(ymlConfig.userFilterMinCapacity) + ',' +
+                           std::to_string(ymlConfig.userFilterRebuildSec);
+    fields["userBatch"] = std::to_string(ymlConfig.userBatchOpen) + ',' + std::to_string(ymlConfig.userBatchMaxRows) +
+                          ',' + std::to_string(ymlConfig.userBatchMaxDelayMs);
+    fields["userStore"] = ymlConfig.userStoreType + ',' + ymlConfig.userStoreSnapshotFile + ',' +
+                          std::to_string(ymlConfig.userStoreSnapshotSec);
+    fields["tls"] = std::to_string(ymlConfig.tlsOpen) + ',' + std::to_string(ymlConfig.tlsPort) + ',' +
+                    ymlConfig.tlsCertFile + ',' + ymlConfig.tlsKeyFile + ',' + std::to_string(ymlConfig.tlsKtls);
+    fields["upload"] = std::to_string(ymlConfig.uploadOpen) + ',' + ymlConfig.uploadDir + ',' +
+                       std::to_string(ymlConfig.uploadMaxBodyMb) + ';' + join(ymlConfig.uploadPaths);
+    //包文件路径可热加载，开关需要重启
+    fields["assetBundle.open"] = std::to_string(ymlConfig.assetBundleOpen);
+    //执行器的增删需要重启，已有执行器的线程数与排队上限可热加载
+    std::vector<std::string> executors;
+    for(const auto& executor : ymlConfig.executors) {
+        executors.push_back(executor.name);
+    }
+    fields["executors"] = join(executors);
+    fields["accessLog.open"] = std::to_string(ymlConfig.accessLogOpen);
+    fields["metrics"] = std::to_string(ymlConfig.metricsOpen) + ',' + ymlConfig.metricsPath;
+    fields["slowLog"] = std::to_string(ymlConfig.slowLogOpen) + ',' + std::to_string(ymlConfig.slowLogCapacity) + ',' +
+                        ymlConfig.slowLogPath;
+    return fields;
+}
+
+#endif
@@ -5,6 +5,23 @@
 #include <string>
 #include <yaml-cpp/yaml.h>
 #include <iostream>
+#include <memory>
+#include <vector>
+#include <map>
+
+//反向代理路由配置
+struct ProxyRouteCfg {
+    std::string prefix;
+    std::vector<std::string> upstreams;
+};
+
+//具名执行器配置
+struct ExecutorCfg {
+    std::string name;
+    int threadNum;
+    int maxThreadNum;
+    int queueMax;
+};
 
 struct YmlConfig {
     int serverPort;
@@ -13,18 +30,88 @@ struct YmlConfig {
     bool optLinger;
     int connPoolNum;
     int threadNum;
+    //线程池弹性上限，不大于threadNum时不伸缩
+    int maxThreadNum = 0;
+    int threadGrowWaitMs = 5;
+    int threadIdleMs = 30000;
     bool openLog;
     int logLevel;
     int logQueSize;
+    //二进制日志，用logdecode还原
+    bool logBinary = false;
+    //日志文件切分、压缩与保留，0为不限制
+    int logMaxFileMb = 64;
+    bool logCompress = false;
+    int logMaxFiles = 0;
+    int logMaxAgeDays = 0;
+    int logMaxTotalMb = 0;
+    int maxConn = 65536;
+    //单个长连接最多处理的请求数，0为不限
+    int keepAliveMax = 0;
+    //监视properties.yml，保存后自动重新加载；SIGHUP总是触发重新加载
+    bool configWatch = false;
     int sqlPort;
     std::unique_ptr<std::string> sqlUser;
     std::unique_ptr<std::string> sqlPwd;
     std::unique_ptr<std::string> dbName;
+    //非阻塞查库，客户端库不支持时回到db执行器
+    bool sqlAsync = true;
+    int sqlMinConn = 2;
+    int sqlIdleMs = 60000;
+    int sqlKeepaliveMs = 30000;
+    int sqlAcquireTimeoutMs = 3000;
+    int sqlRetryMs = 1000;
+    int proxyPoolSize = 8;
+    int proxyTimeOutMs = 3000;
+    std::vector<ProxyRouteCfg> proxyRoutes;
+    bool microCacheOpen = false;
+    int microCacheTtlMs = 2000;
+    int microCacheStaleMs = 5000;
+    int microCacheMaxEntries = 4096;
+    std::vector<std::string> microCacheVary;
+    std::vector<std::string> microCachePaths;
+    bool userCacheOpen = false;
+    int userCacheTtlMs = 60000;
+    int userCacheNegativeTtlMs = 5000;
+    int userCacheMaxKb = 16384;
+    bool userFilterOpen = false;
+    double userFilterFpRate = 0.01;
+    int userFilterMinCapacity = 100000;
+    int userFilterRebuildSec = 600;
+    bool userBatchOpen = false;
+    int userBatchMaxRows = 64;
+    int userBatchMaxDelayMs = 2;
+    std::string userStoreType = "mysql";
+    std::string userStoreSnapshotFile = "./userstore.snap";
+    int userStoreSnapshotSec = 60;
+    bool tlsOpen = false;
+    int tlsPort = 1443;
+    std::string tlsCertFile;
+    std::string tlsKeyFile;
+    bool tlsKtls = true;
+    bool uploadOpen = false;
+    std::string uploadDir = "./upload";
+    int uploadMaxBodyMb = 16;
+    std::vector<std::string> uploadPaths;
+    bool assetBundleOpen = false;
+    std::string assetBundleFile = "./resources.bundle";
+    bool metricsOpen = false;
+    std::string metricsPath = "/metrics";
+    bool slowLogOpen = false;
+    int slowLogThresholdMs = 500;
+    int slowLogCapacity = 128;
+    std::string slowLogPath = "/admin/slowlog";
+    std::vector<ExecutorCfg> executors;
+    bool accessLogOpen = false;
+    double accessLogSampleRate = 1.0;
+    //按状态类（5xx）或状态码（404）覆盖的采样率
+    std::map<std::string, double> accessLogStatusRates;
 
-    void ymlInit();
+    //读取失败返回false
+    bool ymlInit();
 };
 
-void YmlConfig::ymlInit() {
+bool YmlConfig::ymlInit() {
     try {
         YAML::Node yamlFile = YAML::LoadFile("properties.yml");
         //server配置
@@ -37,15 +124,158 @@ void YmlConfig::ymlInit() {
         openLog = yamlFile["server"]["openLog"].as<std::string>() == "true" ? true : false;
         logLevel = yamlFile["server"]["logLevel"].as<int>();
         logQueSize = yamlFile["server"]["logQueSize"].as<int>();
+        if(yamlFile["server"]["logBinary"]) {
+            logBinary = yamlFile["server"]["logBinary"].as<std::string>() == "true" ? true : false;
+        }
+        //日志切分与保留，可选
+        if(yamlFile["logRotate"]) {
+            logMaxFileMb = yamlFile["logRotate"]["maxFileMb"].as<int>();
+            logCompress = yamlFile["logRotate"]["compress"].as<std::string>() == "true" ? true : false;
+            logMaxFiles = yamlFile["logRotate"]["maxFiles"].as<int>();
+            logMaxAgeDays = yamlFile["logRotate"]["maxAgeDays"].as<int>();
+            logMaxTotalMb = yamlFile["logRotate"]["maxTotalMb"].as<int>();
+        }
+        if(yamlFile["server"]["maxConn"]) {
+            maxConn = yamlFile["server"]["maxConn"].as<int>();
+        }
+        if(yamlFile["server"]["keepAliveMax"]) {
+            keepAliveMax = yamlFile["server"]["keepAliveMax"].as<int>();
+        }
+        if(yamlFile["server"]["configWatch"]) {
+            configWatch = yamlFile["server"]["configWatch"].as<std::string>() == "true" ? true : false;
+        }
+        if(yamlFile["server"]["maxThreadNum"]) {
+            maxThreadNum = yamlFile["server"]["maxThreadNum"].as<int>();
+            threadGrowWaitMs = yamlFile["server"]["threadGrowWaitMs"].as<int>();
+            threadIdleMs = yamlFile["server"]["threadIdleMs"].as<int>();
+        }
         //mysql配置
         sqlPort = yamlFile["mysql"]["sqlPort"].as<int>();
         sqlUser = std::make_unique<std::string>(yamlFile["mysql"]["sqlUser"].as<std::string>()); ;
         sqlPwd = std::make_unique<std::string>(yamlFile["mysql"]["sqlPwd"].as<std::string>());
         dbName = std::make_unique<std::string>(yamlFile["mysql"]["dbName"].as<std::string>());
+        if(yamlFile["mysql"]["async"]) {
+            sqlAsync = yamlFile["mysql"]["async"].as<std::string>() == "true" ? true : false;
+        }
+        //连接池伸缩与保活，可选；连接数上限为server.connPoolNum
+        if(yamlFile["mysql"]["pool"]) {
+            sqlMinConn = yamlFile["mysql"]["pool"]["minConn"].as<int>();
+            sqlIdleMs = yamlFile["mysql"]["pool"]["idleMs"].as<int>();
+            sqlKeepaliveMs = yamlFile["mysql"]["pool"]["keepaliveMs"].as<int>();
+            sqlAcquireTimeoutMs = yamlFile["mysql"]["pool"]["acquireTimeoutMs"].as<int>();
+            sqlRetryMs = yamlFile["mysql"]["pool"]["retryMs"].as<int>();
+        }
+        //反向代理配置，可选
+        if(yamlFile["proxy"]) {
+            proxyPoolSize = yamlFile["proxy"]["poolSize"].as<int>();
+            proxyTimeOutMs = yamlFile["proxy"]["timeOutMs"].as<int>();
+            for(const auto& route : yamlFile["proxy"]["routes"]) {
+                ProxyRouteCfg routeCfg;
+                routeCfg.prefix = route["prefix"].as<std::string>();
+                for(const auto& upstream : route["upstreams"]) {
+                    routeCfg.upstreams.push_back(upstream.as<std::string>());
+                }
+                proxyRoutes.push_back(routeCfg);
+            }
+        }
+        //动态响应微缓存配置，可选
+        if(yamlFile["microCache"]) {
+            microCacheOpen = yamlFile["microCache"]["open"].as<std::string>() == "true" ? true : false;
+            microCacheTtlMs = yamlFile["microCache"]["ttlMs"].as<int>();
+            microCacheStaleMs = yamlFile["microCache"]["staleMs"].as<int>();
+            microCacheMaxEntries = yamlFile["microCache"]["maxEntries"].as<int>();
+            for(const auto& header : yamlFile["microCache"]["varyHeaders"]) {
+                microCacheVary.push_back(header.as<std::string>());
+            }
+            for(const auto& path : yamlFile["microCache"]["paths"]) {
+                microCachePaths.push_back(path.as<std::string>());
+            }
+        }
+        //用户凭据缓存配置，可选
+        if(yamlFile["userCache"]) {
+            userCacheOpen = yamlFile["userCache"]["open"].as<std::string>() == "true" ? true : false;
+            userCacheTtlMs = yamlFile["userCache"]["ttlMs"].as<int>();
+            userCacheNegativeTtlMs = yamlFile["userCache"]["negativeTtlMs"].as<int>();
+            userCacheMaxKb = yamlFile["userCache"]["maxKb"].as<int>();
+        }
+        //用户名布隆过滤器，可选
+        if(yamlFile["userFilter"]) {
+            userFilterOpen = yamlFile["userFilter"]["open"].as<std::string>() == "true" ? true : false;
+            userFilterFpRate = yamlFile["userFilter"]["fpRate"].as<double>();
+            userFilterMinCapacity = yamlFile["userFilter"]["minCapacity"].as<int>();
+            userFilterRebuildSec = yamlFile["userFilter"]["rebuildSec"].as<int>();
+        }
+        //注册INSERT组提交，可选
+        if(yamlFile["userBatch"]) {
+            userBatchOpen = yamlFile["userBatch"]["open"].as<std::string>() == "true" ? true : false;
+            userBatchMaxRows = yamlFile["userBatch"]["maxRows"].as<int>();
+            userBatchMaxDelayMs = yamlFile["userBatch"]["maxDelayMs"].as<int>();
+        }
+        //用户数据后端，可选，默认mysql
+        if(yamlFile["userStore"]) {
+            userStoreType = yamlFile["userStore"]["type"].as<std::string>();
+            userStoreSnapshotFile = yamlFile["userStore"]["snapshotFile"].as<std::string>();
+            userStoreSnapshotSec = yamlFile["userStore"]["snapshotSec"].as<int>();
+        }
+        //TLS监听配置，可选
+        if(yamlFile["tls"]) {
+            tlsOpen = yamlFile["tls"]["open"].as<std::string>() == "true" ? true : false;
+            tlsPort = yamlFile["tls"]["port"].as<int>();
+            tlsCertFile = yamlFile["tls"]["certFile"].as<std::string>();
+            tlsKeyFile = yamlFile["tls"]["keyFile"].as<std::string>();
+            tlsKtls = yamlFile["tls"]["ktls"].as<std::string>() == "true" ? true : false;
+        }
+        //multipart文件上传配置，可选
+        if(yamlFile["upload"]) {
+            uploadOpen = yamlFile["upload"]["open"].as<std::string>() == "true" ? true : false;
+            uploadDir = yamlFile["upload"]["dir"].as<std::string>();
+            uploadMaxBodyMb = yamlFile["upload"]["maxBodyMb"].as<int>();
+            for(const auto& path : yamlFile["upload"]["paths"]) {
+                uploadPaths.push_back(path.as<std::string>());
+            }
+        }
+        //静态资源包配置，可选
+        if(yamlFile["assetBundle"]) {
+            assetBundleOpen = yamlFile["assetBundle"]["open"].as<std::string>() == "true" ? true : false;
+            assetBundleFile = yamlFile["assetBundle"]["file"].as<std::string>();
+        }
+        //指标输出配置，可选
+        if(yamlFile["metrics"]) {
+            metricsOpen = yamlFile["metrics"]["open"].as<std::string>() == "true" ? true : false;
+            metricsPath = yamlFile["metrics"]["path"].as<std::string>();
+        }
+        //慢请求记录配置，可选
+        if(yamlFile["slowLog"]) {
+            slowLogOpen = yamlFile["slowLog"]["open"].as<std::string>() == "true" ? true : false;
+            slowLogThresholdMs = yamlFile["slowLog"]["thresholdMs"].as<int>();
+            slowLogCapacity = yamlFile["slowLog"]["capacity"].as<int>();
+            slowLogPath = yamlFile["slowLog"]["path"].as<std::string>();
+        }
+        //具名执行器，可选
+        if(yamlFile["executors"]) {
+            for(const auto& item : yamlFile["executors"]) {
+                ExecutorCfg executorCfg;
+                executorCfg.name = item.first.as<std::string>();
+                executorCfg.threadNum = item.second["threadNum"].as<int>();
+                executorCfg.maxThreadNum = item.second["maxThreadNum"].as<int>();
+                executorCfg.queueMax = item.second["queueMax"].as<int>();
+                executors.push_back(executorCfg);
+            }
+        }
+        //访问日志，可选
+        if(yamlFile["accessLog"]) {
+            accessLogOpen = yamlFile["accessLog"]["open"].as<std::string>() == "true" ? true : false;
+            accessLogSampleRate = yamlFile["accessLog"]["sampleRate"].as<double>();
+            for(const auto& item : yamlFile["accessLog"]["statusRates"]) {
+                accessLogStatusRates[item.first.as<std::string>()] = item.second.as<double>();
+            }
+        }
 
     } catch(const std::exception& e) {
         std::cerr << e.what() << " -- above is a yaml exception\n";
+        return false;
     }
+    return true;
 }
 
 
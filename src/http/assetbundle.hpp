@@ -0,0 +1,194 @@
+#ifndef ASSETBUNDLE_HPP
+#define ASSETBUNDLE_HPP
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+#include "bundleformat.hpp"
+#include "../logger/logger.hpp"
+
+/*
+    静态资源包：启动时整体映射一次，静态请求按路径二分查找后直接从映射发送，不再stat/open/mmap
+    1、映射时预读全部页面，之后的请求不触发缺页读盘
+    2、重新打包后再次Open（由配置热加载触发）原子切换到新包，文件未变化时不重新映射
+    3、旧映射不解除：发送中的响应仍指向旧包，无法得知何时发完；换包次数有限
+*/
+class AssetBundle final {
+public:
+    //一个资源在映射中的位置，随映射一直有效
+    struct Asset {
+        const char* data;
+        size_t len;
+        const char* gzData;
+        size_t gzLen;
+        const char* type;
+        size_t typeLen;
+        const char* etag;
+        size_t etagLen;
+    };
+
+    static AssetBundle* GetInstance();
+
+    //映射并校验资源包，成功后替换当前包；失败时保留当前包
+    bool Open(const std::string& file);
+    bool IsOpen() const;
+    bool Find(const char* path, size_t len, Asset* asset) const;
+
+private:
+    struct Mapping {
+        const char* base;
+        size_t size;
+        const BundleEntry* entries;
+        uint32_t count;
+        dev_t dev;
+        ino_t ino;
+        timespec mtime;
+    };
+
+    AssetBundle() = default;
+    ~AssetBundle() = default;
+
+    //检查头部与每个条目的偏移都落在文件内、索引有序
+    static bool Check_(const char* base, size_t size);
+
+    std::atomic<const Mapping*> current_{nullptr};
+    std::mutex mtx_;
+    std::vector<std::unique_ptr<Mapping>> mappings_;
+};
+
+AssetBundle* AssetBundle::GetInstance() {
+    static AssetBundle bundle;
+    return &bundle;
+}
+
+bool AssetBundle::Open(const std::string& file) {
+    std::lock_guard<std::mutex> locker(mtx_);
+    int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st) < 0) {
+        LOG_ERROR("AssetBundle open %s error: %s", file.c_str(), strerror(errno));
+        if(fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+    const Mapping* current = current_.load(std::memory_order_relaxed);
+    if(current && current->dev == st.st_dev && current->ino == st.st_ino && current->size == (size_t)st.st_size &&
+       current->mtime.tv_sec == st.st_mtim.tv_sec && current->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+        close(fd);
+        return true;
+    }
+    size_t size = st.st_size;
+    void* base = size >= sizeof(BundleHeader) ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0)
+                                              : MAP_FAILED;
+    close(fd);
+    if(base == MAP_FAILED) {
+        LOG_ERROR("AssetBundle map %s error", file.c_str());
+        return false;
+    }
+    if(!Check_(static_cast<const char*>(base), size)) {
+        LOG_ERROR("AssetBundle %s corrupted", file.c_str());
+        munmap(base, size);
+        return false;
+    }
+    madvise(base, size, MADV_WILLNEED);
+
+    const BundleHeader* header = static_cast<const BundleHeader*>(base);
+    std::unique_ptr<Mapping> mapping(new Mapping());
+    mapping->base = static_cast<const char*>(base);
+    mapping->size = size;
+    mapping->entries = reinterpret_cast<const BundleEntry*>(mapping->base + header->indexOff);
+    mapping->count = header->count;
+    mapping->dev = st.st_dev;
+    mapping->ino = st.st_ino;
+    mapping->mtime = st.st_mtim;
+    current_.store(mapping.get(), std::memory_order_release);
+    mappings_.push_back(std::move(mapping));
+    LOG_INFO("AssetBundle: %s, %u assets, %zu bytes", file.c_str(), header->count, size);
+    return true;
+}
+
+bool AssetBundle::IsOpen() const {
+    return current_.load(std::memory_order_relaxed) != nullptr;
+}
+
+bool AssetBundle::Find(const char* path, size_t len, Asset* asset) const {
+    assert(path && asset);
+    const Mapping* mapping = current_.load(std::memory_order_acquire);
+    if(!mapping) {
+        return false;
+    }
+    const BundleHeader* header = reinterpret_cast<const BundleHeader*>(mapping->base);
+    const char* strings = mapping->base + header->stringOff;
+    uint32_t low = 0;
+    uint32_t high = mapping->count;
+    while(low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        const BundleEntry& entry = mapping->entries[mid];
+        int ret = BundleFormat::Compare(strings + entry.pathOff, entry.pathLen, path, len);
+        if(ret < 0) {
+            low = mid + 1;
+        }
+        else if(ret > 0) {
+            high = mid;
+        }
+        else {
+            asset->data = mapping->base + entry.dataOff;
+            asset->len = entry.dataLen;
+            asset->gzData = entry.gzLen > 0 ? mapping->base + entry.gzOff : nullptr;
+            asset->gzLen = entry.gzLen;
+            asset->type = strings + entry.typeOff;
+            asset->typeLen = entry.typeLen;
+            asset->etag = strings + entry.etagOff;
+            asset->etagLen = entry.etagLen;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool AssetBundle::Check_(const char* base, size_t size) {
+    const BundleHeader* header = reinterpret_cast<const BundleHeader*>(base);
+    if(memcmp(header->magic, BundleFormat::MAGIC, sizeof(header->magic)) != 0 ||
+       header->version != BundleFormat::VERSION || header->fileSize != size) {
+        return false;
+    }
+    if(header->indexOff % alignof(BundleEntry) != 0 || header->indexOff > size ||
+       header->count > (size - header->indexOff) / sizeof(BundleEntry) ||
+       header->stringOff > size || header->stringLen > size - header->stringOff) {
+        return false;
+    }
+    const BundleEntry* entries = reinterpret_cast<const BundleEntry*>(base + header->indexOff);
+    const char* strings = base + header->stringOff;
+    auto inStrings = [header](uint32_t off, uint32_t len) {
+        return off <= header->stringLen && len <= header->stringLen - off;
+    };
+    auto inFile = [size](uint64_t off, uint64_t len) {
+        return off <= size && len <= size - off;
+    };
+    for(uint32_t i = 0; i < header->count; ++i) {
+        const BundleEntry& entry = entries[i];
+        if(!inStrings(entry.pathOff, entry.pathLen) || !inStrings(entry.typeOff, entry.typeLen) ||
+           !inStrings(entry.etagOff, entry.etagLen) || !inFile(entry.dataOff, entry.dataLen) ||
+           !inFile(entry.gzOff, entry.gzLen)) {
+            return false;
+        }
+        if(i > 0 && BundleFormat::Compare(strings + entries[i - 1].pathOff, entries[i - 1].pathLen,
+                                          strings + entry.pathOff, entry.pathLen) >= 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef BUNDLEFORMAT_HPP
+#define BUNDLEFORMAT_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/*
+    静态资源包格式，由bundlepack打包，服务端整体映射后直接发送，两端共用本文件
+    文件：头部 | 索引 | 字符串区 | 数据区
+        头部：魔数 | u32 版本 | u32 条目数 | u64 索引偏移 | u64 字符串区偏移 | u64 字符串区长度 | u64 文件总长 | i64 打包时间
+        索引：定长条目，按路径字节序升序排列，查找时二分
+        字符串区：各条目的路径（以/开头，相对资源目录）、Content-type与ETag（含引号）
+        数据区：原始内容与可选的gzip变体，各自按BLOB_ALIGN对齐
+    整数按本机字节序
+*/
+struct BundleHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    uint64_t indexOff;
+    uint64_t stringOff;
+    uint64_t stringLen;
+    uint64_t fileSize;
+    int64_t buildTime;
+    uint64_t reserved;
+};
+
+struct BundleEntry {
+    uint32_t pathOff;
+    uint32_t pathLen;
+    uint32_t typeOff;
+    uint32_t typeLen;
+    uint32_t etagOff;
+    uint32_t etagLen;
+    uint64_t dataOff;
+    uint64_t dataLen;
+    //gzip变体，没有时长度为0
+    uint64_t gzOff;
+    uint64_t gzLen;
+    uint64_t reserved;
+};
+
+class BundleFormat final {
+public:
+    static const char MAGIC[8];
+    static const uint32_t VERSION = 1;
+    static const size_t BLOB_ALIGN = 64;
+
+    static uint64_t Align(uint64_t off) {
+        return (off + BLOB_ALIGN - 1) & ~static_cast<uint64_t>(BLOB_ALIGN - 1);
+    }
+    //路径按字节序比较，短的前缀在前
+    static int Compare(const char* a, size_t aLen, const char* b, size_t bLen) {
+        int ret = memcmp(a, b, aLen < bLen ? aLen : bLen);
+        if(ret != 0) {
+            return ret;
+        }
+        return aLen < bLen ? -1 : (aLen > bLen ? 1 : 0);
+    }
+    //内容的FNV-1a 64位摘要，作为强ETag
+    static uint64_t Digest(const char* data, size_t len) {
+        uint64_t hash = 14695981039346656037ULL;
+        for(size_t i = 0; i < len; ++i) {
+            hash ^= static_cast<unsigned char>(data[i]);
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+};
+
+static_assert(sizeof(BundleHeader) == 64, "BundleHeader layout");
+static_assert(sizeof(BundleEntry) == 64, "BundleEntry layout");
+
+const char BundleFormat::MAGIC[8] = {'W', 'S', 'B', 'N', 'D', 'L', '0', '1'};
+const uint32_t BundleFormat::VERSION;
+const size_t BundleFormat::BLOB_ALIGN;
+
+#endif
@@ -6,58 +6,157 @@
 #include <arpa/inet.h>   // sockaddr_in
 #include <stdlib.h>      // atoi()
 #include <errno.h>      
+#include <atomic>
+#include <functional>
 
 #include "../buffer/buffer.hpp"
-#include "httprequest.hpp"
-#include "httpresponse.hpp"
-#include "../pool/sqlconnRAII.hpp"
+#include "httpcontext.hpp"
+#include "../store/userstore.hpp"
+#include "../pool/objectpool.hpp"
+#include "../tls/tlsconn.hpp"
+#include "../logger/accesslog.hpp"
+#include "../cfg/runtimeconfig.hpp"
+#include "../metrics/metrics.hpp"
+#include "../metrics/slowlog.hpp"
 
 class HttpConn final {
 public:
     HttpConn();
     ~HttpConn();
 
-    //初始化连接
-    void Init(int sockfd, const sockaddr_in &addr);
+    //初始化连接，isTls为TLS监听端口接入的连接；TLS初始化失败时关闭连接并返回false，不退回明文
+    bool Init(int sockfd, const sockaddr_in &addr, bool isTls = false);
     //主处理函数
     bool Process();
+    //挂起的请求（等待缓存结果、查库或定时）被唤醒后继续处理
+    bool Resume();
+    //挂起方与完成方各调用一次，两方都到达后重新调度
+    void Park();
+    bool IsParked() const;
     ssize_t Read(int *saveErrno);
     ssize_t Write(int *saveErrno);
     void Close();
+    //响应发送完毕时调用：记录指标与慢请求，按采样写一行访问日志
+    void FinishResponse();
 
     int GetFd() const;
     int GetPort() const;
-    const char* GetIP() const;
+    //地址写入调用方的缓冲（至少INET_ADDRSTRLEN），多个io线程可同时调用
+    const char* GetIP(char* buf, size_t len) const;
     sockaddr_in GetAddr() const;
     int ToWriteBytes();
     bool IsKeepAlive() const;
+    //TLS握手阻塞在写出，应等待可写后继续握手
+    bool IsHandshakeWantWrite() const;
+    //代理响应体等待上游数据
+    bool IsWaitUpstream() const;
+    int GetUpstreamFd() const;
 
     static bool isET;
     static const char *srcDir;
-    static unsigned userCount;
+    static std::atomic<unsigned> userCount;
+    //挂起的连接结果就绪后的重新调度入口
+    static std::function<void(HttpConn*)> onResume;
+    //投递查库任务到db执行器，与静态请求隔离；队列已满返回false
+    static std::function<bool(std::function<void()>)> postDbTask;
+    //ms毫秒后由reactor执行任务
+    static std::function<void(int, std::function<void()>)> runAfter;
+    //由reactor等待fd可读或可写（isWrite），就绪或超时后在io执行器上回调，参数为是否就绪
+    static std::function<void(int, bool, int, std::function<void(bool)>)> awaitFd;
 
 private:
+    //db执行器满时退避后重试一次的等待时长
+    static const int DB_RETRY_MS = 50;
+
+    /*
+        挂起与唤醒：异步操作发起前调用Suspend_保存后续处理then，操作完成方调用Park，
+        连接与完成方都到达后经onResume回到io执行器，由Resume执行then
+        以下Await*_按此组合出查库、定时两类等待，处理流程写成“发起-后续”的顺序形式
+    */
+    void Suspend_(std::function<bool()> then);
+    //异步操作未能发起，撤销挂起
+    void CancelSuspend_();
+    //work在db执行器上执行，完成后从then继续；执行器已满返回false，不挂起
+    template<typename Work>
+    bool AwaitDb_(Work work, std::function<bool()> then);
+    //不占线程等待ms毫秒后从then继续
+    void AwaitSleep_(int ms, std::function<bool()> then);
+    //不占线程等待fd就绪后从then继续，超时同样继续并置ctx_->isWaitTimeout
+    void AwaitFd_(int fd, bool isWrite, int timeoutMs, std::function<bool()> then);
+
+    //回复指标、慢请求记录等文本
+    bool SendText_(std::string body);
+    //响应体已在ctx_->cached中，组装响应头后直接发送
+    void SendCached_();
+    void RecordMetrics_(int status, uint64_t bytes);
+    void RecordSlow_(int status, uint64_t bytes, unsigned reuse, const char* ip);
+    void LogAccess_(int status, uint64_t bytes, unsigned reuse, const char* ip);
+
+    //请求要求保持连接且本连接未达到keepAliveMax
+    bool KeepAlive_() const;
+    void MakeResponse_();
+    //查询微缓存：命中直接组装，未命中则计算并回填，他人计算中则挂起
+    bool ProcessCacheable_();
+    //本请求计算出的响应回填微缓存，不可缓存时唤醒等待者
+    void FillCache_();
+    //查库请求挂起，完成后回到io执行器组装响应
+    //连接池为非阻塞模式时由reactor驱动查询，否则交给db执行器
+    bool StartDynamic_();
+    //查库完成，组装响应
+    bool FinishDynamic_();
+    //代理请求：等待上游连接、发送与响应头时挂起，响应头就绪后由proxy搬运响应体
+    bool StartProxy_(ProxyRoute* route);
+    bool ContinueProxy_(ProxyRelay::STEP step);
+    //后台重新计算陈旧的缓存条目
+    static void Revalidate_(const std::string& key, HttpRequest request);
+    //继续解析上传请求体，未接收完返回false
+    bool ProcessUpload_();
+    //客户端等待100-continue时先回复临时响应（上传与未收全的请求体）
+    void SendContinue_();
+    //开始处理请求时借出上下文，连接回到空闲时归还
+    void AcquireContext_();
+    void ReleaseContext_();
+
     int fd_;
     struct sockaddr_in addr_;
 
     bool isClose_;
-    int iovCnt_;
-    struct iovec iov_[2];
     Buffer readBuff_;
     Buffer writeBuff_;
 
-    HttpRequest request_;
-    HttpResponse response_;
+    TlsConn tls_;
+    //接入时间与最近一次读入请求第一批字节的时间，开始处理请求时填入trace
+    HttpContext::Clock::time_point acceptTime_;
+    HttpContext::Clock::time_point readTime_;
+    //本连接上已发完的响应数，访问日志中的复用次数
+    unsigned requestCount_;
+
+    //请求处理中的状态，空闲时为nullptr
+    HttpContext* ctx_;
+    //挂起方与唤醒方都到达后才重新调度，避免与挂起流程并发
+    std::atomic<int> parkGate_;
+
+    //所有连接共用的请求上下文池
+    static ObjectPool<HttpContext> contextPool_;
 };
 
 bool HttpConn::isET = false;
 const char * HttpConn::srcDir = nullptr;
-unsigned HttpConn::userCount = 0;
+std::atomic<unsigned> HttpConn::userCount(0);
+std::function<void(HttpConn*)> HttpConn::onResume;
+std::function<bool(std::function<void()>)> HttpConn::postDbTask;
+std::function<void(int, std::function<void()>)> HttpConn::runAfter;
+std::function<void(int, bool, int, std::function<void(bool)>)> HttpConn::awaitFd;
+const int HttpConn::DB_RETRY_MS;
+ObjectPool<HttpContext> HttpConn::contextPool_;
 
 HttpConn::HttpConn() {
     fd_ = -1;
     addr_ = {0};
     isClose_ = true;
+    requestCount_ = 0;
+    ctx_ = nullptr;
+    parkGate_ = 0;
 }
 
 HttpConn::~HttpConn() {
@@ -67,12 +166,16 @@ HttpConn::~HttpConn() {
 void HttpConn::Close() {
     if(isClose_ == false) {
         isClose_ = true;
+        ReleaseContext_();
+        readBuff_.RetrieveAll();
+        writeBuff_.RetrieveAll();
+        tls_.Close();
         userCount--;
         close(fd_);
     }
 }
 
-void HttpConn::Init(int sockfd, const sockaddr_in &addr) {
+bool HttpConn::Init(int sockfd, const sockaddr_in &addr, bool isTls) {
     assert(sockfd > 0);
     userCount++;
     fd_ = sockfd;
@@ -80,6 +183,14 @@ void HttpConn::Init(int sockfd, const sockaddr_in &addr) {
     writeBuff_.RetrieveAll();
     readBuff_.RetrieveAll();
     isClose_ = false;
+    requestCount_ = 0;
+    acceptTime_ = readTime_ = HttpContext::Clock::now();
+    if (isTls && !tls_.Init(sockfd)) {
+        LOG_ERROR("TLS conn init error, fd: %d", sockfd);
+        Close();
+        return false;
+    }
+    return true;
 }
 
 int HttpConn::GetFd() const {
@@ -90,8 +201,12 @@ struct sockaddr_in HttpConn::GetAddr() const {
     return addr_;
 }
 
-const char* HttpConn::GetIP() const {
-    return inet_ntoa(addr_.sin_addr);
+const char* HttpConn::GetIP(char* buf, size_t len) const {
+    //inet_ntoa返回静态缓冲区，多个io线程同时调用会互相覆盖
+    if (!inet_ntop(AF_INET, &addr_.sin_addr, buf, len)) {
+        snprintf(buf, len, "-");
+    }
+    return buf;
 }
 
 int HttpConn::GetPort() const {
@@ -99,80 +214,574 @@ int HttpConn::GetPort() const {
 }
 
 int HttpConn::ToWriteBytes() { 
-    return iov_[0].iov_len + iov_[1].iov_len; 
+    if (!ctx_) {
+        return 0;
+    }
+    return ctx_->iov[0].iov_len + ctx_->iov[1].iov_len + ctx_->proxy.PendingBytes(); 
 }
 
 bool HttpConn::IsKeepAlive() const {
-    return request_.IsKeepAlive();
+    if(!ctx_) {
+        return false;
+    }
+    if(ctx_->isProxy) {
+        return ctx_->proxy.IsKeepAlive();
+    }
+    //与响应头中的Connection一致
+    return ctx_->response.IsKeepAlive();
+}
+
+bool HttpConn::IsHandshakeWantWrite() const {
+    return tls_.IsHandshakeWantWrite();
+}
+
+bool HttpConn::IsWaitUpstream() const {
+    return ctx_ && ctx_->proxy.IsWaitUpstream();
+}
+
+int HttpConn::GetUpstreamFd() const {
+    return ctx_ ? ctx_->proxy.GetUpstreamFd() : -1;
 }
 
 bool HttpConn::Process() {
-    request_.Init();
+    //上传请求体跨多次读事件，继续解析而不重新初始化请求
+    if (ctx_ && ctx_->upload.IsActive()) {
+        return ProcessUpload_();
+    }
+    //请求体同样可能跨多次读事件，收全之前不开始处理
+    bool isBodyPending = ctx_ && ctx_->request.IsBodyPending();
+    if (isBodyPending && readBuff_.ReadableBytes() <= 0) {
+        return false;
+    }
+    if (!isBodyPending) {
+        if (readBuff_.ReadableBytes() <= 0) {
+            //回到空闲的长连接
+            ReleaseContext_();
+            return false;
+        }
+        AcquireContext_();
+    }
 
-    if (readBuff_.ReadableBytes() <= 0) {
+    bool isParsed = ctx_->request.ParseRequest(readBuff_);
+    if (isParsed && ctx_->request.IsBodyPending()) {
+        if (!isBodyPending) {
+            SendContinue_();
+        }
         return false;
     }
-    else if (request_.ParseRequest(readBuff_)) {
-        //response_200
-        response_.Init(srcDir, request_.GetPath(), request_.IsKeepAlive(), 200);
+    ctx_->trace.parsed = HttpContext::Clock::now();
+    if (isParsed) {
+        ProxyRoute* route = ProxyRouter::GetInstance()->Match(ctx_->request.GetTarget().c_str());
+        if (Metrics::GetInstance()->IsScrapePath(ctx_->request.GetMethod().c_str(), ctx_->request.GetPath().c_str())) {
+            return SendText_(Metrics::GetInstance()->Render());
+        }
+        else if (SlowLog::GetInstance()->IsDumpPath(ctx_->request.GetMethod().c_str(),
+                                                    ctx_->request.GetPath().c_str())) {
+            return SendText_(SlowLog::GetInstance()->Render());
+        }
+        else if (ctx_->request.IsUpload()) {
+            auto& headers = ctx_->request.GetHeaders();
+            auto type = headers.find("Content-Type");
+            auto length = headers.find("Content-Length");
+            if (ctx_->upload.Init(type->second.c_str(), length != headers.end() ? length->second.c_str() : "")) {
+                SendContinue_();
+                return ProcessUpload_();
+            }
+            //response_400，请求体未读取，不能复用连接
+            ctx_->response.Init(srcDir, "/400.html", false, 400);
+        }
+        else if (route) {
+            return StartProxy_(route);
+        }
+        else if (MicroCache::GetInstance()->IsCacheable(ctx_->request.GetMethod().c_str(),
+                                                        ctx_->request.GetTarget().c_str())) {
+            ctx_->cacheKey = MicroCache::GetInstance()->MakeKey(ctx_->request.GetMethod(), ctx_->request.GetTarget(),
+                                                           ctx_->request.GetHeaders());
+            return ProcessCacheable_();
+        }
+        else if (ctx_->request.IsDynamic()) {
+            return StartDynamic_();
+        }
+        else {
+            //response_200
+            ctx_->response.Init(srcDir, ctx_->request.GetPath().c_str(), KeepAlive_(), 200);
+        }
     }
     else {
-        //response_400
-        response_.Init(srcDir, request_.GetPath(), false, 400);
+        //response_400/411/413，请求体的边界不可信，回复后关闭连接
+        ctx_->response.Init(srcDir, "/400.html", false, ctx_->request.GetErrorCode());
+    }
+
+    MakeResponse_();
+    return true;
+}
+
+bool HttpConn::Resume() {
+    assert(ctx_ && ctx_->then);
+    //then执行中可能再次挂起并保存新的then
+    std::function<bool()> then = std::move(ctx_->then);
+    ctx_->then = nullptr;
+    ctx_->isParked = false;
+    return then();
+}
+
+void HttpConn::Park() {
+    if (parkGate_.fetch_add(1) == 1) {
+        onResume(this);
+    }
+}
+
+bool HttpConn::IsParked() const {
+    return ctx_ && ctx_->isParked;
+}
+
+void HttpConn::Suspend_(std::function<bool()> then) {
+    //先置挂起状态再发起：完成方可能在发起函数返回前就调用Park
+    ctx_->then = std::move(then);
+    ctx_->isParked = true;
+    ++ctx_->trace.parks;
+    parkGate_ = 0;
+}
+
+void HttpConn::CancelSuspend_() {
+    ctx_->then = nullptr;
+    ctx_->isParked = false;
+}
+
+template<typename Work>
+bool HttpConn::AwaitDb_(Work work, std::function<bool()> then) {
+    Suspend_(std::move(then));
+    if (postDbTask([this, work]() {
+        work();
+        Park();
+    })) {
+        return true;
     }
+    CancelSuspend_();
+    return false;
+}
+
+void HttpConn::AwaitSleep_(int ms, std::function<bool()> then) {
+    Suspend_(std::move(then));
+    runAfter(ms, [this]() {
+        Park();
+    });
+}
 
-    response_.MakeResponse(writeBuff_);
-    iov_[0].iov_base = const_cast<char*>(writeBuff_.Peek());
-    iov_[0].iov_len = writeBuff_.ReadableBytes();
-    iovCnt_ = 1;
+void HttpConn::AwaitFd_(int fd, bool isWrite, int timeoutMs, std::function<bool()> then) {
+    Suspend_(std::move(then));
+    ctx_->isWaitTimeout = false;
+    awaitFd(fd, isWrite, timeoutMs, [this](bool isReady) {
+        ctx_->isWaitTimeout = !isReady;
+        Park();
+    });
+}
+
+bool HttpConn::ProcessCacheable_() {
+    MicroCache* cache = MicroCache::GetInstance();
+    std::shared_ptr<const CachedResponse> entry;
+    //他人计算中时登记为等待者，结果就绪后重新查询
+    Suspend_([this]() {
+        return ProcessCacheable_();
+    });
+    MicroCache::LOOKUP_STATE state = cache->Lookup(ctx_->cacheKey, &entry, [this]() {
+        Park();
+    });
 
-    if(response_.GetFileLen() > 0 && response_.GetFile()) {
-        iov_[1].iov_base = response_.GetFile();
-        iov_[1].iov_len = response_.GetFileLen();
-        iovCnt_ = 2;        
+    if (state == MicroCache::CACHE_WAIT) {
+        return false;
+    }
+    CancelSuspend_();
+    if (state == MicroCache::CACHE_HIT || state == MicroCache::CACHE_STALE) {
+        if (state == MicroCache::CACHE_STALE &&
+            !postDbTask(std::bind(&HttpConn::Revalidate_, ctx_->cacheKey, ctx_->request))) {
+            cache->Abandon(ctx_->cacheKey);
+        }
+        ctx_->cached = entry;
+        SendCached_();
+        return true;
     }
+
+    //CACHE_LEAD：由本请求计算，结果回填缓存并唤醒等待者
+    ctx_->isCacheLead = true;
+    if (ctx_->request.IsDynamic()) {
+        return StartDynamic_();
+    }
+    ctx_->response.Init(srcDir, ctx_->request.GetPath().c_str(), KeepAlive_(), 200);
+    MakeResponse_();
+    FillCache_();
+    return true;
+}
+
+bool HttpConn::SendText_(std::string body) {
+    std::shared_ptr<CachedResponse> text = std::make_shared<CachedResponse>();
+    text->code = 200;
+    text->path.assign(ctx_->request.GetPath().data(), ctx_->request.GetPath().size());
+    text->body = std::move(body);
+    ctx_->cached = std::move(text);
+    SendCached_();
     return true;
 }
 
+void HttpConn::SendCached_() {
+    ctx_->response.Init(srcDir, ctx_->cached->path.c_str(), KeepAlive_(), ctx_->cached->code);
+    ctx_->response.MakeCachedResponse(writeBuff_, ctx_->cached->body.size());
+    ctx_->iov[0].iov_base = const_cast<char*>(writeBuff_.Peek());
+    ctx_->iov[0].iov_len = writeBuff_.ReadableBytes();
+    ctx_->iov[1].iov_base = const_cast<char*>(ctx_->cached->body.data());
+    ctx_->iov[1].iov_len = ctx_->cached->body.size();
+    ctx_->iovCnt = 2;
+    ctx_->trace.ready = HttpContext::Clock::now();
+}
+
+void HttpConn::FillCache_() {
+    MicroCache* cache = MicroCache::GetInstance();
+    ctx_->isCacheLead = false;
+    if (ctx_->response.GetFile()) {
+        std::shared_ptr<CachedResponse> fresh = std::make_shared<CachedResponse>();
+        fresh->code = ctx_->response.GetCode();
+        fresh->path.assign(ctx_->response.GetPath().data(), ctx_->response.GetPath().size());
+        fresh->body.assign(ctx_->response.GetFile(), ctx_->response.GetFileLen());
+        cache->Fill(ctx_->cacheKey, std::move(fresh));
+    }
+    else {
+        cache->Abandon(ctx_->cacheKey);
+    }
+}
+
+bool HttpConn::StartDynamic_() {
+    UserStore::EXEC_MODE mode = UserStore::GetInstance()->GetExecMode();
+    //内存后端不会阻塞，直接在io线程上完成
+    if (mode == UserStore::EXEC_INLINE) {
+        ctx_->request.HandleDynamic();
+        return FinishDynamic_();
+    }
+    //退避重试时从第一次发起算起
+    if (!ctx_->isDbWait) {
+        ctx_->isDbWait = true;
+        ctx_->dbWaitTime = HttpContext::Clock::now();
+    }
+    if (mode == UserStore::EXEC_ASYNC) {
+        Suspend_([this]() {
+            return FinishDynamic_();
+        });
+        ctx_->request.HandleDynamicAsync([this]() {
+            Park();
+        });
+        return false;
+    }
+    bool isPosted = AwaitDb_([this]() {
+        ctx_->request.HandleDynamic();
+    }, [this]() {
+        return FinishDynamic_();
+    });
+    if (isPosted) {
+        return false;
+    }
+    //db执行器积压已满：挂起退避一次再投递，期间不占用io线程；仍满则拒绝
+    if (!ctx_->isDbRetried) {
+        ctx_->isDbRetried = true;
+        AwaitSleep_(DB_RETRY_MS, [this]() {
+            return StartDynamic_();
+        });
+        return false;
+    }
+    LOG_WARN("Client[%d] db executor full, reject %s", fd_, ctx_->request.GetTarget().c_str());
+    if (ctx_->isCacheLead) {
+        ctx_->isCacheLead = false;
+        MicroCache::GetInstance()->Abandon(ctx_->cacheKey);
+    }
+    ctx_->response.Init(srcDir, "/503.html", KeepAlive_(), 503);
+    MakeResponse_();
+    return true;
+}
+
+bool HttpConn::FinishDynamic_() {
+    if (ctx_->isDbWait) {
+        Metrics::GetInstance()->RecordLatency(Metrics::DB_WAIT,
+                                              RequestTrace::ElapsedUs(ctx_->dbWaitTime, HttpContext::Clock::now()));
+    }
+    ctx_->response.Init(srcDir, ctx_->request.GetPath().c_str(), KeepAlive_(), 200);
+    MakeResponse_();
+    if (ctx_->isCacheLead) {
+        FillCache_();
+    }
+    return true;
+}
+
+bool HttpConn::StartProxy_(ProxyRoute* route) {
+    char ip[INET_ADDRSTRLEN];
+    return ContinueProxy_(ctx_->proxy.Start(route, ctx_->request, GetIP(ip, sizeof(ip)), KeepAlive_(), writeBuff_));
+}
+
+bool HttpConn::ContinueProxy_(ProxyRelay::STEP step) {
+    if (step == ProxyRelay::STEP_WAIT_READ || step == ProxyRelay::STEP_WAIT_WRITE) {
+        //上游未就绪时挂起，上游fd交给reactor等待，不占io线程
+        AwaitFd_(ctx_->proxy.GetUpstreamFd(), step == ProxyRelay::STEP_WAIT_WRITE,
+                 ProxyRouter::GetInstance()->GetTimeOutMs(), [this]() {
+            return ContinueProxy_(ctx_->proxy.Continue(ctx_->isWaitTimeout, writeBuff_));
+        });
+        return false;
+    }
+    if (step == ProxyRelay::STEP_READY) {
+        //代理响应：iov只放响应头，响应体由proxy搬运
+        ctx_->isProxy = true;
+        ctx_->iov[0].iov_base = const_cast<char*>(writeBuff_.Peek());
+        ctx_->iov[0].iov_len = writeBuff_.ReadableBytes();
+        ctx_->iov[1].iov_len = 0;
+        ctx_->iovCnt = 1;
+        ctx_->trace.ready = HttpContext::Clock::now();
+        return true;
+    }
+    //response_502
+    ctx_->response.Init(srcDir, "/502.html", KeepAlive_(), 502);
+    MakeResponse_();
+    return true;
+}
+
+void HttpConn::Revalidate_(const std::string& key, HttpRequest request) {
+    request.HandleDynamic();
+    Buffer buff;
+    HttpResponse response;
+    response.Init(srcDir, request.GetPath().c_str(), false, 200);
+    response.MakeResponse(buff);
+    if (response.GetFile()) {
+        std::shared_ptr<CachedResponse> fresh = std::make_shared<CachedResponse>();
+        fresh->code = response.GetCode();
+        fresh->path.assign(response.GetPath().data(), response.GetPath().size());
+        fresh->body.assign(response.GetFile(), response.GetFileLen());
+        MicroCache::GetInstance()->Fill(key, std::move(fresh));
+    }
+    else {
+        MicroCache::GetInstance()->Abandon(key);
+    }
+}
+
+bool HttpConn::ProcessUpload_() {
+    ctx_->upload.Feed(readBuff_);
+    if (!ctx_->upload.IsFinish() && !ctx_->upload.IsError()) {
+        return false;
+    }
+    //上传的请求体接收计入解析阶段
+    ctx_->trace.parsed = HttpContext::Clock::now();
+    if (ctx_->upload.IsError()) {
+        //response_400，剩余请求体未读取，回复后关闭连接
+        ctx_->response.Init(srcDir, "/400.html", false, 400);
+    }
+    else {
+        char ip[INET_ADDRSTRLEN];
+        LOG_INFO("Upload from %s done, files: %d, fields: %d", GetIP(ip, sizeof(ip)),
+                 (int)ctx_->upload.GetFiles().size(), (int)ctx_->upload.GetFields().size());
+        ctx_->response.Init(srcDir, "/picture.html", KeepAlive_(), 200);
+        //重名时落盘的文件名与提交的不同，经响应头告知客户端
+        std::string savedNames;
+        for (const auto& name : ctx_->upload.GetFiles()) {
+            savedNames += savedNames.empty() ? name : ", " + name;
+        }
+        if (!savedNames.empty()) {
+            ctx_->response.AddHeader("X-Upload-Files", savedNames);
+        }
+    }
+    ctx_->upload.Reset();
+    MakeResponse_();
+    return true;
+}
+
+void HttpConn::SendContinue_() {
+    auto iter = ctx_->request.GetHeaders().find("Expect");
+    if (iter == ctx_->request.GetHeaders().end() || iter->second != "100-continue") {
+        return;
+    }
+    //尽力发送，失败时客户端超时后也会继续发送请求体
+    static const char CONTINUE[] = "HTTP/1.1 100 Continue\r\n\r\n";
+    int err = 0;
+    if (tls_.IsOpen()) {
+        tls_.Write(CONTINUE, sizeof(CONTINUE) - 1, &err);
+    }
+    else {
+        send(fd_, CONTINUE, sizeof(CONTINUE) - 1, MSG_NOSIGNAL);
+    }
+}
+
+void HttpConn::AcquireContext_() {
+    if (!ctx_) {
+        ctx_ = contextPool_.Acquire();
+    }
+    ctx_->BeginRequest();
+    ctx_->trace.accept = acceptTime_;
+    ctx_->trace.firstRead = readTime_;
+}
+
+void HttpConn::ReleaseContext_() {
+    if (ctx_) {
+        ctx_->Reset();
+        contextPool_.Release(ctx_);
+        ctx_ = nullptr;
+    }
+}
+
+bool HttpConn::KeepAlive_() const {
+    int keepAliveMax = RuntimeConfig::Get()->keepAliveMax;
+    //requestCount_不含本请求
+    return ctx_->request.IsKeepAlive() && (keepAliveMax <= 0 || requestCount_ + 1 < static_cast<unsigned>(keepAliveMax));
+}
+
+void HttpConn::MakeResponse_() {
+    ctx_->trace.ready = HttpContext::Clock::now();
+    //回填微缓存的响应须是完整的原始内容，不按客户端缓存回复304或压缩变体
+    if (!ctx_->isCacheLead) {
+        auto& headers = ctx_->request.GetHeaders();
+        auto etag = headers.find("If-None-Match");
+        auto encoding = headers.find("Accept-Encoding");
+        ctx_->response.SetConditional(etag != headers.end() ? etag->second.c_str() : nullptr,
+                                      encoding != headers.end() && strstr(encoding->second.c_str(), "gzip"));
+    }
+    ctx_->response.MakeResponse(writeBuff_);
+    ctx_->iov[0].iov_base = const_cast<char*>(writeBuff_.Peek());
+    ctx_->iov[0].iov_len = writeBuff_.ReadableBytes();
+    ctx_->iov[1].iov_len = 0;
+    ctx_->iovCnt = 1;
+
+    if(ctx_->response.GetFileLen() > 0 && ctx_->response.GetFile()) {
+        ctx_->iov[1].iov_base = ctx_->response.GetFile();
+        ctx_->iov[1].iov_len = ctx_->response.GetFileLen();
+        ctx_->iovCnt = 2;        
+    }
+}
+
+void HttpConn::FinishResponse() {
+    unsigned reuse = requestCount_++;
+    if (!ctx_) {
+        return;
+    }
+    ctx_->trace.lastWrite = HttpContext::Clock::now();
+    int status = ctx_->isProxy ? ctx_->proxy.GetStatus() : ctx_->response.GetCode();
+    uint64_t bytes = ctx_->sentBytes + (ctx_->isProxy ? ctx_->proxy.GetRelayedBytes() : 0);
+    char ip[INET_ADDRSTRLEN];
+    GetIP(ip, sizeof(ip));
+    RecordMetrics_(status, bytes);
+    RecordSlow_(status, bytes, reuse, ip);
+    LogAccess_(status, bytes, reuse, ip);
+}
+
+void HttpConn::RecordMetrics_(int status, uint64_t bytes) {
+    Metrics* metrics = Metrics::GetInstance();
+    if (!metrics->IsOpen()) {
+        return;
+    }
+    metrics->RecordResponse(status, bytes);
+    metrics->RecordLatency(Metrics::PARSE, RequestTrace::ElapsedUs(ctx_->trace.begin, ctx_->trace.parsed));
+    metrics->RecordLatency(Metrics::PROCESS, RequestTrace::ElapsedUs(ctx_->trace.parsed, ctx_->trace.ready));
+    metrics->RecordLatency(Metrics::WRITE, RequestTrace::ElapsedUs(ctx_->trace.ready, ctx_->trace.lastWrite));
+}
+
+void HttpConn::RecordSlow_(int status, uint64_t bytes, unsigned reuse, const char* ip) {
+    SlowLog* slowLog = SlowLog::GetInstance();
+    if (!slowLog->IsSlow(ctx_->trace)) {
+        return;
+    }
+    SlowRecord record;
+    record.trace = &ctx_->trace;
+    record.ip = ip;
+    record.method = ctx_->request.GetMethod().empty() ? "-" : ctx_->request.GetMethod().c_str();
+    record.target = ctx_->request.GetTarget().empty() ? "-" : ctx_->request.GetTarget().c_str();
+    record.status = status;
+    record.bytes = bytes;
+    record.reuse = reuse;
+    record.isProxy = ctx_->isProxy;
+    record.headers = &ctx_->request.GetHeaders();
+    slowLog->Add(record);
+}
+
+void HttpConn::LogAccess_(int status, uint64_t bytes, unsigned reuse, const char* ip) {
+    AccessLog* log = AccessLog::GetInstance();
+    if (!log->IsOpen() || !log->Sample(status)) {
+        return;
+    }
+    AccessRecord record;
+    record.ip = ip;
+    record.method = ctx_->request.GetMethod().empty() ? "-" : ctx_->request.GetMethod().c_str();
+    record.path = ctx_->request.GetTarget().empty() ? "-" : ctx_->request.GetTarget().c_str();
+    record.status = status;
+    record.bytes = bytes;
+    record.parseUs = RequestTrace::ElapsedUs(ctx_->trace.begin, ctx_->trace.parsed);
+    record.handleUs = RequestTrace::ElapsedUs(ctx_->trace.parsed, ctx_->trace.ready);
+    record.sendUs = RequestTrace::ElapsedUs(ctx_->trace.ready, ctx_->trace.lastWrite);
+    record.reuse = reuse;
+    record.isProxy = ctx_->isProxy;
+    log->Write(record);
+}
+
 ssize_t HttpConn::Read(int *saveErrno){
+    //明文上传直接从socket落盘，TLS上传先解密到readBuff_再由Process解析
+    if (ctx_ && ctx_->upload.IsActive() && !tls_.IsOpen()) {
+        return ctx_->upload.ReadFrom(fd_, readBuff_, saveErrno);
+    }
+    bool isEmpty = readBuff_.ReadableBytes() == 0;
     ssize_t len = -1;
-    do {
-        len = readBuff_.ReadFd(fd_, saveErrno);        
-        if (len <= 0) {
-            break;
-        }
-    } while(isET);
+    if (tls_.IsOpen()) {
+        len = tls_.Read(readBuff_, saveErrno);
+    }
+    else {
+        do {
+            len = readBuff_.ReadFd(fd_, saveErrno);        
+            if (len <= 0) {
+                break;
+            }
+        } while(isET);
+    }
+    //下一个请求的第一批字节到达
+    if (isEmpty && readBuff_.ReadableBytes() > 0) {
+        readTime_ = HttpContext::Clock::now();
+    }
     return len;
 }
 
 ssize_t HttpConn::Write(int *saveErrno){
+    assert(ctx_);
     ssize_t len = -1;
+    bool isFirstByte = ctx_->sentBytes == 0;
+    ++ctx_->trace.writes;
     do {
+        //响应头已写完，剩余为代理响应体
+        if (ctx_->iov[0].iov_len + ctx_->iov[1].iov_len == 0) break;
         //真正将响应报文写出的地方，从iov写到fd中
-        len = writev(fd_, iov_, iovCnt_);      
-        // size_t temp = iov_[1].iov_len;
+        len = tls_.IsOpen() ? tls_.Writev(ctx_->iov, ctx_->iovCnt, saveErrno) : writev(fd_, ctx_->iov, ctx_->iovCnt);
+        // size_t temp = ctx_->iov[1].iov_len;
         // printf("%ld\n", temp);
         if (len <= 0) {
             *saveErrno = errno;
             break;
         }
+        ctx_->sentBytes += len;
         //缓冲区写完
-        if (iov_[0].iov_len + iov_[1].iov_len == 0) break;
+        if (ctx_->iov[0].iov_len + ctx_->iov[1].iov_len == 0) break;
         //第一块缓冲区写完
-        else if (static_cast<size_t>(len) > iov_[0].iov_len) {
-            iov_[1].iov_base = (uint8_t*)iov_[1].iov_base + (len - iov_[0].iov_len);
-            iov_[1].iov_len -= (len - iov_[0].iov_len);
-            if(iov_[0].iov_len) {
+        else if (static_cast<size_t>(len) > ctx_->iov[0].iov_len) {
+            ctx_->iov[1].iov_base = (uint8_t*)ctx_->iov[1].iov_base + (len - ctx_->iov[0].iov_len);
+            ctx_->iov[1].iov_len -= (len - ctx_->iov[0].iov_len);
+            if(ctx_->iov[0].iov_len) {
                 writeBuff_.RetrieveAll();
-                iov_[0].iov_len = 0;
+                ctx_->iov[0].iov_len = 0;
             }
         }
         else {
-            iov_[0].iov_base = (uint8_t*)iov_[0].iov_base + len;
-            iov_[0].iov_len -= len;
+            ctx_->iov[0].iov_base = (uint8_t*)ctx_->iov[0].iov_base + len;
+            ctx_->iov[0].iov_len -= len;
             writeBuff_.Retrieve(len);
         }
     } while(isET || ToWriteBytes() > 10240);
+    if (isFirstByte && ctx_->sentBytes > 0) {
+        ctx_->trace.firstWrite = HttpContext::Clock::now();
+        //连接上的第一个响应
+        if (requestCount_ == 0) {
+            Metrics::GetInstance()->RecordLatency(Metrics::ACCEPT_TO_FIRST_BYTE,
+                                                  RequestTrace::ElapsedUs(ctx_->trace.accept, ctx_->trace.firstWrite));
+        }
+    }
+    if (ctx_->iov[0].iov_len + ctx_->iov[1].iov_len == 0 && ctx_->proxy.IsActive()) {
+        len = ctx_->proxy.Relay(fd_, tls_.IsOpen() ? &tls_ : nullptr, saveErrno);
+    }
     return len;
 }
 
@@ -0,0 +1,97 @@
+#ifndef HTTPCONTEXT_HPP
+#define HTTPCONTEXT_HPP
+
+#include <sys/uio.h>
+#include <string>
+#include <memory>
+#include <functional>
+#include <chrono>
+
+#include "../buffer/arena.hpp"
+#include "httprequest.hpp"
+#include "httpresponse.hpp"
+#include "../proxy/proxyrelay.hpp"
+#include "../cache/microcache.hpp"
+#include "../upload/multipartparser.hpp"
+#include "../metrics/requesttrace.hpp"
+
+/*
+    单个请求处理期间才需要的状态
+    连接收到请求时从对象池借出，响应发完回到空闲时归还，
+    空闲的长连接只保留fd、地址与收发缓冲（缓冲读空即不占内存块）
+    请求与响应的字符串、头部表从arena分配，每个请求开始时整体回收
+*/
+struct HttpContext {
+    typedef RequestTrace::Clock Clock;
+
+    HttpContext();
+
+    //先于request/response构造、后于其析构
+    Arena arena;
+    HttpRequest request;
+    HttpResponse response;
+
+    int iovCnt = 0;
+    struct iovec iov[2] = {};
+
+    //当前响应是否由上游代理产生
+    bool isProxy = false;
+    ProxyRelay proxy;
+
+    //进行中的multipart上传，跨多次读事件
+    MultipartParser upload;
+
+    bool isParked = false;
+    //挂起期间保存的后续处理，唤醒后在io执行器上从这里继续
+    std::function<bool()> then;
+    //AwaitFd_等待的fd超时未就绪
+    bool isWaitTimeout = false;
+    //db执行器满时已退避重试过一次
+    bool isDbRetried = false;
+    //本请求负责计算并回填微缓存
+    bool isCacheLead = false;
+    std::string cacheKey;
+    //命中的缓存响应，发送期间持有
+    std::shared_ptr<const CachedResponse> cached;
+
+    //各阶段时间点，以及writev已发出的字节数
+    RequestTrace trace;
+    size_t sentBytes = 0;
+    //查库请求首次发起的时间，查库完成时计入指标
+    bool isDbWait = false;
+    Clock::time_point dbWaitTime;
+
+    //同一连接上开始下一个请求，清空请求期状态并回收arena
+    void BeginRequest();
+    //归还对象池前清理，释放文件映射与上游连接
+    void Reset();
+};
+
+HttpContext::HttpContext() : request(&arena), response(&arena) {}
+
+void HttpContext::BeginRequest() {
+    request.Init();
+    response.Clear();
+    arena.Reset();
+    isProxy = false;
+    isParked = false;
+    then = nullptr;
+    isWaitTimeout = false;
+    isDbRetried = false;
+    isCacheLead = false;
+    cached.reset();
+    trace.Begin(Clock::now());
+    sentBytes = 0;
+    isDbWait = false;
+}
+
+void HttpContext::Reset() {
+    BeginRequest();
+    iovCnt = 0;
+    iov[0].iov_len = iov[1].iov_len = 0;
+    proxy.Abort();
+    upload.Reset();
+    cacheKey.clear();
+}
+
+#endif
@@ -5,13 +5,18 @@
 #include <unordered_map>
 #include <unordered_set>
 #include <algorithm>
-#include <regex>
+#include <functional>
+#include <memory>
 #include <errno.h>     
-#include <mysql/mysql.h>  //mysql
+#include <string.h>
+#include <strings.h>   // strcasecmp
+#include <ctype.h>
+#include <stdlib.h>
 
 #include "../buffer/buffer.hpp"
-#include "../pool/sqlconnpool.hpp"
-#include "../pool/sqlconnRAII.hpp"
+#include "../buffer/arena.hpp"
+#include "../upload/uploadstore.hpp"
+#include "../store/userstore.hpp"
 
 
 class HttpRequest {
@@ -36,39 +41,79 @@ public:
         REQUEST_FINISH
     };
 
-    HttpRequest();
+    //请求期间的字符串与表从arena分配，arena为空时使用堆
+    explicit HttpRequest(Arena* arena = nullptr);
     ~HttpRequest();
+    //清空请求，之后才能重置arena
     void Init();
+    //解析失败时GetErrorCode给出应回复的状态码
     bool ParseRequest(Buffer& buf);
+    //请求体按Content-Length尚未收全，之后的读入继续ParseRequest
+    bool IsBodyPending() const;
+    //400，chunked请求体为411，请求体超过MAX_BODY_LEN为413
+    int GetErrorCode() const;
     bool IsKeepAlive() const;
-
-    std::string GetPath() const;
-    std::string& GetPath();
-    std::string GetMethod() const;
-    std::string GetVersion() const;
+    //是否为需要查库的动态请求（登录/注册表单）
+    bool IsDynamic() const;
+    //执行动态请求，按结果改写path_
+    void HandleDynamic();
+    //非阻塞执行动态请求，改写path_后回调done；连接池须已开启非阻塞模式
+    void HandleDynamicAsync(std::function<void()> done);
+    //multipart上传请求，请求体留在缓冲区由MultipartParser流式处理
+    bool IsUpload() const;
+
+    const ArenaString& GetPath() const;
+    ArenaString& GetPath();
+    const ArenaString& GetMethod() const;
+    const ArenaString& GetVersion() const;
+    //请求行中的原始目标，未经ParsePath_改写
+    const ArenaString& GetTarget() const;
+    const ArenaString& GetBody() const;
+    const ArenaStringMap& GetHeaders() const;
     std::string GetPost(const std::string& key) const;
     std::string GetPost(const char* key) const;
 
 private:
-    bool ParseRequestLine_(const std::string& line);
-    void ParseRequestHeader_(const std::string& line);
-    void ParseRequestBody_(const std::string& line);
+    //行的范围为[begin, end)，不含CRLF
+    bool ParseRequestLine_(const char* begin, const char* end);
+    void ParseRequestHeader_(const char* begin, const char* end);
+    void ParseRequestBody_(const char* begin, const char* end);
+    //头部结束后按Content-Length确定请求体长度，不支持或过长时置errorCode_并返回false
+    bool ParseBodyLength_();
+    //分帧相关的头部按名称不区分大小写查找
+    const ArenaString* FindHeaderNoCase_(const char* name) const;
     void ParsePath_();
     void ParsePost_();
+    bool IsFormPost_() const;
+    bool IsMultipartUpload_() const;
     void ParseFromUrlencoded_();
-    bool UserVerify_(const std::string& user, const std::string& pw, bool isLogin);
+    //同名键覆盖
+    void SetField_(ArenaStringMap& fields, const char* key, size_t keyLen, const char* value, size_t valueLen);
+    ArenaAllocator<char> Alloc_() const;
+    //表单不全直接失败，其余交给用户数据后端
+    static bool UserVerify_(const char* user, const char* pw, bool isLogin);
+    //user、pw须在回调前保持有效（指向本请求arena中的表单字段）
+    static void UserVerifyAsync_(const char* user, const char* pw, bool isLogin, std::function<void(bool)> done);
     static int ConverHex(const char ch);        //十六转十进制
 
+    //非上传请求的请求体整体收在arena中，超过即拒绝
+    static const size_t MAX_BODY_LEN = 1 << 20;
+
 private:
     PARSE_STATE state_;
-    std::string method_, path_, version_, body_;
-    std::unordered_map<std::string, std::string> header_;
-    std::unordered_map<std::string, std::string> post_;                         //请求体账号密码等
+    bool isUpload_;
+    size_t contentLen_;
+    int errorCode_;
+    ArenaString method_, path_, version_, body_, target_;
+    ArenaStringMap header_;
+    ArenaStringMap post_;                         //请求体账号密码等
 
     static const std::unordered_set<std::string> DEFAULT_HTML_;
     static const std::unordered_map<std::string, int> DEFAULT_HTML_TAG_;
 };
 
+const size_t HttpRequest::MAX_BODY_LEN;
+
 const std::unordered_set<std::string> HttpRequest::DEFAULT_HTML_ {
     "/index", "/register", "/login", "/welcome", "/video", "/picture"
 };
@@ -77,21 +122,35 @@ const std::unordered_map<std::string, int> HttpRequest::DEFAULT_HTML_TAG_ {
     {"/register.html", 0}, {"/login.html", 1}
 };
 
-HttpRequest::HttpRequest() {
-    Init();
+HttpRequest::HttpRequest(Arena* arena)
+    : state_(REQUEST_LINE), isUpload_(false), contentLen_(0), errorCode_(400),
+      method_(ArenaAllocator<char>(arena)), path_(ArenaAllocator<char>(arena)),
+      version_(ArenaAllocator<char>(arena)), body_(ArenaAllocator<char>(arena)),
+      target_(ArenaAllocator<char>(arena)),
+      header_(ArenaStringMap::allocator_type(arena)), post_(ArenaStringMap::allocator_type(arena)) {
 }
 
 HttpRequest::~HttpRequest() {
 }
 
 void HttpRequest::Init() {
-    method_ = "";
-    path_ = "";
-    version_ = "";
-    body_ = "";
+    //与空对象交换而非clear：clear会保留arena上的容量与桶数组
+    ArenaAllocator<char> alloc = Alloc_();
+    ArenaString(alloc).swap(method_);
+    ArenaString(alloc).swap(path_);
+    ArenaString(alloc).swap(target_);
+    ArenaString(alloc).swap(version_);
+    ArenaString(alloc).swap(body_);
+    ArenaStringMap(ArenaStringMap::allocator_type(alloc)).swap(header_);
+    ArenaStringMap(ArenaStringMap::allocator_type(alloc)).swap(post_);
     state_ = REQUEST_LINE;
-    header_.clear();
-    post_.clear();    
+    isUpload_ = false;
+    contentLen_ = 0;
+    errorCode_ = 400;
+}
+
+ArenaAllocator<char> HttpRequest::Alloc_() const {
+    return method_.get_allocator();
 }
 
 bool HttpRequest::IsKeepAlive() const {
@@ -107,30 +166,49 @@ bool HttpRequest::ParseRequest(Buffer& buf) {
         return false;
     }
     while(buf.ReadableBytes() > 0 && state_ != REQUEST_FINISH) {
-        const char* lineEnd = std::search(buf.Peek(), buf.BeginWriteConst(), CRLF, CRLF + 2);
-        std::string line(buf.Peek(), lineEnd);
-//printf("%s: %d--%s\n", __FILE__ , __LINE__, line.c_str());
+        //请求体不按行解析：收满Content-Length才取出，剩余字节属于下一个请求
+        if (state_ == REQUEST_BODY) {
+            if (buf.ReadableBytes() >= contentLen_) {
+                ParseRequestBody_(buf.Peek(), buf.Peek() + contentLen_);
+                buf.Retrieve(contentLen_);
+            }
+            break;
+        }
+        const char* begin = buf.Peek();
+        const char* end = begin + buf.ReadableBytes();
+        const char* lineEnd = std::search(begin, end, CRLF, CRLF + 2);
         switch (state_)
         {
         case REQUEST_LINE:
-            if (ParseRequestLine_(line) == false) {
+            if (ParseRequestLine_(begin, lineEnd) == false) {
                 return false;
             }
             ParsePath_();
             break;
         case REQUEST_HEADER:
-            ParseRequestHeader_(line);
-            if (buf.ReadableBytes() <= 2) {
+            ParseRequestHeader_(begin, lineEnd);
+            //上传请求体不按行解析，头部结束即完成
+            if (state_ == REQUEST_BODY && IsMultipartUpload_()) {
+                isUpload_ = true;
+                state_ = REQUEST_FINISH;
+            }
+            else if (state_ == REQUEST_BODY) {
+                if (ParseBodyLength_() == false) {
+                    state_ = REQUEST_FINISH;
+                    return false;
+                }
+                if (contentLen_ == 0) {
+                    state_ = REQUEST_FINISH;
+                }
+            }
+            else if (buf.ReadableBytes() <= 2) {
                 state_ = REQUEST_FINISH;
             }
             break;     
-        case REQUEST_BODY:
-            ParseRequestBody_(line);
-            break;                              
         default:
             break;
         }
-        if (lineEnd == buf.BeginWrite()) {
+        if (lineEnd == end) {
             break;
         }
         buf.RetrieveUntil(lineEnd + 2);
@@ -138,17 +216,23 @@ bool HttpRequest::ParseRequest(Buffer& buf) {
     return true;
 }
 
-bool HttpRequest::ParseRequestLine_(const std::string &line) {
-    std::regex patten("^([^ ]*) ([^ ]*) HTTP/([^ ]*)$");
-    std::smatch regResult;
-    if (std::regex_match(line, regResult, patten)) {
-        method_ = regResult[1];
-        path_ = regResult[2];
-        version_ = regResult[3];
-        state_ = REQUEST_HEADER;
-        return true;
+bool HttpRequest::ParseRequestLine_(const char* begin, const char* end) {
+    //GET /index.html HTTP/1.1，三段均不含空格
+    const char* methodEnd = std::find(begin, end, ' ');
+    if (methodEnd == end) {
+        return false;
     }
-    return false;
+    const char* pathEnd = std::find(methodEnd + 1, end, ' ');
+    if (pathEnd == end || end - pathEnd < 6 || memcmp(pathEnd + 1, "HTTP/", 5) != 0 ||
+        std::find(pathEnd + 6, end, ' ') != end) {
+        return false;
+    }
+    method_.assign(begin, methodEnd);
+    path_.assign(methodEnd + 1, pathEnd);
+    target_ = path_;
+    version_.assign(pathEnd + 6, end);
+    state_ = REQUEST_HEADER;
+    return true;
 }
 
 void HttpRequest::ParsePath_() {
@@ -157,7 +241,7 @@ void HttpRequest::ParsePath_() {
     }
     else {
         for(auto& item : DEFAULT_HTML_) {
-            if(item == path_) {
+            if(path_ == item.c_str()) {
                 path_ += ".html";
                 break;
             }
@@ -165,69 +249,184 @@ void HttpRequest::ParsePath_() {
     }
 }
 
-void HttpRequest::ParseRequestHeader_(const std::string &line) {
-    std::regex patten("^([^:]*): ?(.*)$");
-    std::smatch regResult;
-    if (std::regex_match(line, regResult, patten)) {
-        header_[regResult[1]] = regResult[2];
-    }
-    else {
+void HttpRequest::ParseRequestHeader_(const char* begin, const char* end) {
+    //Name: value，冒号后至多跳过一个空格；没有冒号（空行）即头部结束
+    const char* colon = std::find(begin, end, ':');
+    if (colon == end) {
         state_ = REQUEST_BODY;
+        return;
+    }
+    const char* value = colon + 1;
+    if (value < end && *value == ' ') {
+        ++value;
     }
+    SetField_(header_, begin, colon - begin, value, end - value);
 }
 
-void HttpRequest::ParseRequestBody_(const std::string &line) {
-    body_ = line;
+bool HttpRequest::IsBodyPending() const {
+    return state_ == REQUEST_BODY;
+}
+
+int HttpRequest::GetErrorCode() const {
+    return errorCode_;
+}
+
+bool HttpRequest::ParseBodyLength_() {
+    contentLen_ = 0;
+    //chunked请求体无法预知长度，要求客户端改用Content-Length
+    if (FindHeaderNoCase_("Transfer-Encoding")) {
+        errorCode_ = 411;
+        return false;
+    }
+    const ArenaString* length = FindHeaderNoCase_("Content-Length");
+    if (!length) {
+        return true;
+    }
+    const char* value = length->c_str();
+    char* end = nullptr;
+    unsigned long long len = strtoull(value, &end, 10);
+    if (!isdigit(static_cast<unsigned char>(value[0])) || *end != '\0') {
+        errorCode_ = 400;
+        return false;
+    }
+    if (len > MAX_BODY_LEN) {
+        errorCode_ = 413;
+        return false;
+    }
+    contentLen_ = static_cast<size_t>(len);
+    return true;
+}
+
+const ArenaString* HttpRequest::FindHeaderNoCase_(const char* name) const {
+    for (const auto& header : header_) {
+        if (strcasecmp(header.first.c_str(), name) == 0) {
+            return &header.second;
+        }
+    }
+    return nullptr;
+}
+
+void HttpRequest::ParseRequestBody_(const char* begin, const char* end) {
+    body_.assign(begin, end);
     ParsePost_();
     state_ = REQUEST_FINISH;
 }
 
+void HttpRequest::SetField_(ArenaStringMap& fields, const char* key, size_t keyLen,
+                            const char* value, size_t valueLen) {
+    ArenaString name(key, keyLen, Alloc_());
+    auto iter = fields.find(name);
+    if (iter != fields.end()) {
+        iter->second.assign(value, valueLen);
+        return;
+    }
+    fields.emplace(std::move(name), ArenaString(value, valueLen, Alloc_()));
+}
+
 void HttpRequest::ParsePost_() {
-    if((method_ == "POST" || method_ == "post") && header_["Content-Type"] == "application/x-www-form-urlencoded") {
+    if(IsFormPost_()) {
         ParseFromUrlencoded_();
-        if(DEFAULT_HTML_TAG_.find(path_) != DEFAULT_HTML_TAG_.end()) {
-            int tag = DEFAULT_HTML_TAG_.find(path_)->second;
-            if(tag == 0 || tag == 1) {
-                bool isLogin = (tag == 1);
-                if(UserVerify_(post_["username"], post_["password"], isLogin)) {
-                    path_ = "/welcome.html";
-                }
-                else {
-                    path_ = "/error.html";
-                }
-            }
+    }
+}
+
+bool HttpRequest::IsFormPost_() const {
+    if(method_ != "POST" && method_ != "post") {
+        return false;
+    }
+    auto iter = header_.find("Content-Type");
+    return iter != header_.end() && iter->second == "application/x-www-form-urlencoded";
+}
+
+bool HttpRequest::IsDynamic() const {
+    return IsFormPost_() && DEFAULT_HTML_TAG_.find(path_.c_str()) != DEFAULT_HTML_TAG_.end();
+}
+
+bool HttpRequest::IsUpload() const {
+    return isUpload_;
+}
+
+bool HttpRequest::IsMultipartUpload_() const {
+    if(method_ != "POST" && method_ != "post") {
+        return false;
+    }
+    auto iter = header_.find("Content-Type");
+    return iter != header_.end() && iter->second.compare(0, 19, "multipart/form-data") == 0 &&
+           UploadStore::GetInstance()->IsUploadPath(target_.c_str());
+}
+
+void HttpRequest::HandleDynamic() {
+    if(!IsDynamic()) {
+        return;
+    }
+    int tag = DEFAULT_HTML_TAG_.find(path_.c_str())->second;
+    if(tag == 0 || tag == 1) {
+        bool isLogin = (tag == 1);
+        auto user = post_.find("username");
+        auto pw = post_.find("password");
+        if(UserVerify_(user != post_.end() ? user->second.c_str() : "",
+                       pw != post_.end() ? pw->second.c_str() : "", isLogin)) {
+            path_ = "/welcome.html";
+        }
+        else {
+            path_ = "/error.html";
         }
     }
 }
 
+void HttpRequest::HandleDynamicAsync(std::function<void()> done) {
+    if(!IsDynamic()) {
+        done();
+        return;
+    }
+    int tag = DEFAULT_HTML_TAG_.find(path_.c_str())->second;
+    if(tag != 0 && tag != 1) {
+        done();
+        return;
+    }
+    bool isLogin = (tag == 1);
+    auto user = post_.find("username");
+    auto pw = post_.find("password");
+    UserVerifyAsync_(user != post_.end() ? user->second.c_str() : "",
+                     pw != post_.end() ? pw->second.c_str() : "", isLogin, [this, done](bool isOk) {
+        if(isOk) {
+            path_ = "/welcome.html";
+        }
+        else {
+            path_ = "/error.html";
+        }
+        done();
+    });
+}
+
 void HttpRequest::ParseFromUrlencoded_() {
     if (body_.size() == 0) return;
-    std::string key, value;
+    //在副本上解码，body_保持原样（代理转发、微缓存键取原始请求体）
+    ArenaString body(body_.data(), body_.size(), Alloc_());
+    ArenaString key(Alloc_());
     int num = 0;
-    int len = body_.size();
+    int len = body.size();
     int rightPos = 0, leftPos = 0;
 
     for(; rightPos < len; ++rightPos) {
-        char ch = body_[rightPos];
+        char ch = body[rightPos];
         switch (ch)
         {
         case '=':
-            key = body_.substr(leftPos, rightPos - leftPos);
+            key.assign(body, leftPos, rightPos - leftPos);
             leftPos = rightPos + 1;
             break;
         case '+':
-            body_[rightPos] = ' ';
+            body[rightPos] = ' ';
             break;        
         case '%':
-            num = ConverHex(body_[rightPos + 1]) * 16 + ConverHex(body_[rightPos + 2]);
-            body_[rightPos + 2] = num % 10 + '0';
-            body_[rightPos + 1] = num / 10 + '0';
+            num = ConverHex(body[rightPos + 1]) * 16 + ConverHex(body[rightPos + 2]);
+            body[rightPos + 2] = num % 10 + '0';
+            body[rightPos + 1] = num / 10 + '0';
             rightPos += 2;
             break;
         case '&':
-            value = body_.substr(leftPos, rightPos - leftPos);
+            SetField_(post_, key.data(), key.size(), body.data() + leftPos, rightPos - leftPos);
             leftPos = rightPos + 1;
-            post_[key] = value;
             break;   
         default:
             break;
@@ -236,99 +435,67 @@ void HttpRequest::ParseFromUrlencoded_() {
     //处理最后一个键值表单字段
     assert(leftPos <= rightPos);
     if(post_.find(key) == post_.end() && leftPos <= rightPos) {
-        value = body_.substr(leftPos, rightPos - leftPos);
-        post_[key] = value;
+        SetField_(post_, key.data(), key.size(), body.data() + leftPos, rightPos - leftPos);
     }
 }
 
-int HttpRequest::ConverHex(const char ch) {
-    if(ch >= 'A' && ch <= 'Z') return ch - 'A' + 10;
-    if(ch >= 'a' && ch <= 'z') return ch - 'a' + 10;
-    return ch;
+bool HttpRequest::UserVerify_(const char* user, const char* pw, bool isLogin) {
+    if(*user == '\0' || *pw == '\0') return false;
+    return UserStore::GetInstance()->Verify(user, pw, isLogin);
 }
 
-bool HttpRequest::UserVerify_(const std::string &user, const std::string &pw, bool isLogin) {
-    if(user == "" || pw == "") return false;
-    MYSQL* sql = nullptr;
-    SqlConnRAII(&sql, SqlConnPool::GetInstance());
-    assert(sql);
-
-    bool flag = false;
-    //unsigned int fieldsNum = 0;
-    //MYSQL_FIELD *fields = nullptr;
-    char order[256] = { 0 };
-    MYSQL_RES *res = nullptr;
-    //todo
-    //存在sql注入问题
-    std::string selectStatement = "SELECT username, password FROM user WHERE username='%s' LIMIT 1";
-    std::string insertStatement = "INSERT INTO user(username, password) VALUES('%s','%s')";
-
-    if(!isLogin) flag = true;
-    snprintf(order, sizeof(order) / sizeof(order[0]), selectStatement.c_str(), user.c_str());
-    if (mysql_query(sql, order)) {
-        mysql_free_result(res);
-        return false;
-    }
-
-    res = mysql_store_result(sql);
-    //fieldsNum = mysql_num_fields(res);
-    //fields = mysql_fetch_field(res);
-
-    while (MYSQL_ROW row = mysql_fetch_row(res)) {
-        if(isLogin) {
-            std::string passwordInDB(row[1]);
-            if(passwordInDB == pw) {
-                flag = true;
-            }
-            else {
-                flag = false;
-            }
-        }
-    }
-    mysql_free_result(res);
-
-    if(!isLogin && flag == true) {
-        bzero(order, sizeof(order) / sizeof(order[0]));
-        snprintf(order, sizeof(order) / sizeof(order[0]), insertStatement.c_str(), user.c_str(), pw.c_str());
-        if (mysql_query(sql, order)) {
-            flag = false;
-        }
-        flag = true;
+void HttpRequest::UserVerifyAsync_(const char* user, const char* pw, bool isLogin, std::function<void(bool)> done) {
+    if(*user == '\0' || *pw == '\0') {
+        done(false);
+        return;
     }
-
-    SqlConnPool::GetInstance()->FreeSqlConn(sql);
-    return flag;
+    UserStore::GetInstance()->VerifyAsync(user, pw, isLogin, std::move(done));
 }
 
+int HttpRequest::ConverHex(const char ch) {
+    if(ch >= 'A' && ch <= 'Z') return ch - 'A' + 10;
+    if(ch >= 'a' && ch <= 'z') return ch - 'a' + 10;
+    return ch;
+}
 
-std::string HttpRequest::GetPath() const {
+const ArenaString& HttpRequest::GetPath() const {
     return path_;
 }
 
-std::string& HttpRequest::GetPath() {
+ArenaString& HttpRequest::GetPath() {
     return path_;
 }
 
-std::string HttpRequest::GetMethod() const {
+const ArenaString& HttpRequest::GetMethod() const {
     return method_;
 }
 
-std::string HttpRequest::GetVersion() const {
+const ArenaString& HttpRequest::GetVersion() const {
     return version_;
 }
 
+const ArenaString& HttpRequest::GetTarget() const {
+    return target_;
+}
+
+const ArenaString& HttpRequest::GetBody() const {
+    return body_;
+}
+
+const ArenaStringMap& HttpRequest::GetHeaders() const {
+    return header_;
+}
+
 std::string HttpRequest::GetPost(const std::string& key) const {
     assert(key != "");
-    if(post_.find(key) != post_.end()) {
-        return post_.find(key)->second;
-    }
-    return "";
+    return GetPost(key.c_str());
 }
 
 std::string HttpRequest::GetPost(const char* key) const {
     assert(key != nullptr);
-    if(post_.find(key) != post_.end()) {
-        return post_.find(key)->second;
+    auto iter = post_.find(key);
+    if(iter != post_.end()) {
+        return std::string(iter->second.data(), iter->second.size());
     }
     return "";
 }
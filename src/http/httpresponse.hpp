@@ -6,84 +6,117 @@
 #include <unistd.h>      // close
 #include <sys/stat.h>    // stat
 #include <sys/mman.h>    // mmap, munmap
+#include <stdio.h>       // snprintf
 
 #include "../buffer/buffer.hpp"
+#include "../buffer/arena.hpp"
+#include "mimetype.hpp"
+#include "assetbundle.hpp"
 
 class HttpResponse {
 public:
-    HttpResponse();
+    //路径字符串从arena分配，arena为空时使用堆
+    explicit HttpResponse(Arena* arena = nullptr);
     ~HttpResponse();
 
-    void Init(const std::string& srcDir, std::string& path, bool isKeepAlive = false, int code = -1);
+    //srcDir须在响应期间保持有效，path会被复制
+    void Init(const char* srcDir, const char* path, bool isKeepAlive = false, int code = -1);
+    //客户端缓存的ETag（If-None-Match）与是否接受gzip，资源包中的文件据此回复304或压缩变体
+    //ifNoneMatch须保持有效到MakeResponse
+    void SetConditional(const char* ifNoneMatch, bool isAcceptGzip);
+    //追加一个响应头，在Init之后、MakeResponse之前调用，value不能含CRLF
+    void AddHeader(const char* name, const std::string& value);
     void MakeResponse(Buffer& buff);
+    //响应体来自缓存，只组装响应头，响应体由调用方直接发送
+    void MakeCachedResponse(Buffer& buff, size_t bodyLen);
     void UnmapFile();
+    //解除映射并清空路径，之后才能重置arena
+    void Clear();
     char* GetFile();
     size_t GetFileLen() const;
     void ErrorContent(Buffer& buff, std::string msg);
     int GetCode() const;
+    bool IsKeepAlive() const;
+    const ArenaString& GetPath() const;
 
 private:
     void AddStateLine_(Buffer &buff);
     void AddHeader_(Buffer &buff);
     void AddContent_(Buffer &buff);
+    void AddContentLength_(Buffer &buff, size_t len);
+    //从资源包映射发送，不打开文件
+    void AddAssetContent_(Buffer &buff);
+    //在资源包中查找当前路径，找到时记入asset_
+    bool FindAsset_();
+    //If-None-Match为*或列出了将要回复的变体的ETag
+    bool IsNotModified_() const;
+    //回复资源包中的gzip变体
+    bool IsGzipVariant_() const;
+    //将要回复的变体的ETag写入buf（不以'\0'结尾），返回长度
+    size_t VariantEtag_(char* buf, size_t size) const;
 
+    //同时拼好文件的完整路径，避免每次stat/open都重新拼接
+    void SetPath_(const char* path);
     void GetErrorHtml_();
-    std::string GetFileType_();
+    const std::string& GetFileType_();
 
 private:
     int code_;
     bool isKeepAlive_;
-    std::string path_;
-    std::string srcDir_;
+    ArenaString path_;
+    ArenaString file_;          //srcDir_ + path_
+    ArenaString extraHeaders_;  //AddHeader追加的完整头部行
+    const char* srcDir_;
     char* mmFile_;              //内存映射文件句柄
     struct stat mmFileStat_;
+    //响应体来自资源包时mmFile_指向包的映射，不单独解除映射
+    bool isAsset_;
+    AssetBundle::Asset asset_;
+    const char* ifNoneMatch_;
+    bool isAcceptGzip_;
 
-    static const std::unordered_map<std::string, std::string> SUFFIX_TYPE;
+    //包中ETag加上变体后缀后的长度上限
+    static const size_t MAX_ETAG = 128;
     static const std::unordered_map<int, std::string> CODE_STATUS;
     static const std::unordered_map<int, std::string> CODE_PATH;
 };
 
-const std::unordered_map<std::string, std::string> HttpResponse::SUFFIX_TYPE = {
-    { ".html",  "text/html" },
-    { ".xml",   "text/xml" },
-    { ".xhtml", "application/xhtml+xml" },
-    { ".txt",   "text/plain" },
-    { ".rtf",   "application/rtf" },
-    { ".pdf",   "application/pdf" },
-    { ".word",  "application/nsword" },
-    { ".png",   "image/png" },
-    { ".gif",   "image/gif" },
-    { ".jpg",   "image/jpeg" },
-    { ".jpeg",  "image/jpeg" },
-    { ".au",    "audio/basic" },
-    { ".mpeg",  "video/mpeg" },
-    { ".mpg",   "video/mpeg" },
-    { ".avi",   "video/x-msvideo" },
-    { ".gz",    "application/x-gzip" },
-    { ".tar",   "application/x-tar" },
-    { ".css",   "text/css "},
-    { ".js",    "text/javascript "},
-};
+const size_t HttpResponse::MAX_ETAG;
 
 const std::unordered_map<int, std::string> HttpResponse::CODE_STATUS = {
     { 200, "OK" },
+    { 304, "Not Modified" },
     { 400, "Bad Request" },
     { 403, "Forbidden" },
     { 404, "Not Found" },
+    { 411, "Length Required" },
+    { 413, "Payload Too Large" },
+    { 502, "Bad Gateway" },
+    { 503, "Service Unavailable" },
 };
 
 const std::unordered_map<int, std::string> HttpResponse::CODE_PATH = {
     { 400, "/400.html" },
     { 403, "/403.html" },
     { 404, "/404.html" },
+    { 411, "/400.html" },
+    { 413, "/400.html" },
+    { 502, "/502.html" },
+    { 503, "/503.html" },
 };
 
-HttpResponse::HttpResponse() {
+HttpResponse::HttpResponse(Arena* arena)
+    : path_(ArenaAllocator<char>(arena)), file_(ArenaAllocator<char>(arena)),
+      extraHeaders_(ArenaAllocator<char>(arena)) {
     code_ = -1;
     isKeepAlive_ = false;
-    path_ = srcDir_ = "";
+    srcDir_ = "";
     mmFile_ = nullptr;
     mmFileStat_ = {0};
+    isAsset_ = false;
+    asset_ = {};
+    ifNoneMatch_ = nullptr;
+    isAcceptGzip_ = false;
 }
 
 HttpResponse::~HttpResponse() {
@@ -92,25 +125,64 @@ HttpResponse::~HttpResponse() {
 
 void HttpResponse::UnmapFile() {
     if (mmFile_) {
-        munmap(mmFile_, mmFileStat_.st_size);
+        if (!isAsset_) {
+            munmap(mmFile_, mmFileStat_.st_size);
+        }
         mmFile_ = nullptr;
     }
+    isAsset_ = false;
 }
 
-void HttpResponse::Init(const std::string &srcDir, std::string &path, bool isKeepAlive, int code) {
-    assert(srcDir != "");
+void HttpResponse::Clear() {
+    UnmapFile();
+    //与空串交换而非clear，不保留arena上的容量
+    ArenaString(path_.get_allocator()).swap(path_);
+    ArenaString(file_.get_allocator()).swap(file_);
+    ArenaString(extraHeaders_.get_allocator()).swap(extraHeaders_);
+    code_ = -1;
+}
+
+void HttpResponse::Init(const char* srcDir, const char* path, bool isKeepAlive, int code) {
+    assert(srcDir && *srcDir);
     if (mmFile_) {
         UnmapFile();
     }
     code_ = code;
     isKeepAlive_ = isKeepAlive;
-    path_ = path;
     srcDir_ = srcDir;
+    SetPath_(path);
+    extraHeaders_.clear();
     mmFileStat_ = {0};
+    ifNoneMatch_ = nullptr;
+    isAcceptGzip_ = false;
+}
+
+void HttpResponse::SetConditional(const char* ifNoneMatch, bool isAcceptGzip) {
+    ifNoneMatch_ = ifNoneMatch;
+    isAcceptGzip_ = isAcceptGzip;
+}
+
+void HttpResponse::AddHeader(const char* name, const std::string& value) {
+    extraHeaders_.append(name);
+    extraHeaders_.append(": ");
+    extraHeaders_.append(value.data(), value.size());
+    extraHeaders_.append("\r\n");
+}
+
+void HttpResponse::SetPath_(const char* path) {
+    path_.assign(path);
+    file_.assign(srcDir_);
+    file_.append(path_);
 }
 
 void HttpResponse::MakeResponse(Buffer &buff) {
-    if(stat((srcDir_ + path_).data(), &mmFileStat_) < 0 || S_ISDIR(mmFileStat_.st_mode)) {
+    //资源包中有的路径直接从映射发送；包中没有的仍读磁盘
+    if(FindAsset_()) {
+        if(code_ == -1) {
+            code_ = 200;
+        }
+    }
+    else if(stat(file_.c_str(), &mmFileStat_) < 0 || S_ISDIR(mmFileStat_.st_mode)) {
         code_ = 404;
     }
     else if(!(mmFileStat_.st_mode & S_IROTH)) {
@@ -120,29 +192,76 @@ void HttpResponse::MakeResponse(Buffer &buff) {
         code_ = 200;
     }
     GetErrorHtml_();
+    if(isAsset_ && code_ == 200 && IsNotModified_()) {
+        code_ = 304;
+    }
     AddStateLine_(buff);
     AddHeader_(buff);
-    AddContent_(buff);
+    if(isAsset_) {
+        AddAssetContent_(buff);
+    }
+    else {
+        AddContent_(buff);
+    }
+}
+
+void HttpResponse::MakeCachedResponse(Buffer &buff, size_t bodyLen) {
+    AddStateLine_(buff);
+    AddHeader_(buff);
+    AddContentLength_(buff, bodyLen);
 }
 
 void HttpResponse::GetErrorHtml_() {
-    if(CODE_PATH.find(code_) != CODE_PATH.end()) {
-        path_ = CODE_PATH.find(code_)->second;
-        stat((srcDir_ + path_).data(), &mmFileStat_);
+    auto iter = CODE_PATH.find(code_);
+    if(iter != CODE_PATH.end()) {
+        SetPath_(iter->second.c_str());
+        if(!FindAsset_()) {
+            stat(file_.c_str(), &mmFileStat_);
+        }
+    }
+}
+
+bool HttpResponse::FindAsset_() {
+    isAsset_ = AssetBundle::GetInstance()->Find(path_.data(), path_.size(), &asset_);
+    return isAsset_;
+}
+
+bool HttpResponse::IsNotModified_() const {
+    if(!ifNoneMatch_) {
+        return false;
+    }
+    //只认本次要回复的变体的ETag，另一变体的缓存不能用304续用
+    char etag[MAX_ETAG];
+    size_t len = VariantEtag_(etag, sizeof(etag));
+    return strcmp(ifNoneMatch_, "*") == 0 || memmem(ifNoneMatch_, strlen(ifNoneMatch_), etag, len) != nullptr;
+}
+
+bool HttpResponse::IsGzipVariant_() const {
+    return asset_.gzData && isAcceptGzip_;
+}
+
+size_t HttpResponse::VariantEtag_(char* buf, size_t size) const {
+    static const char GZIP_SUFFIX[] = "-gzip\"";
+    size_t len = std::min(asset_.etagLen, size);
+    memcpy(buf, asset_.etag, len);
+    //两种内容编码的响应体不同，强ETag也须不同：gzip变体在结尾引号前加-gzip
+    if(IsGzipVariant_() && len >= 2 && buf[len - 1] == '"' && len + sizeof(GZIP_SUFFIX) - 2 <= size) {
+        memcpy(buf + len - 1, GZIP_SUFFIX, sizeof(GZIP_SUFFIX) - 1);
+        len += sizeof(GZIP_SUFFIX) - 2;
     }
+    return len;
 }
 
 void HttpResponse::AddStateLine_(Buffer &buff) {
     //HTTP/1.1 200 OK
-    std::string status;
-    if(CODE_STATUS.find(code_) != CODE_STATUS.end()) {
-        status = CODE_STATUS.find(code_)->second;
-    }
-    else {
+    auto iter = CODE_STATUS.find(code_);
+    if(iter == CODE_STATUS.end()) {
         code_ = 400;
-        status = CODE_STATUS.find(400)->second;
+        iter = CODE_STATUS.find(400);
     }
-    buff.Append("HTTP/1.1 " + std::to_string(code_) + " " + status + "\r\n");
+    char line[64];
+    int len = snprintf(line, sizeof(line), "HTTP/1.1 %d %s\r\n", code_, iter->second.c_str());
+    buff.Append(line, len);
 }
     
 void HttpResponse::AddHeader_(Buffer &buff) {
@@ -154,25 +273,33 @@ void HttpResponse::AddHeader_(Buffer &buff) {
     else {
         buff.Append("close\r\n");
     }
-    buff.Append("Content-type: " + GetFileType_() + "\r\n");
-}
-
-std::string HttpResponse::GetFileType_() {
-    std::size_t fileIdx = path_.find_last_of('.');
-    if(fileIdx == std::string::npos) {
-        return "text/plain";
+    buff.Append("Content-type: ");
+    if(isAsset_) {
+        buff.Append(asset_.type, asset_.typeLen);
+    }
+    else {
+        buff.Append(GetFileType_());
     }
-    std::string suffix = path_.substr(fileIdx);
-    if(SUFFIX_TYPE.find(suffix) != SUFFIX_TYPE.end()) {
-        return SUFFIX_TYPE.find(suffix)->second;
+    buff.Append("\r\n");
+    if(!extraHeaders_.empty()) {
+        buff.Append(extraHeaders_.data(), extraHeaders_.size());
     }
-    return "text/plain";
+}
+
+const std::string& HttpResponse::GetFileType_() {
+    return MimeType::Get(path_.data(), path_.size());
+}
+
+void HttpResponse::AddContentLength_(Buffer &buff, size_t len) {
+    char line[64];
+    int n = snprintf(line, sizeof(line), "Content-length: %zu\r\n\r\n", len);
+    buff.Append(line, n);
 }
 
 void HttpResponse::AddContent_(Buffer &buff) {
     //响应资源文件
     //1、读取文件
-    int fileFd = open((srcDir_ + path_).data(), O_RDONLY);
+    int fileFd = open(file_.c_str(), O_RDONLY);
     if(fileFd < 0) {
         ErrorContent(buff, "File NotFound!");
         return;
@@ -188,7 +315,33 @@ void HttpResponse::AddContent_(Buffer &buff) {
     close(fileFd);
     
     //3、写入注意有空行
-    buff.Append("Content-length: " + std::to_string(mmFileStat_.st_size) + "\r\n\r\n");
+    AddContentLength_(buff, mmFileStat_.st_size);
+}
+
+void HttpResponse::AddAssetContent_(Buffer &buff) {
+    char etag[MAX_ETAG];
+    size_t etagLen = VariantEtag_(etag, sizeof(etag));
+    buff.Append("ETag: ");
+    buff.Append(etag, etagLen);
+    buff.Append("\r\n");
+    if(asset_.gzData) {
+        buff.Append("Vary: Accept-Encoding\r\n");
+    }
+    //304不带响应体
+    if(code_ == 304) {
+        buff.Append("\r\n");
+        return;
+    }
+    const char* body = asset_.data;
+    size_t len = asset_.len;
+    if(IsGzipVariant_()) {
+        body = asset_.gzData;
+        len = asset_.gzLen;
+        buff.Append("Content-Encoding: gzip\r\n");
+    }
+    mmFile_ = const_cast<char*>(body);
+    mmFileStat_.st_size = len;
+    AddContentLength_(buff, len);
 }
 
 void HttpResponse::ErrorContent(Buffer &buff, std::string msg) {
@@ -206,7 +359,7 @@ void HttpResponse::ErrorContent(Buffer &buff, std::string msg) {
     body += "<p>" + msg + "</p>";
     body += "<hr><em>TestServer</em></body></html>";
 
-    buff.Append("Content-length: " + std::to_string(body.size()) + "\r\n\r\n");
+    AddContentLength_(buff, body.size());
     buff.Append(body);
 }
 
@@ -218,4 +371,16 @@ size_t HttpResponse::GetFileLen() const {
     return mmFileStat_.st_size;
 }
 
+int HttpResponse::GetCode() const {
+    return code_;
+}
+
+bool HttpResponse::IsKeepAlive() const {
+    return isKeepAlive_;
+}
+
+const ArenaString& HttpResponse::GetPath() const {
+    return path_;
+}
+
 #endif
\ No newline at end of file
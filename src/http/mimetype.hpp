@@ -0,0 +1,58 @@
+#ifndef MIMETYPE_HPP
+#define MIMETYPE_HPP
+
+#include <string>
+#include <unordered_map>
+#include <stddef.h>
+
+//按文件后缀取Content-type，响应与资源打包工具共用
+class MimeType final {
+public:
+    //未知后缀返回text/plain
+    static const std::string& Get(const char* path, size_t len);
+
+private:
+    static const std::unordered_map<std::string, std::string> SUFFIX_TYPE;
+};
+
+const std::unordered_map<std::string, std::string> MimeType::SUFFIX_TYPE = {
+    { ".html",  "text/html" },
+    { ".xml",   "text/xml" },
+    { ".xhtml", "application/xhtml+xml" },
+    { ".txt",   "text/plain" },
+    { ".rtf",   "application/rtf" },
+    { ".pdf",   "application/pdf" },
+    { ".word",  "application/nsword" },
+    { ".png",   "image/png" },
+    { ".gif",   "image/gif" },
+    { ".jpg",   "image/jpeg" },
+    { ".jpeg",  "image/jpeg" },
+    { ".au",    "audio/basic" },
+    { ".mpeg",  "video/mpeg" },
+    { ".mpg",   "video/mpeg" },
+    { ".avi",   "video/x-msvideo" },
+    { ".gz",    "application/x-gzip" },
+    { ".tar",   "application/x-tar" },
+    { ".bin",   "application/octet-stream" },
+    { ".css",   "text/css "},
+    { ".js",    "text/javascript "},
+};
+
+const std::string& MimeType::Get(const char* path, size_t len) {
+    static const std::string DEFAULT_TYPE = "text/plain";
+    size_t dot = len;
+    while(dot > 0 && path[dot - 1] != '.' && path[dot - 1] != '/') {
+        --dot;
+    }
+    if(dot == 0 || path[dot - 1] != '.') {
+        return DEFAULT_TYPE;
+    }
+    //后缀都很短，临时串落在SSO内不分配
+    auto iter = SUFFIX_TYPE.find(std::string(path + dot - 1, len - dot + 1));
+    if(iter != SUFFIX_TYPE.end()) {
+        return iter->second;
+    }
+    return DEFAULT_TYPE;
+}
+
+#endif
@@ -0,0 +1,401 @@
+#ifndef ACCESSLOG_HPP
+#define ACCESSLOG_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include "logger.hpp"
+
+//一次请求的访问记录，字段在连接上采集，写入时才格式化
+struct AccessRecord {
+    const char* ip;
+    const char* method;
+    const char* path;
+    int status;
+    size_t bytes;
+    //各阶段耗时（微秒）：解析请求（含上传请求体）、处理（查库/缓存/代理上游）、发送响应
+    int64_t parseUs;
+    int64_t handleUs;
+    int64_t sendUs;
+    //本请求之前同一连接上已完成的请求数，0为新连接
+    unsigned reuse;
+    bool isProxy;
+};
+
+/*
+    访问日志：每个请求一行JSON，写入 path/access_yyyy_mm_dd.log，与运行日志分开
+    1、按状态码查表采样：sampleRate为默认采样率，statusRates可按状态类（"5xx"）或状态码（"404"）覆盖，
+       未覆盖时5xx总是记录；未采中的请求不格式化；采样表不可变，热加载时整表替换
+    2、业务线程在线程局部缓冲区格式化整行，持锁只做追加；攒满BATCH_SIZE交给写线程，
+       写线程每FLUSH_MS或有整批时批量写出
+    3、写线程跟不上、积压超过MAX_PENDING批时丢弃新行并计数，下一批写出时记一行提示
+*/
+class AccessLog final {
+public:
+    static AccessLog* GetInstance();
+
+    void Init(bool open, const char* path, double sampleRate, const std::map<std::string, double>& statusRates);
+    bool IsOpen() const;
+    //重建采样表并替换，可在运行中调用
+    void SetSampling(double sampleRate, const std::map<std::string, double>& statusRates);
+    //按状态码采样，决定本次请求是否记录
+    bool Sample(int status) const;
+    void Write(const AccessRecord& record);
+    //停止写线程并写完剩余记录
+    void Close();
+
+private:
+    static const int MAX_STATUS = 600;
+    static const size_t BATCH_SIZE = 64 * 1024;
+    static const size_t MAX_PENDING = 64;
+    static const int FLUSH_MS = 1000;
+    static const size_t LINE_SIZE = 4096;
+    //路径最多记录的字节数，超出截断
+    static const size_t MAX_PATH_LEN = 1024;
+    static const size_t TAIL_SIZE = 256;
+    //采样阈值的满刻度，32位随机数小于阈值即采中
+    static const uint64_t RATE_SCALE = 1ULL << 32;
+
+    //状态码 -> 采样阈值
+    struct SampleTable {
+        uint64_t thresholds[MAX_STATUS];
+    };
+
+    AccessLog() = default;
+    ~AccessLog();
+
+    //rate截断到[0, 1]后换算为采样阈值
+    static uint64_t Threshold_(double rate);
+    //线程局部的xorshift随机数
+    static uint32_t Random_();
+    //写入JSON字符串内容，转义引号、反斜杠与控制字符
+    static size_t AppendEscaped_(char* buf, size_t size, const char* str, size_t maxLen);
+    //按日期切换文件，只由写线程调用
+    void RollFile_();
+    void WriteLoop_();
+
+    std::atomic<bool> isOpen_{false};
+    std::string path_;
+    //当前采样表；替换下来的表不释放，采样时不加锁读取
+    std::atomic<const SampleTable*> table_{nullptr};
+    std::mutex tableMtx_;
+    std::vector<std::unique_ptr<const SampleTable>> tables_;
+
+    std::mutex mtx_;
+    std::condition_variable cond_;
+    std::string current_;
+    std::vector<std::string> full_;
+    std::vector<std::string> spares_;
+    size_t dropped_ = 0;
+    bool isClose_ = false;
+    std::unique_ptr<std::thread> writeThread_;
+
+    //只由写线程访问
+    FILE* file_ = nullptr;
+    int today_ = 0;
+};
+
+const int AccessLog::MAX_STATUS;
+const size_t AccessLog::BATCH_SIZE;
+const size_t AccessLog::MAX_PENDING;
+const int AccessLog::FLUSH_MS;
+const size_t AccessLog::LINE_SIZE;
+const size_t AccessLog::MAX_PATH_LEN;
+const size_t AccessLog::TAIL_SIZE;
+const uint64_t AccessLog::RATE_SCALE;
+
+AccessLog* AccessLog::GetInstance() {
+    static AccessLog log;
+    return &log;
+}
+
+AccessLog::~AccessLog() {
+    Close();
+}
+
+void AccessLog::Init(bool open, const char* path, double sampleRate, const std::map<std::string, double>& statusRates) {
+    assert(path);
+    if(!open || isOpen_) {
+        return;
+    }
+    path_ = path;
+    SetSampling(sampleRate, statusRates);
+
+    mkdir(path_.c_str(), 0777);
+    current_.reserve(BATCH_SIZE);
+    RollFile_();
+    if(!file_) {
+        LOG_ERROR("AccessLog open error in %s", path_.c_str());
+        return;
+    }
+    writeThread_.reset(new std::thread(&AccessLog::WriteLoop_, this));
+    pthread_setname_np(writeThread_->native_handle(), "accesslog");
+    isOpen_ = true;
+    LOG_INFO("AccessLog: %s, sampleRate: %.3f, statusRates: %zu", path_.c_str(), sampleRate, statusRates.size());
+}
+
+void AccessLog::SetSampling(double sampleRate, const std::map<std::string, double>& statusRates) {
+    std::unique_ptr<SampleTable> table(new SampleTable());
+    uint64_t* thresholds = table->thresholds;
+    uint64_t threshold = Threshold_(sampleRate);
+    for(int status = 0; status < MAX_STATUS; ++status) {
+        thresholds[status] = status >= 500 ? RATE_SCALE : threshold;
+    }
+    //先按状态类覆盖，再按具体状态码覆盖
+    for(int pass = 0; pass < 2; ++pass) {
+        for(const auto& item : statusRates) {
+            const std::string& key = item.first;
+            bool isClass = key.size() == 3 && key[0] >= '1' && key[0] <= '5' &&
+                           (key[1] == 'x' || key[1] == 'X') && (key[2] == 'x' || key[2] == 'X');
+            char* end = nullptr;
+            long code = strtol(key.c_str(), &end, 10);
+            bool isCode = !key.empty() && *end == '\0' && code >= 100 && code < MAX_STATUS;
+            if(!isClass && !isCode) {
+                if(pass == 0) {
+                    LOG_WARN("AccessLog unknown status key: %s", key.c_str());
+                }
+                continue;
+            }
+            if(pass == 0 && isClass) {
+                int begin = (key[0] - '0') * 100;
+                for(int status = begin; status < begin + 100; ++status) {
+                    thresholds[status] = Threshold_(item.second);
+                }
+            }
+            else if(pass == 1 && isCode) {
+                thresholds[code] = Threshold_(item.second);
+            }
+        }
+    }
+    std::lock_guard<std::mutex> locker(tableMtx_);
+    table_.store(table.get(), std::memory_order_release);
+    tables_.push_back(std::move(table));
+}
+
+bool AccessLog::IsOpen() const {
+    return isOpen_.load(std::memory_order_relaxed);
+}
+
+bool AccessLog::Sample(int status) const {
+    if(status < 0 || status >= MAX_STATUS) {
+        status = 0;
+    }
+    const SampleTable* table = table_.load(std::memory_order_acquire);
+    if(!table) {
+        return false;
+    }
+    uint64_t threshold = table->thresholds[status];
+    if(threshold >= RATE_SCALE) {
+        return true;
+    }
+    return threshold > 0 && Random_() < threshold;
+}
+
+void AccessLog::Write(const AccessRecord& record) {
+    if(!IsOpen()) {
+        return;
+    }
+    static thread_local char line[LINE_SIZE];
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    tm sysTime;
+    localtime_r(&now.tv_sec, &sysTime);
+    size_t len = snprintf(line, LINE_SIZE,
+                          "{\"time\":\"%04d-%02d-%02d %02d:%02d:%02d.%06ld\",\"ip\":\"%s\",\"method\":\"",
+                          sysTime.tm_year + 1900, sysTime.tm_mon + 1, sysTime.tm_mday,
+                          sysTime.tm_hour, sysTime.tm_min, sysTime.tm_sec, now.tv_nsec / 1000, record.ip);
+    len += AppendEscaped_(line + len, LINE_SIZE - len, record.method, 16);
+    len += snprintf(line + len, LINE_SIZE - len, "\",\"path\":\"");
+    //路径之后的字段不超过TAIL_SIZE字节
+    len += AppendEscaped_(line + len, LINE_SIZE - len - TAIL_SIZE, record.path, MAX_PATH_LEN);
+    len += snprintf(line + len, LINE_SIZE - len,
+                    "\",\"status\":%d,\"bytes\":%zu,\"parse_us\":%lld,\"handle_us\":%lld,\"send_us\":%lld,"
+                    "\"reuse\":%u,\"proxy\":%s}\n",
+                    record.status, record.bytes, static_cast<long long>(record.parseUs),
+                    static_cast<long long>(record.handleUs), static_cast<long long>(record.sendUs),
+                    record.reuse, record.isProxy ? "true" : "false");
+    if(len >= LINE_SIZE) {
+        return;
+    }
+
+    bool isBatch = false;
+    {
+        std::lock_guard<std::mutex> locker(mtx_);
+        if(current_.size() + len > BATCH_SIZE) {
+            if(full_.size() >= MAX_PENDING) {
+                ++dropped_;
+                return;
+            }
+            full_.push_back(std::move(current_));
+            if(!spares_.empty()) {
+                current_ = std::move(spares_.back());
+                spares_.pop_back();
+            }
+            else {
+                current_ = std::string();
+                current_.reserve(BATCH_SIZE);
+            }
+            isBatch = true;
+        }
+        current_.append(line, len);
+    }
+    if(isBatch) {
+        cond_.notify_one();
+    }
+}
+
+void AccessLog::Close() {
+    if(!writeThread_) {
+        return;
+    }
+    isOpen_ = false;
+    {
+        std::lock_guard<std::mutex> locker(mtx_);
+        isClose_ = true;
+    }
+    cond_.notify_one();
+    writeThread_->join();
+    writeThread_.reset();
+    if(file_) {
+        fclose(file_);
+        file_ = nullptr;
+    }
+}
+
+uint64_t AccessLog::Threshold_(double rate) {
+    if(!(rate > 0)) {
+        return 0;
+    }
+    if(rate >= 1) {
+        return RATE_SCALE;
+    }
+    return static_cast<uint64_t>(rate * static_cast<double>(RATE_SCALE));
+}
+
+uint32_t AccessLog::Random_() {
+    static thread_local uint64_t state = 0;
+    if(state == 0) {
+        state = static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count()) ^
+                reinterpret_cast<uintptr_t>(&state) ^ 0x9e3779b97f4a7c15ULL;
+    }
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return static_cast<uint32_t>(state >> 32);
+}
+
+size_t AccessLog::AppendEscaped_(char* buf, size_t size, const char* str, size_t maxLen) {
+    static const char HEX[] = "0123456789abcdef";
+    size_t len = 0;
+    if(!str) {
+        str = "";
+    }
+    //留出转义最长的6字节与结尾
+    for(size_t i = 0; str[i] && i < maxLen && len + 7 < size; ++i) {
+        unsigned char ch = static_cast<unsigned char>(str[i]);
+        if(ch == '"' || ch == '\\') {
+            buf[len++] = '\\';
+            buf[len++] = ch;
+        }
+        else if(ch < 0x20 || ch == 0x7f) {
+            buf[len++] = '\\';
+            buf[len++] = 'u';
+            buf[len++] = '0';
+            buf[len++] = '0';
+            buf[len++] = HEX[ch >> 4];
+            buf[len++] = HEX[ch & 0xf];
+        }
+        else {
+            buf[len++] = ch;
+        }
+    }
+    buf[len] = '\0';
+    return len;
+}
+
+void AccessLog::RollFile_() {
+    time_t timer = time(nullptr);
+    tm sysTime;
+    localtime_r(&timer, &sysTime);
+    if(file_ && today_ == sysTime.tm_mday) {
+        return;
+    }
+    char fileName[256];
+    snprintf(fileName, sizeof(fileName), "%s/access_%04d_%02d_%02d.log",
+             path_.c_str(), sysTime.tm_year + 1900, sysTime.tm_mon + 1, sysTime.tm_mday);
+    FILE* file = fopen(fileName, "a");
+    if(!file) {
+        return;
+    }
+    if(file_) {
+        fclose(file_);
+    }
+    file_ = file;
+    today_ = sysTime.tm_mday;
+}
+
+void AccessLog::WriteLoop_() {
+    std::vector<std::string> toWrite;
+    bool isClose = false;
+    while(!isClose) {
+        size_t dropped = 0;
+        {
+            std::unique_lock<std::mutex> locker(mtx_);
+            cond_.wait_for(locker, std::chrono::milliseconds(FLUSH_MS), [this]() {
+                return !full_.empty() || isClose_;
+            });
+            isClose = isClose_;
+            toWrite.swap(full_);
+            if(!current_.empty()) {
+                toWrite.push_back(std::move(current_));
+                current_ = std::string();
+                if(!spares_.empty()) {
+                    current_ = std::move(spares_.back());
+                    spares_.pop_back();
+                }
+            }
+            dropped = dropped_;
+            dropped_ = 0;
+        }
+        if(toWrite.empty() && dropped == 0) {
+            continue;
+        }
+
+        RollFile_();
+        for(const std::string& batch : toWrite) {
+            fwrite(batch.data(), 1, batch.size(), file_);
+        }
+        if(dropped > 0) {
+            fprintf(file_, "{\"dropped\":%zu}\n", dropped);
+        }
+        fflush(file_);
+
+        //留两块给前端复用
+        std::lock_guard<std::mutex> locker(mtx_);
+        for(std::string& batch : toWrite) {
+            if(spares_.size() >= 2) {
+                break;
+            }
+            batch.clear();
+            spares_.push_back(std::move(batch));
+        }
+        toWrite.clear();
+    }
+}
+
+#endif
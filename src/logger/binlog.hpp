@@ -0,0 +1,274 @@
+#ifndef BINLOG_HPP
+#define BINLOG_HPP
+
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <mutex>
+#include <deque>
+#include <string>
+#include <type_traits>
+#include <time.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/*
+    二进制日志：调用点的格式串只登记一次，热路径只拷贝格式id、TSC时间戳与原始参数，不做格式化
+    由logdecode离线还原成文本，日志写入与logdecode共用本文件中的格式定义
+    线程环形缓冲区中的记录：u32 总长 | u32 格式id | u64 tsc | 参数...
+        参数：u8 类型 + 数据；整数与浮点统一8字节，字符串拷贝内容（u32 长度 + 字节）
+    文件：魔数 | double 每纳秒tsc数 | 若干条目，条目首字节为类型
+        F 格式：u32 id | u8 等级 | u32 长度 | 格式串
+        T 线程：u32 序号 | u64 线程id | u32 长度 | 线程名
+        S 对时：u64 tsc | i64 unix纳秒
+        L 日志：u32 线程序号 | 记录
+        D 丢弃：u32 线程序号 | u64 条数
+    每个文件自带其中用到的格式与线程，可单独解码；整数按本机字节序
+*/
+class BinLog final {
+public:
+    static const char MAGIC[8];
+    static const size_t HEAD_LEN = 16;
+    //单个字符串参数最多保存的字节数
+    static const uint32_t MAX_STR_LEN = 4096;
+
+    enum ENTRY_TYPE : uint8_t {
+        ENTRY_FORMAT = 'F',
+        ENTRY_THREAD = 'T',
+        ENTRY_SYNC = 'S',
+        ENTRY_LOG = 'L',
+        ENTRY_DROP = 'D',
+    };
+
+    enum ARG_TYPE : uint8_t {
+        ARG_INT = 'i',
+        ARG_UINT = 'u',
+        ARG_DOUBLE = 'f',
+        ARG_STR = 's',
+        ARG_PTR = 'p',
+    };
+
+    //x86上为TSC，其他平台退回单调时钟纳秒
+    static uint64_t ReadTsc() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return static_cast<uint64_t>(now.tv_sec) * 1000000000ULL + now.tv_nsec;
+#endif
+    }
+
+    //调用点登记格式串，返回格式id；格式串须为字面量
+    static uint32_t Register(int level, const char* format);
+    static bool GetFormat(uint32_t id, int* level, const char** format);
+
+    //编码后参数的总字节数
+    static size_t ArgsSize() {
+        return 0;
+    }
+    template<class T, class... Rest>
+    static size_t ArgsSize(const T& arg, const Rest&... rest) {
+        return ArgSize_(arg) + ArgsSize(rest...);
+    }
+    //依次写入参数，返回写入后的位置
+    static char* PutArgs(char* p) {
+        return p;
+    }
+    template<class T, class... Rest>
+    static char* PutArgs(char* p, const T& arg, const Rest&... rest) {
+        return PutArgs(PutArg_(p, arg), rest...);
+    }
+    static char* PutHead(char* p, uint32_t len, uint32_t formatId, uint64_t tsc) {
+        memcpy(p, &len, 4);
+        memcpy(p + 4, &formatId, 4);
+        memcpy(p + 8, &tsc, 8);
+        return p + HEAD_LEN;
+    }
+
+private:
+    struct Format {
+        int level;
+        const char* format;
+    };
+
+    template<class T>
+    static typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value, size_t>::type
+    ArgSize_(const T&) {
+        return 9;
+    }
+    static size_t ArgSize_(double) {
+        return 9;
+    }
+    static size_t ArgSize_(const void*) {
+        return 9;
+    }
+    static size_t ArgSize_(const char* str) {
+        return 5 + StrLen_(str);
+    }
+
+    template<class T>
+    static typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value, char*>::type
+    PutArg_(char* p, const T& arg) {
+        if(std::is_signed<T>::value) {
+            int64_t value = static_cast<int64_t>(arg);
+            return PutValue_(p, ARG_INT, &value);
+        }
+        uint64_t value = static_cast<uint64_t>(arg);
+        return PutValue_(p, ARG_UINT, &value);
+    }
+    static char* PutArg_(char* p, double arg) {
+        return PutValue_(p, ARG_DOUBLE, &arg);
+    }
+    static char* PutArg_(char* p, const void* arg) {
+        uint64_t value = reinterpret_cast<uintptr_t>(arg);
+        return PutValue_(p, ARG_PTR, &value);
+    }
+    static char* PutArg_(char* p, const char* arg) {
+        uint32_t len = StrLen_(arg);
+        *p = ARG_STR;
+        memcpy(p + 1, &len, 4);
+        memcpy(p + 5, arg ? arg : "(null)", len);
+        return p + 5 + len;
+    }
+    static char* PutValue_(char* p, ARG_TYPE type, const void* value) {
+        *p = type;
+        memcpy(p + 1, value, 8);
+        return p + 9;
+    }
+    static uint32_t StrLen_(const char* str) {
+        if(!str) {
+            return 6;
+        }
+        size_t len = strnlen(str, MAX_STR_LEN);
+        return static_cast<uint32_t>(len);
+    }
+
+    //不析构：日志写线程在静态对象析构阶段仍要查格式
+    static std::mutex& FormatMtx_() {
+        static std::mutex* mtx = new std::mutex;
+        return *mtx;
+    }
+    static std::deque<Format>& Formats_() {
+        static std::deque<Format>* formats = new std::deque<Format>;
+        return *formats;
+    }
+};
+
+const char BinLog::MAGIC[8] = {'W', 'S', 'B', 'L', 'O', 'G', '0', '1'};
+const size_t BinLog::HEAD_LEN;
+const uint32_t BinLog::MAX_STR_LEN;
+
+uint32_t BinLog::Register(int level, const char* format) {
+    std::lock_guard<std::mutex> locker(FormatMtx_());
+    Formats_().push_back({level, format});
+    return static_cast<uint32_t>(Formats_().size() - 1);
+}
+
+bool BinLog::GetFormat(uint32_t id, int* level, const char** format) {
+    std::lock_guard<std::mutex> locker(FormatMtx_());
+    if(id >= Formats_().size()) {
+        return false;
+    }
+    *level = Formats_()[id].level;
+    *format = Formats_()[id].format;
+    return true;
+}
+
+/*
+    单生产者单消费者字节环：生产者为所属线程，消费者为日志写线程
+    写不下时丢弃并计数，不阻塞生产者
+*/
+class BinLogRing final {
+public:
+    BinLogRing(size_t capacity, uint32_t index, uint64_t threadId)
+        : data_(new char[capacity]), capacity_(capacity), index_(index), threadId_(threadId) {
+        //容量为2的幂，位置取模用掩码
+        assert(capacity > 0 && (capacity & (capacity - 1)) == 0);
+    }
+    BinLogRing(const BinLogRing&) = delete;
+    BinLogRing& operator=(const BinLogRing&) = delete;
+
+    //isHalfFull：本次写入使已用空间越过一半，应唤醒消费者
+    bool Push(const char* record, size_t len, bool* isHalfFull) {
+        uint64_t head = head_.load(std::memory_order_relaxed);
+        uint64_t tail = tail_.load(std::memory_order_acquire);
+        if(capacity_ - (head - tail) < len) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            *isHalfFull = false;
+            return false;
+        }
+        *isHalfFull = head - tail < capacity_ / 2 && head + len - tail >= capacity_ / 2;
+        size_t pos = head & (capacity_ - 1);
+        size_t first = std::min(len, capacity_ - pos);
+        memcpy(data_.get() + pos, record, first);
+        memcpy(data_.get(), record + first, len - first);
+        head_.store(head + len, std::memory_order_release);
+        return true;
+    }
+
+    //取出全部可读字节追加到out
+    void PopAll(std::string& out) {
+        uint64_t tail = tail_.load(std::memory_order_relaxed);
+        uint64_t head = head_.load(std::memory_order_acquire);
+        size_t len = head - tail;
+        size_t pos = tail & (capacity_ - 1);
+        size_t first = std::min(len, capacity_ - pos);
+        out.append(data_.get() + pos, first);
+        out.append(data_.get(), len - first);
+        tail_.store(head, std::memory_order_release);
+    }
+
+    uint64_t TakeDropped() {
+        return dropped_.exchange(0, std::memory_order_relaxed);
+    }
+    uint32_t GetIndex() const {
+        return index_;
+    }
+    uint64_t GetThreadId() const {
+        return threadId_;
+    }
+    void SetName(const char* name) {
+        std::lock_guard<std::mutex> locker(nameMtx_);
+        if(name_ != name) {
+            name_ = name;
+            ++nameVersion_;
+        }
+    }
+    //返回名称版本，名称变化后版本加一
+    uint32_t GetName(std::string& name) {
+        std::lock_guard<std::mutex> locker(nameMtx_);
+        name = name_;
+        return nameVersion_;
+    }
+    //所属线程退出，读空后可回收
+    void SetDead() {
+        isDead_.store(true, std::memory_order_release);
+    }
+    bool IsDead() const {
+        return isDead_.load(std::memory_order_acquire);
+    }
+
+    //生产者上次刷新线程名时的tsc
+    uint64_t nameTsc = 0;
+
+private:
+    std::unique_ptr<char[]> data_;
+    size_t capacity_;
+    uint32_t index_;
+    uint64_t threadId_;
+    std::atomic<uint64_t> head_{0};
+    std::atomic<uint64_t> tail_{0};
+    std::atomic<uint64_t> dropped_{0};
+    std::atomic<bool> isDead_{false};
+    std::mutex nameMtx_;
+    std::string name_;
+    uint32_t nameVersion_ = 0;
+};
+
+#endif
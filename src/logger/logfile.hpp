@@ -0,0 +1,425 @@
+#ifndef LOGFILE_HPP
+#define LOGFILE_HPP
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <condition_variable>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <zlib.h>
+
+/*
+    日志文件：O_APPEND打开，数据先进按页对齐的大缓冲区，满了整块write，不经过stdio
+    超过缓冲区大小的数据（异步日志整块写出的缓冲区）先写出已缓冲部分再直接写
+    写失败（如磁盘满）时丢弃本次数据，不重试不阻塞，每个文件只提示一次
+*/
+class LogFile final {
+public:
+    LogFile() : buff_(nullptr, free) {}
+    ~LogFile() {
+        Close();
+    }
+    LogFile(const LogFile&) = delete;
+    LogFile& operator=(const LogFile&) = delete;
+
+    bool Open(const char* fileName);
+    //写出缓冲区后关闭
+    void Close();
+    void Append(const char* data, size_t len);
+    void Flush();
+    bool IsOpen() const {
+        return fd_ >= 0;
+    }
+    //文件大小，含未写出的缓冲
+    size_t GetSize() const {
+        return size_;
+    }
+    const std::string& GetName() const {
+        return name_;
+    }
+
+private:
+    static const size_t BUFFER_SIZE = 256 * 1024;
+    static const size_t ALIGN = 4096;
+
+    void WriteFd_(const char* data, size_t len);
+
+    int fd_ = -1;
+    std::string name_;
+    std::unique_ptr<char, void(*)(void*)> buff_;
+    size_t len_ = 0;
+    size_t size_ = 0;
+    bool isErrorReported_ = false;
+};
+
+const size_t LogFile::BUFFER_SIZE;
+const size_t LogFile::ALIGN;
+
+bool LogFile::Open(const char* fileName) {
+    Close();
+    if(!buff_) {
+        void* buff = nullptr;
+        if(posix_memalign(&buff, ALIGN, BUFFER_SIZE) != 0) {
+            return false;
+        }
+        buff_.reset(static_cast<char*>(buff));
+    }
+    fd_ = open(fileName, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(fd_ < 0) {
+        fprintf(stderr, "Logger open %s error: %s\n", fileName, strerror(errno));
+        return false;
+    }
+    struct stat st;
+    size_ = fstat(fd_, &st) == 0 ? static_cast<size_t>(st.st_size) : 0;
+    name_ = fileName;
+    len_ = 0;
+    isErrorReported_ = false;
+    return true;
+}
+
+void LogFile::Close() {
+    if(fd_ < 0) {
+        return;
+    }
+    Flush();
+    close(fd_);
+    fd_ = -1;
+}
+
+void LogFile::Append(const char* data, size_t len) {
+    if(fd_ < 0) {
+        return;
+    }
+    size_ += len;
+    if(len_ + len <= BUFFER_SIZE) {
+        memcpy(buff_.get() + len_, data, len);
+        len_ += len;
+        return;
+    }
+    Flush();
+    if(len >= BUFFER_SIZE) {
+        WriteFd_(data, len);
+        return;
+    }
+    memcpy(buff_.get(), data, len);
+    len_ = len;
+}
+
+void LogFile::Flush() {
+    if(fd_ < 0 || len_ == 0) {
+        return;
+    }
+    WriteFd_(buff_.get(), len_);
+    len_ = 0;
+}
+
+void LogFile::WriteFd_(const char* data, size_t len) {
+    while(len > 0) {
+        ssize_t n = write(fd_, data, len);
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n <= 0) {
+            if(!isErrorReported_) {
+                fprintf(stderr, "Logger write %s error: %s, %zu bytes dropped\n",
+                        name_.c_str(), n < 0 ? strerror(errno) : "no progress", len);
+                isErrorReported_ = true;
+            }
+            size_ -= std::min(size_, len);
+            return;
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+/*
+    已切换下来的日志文件的后台整理，不占写日志的线程
+    1、压缩：gzip为 原文件名.gz（先写 .gz.tmp 再rename），保留原文件的修改时间，完成后删除原文件
+    2、保留：按修改时间从旧到新，删除超过maxAgeDays天的，再删到不超过maxFiles个、总大小不超过maxTotalBytes
+    只处理本日志目录下 yyyy_mm_dd[-n]后缀[.gz] 形式的文件，正在写入的文件不压缩不删除
+    文件切换时唤醒，另外每SWEEP_MS整理一次使按天数的保留及时生效
+*/
+class LogArchiver final {
+public:
+    LogArchiver(const std::string& dir, const std::string& suffix);
+    ~LogArchiver();
+    LogArchiver(const LogArchiver&) = delete;
+    LogArchiver& operator=(const LogArchiver&) = delete;
+
+    //各项为0表示不限制
+    void Configure(bool compress, int maxFiles, int maxAgeDays, size_t maxTotalBytes);
+    void SetActive(const std::string& fileName);
+    void Notify();
+
+private:
+    static const int SWEEP_MS = 3600 * 1000;
+    static const size_t CHUNK_SIZE = 256 * 1024;
+
+    struct Entry {
+        std::string path;
+        timespec mtime;
+        size_t size;
+        bool isCompressed;
+    };
+
+    void Loop_();
+    void Sweep_();
+    bool IsLogFile_(const char* name, bool* isCompressed) const;
+    //压缩成功时更新entry为压缩后的文件
+    bool Compress_(Entry& entry);
+
+    std::string dir_;
+    std::string suffix_;
+
+    std::mutex mtx_;
+    std::condition_variable cond_;
+    bool isCompress_ = false;
+    int maxFiles_ = 0;
+    int maxAgeDays_ = 0;
+    size_t maxTotalBytes_ = 0;
+    std::string active_;
+    bool isPending_ = false;
+    bool isClose_ = false;
+    std::thread thread_;
+};
+
+const int LogArchiver::SWEEP_MS;
+const size_t LogArchiver::CHUNK_SIZE;
+
+LogArchiver::LogArchiver(const std::string& dir, const std::string& suffix)
+    : dir_(dir), suffix_(suffix) {
+    thread_ = std::thread(&LogArchiver::Loop_, this);
+    pthread_setname_np(thread_.native_handle(), "logarchive");
+}
+
+LogArchiver::~LogArchiver() {
+    {
+        std::lock_guard<std::mutex> locker(mtx_);
+        isClose_ = true;
+    }
+    cond_.notify_one();
+    thread_.join();
+}
+
+void LogArchiver::Configure(bool compress, int maxFiles, int maxAgeDays, size_t maxTotalBytes) {
+    {
+        std::lock_guard<std::mutex> locker(mtx_);
+        isCompress_ = compress;
+        maxFiles_ = std::max(maxFiles, 0);
+        maxAgeDays_ = std::max(maxAgeDays, 0);
+        maxTotalBytes_ = maxTotalBytes;
+        isPending_ = true;
+    }
+    cond_.notify_one();
+}
+
+void LogArchiver::SetActive(const std::string& fileName) {
+    std::lock_guard<std::mutex> locker(mtx_);
+    active_ = fileName;
+}
+
+void LogArchiver::Notify() {
+    {
+        std::lock_guard<std::mutex> locker(mtx_);
+        isPending_ = true;
+    }
+    cond_.notify_one();
+}
+
+void LogArchiver::Loop_() {
+    while(true) {
+        {
+            std::unique_lock<std::mutex> locker(mtx_);
+            cond_.wait_for(locker, std::chrono::milliseconds(SWEEP_MS), [this]() {
+                return isPending_ || isClose_;
+            });
+            if(isClose_) {
+                return;
+            }
+            isPending_ = false;
+        }
+        Sweep_();
+    }
+}
+
+bool LogArchiver::IsLogFile_(const char* name, bool* isCompressed) const {
+    //yyyy_mm_dd
+    for(int i = 0; i < 10; ++i) {
+        bool isSep = i == 4 || i == 7;
+        if(isSep ? name[i] != '_' : (name[i] < '0' || name[i] > '9')) {
+            return false;
+        }
+    }
+    const char* p = name + 10;
+    if(*p == '-') {
+        ++p;
+        if(*p < '0' || *p > '9') {
+            return false;
+        }
+        while(*p >= '0' && *p <= '9') {
+            ++p;
+        }
+    }
+    if(strncmp(p, suffix_.c_str(), suffix_.size()) != 0) {
+        return false;
+    }
+    p += suffix_.size();
+    *isCompressed = strcmp(p, ".gz") == 0;
+    return *p == '\0' || *isCompressed;
+}
+
+void LogArchiver::Sweep_() {
+    bool isCompress;
+    int maxFiles, maxAgeDays;
+    size_t maxTotalBytes;
+    std::string active;
+    {
+        std::lock_guard<std::mutex> locker(mtx_);
+        isCompress = isCompress_;
+        maxFiles = maxFiles_;
+        maxAgeDays = maxAgeDays_;
+        maxTotalBytes = maxTotalBytes_;
+        active = active_;
+    }
+    if(!isCompress && maxFiles == 0 && maxAgeDays == 0 && maxTotalBytes == 0) {
+        return;
+    }
+    DIR* dir = opendir(dir_.c_str());
+    if(!dir) {
+        return;
+    }
+    std::vector<Entry> entries;
+    size_t activeSize = 0;
+    while(dirent* item = readdir(dir)) {
+        bool isCompressed = false;
+        if(!IsLogFile_(item->d_name, &isCompressed)) {
+            continue;
+        }
+        Entry entry;
+        entry.path = dir_ + "/" + item->d_name;
+        struct stat st;
+        if(stat(entry.path.c_str(), &st) < 0 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        if(entry.path == active) {
+            activeSize = st.st_size;
+            continue;
+        }
+        entry.mtime = st.st_mtim;
+        entry.size = st.st_size;
+        entry.isCompressed = isCompressed;
+        entries.push_back(std::move(entry));
+    }
+    closedir(dir);
+
+    if(isCompress) {
+        for(Entry& entry : entries) {
+            if(!entry.isCompressed) {
+                Compress_(entry);
+            }
+        }
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+        if(a.mtime.tv_sec != b.mtime.tv_sec) {
+            return a.mtime.tv_sec < b.mtime.tv_sec;
+        }
+        return a.mtime.tv_nsec < b.mtime.tv_nsec;
+    });
+    size_t total = activeSize;
+    for(const Entry& entry : entries) {
+        total += entry.size;
+    }
+    time_t expire = time(nullptr) - static_cast<time_t>(maxAgeDays) * 86400;
+    size_t count = entries.size();
+    for(const Entry& entry : entries) {
+        bool isExpired = maxAgeDays > 0 && entry.mtime.tv_sec < expire;
+        bool isOverCount = maxFiles > 0 && count > static_cast<size_t>(maxFiles);
+        bool isOverSize = maxTotalBytes > 0 && total > maxTotalBytes;
+        if(!isExpired && !isOverCount && !isOverSize) {
+            break;
+        }
+        if(unlink(entry.path.c_str()) < 0 && errno != ENOENT) {
+            fprintf(stderr, "Logger remove %s error: %s\n", entry.path.c_str(), strerror(errno));
+            continue;
+        }
+        --count;
+        total -= entry.size;
+    }
+}
+
+bool LogArchiver::Compress_(Entry& entry) {
+    std::string target = entry.path + ".gz";
+    std::string tmp = target + ".tmp";
+    int fd = open(entry.path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        return false;
+    }
+    gzFile gz = gzopen(tmp.c_str(), "wb6");
+    if(!gz) {
+        close(fd);
+        return false;
+    }
+    std::unique_ptr<char[]> chunk(new char[CHUNK_SIZE]);
+    bool isOk = true;
+    ssize_t n;
+    while((n = read(fd, chunk.get(), CHUNK_SIZE)) > 0) {
+        if(gzwrite(gz, chunk.get(), static_cast<unsigned>(n)) != n) {
+            isOk = false;
+            break;
+        }
+    }
+    isOk = n == 0 && isOk;
+    close(fd);
+    isOk = gzclose(gz) == Z_OK && isOk;
+    //同名.gz已存在时（重启后沿用了旧序号）追加为新的gzip成员，gunzip读出的是两段的拼接
+    if(isOk) {
+        struct stat st;
+        if(stat(target.c_str(), &st) == 0) {
+            int out = open(target.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+            int in = open(tmp.c_str(), O_RDONLY | O_CLOEXEC);
+            isOk = out >= 0 && in >= 0;
+            while(isOk && (n = read(in, chunk.get(), CHUNK_SIZE)) > 0) {
+                isOk = write(out, chunk.get(), n) == n;
+            }
+            isOk = isOk && n == 0;
+            if(out >= 0) close(out);
+            if(in >= 0) close(in);
+            unlink(tmp.c_str());
+        }
+        else {
+            isOk = rename(tmp.c_str(), target.c_str()) == 0;
+        }
+    }
+    if(!isOk) {
+        fprintf(stderr, "Logger compress %s error: %s\n", entry.path.c_str(), strerror(errno));
+        unlink(tmp.c_str());
+        return false;
+    }
+    //按原文件的时间参与保留排序
+    timespec times[2] = {entry.mtime, entry.mtime};
+    utimensat(AT_FDCWD, target.c_str(), times, 0);
+    unlink(entry.path.c_str());
+    struct stat st;
+    entry.size = stat(target.c_str(), &st) == 0 ? static_cast<size_t>(st.st_size) : 0;
+    entry.path = target;
+    entry.isCompressed = true;
+    return true;
+}
+
+#endif
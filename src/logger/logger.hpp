@@ -2,84 +2,218 @@
 #define LOGGER_HPP
 
 #include <memory>
+#include <vector>
+#include <string>
+#include <unordered_map>
 #include <string.h>
-#include <queue>
 #include <thread>
 #include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <pthread.h>
+#include <time.h>
 #include <sys/time.h>
 #include <sys/stat.h>
+#include <dirent.h>
+#include <stdio.h>
 #include <stdarg.h>
-
-#include "../buffer/buffer.hpp"
-#include "blockdeque.hpp"
-
-// class ThreadAttr {
-// public:
-//     ThreadAttr() = default;
-
-//     ThreadAttr(pthread_t id, char* name) {
-//         threadId = id;
-//         memcpy(threadName, name, 64);
-//     }
-
-//     pthread_t getThreadId() {return threadId;}
-//     char* getThreadName() {return threadName;}
-
-// private:
-//     pthread_t threadId;
-//     char threadName[64];
-// };
-
+#include <assert.h>
+
+#include "binlog.hpp"
+#include "logfile.hpp"
+
+/*
+    双缓冲异步日志（maxQueueSize > 0）
+    1、各线程在线程局部暂存区格式化整行，时间前缀与线程名按秒缓存，不再逐行localtime、取线程名
+    2、整行拷入共享的当前缓冲区，只在拷贝时持锁；写满即换入空闲缓冲区并唤醒写线程
+    3、写线程满一块或每FLUSH_MS取走全部缓冲区，锁外经LogFile批量写出
+    4、写线程跟不上、积压超过MAX_PENDING块时丢弃多出的部分并记一行提示，不阻塞业务线程
+    5、跨日或文件将超过maxFileMb时由写线程切换到下一个分文件，切下来的文件交给LogArchiver在后台压缩与按保留策略删除
+    maxQueueSize <= 0 时同步写，每行直接写入并刷盘，切换文件在写入方完成
+    二进制模式（isBinary）：各线程把格式id与原始参数写入自己的环形缓冲区，写线程每BINARY_DRAIN_MS或有环过半时收集、
+    按时间排序后写入.blog文件，由logdecode还原成文本；环满时丢弃并在文件中记下丢弃条数
+*/
 class Logger {
 public:
     static Logger* GetInstance();
-    //异步写
-    static void FlushLogThread();
 
-    void Init(int level = 1, const char* path = "./log", const char* suffix = ".log", int maxQueueSize = 1024);
-    //根据异步开关将队列刷进缓存/文件
+    //只需调用一次，重复调用只更新日志等级
+    void Init(int level = 1, const char* path = "./log", const char* suffix = ".log", int maxQueueSize = 1024,
+              bool isBinary = false);
+    //按大小切分文件，以及切下来的文件的压缩与保留，各项为0表示不限制；可在Init前后调用
+    void SetRotation(int maxFileMb, bool compress, int maxFiles, int maxAgeDays, int maxTotalMb);
+    //异步时唤醒写线程立即落盘，同步时刷新文件缓冲
     void Flush();
     void Write(int level, pthread_t threadId, const char* format, ...);
+    //二进制模式下由LOG_*调用，formatId为调用点登记的格式
+    template<class... Args>
+    void WriteBinary(uint32_t formatId, const Args&... args);
+    bool IsBinary() const;
     int GetLevel();
     void SetLevel(int level);
-    bool GetIsOpen(); 
+    bool GetIsOpen();
 
 private:
+    static const int LOG_PATH_LEN = 256;
+    static const int LOG_NAME_LEN = 256;
+    //未配置时单个文件的大小上限
+    static const int DEFAULT_MAX_FILE_MB = 64;
+    static const int LINE_SIZE = 4096;
+    static const size_t BUFFER_SIZE = 1024 * 1024;
+    static const size_t MAX_PENDING = 16;
+    static const int FLUSH_MS = 1000;
+    static const int BINARY_DRAIN_MS = 50;
+    static const size_t RING_SIZE = 512 * 1024;
+
+    //定长的日志缓冲区，只追加整行
+    class LogBuffer final {
+    public:
+        LogBuffer() : data_(new char[BUFFER_SIZE]), len_(0), lines_(0) {}
+
+        size_t Avail() const {return BUFFER_SIZE - len_;}
+        size_t Length() const {return len_;}
+        int Lines() const {return lines_;}
+        const char* Data() const {return data_.get();}
+        void Append(const char* line, size_t len) {
+            memcpy(data_.get() + len_, line, len);
+            len_ += len;
+            ++lines_;
+        }
+        void Reset() {len_ = 0; lines_ = 0;}
+
+    private:
+        std::unique_ptr<char[]> data_;
+        size_t len_;
+        int lines_;
+    };
+    typedef std::unique_ptr<LogBuffer> BufferPtr;
+
+    //线程退出时标记其环形缓冲区，写线程读空后回收
+    struct RingHolder {
+        std::shared_ptr<BinLogRing> ring;
+        ~RingHolder() {
+            if(ring) {
+                ring->SetDead();
+            }
+        }
+    };
+
+    //一次收集到的日志记录，按tsc排序后写出
+    struct BinaryEntry {
+        uint64_t tsc;
+        uint32_t ringIndex;
+        size_t offset;
+        uint32_t len;
+    };
+
+    //线程局部的格式化暂存区
+    struct LogStage {
+        time_t second = -1;
+        //"yyyy-mm-dd hh:mm:ss."
+        char timePrefix[32];
+        int timeLen = 0;
+        //"[线程名\t-线程id] "
+        char threadAttr[64];
+        int threadLen = 0;
+        char line[LINE_SIZE];
+    };
+
     Logger();
     virtual ~Logger();
-    void AppendLogLevelTitle_(int level);
-    void AppendThreadAttr_(pthread_t threadId);
-    void AsyncWrite_();
+    static LogStage& Stage_();
+    //秒数变化时重算时间前缀，同时刷新线程名（线程启动后才改名的情况）
+    static void RefreshStage_(LogStage& stage, time_t second, pthread_t threadId);
+    static const char* LevelTitle_(int level);
+    void Append_(const char* line, size_t len);
+    //当前线程的环形缓冲区，首次使用时创建并登记
+    BinLogRing* Ring_();
+    void RefreshRingName_(BinLogRing* ring, uint64_t tsc);
+    void WriteLoop_();
+    void BinaryLoop_();
+    //收集各环中的记录，写出本批用到而本文件还没有的格式与线程，再按时间顺序写出记录
+    void DrainRings_(std::string& data, std::vector<BinaryEntry>& entries, std::string& out);
+    //打开日志文件，二进制模式写入文件头并重置本文件已写出的格式与线程
+    void OpenFile_(const char* fileName);
+    //跨日或写入bytes字节后将超过大小上限时切换日志文件
+    void RollFile_(size_t bytes);
+    //当天第index个分文件的文件名，0为不带序号的首个文件
+    void FileName_(char* fileName, const tm& sysTime, int index) const;
+    //重启时接着当天已有的最后一个分文件写，已压缩的跳过
+    int FindTodayIndex_(const tm& sysTime) const;
 
 private:
-    static const int LOG_PATH_LEN = 256;
-    static const int LOG_NAME_LEN = 256;
-    static const int MAX_LINE = 50000;
-
     bool isOpen_;
     bool isAsync_;
+    bool isBinary_;
+    std::atomic<int> level_;
 
-    FILE* file_;
+    //文件只由写线程（同步时由持mutex_的写入方）访问
+    LogFile file_;
     const char* path_;
     const char* suffix_;
-
-    Buffer logBuff_;
-    int MAX_LINES_;
-    int lineCount_;
+    //当天第几个分文件，与当前文件已写行数
+    int fileIndex_;
+    std::atomic<size_t> maxFileBytes_;
+    //切下来的文件在后台压缩与清理
+    std::unique_ptr<LogArchiver> archiver_;
+    bool isCompress_;
+    int maxFiles_;
+    int maxAgeDays_;
+    size_t maxTotalBytes_;
     int today_;
-    int level_;
 
-    std::unique_ptr<BlockDeque<std::string>> logQueue_;
-    std::unique_ptr<std::thread> writeThread_;
     std::mutex mutex_;
+    std::condition_variable cond_;
+    BufferPtr current_;
+    BufferPtr spare_;
+    std::vector<BufferPtr> full_;
+    bool isFlush_;
+    bool isClose_;
+    std::unique_ptr<std::thread> writeThread_;
+
+    //二进制模式：tsc换算与各线程的环形缓冲区
+    double tscPerNs_;
+    uint64_t tscPerSec_;
+    std::mutex ringMtx_;
+    std::vector<std::shared_ptr<BinLogRing>> rings_;
+    uint32_t nextRingIndex_;
+    std::atomic<bool> isRingHalfFull_;
+    //写线程独占：本文件已写出的格式，以及各线程已写出的名称版本
+    std::vector<bool> formatWritten_;
+    std::unordered_map<uint32_t, uint32_t> threadWritten_;
 };
 
+const int Logger::LOG_PATH_LEN;
+const int Logger::LOG_NAME_LEN;
+const int Logger::DEFAULT_MAX_FILE_MB;
+const int Logger::LINE_SIZE;
+const size_t Logger::BUFFER_SIZE;
+const size_t Logger::MAX_PENDING;
+const int Logger::FLUSH_MS;
+const int Logger::BINARY_DRAIN_MS;
+const size_t Logger::RING_SIZE;
+
+//编译期等级下限：低于LOG_MIN_LEVEL的调用点是常量条件下的死代码，参数求值与格式登记一并被编译器删去
+//默认全部保留，如 make LOG_MIN_LEVEL=1 去掉LOG_DEBUG
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL 0
+#endif
+
+//二进制模式下每个调用点首次执行时登记一次格式串
 #define LOG_BASE(level, format, ...) \
     do {\
-        Logger* log = Logger::GetInstance();\
-        if(log->GetIsOpen() && log->GetLevel() <= level) {\
-            log->Write(level, pthread_self(), format, ##__VA_ARGS__); \
-            log->Flush();\
+        if(level >= LOG_MIN_LEVEL) {\
+            Logger* log = Logger::GetInstance();\
+            if(log->GetIsOpen() && log->GetLevel() <= level) {\
+                if(log->IsBinary()) {\
+                    static const uint32_t logFormatId = BinLog::Register(level, format);\
+                    log->WriteBinary(logFormatId, ##__VA_ARGS__);\
+                }\
+                else {\
+                    log->Write(level, pthread_self(), format, ##__VA_ARGS__); \
+                }\
+            }\
         }\
     } while(0);
 
@@ -89,32 +223,40 @@ private:
 #define LOG_ERROR(format, ...) do {LOG_BASE(3, format, ##__VA_ARGS__)} while(0);
 
 
-Logger::Logger() {
+Logger::Logger() : level_(0) {
     isOpen_ = false;
     isAsync_ = false;
-    file_ = nullptr;
+    isBinary_ = false;
     path_ = nullptr;
     suffix_ = nullptr;
-    lineCount_ = 0;
+    fileIndex_ = 0;
+    maxFileBytes_ = static_cast<size_t>(DEFAULT_MAX_FILE_MB) << 20;
+    isCompress_ = false;
+    maxFiles_ = 0;
+    maxAgeDays_ = 0;
+    maxTotalBytes_ = 0;
     today_ = 0;
-    level_ = 0;
-    logQueue_ = nullptr;
+    isFlush_ = false;
+    isClose_ = false;
     writeThread_ = nullptr;
+    tscPerNs_ = 1.0;
+    tscPerSec_ = 1000000000ULL;
+    nextRingIndex_ = 0;
+    isRingHalfFull_ = false;
 }
 
 Logger::~Logger() {
     if(writeThread_ && writeThread_->joinable()) {
-        while(!logQueue_->empty()) {
-            logQueue_->flush();
+        {
+            std::lock_guard<std::mutex> locker(mutex_);
+            isClose_ = true;
         }
-        logQueue_->close();
+        cond_.notify_one();
+        //写线程退出前写完剩余缓冲区
         writeThread_->join();
     }
-    if(file_) {
-        std::lock_guard<std::mutex> locker(mutex_);
-        Flush();
-        fclose(file_);
-    }
+    file_.Close();
+    archiver_.reset();
 }
 
 Logger *Logger::GetInstance() {
@@ -122,180 +264,541 @@ Logger *Logger::GetInstance() {
     return &log;
 }
 
-void Logger::FlushLogThread() {
-    Logger::GetInstance()->AsyncWrite_();
-}
-
-void Logger::Init(int level, const char* path, const char* suffix, int maxQueueSize) {
-    isOpen_ = true;
+void Logger::Init(int level, const char* path, const char* suffix, int maxQueueSize, bool isBinary) {
     level_ = level;
-    if(maxQueueSize > 0) {
-        isAsync_ = true;
-        if(logQueue_ == nullptr) {
-            std::unique_ptr<BlockDeque<std::string>> newQueue(new BlockDeque<std::string>());
-            logQueue_ = std::move(newQueue);
-
-            std::unique_ptr<std::thread> newThread(new std::thread(FlushLogThread));
-            writeThread_ = move(newThread);
-        }
-    }
-    else {
-        isAsync_ = false;
+    if(isOpen_) {
+        return;
     }
-
-    lineCount_ = 0;
     path_ = path;
     suffix_ = suffix;
+    isBinary_ = isBinary;
+    if(isBinary_) {
+        suffix_ = ".blog";
+        //用10ms的单调时钟标定tsc频率，写入文件头供解码换算
+        timespec begin, end;
+        clock_gettime(CLOCK_MONOTONIC, &begin);
+        uint64_t tscBegin = BinLog::ReadTsc();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        uint64_t tscEnd = BinLog::ReadTsc();
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double ns = (end.tv_sec - begin.tv_sec) * 1e9 + (end.tv_nsec - begin.tv_nsec);
+        tscPerNs_ = (tscEnd - tscBegin) / ns;
+        tscPerSec_ = static_cast<uint64_t>(tscPerNs_ * 1e9);
+    }
     time_t timer = time(nullptr);
-    tm* sysTime = localtime(&timer);
-    //tm t = *sysTime;
-    char fileName[LOG_NAME_LEN] = {0};
-    snprintf(fileName, LOG_NAME_LEN - 1, "%s/%04d_%02d_%02d%s",
-            path_, sysTime->tm_year + 1900, sysTime->tm_mon + 1, sysTime->tm_mday, suffix_);
-    today_ = sysTime->tm_mday;
+    tm sysTime;
+    localtime_r(&timer, &sysTime);
+    today_ = sysTime.tm_mday;
 
-    {    
+    mkdir(path_, 0777);
+    fileIndex_ = FindTodayIndex_(sysTime);
+    char fileName[LOG_NAME_LEN] = {0};
+    FileName_(fileName, sysTime, fileIndex_);
+    archiver_.reset(new LogArchiver(path_, suffix_));
+    {
         std::lock_guard<std::mutex> locker(mutex_);
-        logBuff_.RetrieveAll();
-        if(file_) {
-            Flush();
-            fclose(file_);
-        }
-
-        if((file_ = fopen(fileName, "a")) == nullptr) {
-            mkdir(path_, 0777);
-            file_ = fopen(fileName, "a");
-        }
+        archiver_->Configure(isCompress_, maxFiles_, maxAgeDays_, maxTotalBytes_);
     }
-    assert(file_ != nullptr);
+    OpenFile_(fileName);
+
+    //二进制模式总由写线程收集
+    isAsync_ = maxQueueSize > 0 || isBinary_;
+    if(isAsync_) {
+        current_.reset(new LogBuffer);
+        spare_.reset(new LogBuffer);
+        full_.reserve(MAX_PENDING);
+        writeThread_.reset(new std::thread(isBinary_ ? &Logger::BinaryLoop_ : &Logger::WriteLoop_, this));
+        pthread_setname_np(writeThread_->native_handle(), "logger");
+    }
+    isOpen_ = true;
 }
 
 void Logger::Flush() {
-    if(isAsync_ && logQueue_ != nullptr) {
-        logQueue_->flush();
+    if(!isOpen_) {
+        return;
+    }
+    std::lock_guard<std::mutex> locker(mutex_);
+    if(isAsync_) {
+        isFlush_ = true;
+        cond_.notify_one();
+    }
+    else {
+        file_.Flush();
+    }
+}
+
+void Logger::SetRotation(int maxFileMb, bool compress, int maxFiles, int maxAgeDays, int maxTotalMb) {
+    maxFileBytes_ = maxFileMb > 0 ? static_cast<size_t>(maxFileMb) << 20 : 0;
+    std::lock_guard<std::mutex> locker(mutex_);
+    isCompress_ = compress;
+    maxFiles_ = maxFiles;
+    maxAgeDays_ = maxAgeDays;
+    maxTotalBytes_ = maxTotalMb > 0 ? static_cast<size_t>(maxTotalMb) << 20 : 0;
+    if(archiver_) {
+        archiver_->Configure(isCompress_, maxFiles_, maxAgeDays_, maxTotalBytes_);
     }
-    fflush(file_);
 }
 
 void Logger::Write(int level, pthread_t threadId, const char* format, ...) {
     timeval now = {0, 0};
     gettimeofday(&now, nullptr);
-    time_t timeSec = now.tv_sec;
-    tm* sysTime = localtime(&timeSec);
-    va_list vaList;
-
-    //判断是否跨日/分文件，创建新log
-    if(today_ != sysTime->tm_mday || (lineCount_ && (lineCount_ % MAX_LINE == 0))) {
-        char newFile[LOG_NAME_LEN];
-        char tail[36] = {0};
-        snprintf(tail, sizeof(tail) / sizeof(tail[0]), "%04d_%02d_%02d",
-                sysTime->tm_year + 1900, sysTime->tm_mon + 1, sysTime->tm_mday);
-
-        //隔天
-        if(today_ != sysTime->tm_mday) {
-            snprintf(newFile, LOG_NAME_LEN - 1, "%s/%s%s",
-                    path_, tail, suffix_);
-            today_ = sysTime->tm_mday;
-            lineCount_ = 0;       
-        }
-        //日志分文件，防止过大影响读取效率
-        else {
-            snprintf(newFile, LOG_NAME_LEN - 1, "%s/%s-%d%s",
-                    path_, tail, (lineCount_ / MAX_LINE), suffix_);
-        }
-
-        std::unique_lock<std::mutex> locker(mutex_);
-        Flush();
-        fclose(file_);
-        file_ = fopen(newFile, "a");
-        assert(file_ != nullptr);
+    LogStage& stage = Stage_();
+    if(stage.second != now.tv_sec) {
+        RefreshStage_(stage, now.tv_sec, threadId);
     }
 
-    //写入缓冲区逻辑
-    {
-        std::unique_lock<std::mutex> locker(mutex_);
-        lineCount_++;
-        //日志头部
-        int len = snprintf(logBuff_.BeginWrite(), 128, "%04d-%02d-%02d %02d:%02d:%02d.%06ld ",
-                            sysTime->tm_year + 1900, sysTime->tm_mon + 1, sysTime->tm_mday,
-                            sysTime->tm_hour, sysTime->tm_min, sysTime->tm_sec, now.tv_usec);
-        
-        logBuff_.HasWritten(len);
-        //添加线程属性
-        AppendThreadAttr_(threadId);
-        AppendLogLevelTitle_(level_);
-
-        //日志内容
-        va_start(vaList, format);
-        len = vsnprintf(logBuff_.BeginWrite(), logBuff_.WritableBytes(), format, vaList);
-        va_end(vaList);
-
-        //日志尾部
-        logBuff_.HasWritten(len);
-        logBuff_.Append("\n\0", 2);
-
-        //缓存输出
-        if(isAsync_ && logQueue_ && !logQueue_->full()) {
-            logQueue_->push_back(logBuff_.RetrieveAllToStr());
-        }
-        else {
-            fputs(logBuff_.Peek(), file_);
-        }
-        logBuff_.RetrieveAll();
+    //日志头部：缓存的时间前缀 + 微秒 + 线程属性 + 等级
+    char* line = stage.line;
+    size_t len = stage.timeLen;
+    memcpy(line, stage.timePrefix, len);
+    long usec = now.tv_usec;
+    for(int i = 5; i >= 0; --i) {
+        line[len + i] = static_cast<char>('0' + usec % 10);
+        usec /= 10;
     }
+    line[len + 6] = ' ';
+    len += 7;
+    memcpy(line + len, stage.threadAttr, stage.threadLen);
+    len += stage.threadLen;
+    memcpy(line + len, LevelTitle_(level), 9);
+    len += 9;
+
+    //日志内容，暂存区放不下时按实际长度在堆上重写
+    va_list vaList;
+    va_start(vaList, format);
+    va_list vaCopy;
+    va_copy(vaCopy, vaList);
+    size_t room = LINE_SIZE - len - 1;
+    int n = vsnprintf(line + len, room + 1, format, vaList);
+    if(n >= 0 && static_cast<size_t>(n) <= room) {
+        len += n;
+        line[len++] = '\n';
+        Append_(line, len);
+    }
+    else if(n > 0) {
+        std::string longLine(line, len);
+        longLine.resize(len + n + 1);
+        vsnprintf(&longLine[len], n + 1, format, vaCopy);
+        longLine[len + n] = '\n';
+        Append_(longLine.data(), longLine.size());
+    }
+    va_end(vaCopy);
+    va_end(vaList);
 }
 
 int Logger::GetLevel() {
-    std::lock_guard<std::mutex> locker(mutex_);
-    return level_;
+    return level_.load(std::memory_order_relaxed);
 }
 
 void Logger::SetLevel(int level) {
-    std::lock_guard<std::mutex> locker(mutex_);
-    level_ = level;    
+    level_.store(level, std::memory_order_relaxed);
 }
 
 bool Logger::GetIsOpen() {
     return isOpen_;
 }
 
-void Logger::AppendLogLevelTitle_(int level) {
+bool Logger::IsBinary() const {
+    return isBinary_;
+}
+
+template<class... Args>
+void Logger::WriteBinary(uint32_t formatId, const Args&... args) {
+    uint64_t tsc = BinLog::ReadTsc();
+    BinLogRing* ring = Ring_();
+    if(tsc - ring->nameTsc >= tscPerSec_) {
+        RefreshRingName_(ring, tsc);
+    }
+    size_t len = BinLog::HEAD_LEN + BinLog::ArgsSize(args...);
+    char stackBuf[512];
+    std::unique_ptr<char[]> heapBuf;
+    char* record = stackBuf;
+    if(len > sizeof(stackBuf)) {
+        heapBuf.reset(new char[len]);
+        record = heapBuf.get();
+    }
+    BinLog::PutArgs(BinLog::PutHead(record, len, formatId, tsc), args...);
+    bool isHalfFull = false;
+    ring->Push(record, len, &isHalfFull);
+    //不取锁通知，错过时写线程最迟BINARY_DRAIN_MS后自行收集
+    if(isHalfFull) {
+        isRingHalfFull_.store(true, std::memory_order_relaxed);
+        cond_.notify_one();
+    }
+}
+
+BinLogRing* Logger::Ring_() {
+    static thread_local RingHolder holder;
+    if(!holder.ring) {
+        std::lock_guard<std::mutex> locker(ringMtx_);
+        holder.ring = std::make_shared<BinLogRing>(RING_SIZE, nextRingIndex_++,
+                                                   static_cast<uint64_t>(pthread_self()));
+        rings_.push_back(holder.ring);
+    }
+    return holder.ring.get();
+}
+
+void Logger::RefreshRingName_(BinLogRing* ring, uint64_t tsc) {
+    //线程可能在启动后才改名，按秒刷新
+    char threadName[32] = {0};
+    pthread_getname_np(pthread_self(), threadName, sizeof(threadName));
+    ring->SetName(threadName);
+    ring->nameTsc = tsc;
+}
+
+Logger::LogStage& Logger::Stage_() {
+    static thread_local LogStage stage;
+    return stage;
+}
+
+void Logger::RefreshStage_(LogStage& stage, time_t second, pthread_t threadId) {
+    tm sysTime;
+    localtime_r(&second, &sysTime);
+    stage.timeLen = snprintf(stage.timePrefix, sizeof(stage.timePrefix), "%04d-%02d-%02d %02d:%02d:%02d.",
+                             sysTime.tm_year + 1900, sysTime.tm_mon + 1, sysTime.tm_mday,
+                             sysTime.tm_hour, sysTime.tm_min, sysTime.tm_sec);
+    char threadName[32] = {0};
+    pthread_getname_np(threadId, threadName, sizeof(threadName));
+    stage.threadLen = snprintf(stage.threadAttr, sizeof(stage.threadAttr), "[%s\t-%ld] ", threadName, threadId);
+    if(stage.threadLen >= static_cast<int>(sizeof(stage.threadAttr))) {
+        stage.threadLen = sizeof(stage.threadAttr) - 1;
+    }
+    stage.second = second;
+}
+
+const char* Logger::LevelTitle_(int level) {
     switch (level) {
     case 0:
-        logBuff_.Append("[debug]: ", 9);
-        break;
+        return "[debug]: ";
     case 1:
-        logBuff_.Append("[info] : ", 9);
-        break;
+        return "[info] : ";
     case 2:
-        logBuff_.Append("[warn] : ", 9);
-        break;
+        return "[warn] : ";
     case 3:
-        logBuff_.Append("[error]: ", 9);
-        break;
+        return "[error]: ";
     case 4:
-        logBuff_.Append("[fetal]: ", 9);
-        break;
+        return "[fetal]: ";
     default:
-        logBuff_.Append("[info] : ", 9);
-        break;
+        return "[info] : ";
     }
 }
 
-void Logger::AppendThreadAttr_(pthread_t threadId) {
-    char threadBuf[64], threadName[32];        
-    pthread_getname_np(threadId, threadName, sizeof(threadName));
-    snprintf(threadBuf, sizeof(threadBuf), "[%s\t-%ld] ", threadName, threadId);
-    std::string threadIdStr(threadBuf);
-    logBuff_.Append(threadIdStr);
+void Logger::Append_(const char* line, size_t len) {
+    //超长行截断到一块缓冲区
+    if(len > BUFFER_SIZE) {
+        len = BUFFER_SIZE;
+    }
+    std::lock_guard<std::mutex> locker(mutex_);
+    if(!isAsync_) {
+        RollFile_(len);
+        file_.Append(line, len);
+        file_.Flush();
+        return;
+    }
+    if(current_->Avail() < len) {
+        full_.push_back(std::move(current_));
+        if(spare_) {
+            current_ = std::move(spare_);
+        }
+        else {
+            current_.reset(new LogBuffer);
+        }
+        cond_.notify_one();
+    }
+    current_->Append(line, len);
 }
 
-void Logger::AsyncWrite_() {
-    std::string writeStr = "";
-    while (logQueue_->pop_front(writeStr)) {
-        std::lock_guard<std::mutex> locker(mutex_);
-        fputs(writeStr.c_str(), file_);
+void Logger::WriteLoop_() {
+    //还给前端的两块空缓冲区
+    BufferPtr fresh1(new LogBuffer);
+    BufferPtr fresh2(new LogBuffer);
+    std::vector<BufferPtr> toWrite;
+    toWrite.reserve(MAX_PENDING);
+    bool isClose = false;
+    while(!isClose) {
+        {
+            std::unique_lock<std::mutex> locker(mutex_);
+            cond_.wait_for(locker, std::chrono::milliseconds(FLUSH_MS), [this]() {
+                return !full_.empty() || isFlush_ || isClose_;
+            });
+            isFlush_ = false;
+            isClose = isClose_;
+            full_.push_back(std::move(current_));
+            current_ = std::move(fresh1);
+            toWrite.swap(full_);
+            if(!spare_) {
+                spare_ = std::move(fresh2);
+            }
+        }
+
+        //积压过多：保留最早两块，其余丢弃
+        if(toWrite.size() > MAX_PENDING) {
+            size_t dropped = 0;
+            for(size_t i = 2; i < toWrite.size(); ++i) {
+                dropped += toWrite[i]->Lines();
+            }
+            char note[128];
+            int len = snprintf(note, sizeof(note), "Logger dropped %zu lines, %zu buffers pending\n",
+                               dropped, toWrite.size());
+            fputs(note, stderr);
+            toWrite.resize(2);
+            if(toWrite[1]->Avail() >= static_cast<size_t>(len)) {
+                toWrite[1]->Append(note, len);
+            }
+        }
+        for(const BufferPtr& buffer : toWrite) {
+            if(buffer->Length() == 0) {
+                continue;
+            }
+            RollFile_(buffer->Length());
+            file_.Append(buffer->Data(), buffer->Length());
+        }
+        file_.Flush();
+
+        //回收两块作为下一轮还给前端的缓冲区
+        if(!fresh1) {
+            fresh1 = std::move(toWrite.back());
+            toWrite.pop_back();
+            fresh1->Reset();
+        }
+        if(!fresh2 && !toWrite.empty()) {
+            fresh2 = std::move(toWrite.back());
+            toWrite.pop_back();
+            fresh2->Reset();
+        }
+        toWrite.clear();
+        if(!fresh2) {
+            fresh2.reset(new LogBuffer);
+        }
+    }
+}
+
+void Logger::BinaryLoop_() {
+    std::string data;
+    std::vector<BinaryEntry> entries;
+    std::string out;
+    bool isClose = false;
+    while(!isClose) {
+        {
+            std::unique_lock<std::mutex> locker(mutex_);
+            cond_.wait_for(locker, std::chrono::milliseconds(BINARY_DRAIN_MS), [this]() {
+                return isFlush_ || isClose_ || isRingHalfFull_.load(std::memory_order_relaxed);
+            });
+            isFlush_ = false;
+            isRingHalfFull_.store(false, std::memory_order_relaxed);
+            isClose = isClose_;
+        }
+        DrainRings_(data, entries, out);
+    }
+}
+
+void Logger::DrainRings_(std::string& data, std::vector<BinaryEntry>& entries, std::string& out) {
+    std::vector<std::shared_ptr<BinLogRing>> rings;
+    {
+        std::lock_guard<std::mutex> locker(ringMtx_);
+        rings = rings_;
+    }
+    data.clear();
+    entries.clear();
+    out.clear();
+    std::vector<std::pair<uint32_t, uint64_t>> drops;
+    std::vector<BinLogRing*> deadRings;
+    for(const auto& ring : rings) {
+        //先看是否已退出再读，读完即为全部记录
+        bool isDead = ring->IsDead();
+        size_t offset = data.size();
+        ring->PopAll(data);
+        while(offset + BinLog::HEAD_LEN <= data.size()) {
+            uint32_t len;
+            uint64_t tsc;
+            memcpy(&len, data.data() + offset, 4);
+            memcpy(&tsc, data.data() + offset + 8, 8);
+            assert(len >= BinLog::HEAD_LEN && offset + len <= data.size());
+            entries.push_back({tsc, ring->GetIndex(), offset, len});
+            offset += len;
+        }
+        uint64_t dropped = ring->TakeDropped();
+        if(dropped > 0) {
+            drops.emplace_back(ring->GetIndex(), dropped);
+        }
+        if(isDead) {
+            deadRings.push_back(ring.get());
+        }
+    }
+    if(!deadRings.empty()) {
+        std::lock_guard<std::mutex> locker(ringMtx_);
+        for(BinLogRing* dead : deadRings) {
+            rings_.erase(std::find_if(rings_.begin(), rings_.end(), [dead](const std::shared_ptr<BinLogRing>& ring) {
+                return ring.get() == dead;
+            }));
+        }
+    }
+    if(entries.empty() && drops.empty()) {
+        return;
+    }
+    //先切换文件再写格式与线程表，大小按记录字节数估计
+    RollFile_(data.size());
+
+    //本文件中还没有的格式与线程名
+    for(const BinaryEntry& entry : entries) {
+        uint32_t formatId;
+        memcpy(&formatId, data.data() + entry.offset + 4, 4);
+        if(formatId >= formatWritten_.size()) {
+            formatWritten_.resize(formatId + 1, false);
+        }
+        if(!formatWritten_[formatId]) {
+            int level = 0;
+            const char* format = "";
+            BinLog::GetFormat(formatId, &level, &format);
+            uint8_t levelByte = static_cast<uint8_t>(level);
+            uint32_t formatLen = static_cast<uint32_t>(strlen(format));
+            out.push_back(BinLog::ENTRY_FORMAT);
+            out.append(reinterpret_cast<const char*>(&formatId), 4);
+            out.append(reinterpret_cast<const char*>(&levelByte), 1);
+            out.append(reinterpret_cast<const char*>(&formatLen), 4);
+            out.append(format, formatLen);
+            formatWritten_[formatId] = true;
+        }
+    }
+    for(const auto& ring : rings) {
+        std::string name;
+        uint32_t version = ring->GetName(name) + 1;
+        uint32_t index = ring->GetIndex();
+        auto iter = threadWritten_.find(index);
+        if(iter != threadWritten_.end() && iter->second == version) {
+            continue;
+        }
+        threadWritten_[index] = version;
+        uint64_t threadId = ring->GetThreadId();
+        uint32_t nameLen = static_cast<uint32_t>(name.size());
+        out.push_back(BinLog::ENTRY_THREAD);
+        out.append(reinterpret_cast<const char*>(&index), 4);
+        out.append(reinterpret_cast<const char*>(&threadId), 8);
+        out.append(reinterpret_cast<const char*>(&nameLen), 4);
+        out.append(name);
+    }
+
+    //对时点之后是按tsc排序的记录
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    uint64_t tsc = BinLog::ReadTsc();
+    int64_t unixNs = static_cast<int64_t>(now.tv_sec) * 1000000000LL + now.tv_nsec;
+    out.push_back(BinLog::ENTRY_SYNC);
+    out.append(reinterpret_cast<const char*>(&tsc), 8);
+    out.append(reinterpret_cast<const char*>(&unixNs), 8);
+    for(const auto& drop : drops) {
+        out.push_back(BinLog::ENTRY_DROP);
+        out.append(reinterpret_cast<const char*>(&drop.first), 4);
+        out.append(reinterpret_cast<const char*>(&drop.second), 8);
+    }
+    std::stable_sort(entries.begin(), entries.end(), [](const BinaryEntry& a, const BinaryEntry& b) {
+        return a.tsc < b.tsc;
+    });
+    for(const BinaryEntry& entry : entries) {
+        out.push_back(BinLog::ENTRY_LOG);
+        out.append(reinterpret_cast<const char*>(&entry.ringIndex), 4);
+        out.append(data.data() + entry.offset, entry.len);
+    }
+    file_.Append(out.data(), out.size());
+    file_.Flush();
+}
+
+void Logger::OpenFile_(const char* fileName) {
+    bool isOpen = file_.Open(fileName);
+    assert(isOpen);
+    (void)isOpen;
+    if(isBinary_) {
+        //同一天重启时追加到原文件，解码时遇到新的文件头即换用新的格式与线程表
+        file_.Append(BinLog::MAGIC, sizeof(BinLog::MAGIC));
+        file_.Append(reinterpret_cast<const char*>(&tscPerNs_), sizeof(tscPerNs_));
+        formatWritten_.clear();
+        threadWritten_.clear();
+    }
+    archiver_->SetActive(fileName);
+}
+
+void Logger::RollFile_(size_t bytes) {
+    time_t timer = time(nullptr);
+    tm sysTime;
+    localtime_r(&timer, &sysTime);
+    size_t maxBytes = maxFileBytes_.load(std::memory_order_relaxed);
+    bool isNewDay = today_ != sysTime.tm_mday;
+    //空文件不切换，单次写入超过上限时整块写入当前文件
+    bool isFull = maxBytes > 0 && file_.GetSize() > 0 && file_.GetSize() + bytes > maxBytes;
+    if(!isNewDay && !isFull) {
+        return;
+    }
+    //隔天从不带序号的文件开始，当天写满则换下一个序号，防止单个文件过大
+    if(isNewDay) {
+        today_ = sysTime.tm_mday;
+        fileIndex_ = 0;
+    }
+    else {
+        ++fileIndex_;
+    }
+    char newFile[LOG_NAME_LEN];
+    FileName_(newFile, sysTime, fileIndex_);
+    file_.Close();
+    OpenFile_(newFile);
+    archiver_->Notify();
+}
+
+void Logger::FileName_(char* fileName, const tm& sysTime, int index) const {
+    if(index == 0) {
+        snprintf(fileName, LOG_NAME_LEN - 1, "%s/%04d_%02d_%02d%s",
+                 path_, sysTime.tm_year + 1900, sysTime.tm_mon + 1, sysTime.tm_mday, suffix_);
+    }
+    else {
+        snprintf(fileName, LOG_NAME_LEN - 1, "%s/%04d_%02d_%02d-%d%s",
+                 path_, sysTime.tm_year + 1900, sysTime.tm_mon + 1, sysTime.tm_mday, index, suffix_);
+    }
+}
+
+int Logger::FindTodayIndex_(const tm& sysTime) const {
+    //目录中当天序号最大的分文件，未压缩则接着写，已压缩（或被清理过）则用下一个序号
+    char prefix[16];
+    int prefixLen = snprintf(prefix, sizeof(prefix), "%04d_%02d_%02d",
+                             sysTime.tm_year + 1900, sysTime.tm_mon + 1, sysTime.tm_mday);
+    size_t suffixLen = strlen(suffix_);
+    int maxIndex = -1;
+    bool isPlain = false;
+    DIR* dir = opendir(path_);
+    if(!dir) {
+        return 0;
+    }
+    while(dirent* item = readdir(dir)) {
+        const char* name = item->d_name;
+        if(strncmp(name, prefix, prefixLen) != 0) {
+            continue;
+        }
+        const char* p = name + prefixLen;
+        int index = 0;
+        if(*p == '-') {
+            char* end = nullptr;
+            index = static_cast<int>(strtol(p + 1, &end, 10));
+            if(end == p + 1) {
+                continue;
+            }
+            p = end;
+        }
+        if(strncmp(p, suffix_, suffixLen) != 0) {
+            continue;
+        }
+        p += suffixLen;
+        bool plain = *p == '\0';
+        if(!plain && strcmp(p, ".gz") != 0) {
+            continue;
+        }
+        if(index > maxIndex || (index == maxIndex && plain)) {
+            maxIndex = index;
+            isPlain = plain;
+        }
+    }
+    closedir(dir);
+    if(maxIndex < 0) {
+        return 0;
     }
+    return isPlain ? maxIndex : maxIndex + 1;
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,114 @@
+#ifndef LATENCYHISTOGRAM_HPP
+#define LATENCYHISTOGRAM_HPP
+
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+
+/*
+    HDR风格的对数-线性延迟直方图，单位微秒
+    1、小于16us每微秒一个桶；之后每个2的幂区间等分8个子桶，相对误差不超过12.5%
+    2、记录只需一次前导零计数与两次原子加，不分配、不加锁
+    3、上限约19小时，更大的值计入最后一桶
+*/
+class LatencyHistogram final {
+public:
+    static const int SUB_BITS = 3;
+    static const int SUB_COUNT = 1 << SUB_BITS;
+    static const int LINEAR_COUNT = SUB_COUNT * 2;
+    static const int MAX_EXP = 35;
+    static const int BUCKETS = LINEAR_COUNT + (MAX_EXP - SUB_BITS) * SUB_COUNT;
+
+    //聚合后的快照，抓取时由各分片累加得到
+    struct Snapshot {
+        uint64_t counts[BUCKETS];
+        uint64_t count;
+        uint64_t sumUs;
+
+        Snapshot() {
+            memset(this, 0, sizeof(*this));
+        }
+        //不超过boundUs的样本数，boundUs须为桶边界（如2的幂减1）才精确
+        uint64_t CountLe(uint64_t boundUs) const;
+        //第q分位所在桶的上界
+        uint64_t Quantile(double q) const;
+    };
+
+    void Record(uint64_t us) {
+        counts_[Index(us)].fetch_add(1, std::memory_order_relaxed);
+        sumUs_.fetch_add(us, std::memory_order_relaxed);
+    }
+    void MergeTo(Snapshot* snapshot) const;
+
+    static int Index(uint64_t us);
+    //桶内最大值
+    static uint64_t UpperBound(int index);
+
+private:
+    std::atomic<uint64_t> counts_[BUCKETS] = {};
+    std::atomic<uint64_t> sumUs_{0};
+};
+
+const int LatencyHistogram::SUB_BITS;
+const int LatencyHistogram::SUB_COUNT;
+const int LatencyHistogram::LINEAR_COUNT;
+const int LatencyHistogram::MAX_EXP;
+const int LatencyHistogram::BUCKETS;
+
+int LatencyHistogram::Index(uint64_t us) {
+    if(us < static_cast<uint64_t>(LINEAR_COUNT)) {
+        return static_cast<int>(us);
+    }
+    int exp = 63 - __builtin_clzll(us);
+    if(exp > MAX_EXP) {
+        return BUCKETS - 1;
+    }
+    int sub = static_cast<int>(us >> (exp - SUB_BITS)) & (SUB_COUNT - 1);
+    return LINEAR_COUNT + (exp - SUB_BITS - 1) * SUB_COUNT + sub;
+}
+
+uint64_t LatencyHistogram::UpperBound(int index) {
+    if(index < LINEAR_COUNT) {
+        return static_cast<uint64_t>(index);
+    }
+    int exp = (index - LINEAR_COUNT) / SUB_COUNT + SUB_BITS + 1;
+    uint64_t sub = (index - LINEAR_COUNT) % SUB_COUNT;
+    return ((SUB_COUNT + sub + 1) << (exp - SUB_BITS)) - 1;
+}
+
+void LatencyHistogram::MergeTo(Snapshot* snapshot) const {
+    for(int i = 0; i < BUCKETS; ++i) {
+        uint64_t count = counts_[i].load(std::memory_order_relaxed);
+        snapshot->counts[i] += count;
+        snapshot->count += count;
+    }
+    snapshot->sumUs += sumUs_.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::Snapshot::CountLe(uint64_t boundUs) const {
+    uint64_t total = 0;
+    for(int i = 0; i < BUCKETS && UpperBound(i) <= boundUs; ++i) {
+        total += counts[i];
+    }
+    return total;
+}
+
+uint64_t LatencyHistogram::Snapshot::Quantile(double q) const {
+    if(count == 0) {
+        return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(q * count);
+    if(rank >= count) {
+        rank = count - 1;
+    }
+    uint64_t total = 0;
+    for(int i = 0; i < BUCKETS; ++i) {
+        total += counts[i];
+        if(total > rank) {
+            return UpperBound(i);
+        }
+    }
+    return UpperBound(BUCKETS - 1);
+}
+
+#endif
@@ -0,0 +1,252 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <functional>
+#include <algorithm>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "latencyhistogram.hpp"
+#include "../logger/logger.hpp"
+
+/*
+    运行指标，以Prometheus文本格式从配置的路径（默认/metrics）输出
+    1、计数与延迟直方图按线程分片，每个分片独占缓存行，记录时只在本线程的分片上做原子加，互不争用
+    2、线程首次记录时按序领取分片，线程数超过分片数时取模共用，原子加保证仍然正确
+    3、抓取时累加全部分片；执行器、连接池等已有的运行状态由登记的采集函数在抓取时追加
+*/
+class Metrics final {
+public:
+    //请求各阶段，与直方图一一对应
+    enum PHASE {
+        ACCEPT_TO_FIRST_BYTE = 0,   //连接接入到第一个响应字节写出，每个连接记一次
+        PARSE,                      //开始处理到请求解析完成（含上传请求体接收）
+        PROCESS,                    //解析完成到响应就绪
+        WRITE,                      //响应就绪到发送完毕
+        DB_WAIT,                    //查库请求挂起到查库完成（排队、取连接与查询）
+        PHASE_COUNT
+    };
+
+    static Metrics* GetInstance();
+
+    void Init(bool open, const std::string& path);
+    bool IsOpen() const;
+    //是否为抓取指标的请求
+    bool IsScrapePath(const char* method, const char* path) const;
+    //抓取时调用，向输出追加指标文本；须在服务运行期间保持有效
+    void AddCollector(std::function<void(std::string&)> collector);
+
+    void RecordLatency(PHASE phase, uint64_t us);
+    //响应发送完毕，按状态类计数
+    void RecordResponse(int status, uint64_t bytes);
+    void RecordAccept();
+    void RecordReject();
+
+    std::string Render();
+
+    //追加一行指标，labels形如 executor="io"，可为空
+    static void AppendLine(std::string& out, const char* name, const char* labels, double value);
+    static void AppendHeader(std::string& out, const char* name, const char* type, const char* help);
+
+private:
+    //分片数，超过时线程共用分片
+    static const int SHARD_NUM = 32;
+    static const int STATUS_CLASSES = 5;
+    static const char* PHASE_NAMES[PHASE_COUNT];
+    //导出的histogram桶上界（微秒），取直方图的桶边界，累加结果是精确的
+    static const uint64_t EXPORT_BOUNDS_US[];
+    static const double EXPORT_QUANTILES[];
+
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> responses[STATUS_CLASSES] = {};
+        std::atomic<uint64_t> responseBytes{0};
+        std::atomic<uint64_t> accepts{0};
+        std::atomic<uint64_t> rejects{0};
+        LatencyHistogram latency[PHASE_COUNT];
+    };
+
+    Metrics() = default;
+    ~Metrics() = default;
+
+    Shard& LocalShard_();
+
+    bool isOpen_ = false;
+    std::string path_;
+    std::atomic<int> nextShard_{0};
+    Shard shards_[SHARD_NUM];
+    std::mutex collectorMtx_;
+    std::vector<std::function<void(std::string&)>> collectors_;
+};
+
+const int Metrics::SHARD_NUM;
+const int Metrics::STATUS_CLASSES;
+const char* Metrics::PHASE_NAMES[PHASE_COUNT] = {
+    "accept_to_first_byte", "parse", "process", "write", "db_wait"
+};
+//16us ~ 33s，每档翻倍
+const uint64_t Metrics::EXPORT_BOUNDS_US[] = {
+    15, 31, 63, 127, 255, 511, 1023, 2047, 4095, 8191, 16383, 32767, 65535, 131071,
+    262143, 524287, 1048575, 2097151, 4194303, 8388607, 16777215, 33554431
+};
+const double Metrics::EXPORT_QUANTILES[] = {0.5, 0.9, 0.99, 0.999};
+
+Metrics* Metrics::GetInstance() {
+    static Metrics metrics;
+    return &metrics;
+}
+
+void Metrics::Init(bool open, const std::string& path) {
+    isOpen_ = open && !path.empty();
+    path_ = path;
+    if(isOpen_) {
+        LOG_INFO("Metrics path: %s", path_.c_str());
+    }
+}
+
+bool Metrics::IsOpen() const {
+    return isOpen_;
+}
+
+bool Metrics::IsScrapePath(const char* method, const char* path) const {
+    return isOpen_ && strcmp(method, "GET") == 0 && path_ == path;
+}
+
+void Metrics::AddCollector(std::function<void(std::string&)> collector) {
+    std::lock_guard<std::mutex> locker(collectorMtx_);
+    collectors_.push_back(std::move(collector));
+}
+
+Metrics::Shard& Metrics::LocalShard_() {
+    static thread_local int shard = -1;
+    if(shard < 0) {
+        shard = nextShard_.fetch_add(1, std::memory_order_relaxed) % SHARD_NUM;
+    }
+    return shards_[shard];
+}
+
+void Metrics::RecordLatency(PHASE phase, uint64_t us) {
+    if(!isOpen_) {
+        return;
+    }
+    LocalShard_().latency[phase].Record(us);
+}
+
+void Metrics::RecordResponse(int status, uint64_t bytes) {
+    if(!isOpen_) {
+        return;
+    }
+    Shard& shard = LocalShard_();
+    int statusClass = status / 100 - 1;
+    if(statusClass >= 0 && statusClass < STATUS_CLASSES) {
+        shard.responses[statusClass].fetch_add(1, std::memory_order_relaxed);
+    }
+    shard.responseBytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void Metrics::RecordAccept() {
+    if(isOpen_) {
+        LocalShard_().accepts.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void Metrics::RecordReject() {
+    if(isOpen_) {
+        LocalShard_().rejects.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void Metrics::AppendLine(std::string& out, const char* name, const char* labels, double value) {
+    char line[256];
+    int len = 0;
+    if(labels && labels[0]) {
+        len = snprintf(line, sizeof(line), "%s{%s} %.15g\n", name, labels, value);
+    }
+    else {
+        len = snprintf(line, sizeof(line), "%s %.15g\n", name, value);
+    }
+    if(len > 0) {
+        out.append(line, std::min(static_cast<size_t>(len), sizeof(line) - 1));
+    }
+}
+
+void Metrics::AppendHeader(std::string& out, const char* name, const char* type, const char* help) {
+    out += "# HELP ";
+    out += name;
+    out += ' ';
+    out += help;
+    out += "\n# TYPE ";
+    out += name;
+    out += ' ';
+    out += type;
+    out += '\n';
+}
+
+std::string Metrics::Render() {
+    uint64_t responses[STATUS_CLASSES] = {};
+    uint64_t responseBytes = 0;
+    uint64_t accepts = 0;
+    uint64_t rejects = 0;
+    std::vector<LatencyHistogram::Snapshot> latency(PHASE_COUNT);
+    for(const Shard& shard : shards_) {
+        for(int i = 0; i < STATUS_CLASSES; ++i) {
+            responses[i] += shard.responses[i].load(std::memory_order_relaxed);
+        }
+        responseBytes += shard.responseBytes.load(std::memory_order_relaxed);
+        accepts += shard.accepts.load(std::memory_order_relaxed);
+        rejects += shard.rejects.load(std::memory_order_relaxed);
+        for(int i = 0; i < PHASE_COUNT; ++i) {
+            shard.latency[i].MergeTo(&latency[i]);
+        }
+    }
+
+    std::string out;
+    out.reserve(16384);
+    char labels[128];
+    AppendHeader(out, "webserver_responses_total", "counter", "Responses sent, by status class.");
+    for(int i = 0; i < STATUS_CLASSES; ++i) {
+        snprintf(labels, sizeof(labels), "code=\"%dxx\"", i + 1);
+        AppendLine(out, "webserver_responses_total", labels, responses[i]);
+    }
+    AppendHeader(out, "webserver_response_bytes_total", "counter", "Response bytes written to clients.");
+    AppendLine(out, "webserver_response_bytes_total", nullptr, responseBytes);
+    AppendHeader(out, "webserver_connections_accepted_total", "counter", "Client connections accepted.");
+    AppendLine(out, "webserver_connections_accepted_total", nullptr, accepts);
+    AppendHeader(out, "webserver_connections_rejected_total", "counter", "Client connections rejected at maxConn.");
+    AppendLine(out, "webserver_connections_rejected_total", nullptr, rejects);
+
+    AppendHeader(out, "webserver_request_phase_seconds", "histogram", "Request latency by phase.");
+    for(int i = 0; i < PHASE_COUNT; ++i) {
+        const LatencyHistogram::Snapshot& snapshot = latency[i];
+        for(uint64_t bound : EXPORT_BOUNDS_US) {
+            snprintf(labels, sizeof(labels), "phase=\"%s\",le=\"%g\"", PHASE_NAMES[i], (bound + 1) / 1e6);
+            AppendLine(out, "webserver_request_phase_seconds_bucket", labels, snapshot.CountLe(bound));
+        }
+        snprintf(labels, sizeof(labels), "phase=\"%s\",le=\"+Inf\"", PHASE_NAMES[i]);
+        AppendLine(out, "webserver_request_phase_seconds_bucket", labels, snapshot.count);
+        snprintf(labels, sizeof(labels), "phase=\"%s\"", PHASE_NAMES[i]);
+        AppendLine(out, "webserver_request_phase_seconds_sum", labels, snapshot.sumUs / 1e6);
+        AppendLine(out, "webserver_request_phase_seconds_count", labels, snapshot.count);
+    }
+    //启动以来的分位数，取自完整精度的直方图，误差不超过12.5%
+    AppendHeader(out, "webserver_request_phase_quantile_seconds", "gauge",
+                 "Request latency quantiles by phase since start.");
+    for(int i = 0; i < PHASE_COUNT; ++i) {
+        for(double q : EXPORT_QUANTILES) {
+            snprintf(labels, sizeof(labels), "phase=\"%s\",quantile=\"%g\"", PHASE_NAMES[i], q);
+            AppendLine(out, "webserver_request_phase_quantile_seconds", labels, latency[i].Quantile(q) / 1e6);
+        }
+    }
+
+    std::lock_guard<std::mutex> locker(collectorMtx_);
+    for(const auto& collector : collectors_) {
+        collector(out);
+    }
+    return out;
+}
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef REQUESTTRACE_HPP
+#define REQUESTTRACE_HPP
+
+#include <chrono>
+#include <stdint.h>
+
+/*
+    单个请求的阶段时间点，定长，放在请求上下文中随请求经过OnRead_、OnProcess、OnWrite_依次记录
+    指标、访问日志与慢请求记录都从这里取各阶段耗时
+*/
+struct RequestTrace {
+    typedef std::chrono::steady_clock Clock;
+
+    Clock::time_point accept;       //连接接入，长连接上的后续请求沿用
+    Clock::time_point firstRead;    //本请求的第一批字节读入
+    Clock::time_point begin;        //开始处理
+    Clock::time_point parsed;       //请求解析完成，含上传请求体
+    Clock::time_point ready;        //处理完成，响应就绪
+    Clock::time_point firstWrite;   //第一个响应字节写出
+    Clock::time_point lastWrite;    //响应发送完毕
+    uint32_t writes = 0;            //写出响应调用Write的次数
+    uint32_t parks = 0;             //等待查库、缓存或定时而挂起的次数
+
+    //begin及之后的时间点置为now，accept与firstRead由连接填入
+    void Begin(Clock::time_point now) {
+        begin = parsed = ready = firstWrite = lastWrite = now;
+        writes = parks = 0;
+    }
+
+    static int64_t ElapsedUs(Clock::time_point from, Clock::time_point to) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(to - from).count();
+    }
+};
+
+#endif
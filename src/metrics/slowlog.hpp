@@ -0,0 +1,197 @@
+#ifndef SLOWLOG_HPP
+#define SLOWLOG_HPP
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <time.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+
+#include "requesttrace.hpp"
+#include "../buffer/arena.hpp"
+#include "../cfg/runtimeconfig.hpp"
+#include "../logger/logger.hpp"
+
+//一次慢请求，字段在连接上采集，写入环时才格式化
+struct SlowRecord {
+    const RequestTrace* trace;
+    const char* ip;
+    const char* method;
+    const char* target;
+    int status;
+    uint64_t bytes;
+    unsigned reuse;
+    bool isProxy;
+    const ArenaStringMap* headers;
+};
+
+/*
+    慢请求记录：从第一批字节读入到响应发完超过slowLog.thresholdMs（可热加载）的请求，
+    连同完整的阶段时间点与请求头格式化成一行JSON，存入定长环，最旧的被覆盖
+    1、未超过阈值的请求只做一次比较；慢请求少，格式化与持锁写环不影响正常请求
+    2、GET path按从旧到新输出环中的记录，用于追查长尾请求而无需挂性能分析工具
+*/
+class SlowLog final {
+public:
+    static SlowLog* GetInstance();
+
+    void Init(bool open, int capacity, const std::string& path);
+    bool IsOpen() const;
+    //是否为读取慢请求记录的请求
+    bool IsDumpPath(const char* method, const char* path) const;
+    //从第一批字节读入到响应发完的耗时是否超过阈值
+    bool IsSlow(const RequestTrace& trace) const;
+    void Add(const SlowRecord& record);
+    std::string Render();
+
+private:
+    //请求头最多记录的字节数，超出的头部丢弃
+    static const size_t MAX_HEADER_BYTES = 4096;
+    static const size_t MAX_TARGET_LEN = 1024;
+
+    SlowLog() = default;
+    ~SlowLog() = default;
+
+    //写入JSON字符串内容，转义引号、反斜杠与控制字符
+    static void AppendEscaped_(std::string& out, const char* str, size_t len, size_t maxLen);
+    //凭据类请求头只记录名称
+    static bool IsSecretHeader_(const ArenaString& name);
+
+    bool isOpen_ = false;
+    std::string path_;
+    std::mutex mtx_;
+    std::vector<std::string> ring_;
+    //累计写入的条数，下一条写入ring_[count_ % 容量]
+    uint64_t count_ = 0;
+};
+
+const size_t SlowLog::MAX_HEADER_BYTES;
+const size_t SlowLog::MAX_TARGET_LEN;
+
+SlowLog* SlowLog::GetInstance() {
+    static SlowLog slowLog;
+    return &slowLog;
+}
+
+void SlowLog::Init(bool open, int capacity, const std::string& path) {
+    isOpen_ = open && capacity > 0 && !path.empty();
+    path_ = path;
+    if(!isOpen_) {
+        return;
+    }
+    std::lock_guard<std::mutex> locker(mtx_);
+    ring_.assign(capacity, std::string());
+    count_ = 0;
+    LOG_INFO("SlowLog capacity: %d, path: %s", capacity, path_.c_str());
+}
+
+bool SlowLog::IsOpen() const {
+    return isOpen_;
+}
+
+bool SlowLog::IsDumpPath(const char* method, const char* path) const {
+    return isOpen_ && strcmp(method, "GET") == 0 && path_ == path;
+}
+
+bool SlowLog::IsSlow(const RequestTrace& trace) const {
+    return isOpen_ && RequestTrace::ElapsedUs(trace.firstRead, trace.lastWrite) >=
+                      static_cast<int64_t>(RuntimeConfig::Get()->slowLogThresholdMs) * 1000;
+}
+
+void SlowLog::Add(const SlowRecord& record) {
+    if(!isOpen_) {
+        return;
+    }
+    const RequestTrace& trace = *record.trace;
+    auto since = [&trace](RequestTrace::Clock::time_point point) {
+        return static_cast<long long>(RequestTrace::ElapsedUs(trace.firstRead, point));
+    };
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    tm sysTime;
+    localtime_r(&now.tv_sec, &sysTime);
+    char buf[512];
+    std::string line;
+    line.reserve(1024);
+    snprintf(buf, sizeof(buf), "{\"time\":\"%04d-%02d-%02d %02d:%02d:%02d.%06ld\",\"ip\":\"%s\",\"method\":\"",
+             sysTime.tm_year + 1900, sysTime.tm_mon + 1, sysTime.tm_mday,
+             sysTime.tm_hour, sysTime.tm_min, sysTime.tm_sec, now.tv_nsec / 1000, record.ip);
+    line += buf;
+    AppendEscaped_(line, record.method, strlen(record.method), 16);
+    line += "\",\"target\":\"";
+    AppendEscaped_(line, record.target, strlen(record.target), MAX_TARGET_LEN);
+    //各时间点为相对第一批字节读入的微秒数，conn_age为此前连接已存在的时长
+    snprintf(buf, sizeof(buf),
+             "\",\"status\":%d,\"bytes\":%llu,\"reuse\":%u,\"proxy\":%s,\"total_us\":%lld,"
+             "\"trace_us\":{\"conn_age\":%lld,\"begin\":%lld,\"parsed\":%lld,\"ready\":%lld,"
+             "\"first_write\":%lld,\"last_write\":%lld},\"writes\":%u,\"parks\":%u,\"headers\":{",
+             record.status, static_cast<unsigned long long>(record.bytes), record.reuse,
+             record.isProxy ? "true" : "false", since(trace.lastWrite),
+             static_cast<long long>(RequestTrace::ElapsedUs(trace.accept, trace.firstRead)), since(trace.begin),
+             since(trace.parsed), since(trace.ready), since(trace.firstWrite), since(trace.lastWrite),
+             static_cast<unsigned>(trace.writes), static_cast<unsigned>(trace.parks));
+    line += buf;
+    size_t headerStart = line.size();
+    bool isFirst = true;
+    for(const auto& header : *record.headers) {
+        if(line.size() - headerStart + header.first.size() + header.second.size() > MAX_HEADER_BYTES) {
+            continue;
+        }
+        line += isFirst ? "\"" : ",\"";
+        isFirst = false;
+        AppendEscaped_(line, header.first.data(), header.first.size(), header.first.size());
+        line += "\":\"";
+        if(IsSecretHeader_(header.first)) {
+            line += "-";
+        }
+        else {
+            AppendEscaped_(line, header.second.data(), header.second.size(), header.second.size());
+        }
+        line += '"';
+    }
+    line += "}}\n";
+
+    std::lock_guard<std::mutex> locker(mtx_);
+    ring_[count_ % ring_.size()] = std::move(line);
+    ++count_;
+}
+
+std::string SlowLog::Render() {
+    std::string out;
+    std::lock_guard<std::mutex> locker(mtx_);
+    size_t size = ring_.size();
+    uint64_t first = count_ > size ? count_ - size : 0;
+    for(uint64_t i = first; i < count_; ++i) {
+        out += ring_[i % size];
+    }
+    return out;
+}
+
+void SlowLog::AppendEscaped_(std::string& out, const char* str, size_t len, size_t maxLen) {
+    static const char HEX[] = "0123456789abcdef";
+    for(size_t i = 0; i < len && i < maxLen; ++i) {
+        unsigned char ch = static_cast<unsigned char>(str[i]);
+        if(ch == '"' || ch == '\\') {
+            out += '\\';
+            out += ch;
+        }
+        else if(ch < 0x20 || ch == 0x7f) {
+            out += "\\u00";
+            out += HEX[ch >> 4];
+            out += HEX[ch & 0xf];
+        }
+        else {
+            out += ch;
+        }
+    }
+}
+
+bool SlowLog::IsSecretHeader_(const ArenaString& name) {
+    return strcasecmp(name.c_str(), "Authorization") == 0 || strcasecmp(name.c_str(), "Cookie") == 0 ||
+           strcasecmp(name.c_str(), "Proxy-Authorization") == 0;
+}
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef OBJECTPOOL_HPP
+#define OBJECTPOOL_HPP
+
+#include <vector>
+#include <mutex>
+#include <assert.h>
+
+//对象池：复用构造代价大的对象，空闲对象数超过上限时直接释放
+template<typename T>
+class ObjectPool final {
+public:
+    explicit ObjectPool(size_t maxIdle = 1024);
+    ~ObjectPool();
+
+    //取出对象，池空时新建
+    T* Acquire();
+    //归还对象，调用方负责先重置对象状态
+    void Release(T* obj);
+    size_t IdleCount();
+
+private:
+    size_t maxIdle_;
+    std::mutex mtx_;
+    std::vector<T*> idle_;
+};
+
+template<typename T>
+ObjectPool<T>::ObjectPool(size_t maxIdle) : maxIdle_(maxIdle) {}
+
+template<typename T>
+ObjectPool<T>::~ObjectPool() {
+    for(T* obj : idle_) {
+        delete obj;
+    }
+}
+
+template<typename T>
+T* ObjectPool<T>::Acquire() {
+    {
+        std::lock_guard<std::mutex> locker(mtx_);
+        if(!idle_.empty()) {
+            T* obj = idle_.back();
+            idle_.pop_back();
+            return obj;
+        }
+    }
+    return new T();
+}
+
+template<typename T>
+void ObjectPool<T>::Release(T* obj) {
+    assert(obj);
+    {
+        std::lock_guard<std::mutex> locker(mtx_);
+        if(idle_.size() < maxIdle_) {
+            idle_.push_back(obj);
+            return;
+        }
+    }
+    delete obj;
+}
+
+template<typename T>
+size_t ObjectPool<T>::IdleCount() {
+    std::lock_guard<std::mutex> locker(mtx_);
+    return idle_.size();
+}
+
+#endif
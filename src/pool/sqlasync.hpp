@@ -0,0 +1,258 @@
+#ifndef SQLASYNC_HPP
+#define SQLASYNC_HPP
+
+#include <mysql/mysql.h>
+#include <string>
+#include <memory>
+#include <functional>
+#include <assert.h>
+
+#include "../logger/logger.hpp"
+#include "sqlconnpool.hpp"
+#include "sqlstmt.hpp"
+
+/*
+    非阻塞执行单条SQL，基于MariaDB Connector/C的mysql_*_start/_cont
+    1、连接需先开启MYSQL_OPT_NONBLOCK（见SqlConnPool::SetNonBlocking）
+    2、库函数需要等待socket时，经wait钩子把连接fd登记到reactor，就绪或超时后在io执行器上继续
+    3、执行查询并按需取回结果集，完成后回调；结果集由回调方释放
+    4、预编译语句走连接池的语句缓存，首次在该连接上使用时先非阻塞预编译，句柄失效时重新预编译并重试一次
+    客户端库不提供非阻塞接口时退化为同步执行，此时SqlConnPool不会开启非阻塞模式，调用方应改走db执行器
+*/
+class SqlAsyncQuery final {
+public:
+    //等待事件，与MYSQL_WAIT_*取值一致
+    enum WAIT_EVENT {
+        WAIT_READ = 1,
+        WAIT_WRITE = 2,
+        WAIT_EXCEPT = 4,
+        WAIT_TIMEOUT = 8,
+    };
+    //isOk为查询是否成功，res为结果集（不取结果集或无结果时为nullptr）
+    typedef std::function<void(bool isOk, MYSQL_RES* res)> Callback;
+
+    //登记等待：连接fd、等待的WAIT_EVENT组合、超时毫秒（含WAIT_TIMEOUT时有效）、就绪回调（参数为已发生的WAIT_EVENT）
+    static std::function<void(int, int, unsigned, std::function<void(int)>)> wait;
+
+    //在sql上执行query，isStore为true时取回结果集
+    static void Run(MYSQL* sql, const char* query, bool isStore, Callback done);
+    //在sql上执行预编译语句call，结果留在call中，done参数为是否成功
+    static void RunStmt(MYSQL* sql, std::shared_ptr<SqlStmtCall> call, std::function<void(bool)> done);
+
+private:
+    enum STEP {
+        STEP_QUERY,
+        STEP_STORE,
+        STEP_PREPARE,
+        STEP_EXECUTE,
+        STEP_STMT_STORE,
+    };
+
+    struct State {
+        MYSQL* sql;
+        STEP step;
+        int ret;
+        //文本查询
+        std::string query;
+        bool isStore;
+        MYSQL_RES* res;
+        Callback done;
+        //预编译语句
+        std::shared_ptr<SqlStmtCall> call;
+        MYSQL_STMT* stmt;
+        bool isRetried;
+        std::function<void(bool)> stmtDone;
+    };
+
+    //status为start/_cont的返回值，非0时挂起等待，否则推进到下一步
+    static void Advance_(const std::shared_ptr<State>& state, int status);
+    //预编译语句的一步完成，发起下一步并返回其状态；全部完成或失败时回调并返回-1
+    static int AdvanceStmt_(const std::shared_ptr<State>& state);
+    //取缓存的语句句柄直接执行，没有则先预编译
+    static int BeginStmt_(const std::shared_ptr<State>& state);
+    static int FinishStmt_(const std::shared_ptr<State>& state, bool isOk);
+    //等待结束，带着已发生的事件继续当前步骤
+    static void Continue_(const std::shared_ptr<State>& state, int ready);
+};
+
+std::function<void(int, int, unsigned, std::function<void(int)>)> SqlAsyncQuery::wait;
+
+#ifdef MYSQL_WAIT_READ
+
+void SqlAsyncQuery::Run(MYSQL* sql, const char* query, bool isStore, Callback done) {
+    assert(sql && wait);
+    std::shared_ptr<State> state = std::make_shared<State>();
+    state->sql = sql;
+    //查询串在整个发送过程中都要有效
+    state->query = query;
+    state->isStore = isStore;
+    state->done = std::move(done);
+    state->step = STEP_QUERY;
+    state->ret = 0;
+    state->res = nullptr;
+    state->stmt = nullptr;
+    int status = mysql_real_query_start(&state->ret, sql, state->query.data(), state->query.size());
+    Advance_(state, status);
+}
+
+void SqlAsyncQuery::RunStmt(MYSQL* sql, std::shared_ptr<SqlStmtCall> call, std::function<void(bool)> done) {
+    assert(sql && call && wait);
+    std::shared_ptr<State> state = std::make_shared<State>();
+    state->sql = sql;
+    state->ret = 0;
+    state->isStore = false;
+    state->res = nullptr;
+    state->call = std::move(call);
+    state->stmt = nullptr;
+    state->isRetried = false;
+    state->stmtDone = std::move(done);
+    int status = BeginStmt_(state);
+    if(status >= 0) {
+        Advance_(state, status);
+    }
+}
+
+int SqlAsyncQuery::BeginStmt_(const std::shared_ptr<State>& state) {
+    SQL_STMT_ID id = state->call->GetId();
+    state->stmt = SqlConnPool::GetInstance()->GetStmt(state->sql, id);
+    if(state->stmt) {
+        if(!state->call->BindParams(state->stmt)) {
+            return FinishStmt_(state, false);
+        }
+        state->step = STEP_EXECUTE;
+        return mysql_stmt_execute_start(&state->ret, state->stmt);
+    }
+    state->stmt = mysql_stmt_init(state->sql);
+    if(!state->stmt) {
+        return FinishStmt_(state, false);
+    }
+    state->step = STEP_PREPARE;
+    return mysql_stmt_prepare_start(&state->ret, state->stmt, SQL_STMT_TEXT[id], strlen(SQL_STMT_TEXT[id]));
+}
+
+int SqlAsyncQuery::AdvanceStmt_(const std::shared_ptr<State>& state) {
+    SQL_STMT_ID id = state->call->GetId();
+    switch(state->step) {
+    case STEP_PREPARE:
+        if(state->ret != 0) {
+            LOG_ERROR("Prepare stmt %d error: %s", (int)id, mysql_stmt_error(state->stmt));
+            mysql_stmt_close(state->stmt);
+            state->stmt = nullptr;
+            return FinishStmt_(state, false);
+        }
+        SqlConnPool::GetInstance()->PutStmt(state->sql, id, state->stmt);
+        if(!state->call->BindParams(state->stmt)) {
+            return FinishStmt_(state, false);
+        }
+        state->step = STEP_EXECUTE;
+        return mysql_stmt_execute_start(&state->ret, state->stmt);
+    case STEP_EXECUTE:
+        if(state->ret != 0) {
+            unsigned int err = mysql_stmt_errno(state->stmt);
+            LOG_ERROR("Exec stmt %d error: %s", (int)id, mysql_stmt_error(state->stmt));
+            if(!SqlStmtCall::IsStale(err) || state->isRetried) {
+                return FinishStmt_(state, false);
+            }
+            //服务端已丢弃语句，重新预编译后再执行一次
+            state->isRetried = true;
+            SqlConnPool::GetInstance()->DropStmt(state->sql, id);
+            return BeginStmt_(state);
+        }
+        if(!state->call->BindResult(state->stmt)) {
+            return FinishStmt_(state, false);
+        }
+        state->step = STEP_STMT_STORE;
+        return mysql_stmt_store_result_start(&state->ret, state->stmt);
+    default:
+        if(state->ret != 0) {
+            LOG_ERROR("Store stmt %d error: %s", (int)id, mysql_stmt_error(state->stmt));
+            return FinishStmt_(state, false);
+        }
+        return FinishStmt_(state, state->call->FetchAll(state->stmt));
+    }
+}
+
+int SqlAsyncQuery::FinishStmt_(const std::shared_ptr<State>& state, bool isOk) {
+    state->stmtDone(isOk);
+    return -1;
+}
+
+void SqlAsyncQuery::Advance_(const std::shared_ptr<State>& state, int status) {
+    while(true) {
+        if(status < 0) {
+            return;
+        }
+        if(status != 0) {
+            unsigned timeoutMs = (status & WAIT_TIMEOUT) ? mysql_get_timeout_value_ms(state->sql) : 0;
+            std::shared_ptr<State> holder = state;
+            wait(mysql_get_socket(state->sql), status, timeoutMs, [holder](int ready) {
+                Continue_(holder, ready);
+            });
+            return;
+        }
+        if(state->step >= STEP_PREPARE) {
+            status = AdvanceStmt_(state);
+            continue;
+        }
+        if(state->step == STEP_QUERY) {
+            if(state->ret != 0) {
+                LOG_ERROR("Async query error: %s", mysql_error(state->sql));
+                state->done(false, nullptr);
+                return;
+            }
+            if(!state->isStore) {
+                state->done(true, nullptr);
+                return;
+            }
+            state->step = STEP_STORE;
+            status = mysql_store_result_start(&state->res, state->sql);
+            continue;
+        }
+        //结果集为空指针且有列时为取结果失败
+        bool isOk = state->res != nullptr || mysql_field_count(state->sql) == 0;
+        state->done(isOk, state->res);
+        return;
+    }
+}
+
+void SqlAsyncQuery::Continue_(const std::shared_ptr<State>& state, int ready) {
+    int status = 0;
+    switch(state->step) {
+    case STEP_QUERY:
+        status = mysql_real_query_cont(&state->ret, state->sql, ready);
+        break;
+    case STEP_STORE:
+        status = mysql_store_result_cont(&state->res, state->sql, ready);
+        break;
+    case STEP_PREPARE:
+        status = mysql_stmt_prepare_cont(&state->ret, state->stmt, ready);
+        break;
+    case STEP_EXECUTE:
+        status = mysql_stmt_execute_cont(&state->ret, state->stmt, ready);
+        break;
+    case STEP_STMT_STORE:
+        status = mysql_stmt_store_result_cont(&state->ret, state->stmt, ready);
+        break;
+    }
+    Advance_(state, status);
+}
+
+#else
+
+void SqlAsyncQuery::Run(MYSQL* sql, const char* query, bool isStore, Callback done) {
+    assert(sql);
+    if(mysql_query(sql, query)) {
+        done(false, nullptr);
+        return;
+    }
+    done(true, isStore ? mysql_store_result(sql) : nullptr);
+}
+
+void SqlAsyncQuery::RunStmt(MYSQL* sql, std::shared_ptr<SqlStmtCall> call, std::function<void(bool)> done) {
+    assert(sql && call);
+    done(SqlConnPool::GetInstance()->ExecStmt(sql, *call));
+}
+
+#endif
+
+#endif
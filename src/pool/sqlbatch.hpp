@@ -0,0 +1,292 @@
+#ifndef SQLBATCH_HPP
+#define SQLBATCH_HPP
+
+#include <mysql/mysql.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_set>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <assert.h>
+
+#include "../logger/logger.hpp"
+#include "sqlconnpool.hpp"
+#include "sqlconnRAII.hpp"
+
+/*
+    注册INSERT的组提交
+    1、注册请求登记到队列，攒满maxRows行或最早一行等满maxDelayMs后由批处理线程一次提交
+    2、一个事务内先SELECT ... FOR UPDATE锁住这批用户名，已存在的和批内重名的判失败，其余一条多行INSERT写入后COMMIT
+    3、事务失败时回滚，逐行各走一次同样的查重事务，各请求仍拿到自己的结果；重名始终判失败，不依赖username唯一键
+    回调在批处理线程上执行，应只做投递等轻量操作
+*/
+class UserInsertBatch final {
+public:
+    static UserInsertBatch* GetInstance();
+
+    void Init(bool open, int maxRows, int maxDelayMs);
+    bool IsOpen() const;
+    //登记一次注册，提交后以是否插入成功回调
+    void Submit(const char* user, const char* pw, std::function<void(bool)> done);
+    //登记并阻塞等待结果，不可在批处理线程上调用
+    bool Insert(const char* user, const char* pw);
+    //提交剩余请求后停止批处理线程
+    void Close();
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Pending {
+        std::string user;
+        std::string pw;
+        Clock::time_point enqueued;
+        std::function<void(bool)> done;
+    };
+
+    UserInsertBatch() = default;
+    ~UserInsertBatch();
+
+    void Work_();
+    void Flush_(std::vector<Pending>& batch);
+    //事务内批量插入，results为各行是否插入；事务失败返回false
+    static bool Commit_(MYSQL* sql, const std::vector<Pending>& batch, std::vector<bool>& results);
+    //逐行查重插入，事务失败时的退路
+    static void InsertEach_(MYSQL* sql, const std::vector<Pending>& batch, std::vector<bool>& results);
+    static std::string Quote_(MYSQL* sql, const std::string& value);
+
+    bool isOpen_ = false;
+    bool isClose_ = false;
+    size_t maxRows_ = 64;
+    std::chrono::milliseconds maxDelay_{2};
+    std::mutex mtx_;
+    std::condition_variable cond_;
+    std::deque<Pending> pending_;
+    std::thread worker_;
+    uint64_t batches_ = 0;
+    uint64_t rows_ = 0;
+};
+
+UserInsertBatch* UserInsertBatch::GetInstance() {
+    static UserInsertBatch batch;
+    return &batch;
+}
+
+void UserInsertBatch::Init(bool open, int maxRows, int maxDelayMs) {
+    assert(maxRows > 0 && maxDelayMs >= 0);
+    std::lock_guard<std::mutex> locker(mtx_);
+    maxRows_ = maxRows;
+    maxDelay_ = std::chrono::milliseconds(maxDelayMs);
+    if(!open || worker_.joinable()) {
+        return;
+    }
+    isOpen_ = true;
+    isClose_ = false;
+    worker_ = std::thread(&UserInsertBatch::Work_, this);
+    pthread_setname_np(worker_.native_handle(), "sqlbatch");
+    LOG_INFO("UserInsertBatch maxRows: %d, maxDelay: %dms", maxRows, maxDelayMs);
+}
+
+bool UserInsertBatch::IsOpen() const {
+    return isOpen_;
+}
+
+void UserInsertBatch::Submit(const char* user, const char* pw, std::function<void(bool)> done) {
+    {
+        std::lock_guard<std::mutex> locker(mtx_);
+        if(!isClose_ && isOpen_) {
+            pending_.push_back({user, pw, Clock::now(), std::move(done)});
+            //第一行开始计时，攒满时立即提交
+            if(pending_.size() == 1 || pending_.size() >= maxRows_) {
+                cond_.notify_one();
+            }
+            return;
+        }
+    }
+    done(false);
+}
+
+bool UserInsertBatch::Insert(const char* user, const char* pw) {
+    bool isInserted = false;
+    bool isDone = false;
+    std::mutex doneMtx;
+    std::condition_variable cond;
+    Submit(user, pw, [&isInserted, &isDone, &doneMtx, &cond](bool isOk) {
+        std::lock_guard<std::mutex> locker(doneMtx);
+        isInserted = isOk;
+        isDone = true;
+        cond.notify_one();
+    });
+    std::unique_lock<std::mutex> locker(doneMtx);
+    cond.wait(locker, [&isDone]() {
+        return isDone;
+    });
+    return isInserted;
+}
+
+void UserInsertBatch::Close() {
+    {
+        std::lock_guard<std::mutex> locker(mtx_);
+        if(isClose_ || !worker_.joinable()) {
+            return;
+        }
+        isClose_ = true;
+    }
+    cond_.notify_one();
+    worker_.join();
+    LOG_INFO("UserInsertBatch closed, %llu rows in %llu batches",
+             (unsigned long long)rows_, (unsigned long long)batches_);
+}
+
+UserInsertBatch::~UserInsertBatch() {
+    Close();
+}
+
+void UserInsertBatch::Work_() {
+    std::unique_lock<std::mutex> locker(mtx_);
+    while(true) {
+        cond_.wait(locker, [this]() {
+            return isClose_ || !pending_.empty();
+        });
+        if(pending_.empty()) {
+            break;
+        }
+        //等同批的其他注册，关闭时不再等待
+        Clock::time_point deadline = pending_.front().enqueued + maxDelay_;
+        cond_.wait_until(locker, deadline, [this]() {
+            return isClose_ || pending_.size() >= maxRows_;
+        });
+        size_t count = std::min(pending_.size(), maxRows_);
+        std::vector<Pending> batch;
+        batch.reserve(count);
+        for(size_t i = 0; i < count; ++i) {
+            batch.push_back(std::move(pending_.front()));
+            pending_.pop_front();
+        }
+        ++batches_;
+        rows_ += count;
+        locker.unlock();
+        Flush_(batch);
+        locker.lock();
+    }
+}
+
+void UserInsertBatch::Flush_(std::vector<Pending>& batch) {
+    std::vector<bool> results(batch.size(), false);
+    {
+        MYSQL* sql = nullptr;
+        SqlConnRAII sqlRAII(&sql, SqlConnPool::GetInstance());
+        if(sql && !Commit_(sql, batch, results)) {
+            if(mysql_query(sql, "ROLLBACK")) {
+                LOG_ERROR("UserInsertBatch rollback error: %s", mysql_error(sql));
+            }
+            results.assign(batch.size(), false);
+            InsertEach_(sql, batch, results);
+        }
+    }
+    //连接归还后再回调
+    for(size_t i = 0; i < batch.size(); ++i) {
+        batch[i].done(results[i]);
+    }
+}
+
+bool UserInsertBatch::Commit_(MYSQL* sql, const std::vector<Pending>& batch, std::vector<bool>& results) {
+    //批内重名只有第一行参与插入
+    std::unordered_set<std::string> names;
+    std::vector<size_t> rows;
+    std::vector<std::string> quoted(batch.size());
+    std::string inList;
+    for(size_t i = 0; i < batch.size(); ++i) {
+        if(!names.insert(batch[i].user).second) {
+            continue;
+        }
+        rows.push_back(i);
+        quoted[i] = Quote_(sql, batch[i].user);
+        inList += inList.empty() ? quoted[i] : "," + quoted[i];
+    }
+    if(mysql_query(sql, "START TRANSACTION")) {
+        LOG_ERROR("UserInsertBatch begin error: %s", mysql_error(sql));
+        return false;
+    }
+    //锁住这批用户名（含不存在时的间隙），提交前其他事务无法插入同名用户
+    std::string select = "SELECT username FROM user WHERE username IN (" + inList + ") FOR UPDATE";
+    if(mysql_query(sql, select.c_str())) {
+        LOG_ERROR("UserInsertBatch select error: %s", mysql_error(sql));
+        return false;
+    }
+    MYSQL_RES* res = mysql_store_result(sql);
+    if(!res) {
+        return false;
+    }
+    std::unordered_set<std::string> taken;
+    while(MYSQL_ROW row = mysql_fetch_row(res)) {
+        if(row[0]) {
+            taken.insert(row[0]);
+        }
+    }
+    mysql_free_result(res);
+
+    std::string insert = "INSERT INTO user(username, password) VALUES";
+    size_t insertCnt = 0;
+    for(size_t i : rows) {
+        if(taken.count(batch[i].user)) {
+            continue;
+        }
+        insert += insertCnt == 0 ? "(" : ",(";
+        insert += quoted[i] + "," + Quote_(sql, batch[i].pw) + ")";
+        ++insertCnt;
+    }
+    if(insertCnt > 0) {
+        if(mysql_query(sql, insert.c_str())) {
+            LOG_ERROR("UserInsertBatch insert error: %s", mysql_error(sql));
+            return false;
+        }
+        if(mysql_affected_rows(sql) != insertCnt) {
+            return false;
+        }
+    }
+    if(mysql_query(sql, "COMMIT")) {
+        LOG_ERROR("UserInsertBatch commit error: %s", mysql_error(sql));
+        return false;
+    }
+    for(size_t i : rows) {
+        results[i] = taken.count(batch[i].user) == 0;
+    }
+    LOG_DEBUG("UserInsertBatch %d rows, %d inserted", (int)batch.size(), (int)insertCnt);
+    return true;
+}
+
+void UserInsertBatch::InsertEach_(MYSQL* sql, const std::vector<Pending>& batch, std::vector<bool>& results) {
+    //每行单独一个Commit_事务：已存在的与批内重名的同样判失败，退路不能绕过查重
+    std::unordered_set<std::string> names;
+    for(size_t i = 0; i < batch.size(); ++i) {
+        results[i] = false;
+        if(!names.insert(batch[i].user).second) {
+            continue;
+        }
+        std::vector<Pending> row(1, batch[i]);
+        std::vector<bool> rowResult(1, false);
+        if(Commit_(sql, row, rowResult)) {
+            results[i] = rowResult[0];
+        }
+        else if(mysql_query(sql, "ROLLBACK")) {
+            LOG_ERROR("UserInsertBatch rollback error: %s", mysql_error(sql));
+        }
+    }
+}
+
+std::string UserInsertBatch::Quote_(MYSQL* sql, const std::string& value) {
+    //按连接字符集转义，最坏每字节变两字节
+    std::string quoted(value.size() * 2 + 3, '\0');
+    quoted[0] = '\'';
+    unsigned long len = mysql_real_escape_string(sql, &quoted[1], value.data(), value.size());
+    quoted[len + 1] = '\'';
+    quoted.resize(len + 2);
+    return quoted;
+}
+
+#endif
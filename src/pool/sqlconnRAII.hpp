@@ -15,8 +15,9 @@ public:
         sql_ = *sql;
     }
 
+    //取连接超时或数据库不可达时sql为nullptr，无需归还
     ~SqlConnRAII() {
-        if(sqlPool_) {
+        if(sqlPool_ && sql_) {
             sqlPool_->FreeSqlConn(sql_);        
         }
     }
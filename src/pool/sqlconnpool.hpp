@@ -2,67 +2,225 @@
 #define SQLCONNPOOL_HPP
 
 #include <mysql/mysql.h>
+#include <mysql/errmsg.h>
 #include <string>
-#include <queue>
+#include <deque>
+#include <vector>
+#include <unordered_map>
 #include <mutex>
-#include <semaphore.h>
+#include <condition_variable>
+#include <functional>
 #include <thread>
+#include <chrono>
+#include <algorithm>
+#include <stdint.h>
 #include <cassert>
 
 #include "../logger/logger.hpp"
+#include "sqlstmt.hpp"
 
-//Mysql连接类
+//连接池运行状态快照
+struct SqlConnPoolStats {
+    int minNum;
+    int maxNum;
+    //已建立的连接数（空闲+借出+保活检查中）与正在建立的连接数
+    int connNum;
+    int connectingNum;
+    int idleNum;
+    int inUseNum;
+    size_t waiterNum;
+    //最近一次建连失败且没有可用连接，取连接直接失败
+    bool isDown;
+    //累计计数
+    uint64_t acquires;
+    uint64_t waits;
+    uint64_t waitUs;
+    uint64_t maxWaitUs;
+    uint64_t timeouts;
+    uint64_t fastFails;
+    uint64_t creates;
+    uint64_t createFails;
+    uint64_t closes;
+    uint64_t pingFails;
+    uint64_t uptimeUs;
+};
+
+/*
+    Mysql连接池
+    1、连接按需建立，常驻minNum个，最多maxNum个；超出常驻数的连接空闲idleMs后关闭
+    2、后台维护线程负责建连、保活ping、替换失效连接与取连接超时
+    3、取连接排队超过acquireTimeoutMs返回空；数据库不可达时不再排队，直接失败，维护线程按retryMs重试建连
+*/
 class SqlConnPool final {
 public:
-    //初始化连接池
-    void InitSqlPool(const char* host, unsigned port, 
-                     const char* user, const char* passwd, 
+    //初始化连接池：记录连接参数并启动维护线程，连接在首次使用或按常驻数预热时建立
+    void InitSqlPool(const char* host, unsigned port,
+                     const char* user, const char* passwd,
                      const char* dbname, int maxcount);
+    //调整伸缩与保活参数：常驻连接数、空闲关闭、保活间隔、取连接超时（0为不超时）、建连失败重试间隔
+    void SetElastic(int minCount, int idleMs, int keepaliveMs, int acquireTimeoutMs, int retryMs);
     //返回单例对象
     static SqlConnPool* GetInstance();
-    //创建连接
+    //取连接，池空时阻塞排队，超时或数据库不可达返回nullptr
     MYSQL* GetSqlConn();
-    //释放连接
+    //异步取连接：有空闲连接时当场回调，否则排队，由归还连接或新建连接的线程按先后交给等待者；失败时回调参数为nullptr
+    void GetSqlConnAsync(std::function<void(MYSQL*)> callback);
+    //释放连接，连接已断开时关闭并由维护线程补建
     void FreeSqlConn(MYSQL* sql);
     //获取连接池剩余大小
     int GetFreeConnCount();
+    //排队等待连接的数量
+    int GetWaiterCount();
+    SqlConnPoolStats GetStats();
+    //开启连接的非阻塞模式，客户端库不支持（非MariaDB Connector/C）时返回false
+    bool SetNonBlocking(bool isNonBlocking);
+    bool IsNonBlocking() const;
+
+    //sql上按编号缓存的预编译语句，尚未预编译或连接已重连时返回nullptr；调用方须持有该连接
+    MYSQL_STMT* GetStmt(MYSQL* sql, SQL_STMT_ID id);
+    //缓存sql上预编译完成的语句
+    void PutStmt(MYSQL* sql, SQL_STMT_ID id, MYSQL_STMT* stmt);
+    //语句句柄失效，关闭并移出缓存，下次使用时重新预编译
+    void DropStmt(MYSQL* sql, SQL_STMT_ID id);
+    //阻塞执行预编译语句，首次使用时预编译；句柄失效时重新预编译并重试一次
+    bool ExecStmt(MYSQL* sql, SqlStmtCall& call);
     //关闭连接池
     void CloseSqlConnPool();
 
 private:
+    typedef std::chrono::steady_clock Clock;
+    //维护线程的最长休眠，保证保活与空闲关闭的精度
+    static const int MAINTAIN_TICK_MS = 500;
+    //建连超时秒数，数据库切换期间避免维护线程长时间卡在connect
+    static const unsigned CONNECT_TIMEOUT_S = 3;
+
     //SQL连接池构造/析构私有化
     SqlConnPool() = default;
     SqlConnPool(const SqlConnPool&) = default;
-    ~SqlConnPool();    
+    ~SqlConnPool();
+
+    struct IdleConn {
+        MYSQL* sql;
+        //最近一次归还的时间，空闲关闭按此计算，队列按此排序
+        Clock::time_point lastUsed;
+        //最近一次归还或保活成功的时间
+        Clock::time_point lastChecked;
+    };
+    struct Waiter {
+        Clock::time_point enqueued;
+        //超时后由维护线程以nullptr回调
+        Clock::time_point deadline;
+        std::function<void(MYSQL*)> callback;
+    };
+    //单个连接上的语句缓存，threadId为预编译时的服务端连接号，重连后变化
+    struct ConnStmts {
+        unsigned long threadId;
+        MYSQL_STMT* stmts[STMT_COUNT];
+    };
+
+    //维护线程主循环
+    void Maintain_();
+    //建立一个新连接，失败返回nullptr；不持锁调用
+    MYSQL* Connect_();
+    //关闭连接及其语句缓存；不持锁调用，连接须已不在池中
+    void Close_(MYSQL* sql);
+    //空闲连接与等待者配对，返回待锁外执行的回调；须持有mtx_
+    void Dispatch_(std::vector<std::pair<std::function<void(MYSQL*)>, MYSQL*>>& ready);
+    //按排队时长计入等待统计并借出；须持有mtx_
+    void Lend_(const Waiter& waiter);
+    //还需新建的连接数；须持有mtx_
+    int NeedConnect_() const;
+    ConnStmts& GetConnStmts_(MYSQL* sql);
+    //连接已断开，只能关闭重建
+    static bool IsDead_(MYSQL* sql);
+
+    //连接参数
+    std::string host_;
+    unsigned port_ = 0;
+    std::string user_;
+    std::string passwd_;
+    std::string dbName_;
 
     //连接池大小
-    int maxSqlCount_;
-    //池队列
-    std::queue<MYSQL*> connQueue_;
+    int minSqlCount_ = 0;
+    int maxSqlCount_ = 0;
+    std::chrono::milliseconds idleTime_{60000};
+    std::chrono::milliseconds keepalive_{30000};
+    std::chrono::milliseconds acquireTimeout_{3000};
+    std::chrono::milliseconds retryTime_{1000};
+
+    //空闲连接，表尾为最近归还
+    std::deque<IdleConn> connQueue_;
     //单例模式使用互斥锁
     std::mutex mtx_;
-    //信号量，防止池空时遗漏请求
-    sem_t sem_;
+    //池空时的等待者，同步与异步取连接在同一队列中先到先得
+    std::deque<Waiter> waiters_;
+    bool isNonBlocking_ = false;
+    bool isClose_ = false;
+    //已建立的连接（含借出与保活检查中）与建连中的连接
+    int connCount_ = 0;
+    int connectingCount_ = 0;
+    int inUseCount_ = 0;
+    bool isDown_ = false;
+    Clock::time_point nextRetry_;
+    Clock::time_point started_;
+    //唤醒维护线程：需要建连、参数变化或关池
+    std::condition_variable maintainCond_;
+    std::thread maintainer_;
+
+    uint64_t acquires_ = 0;
+    uint64_t waits_ = 0;
+    uint64_t waitUs_ = 0;
+    uint64_t maxWaitUs_ = 0;
+    uint64_t timeouts_ = 0;
+    uint64_t fastFails_ = 0;
+    uint64_t creates_ = 0;
+    uint64_t createFails_ = 0;
+    uint64_t closes_ = 0;
+    uint64_t pingFails_ = 0;
+
+    //键随连接建立与关闭增删，查找持mtx_；条目只由当前持有连接者访问
+    std::unordered_map<MYSQL*, ConnStmts> stmts_;
 };
 
+const int SqlConnPool::MAINTAIN_TICK_MS;
+const unsigned SqlConnPool::CONNECT_TIMEOUT_S;
+
 
-void SqlConnPool::InitSqlPool(const char* host, unsigned port, 
-                              const char* user, const char* passwd, 
+void SqlConnPool::InitSqlPool(const char* host, unsigned port,
+                              const char* user, const char* passwd,
                               const char* dbname, int maxcount) {
     assert(maxcount > 0);
-    for(int i = 0; i < maxcount; ++i) {
-        MYSQL* sql = nullptr;
-        //api内部构建对象在堆区返回句柄
-        sql = mysql_init(sql);
-        assert(sql);
-        //用句柄连接，失败返回空
-        sql = mysql_real_connect(sql, host, user, passwd, dbname, port, nullptr, 0);
-        assert(sql != NULL);
-        connQueue_.push(sql);
-    }
+    std::lock_guard<std::mutex> locker(mtx_);
+    host_ = host;
+    port_ = port;
+    user_ = user;
+    passwd_ = passwd;
+    dbName_ = dbname;
     maxSqlCount_ = maxcount;
-    sem_init(&sem_, 0, maxSqlCount_);
-    LOG_INFO("SQLPool init success!");
+    minSqlCount_ = std::min(minSqlCount_, maxSqlCount_);
+    isClose_ = false;
+    started_ = Clock::now();
+    nextRetry_ = started_;
+    maintainer_ = std::thread(&SqlConnPool::Maintain_, this);
+    pthread_setname_np(maintainer_.native_handle(), "sqlpool");
+    LOG_INFO("SQLPool init success! max: %d", maxcount);
+}
+
+void SqlConnPool::SetElastic(int minCount, int idleMs, int keepaliveMs, int acquireTimeoutMs, int retryMs) {
+    assert(minCount >= 0 && idleMs > 0 && keepaliveMs > 0 && acquireTimeoutMs >= 0 && retryMs > 0);
+    {
+        std::lock_guard<std::mutex> locker(mtx_);
+        minSqlCount_ = std::min(minCount, maxSqlCount_);
+        idleTime_ = std::chrono::milliseconds(idleMs);
+        keepalive_ = std::chrono::milliseconds(keepaliveMs);
+        acquireTimeout_ = std::chrono::milliseconds(acquireTimeoutMs);
+        retryTime_ = std::chrono::milliseconds(retryMs);
+    }
+    //按新的常驻数预热
+    maintainCond_.notify_one();
+    LOG_INFO("SQLPool elastic: %d ~ %d, idle: %dms, keepalive: %dms, acquireTimeout: %dms",
+             minCount, maxSqlCount_, idleMs, keepaliveMs, acquireTimeoutMs);
 }
 
 SqlConnPool* SqlConnPool::GetInstance() {
@@ -71,28 +229,86 @@ SqlConnPool* SqlConnPool::GetInstance() {
 }
 
 MYSQL* SqlConnPool::GetSqlConn() {
-    if(connQueue_.empty()) {
-        LOG_ERROR("SqlConnPool is empty, wait for connect obj");
+    MYSQL* sql = nullptr;
+    bool isDone = false;
+    std::mutex doneMtx;
+    std::condition_variable cond;
+    //与异步取连接走同一队列，归还、新建或超时的线程回调时交接连接
+    GetSqlConnAsync([&sql, &isDone, &doneMtx, &cond](MYSQL* conn) {
+        std::lock_guard<std::mutex> locker(doneMtx);
+        sql = conn;
+        isDone = true;
+        cond.notify_one();
+    });
+    std::unique_lock<std::mutex> locker(doneMtx);
+    cond.wait(locker, [&isDone]() {
+        return isDone;
+    });
+    if(!sql) {
+        LOG_ERROR("SqlConnPool get connection failed");
     }
+    return sql;
+}
+
+void SqlConnPool::GetSqlConnAsync(std::function<void(MYSQL*)> callback) {
     MYSQL* sql = nullptr;
-    sem_wait(&sem_);
     {
         std::lock_guard<std::mutex> locker(mtx_);
-        if(!connQueue_.empty()) {
-            sql = connQueue_.front();
-            connQueue_.pop();
-            LOG_INFO("Get a SQL connection object");
+        Clock::time_point now = Clock::now();
+        if(isClose_ || (connQueue_.empty() && isDown_ && connCount_ == 0 && now < nextRetry_)) {
+            //数据库不可达且没有借出的连接可等，排队也只会超时；到重试时间后排队并触发建连
+            ++fastFails_;
+        }
+        else if(connQueue_.empty()) {
+            Clock::time_point deadline = acquireTimeout_.count() > 0 ? now + acquireTimeout_ : Clock::time_point::max();
+            waiters_.push_back({now, deadline, std::move(callback)});
+            if(NeedConnect_() > 0) {
+                maintainCond_.notify_one();
+            }
+            return;
+        }
+        else {
+            //取最近归还的连接，久未使用的留给保活与空闲关闭
+            sql = connQueue_.back().sql;
+            connQueue_.pop_back();
+            ++inUseCount_;
+            ++acquires_;
         }
     }
-    //todo 可能空指针
-    return sql;
+    callback(sql);
 }
 
 void SqlConnPool::FreeSqlConn(MYSQL* sql) {
     assert(sql != nullptr);
-    std::lock_guard<std::mutex> locker(mtx_);
-    connQueue_.push(sql);
-    sem_post(&sem_);
+    bool isDead = IsDead_(sql);
+    bool isDrop = false;
+    std::vector<std::pair<std::function<void(MYSQL*)>, MYSQL*>> ready;
+    {
+        std::lock_guard<std::mutex> locker(mtx_);
+        --inUseCount_;
+        isDrop = isDead || isClose_;
+        if(isDrop) {
+            --connCount_;
+            closes_ += isDead ? 1 : 0;
+        }
+        else {
+            connQueue_.push_back({sql, Clock::now(), Clock::now()});
+            Dispatch_(ready);
+        }
+    }
+    if(isDrop) {
+        if(isDead) {
+            LOG_WARN("SQL connection lost: %s", mysql_error(sql));
+        }
+        Close_(sql);
+        //补建由维护线程完成
+        maintainCond_.notify_one();
+        return;
+    }
+    //连接直接交给最早的等待者，锁外回调
+    for(auto& item : ready) {
+        item.first(item.second);
+    }
 }
 
 int SqlConnPool::GetFreeConnCount() {
@@ -100,13 +316,359 @@ int SqlConnPool::GetFreeConnCount() {
     return connQueue_.size();
 }
 
-void SqlConnPool::CloseSqlConnPool() {
+int SqlConnPool::GetWaiterCount() {
+    std::lock_guard<std::mutex> locker(mtx_);
+    return waiters_.size();
+}
+
+SqlConnPoolStats SqlConnPool::GetStats() {
+    std::lock_guard<std::mutex> locker(mtx_);
+    SqlConnPoolStats stats;
+    stats.minNum = minSqlCount_;
+    stats.maxNum = maxSqlCount_;
+    stats.connNum = connCount_;
+    stats.connectingNum = connectingCount_;
+    stats.idleNum = static_cast<int>(connQueue_.size());
+    stats.inUseNum = inUseCount_;
+    stats.waiterNum = waiters_.size();
+    stats.isDown = isDown_;
+    stats.acquires = acquires_;
+    stats.waits = waits_;
+    stats.waitUs = waitUs_;
+    stats.maxWaitUs = maxWaitUs_;
+    stats.timeouts = timeouts_;
+    stats.fastFails = fastFails_;
+    stats.creates = creates_;
+    stats.createFails = createFails_;
+    stats.closes = closes_;
+    stats.pingFails = pingFails_;
+    stats.uptimeUs = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - started_).count();
+    return stats;
+}
+
+bool SqlConnPool::SetNonBlocking(bool isNonBlocking) {
+    std::lock_guard<std::mutex> locker(mtx_);
+#ifdef MYSQL_WAIT_READ
+    bool isOk = true;
+    if(isNonBlocking) {
+        //已建立的空闲连接逐个开启mysql_*_start/_cont所需的协程栈，之后新建的连接在Connect_中开启
+        for(IdleConn& conn : connQueue_) {
+            if(mysql_options(conn.sql, MYSQL_OPT_NONBLOCK, 0) != 0) {
+                isOk = false;
+            }
+        }
+    }
+    isNonBlocking_ = isNonBlocking && isOk;
+    return isOk;
+#else
+    isNonBlocking_ = false;
+    return !isNonBlocking;
+#endif
+}
+
+bool SqlConnPool::IsNonBlocking() const {
+    return isNonBlocking_;
+}
+
+void SqlConnPool::Maintain_() {
+    std::unique_lock<std::mutex> locker(mtx_);
+    while(!isClose_) {
+        Clock::time_point now = Clock::now();
+        Clock::time_point wake = now + std::chrono::milliseconds(MAINTAIN_TICK_MS);
+        if(!waiters_.empty()) {
+            wake = std::min(wake, waiters_.front().deadline);
+        }
+        maintainCond_.wait_until(locker, wake, [this]() {
+            return isClose_ || (NeedConnect_() > 0 && Clock::now() >= nextRetry_) ||
+                   (!waiters_.empty() && waiters_.front().deadline <= Clock::now());
+        });
+        if(isClose_) {
+            break;
+        }
+        std::vector<std::pair<std::function<void(MYSQL*)>, MYSQL*>> ready;
+
+        //1、取连接超时，同一超时时长下表头最早到期
+        now = Clock::now();
+        while(!waiters_.empty() && waiters_.front().deadline <= now) {
+            ready.emplace_back(std::move(waiters_.front().callback), nullptr);
+            waiters_.pop_front();
+            ++timeouts_;
+        }
+
+        //2、补足常驻数与等待者所需的连接，失败后等retryMs再试
+        while(!isClose_ && NeedConnect_() > 0 && Clock::now() >= nextRetry_) {
+            ++connectingCount_;
+            locker.unlock();
+            MYSQL* sql = Connect_();
+            locker.lock();
+            --connectingCount_;
+            if(!sql) {
+                ++createFails_;
+                if(!isDown_) {
+                    LOG_ERROR("SQLPool down, retry every %dms", (int)retryTime_.count());
+                }
+                isDown_ = true;
+                nextRetry_ = Clock::now() + retryTime_;
+                if(connCount_ == 0) {
+                    //没有借出的连接会归还，等待者直接失败
+                    while(!waiters_.empty()) {
+                        ready.emplace_back(std::move(waiters_.front().callback), nullptr);
+                        waiters_.pop_front();
+                        ++fastFails_;
+                    }
+                }
+                break;
+            }
+#ifdef MYSQL_WAIT_READ
+            //持锁判断，避免与SetNonBlocking交错漏开
+            if(isNonBlocking_ && mysql_options(sql, MYSQL_OPT_NONBLOCK, 0) != 0) {
+                LOG_ERROR("SQL connection non-blocking error");
+                locker.unlock();
+                Close_(sql);
+                locker.lock();
+                ++createFails_;
+                nextRetry_ = Clock::now() + retryTime_;
+                break;
+            }
+#endif
+            ++creates_;
+            ++connCount_;
+            if(isDown_) {
+                LOG_INFO("SQLPool reconnected");
+            }
+            isDown_ = false;
+            if(connCount_ > minSqlCount_) {
+                LOG_INFO("SQLPool grow to %d connections, waiters: %d", connCount_, (int)waiters_.size());
+            }
+            connQueue_.push_back({sql, Clock::now(), Clock::now()});
+            Dispatch_(ready);
+        }
+
+        //3、空闲超时：超出常驻数的连接从最久未用的开始关闭
+        now = Clock::now();
+        std::vector<MYSQL*> closing;
+        while(!connQueue_.empty() && connCount_ > minSqlCount_ &&
+              now - connQueue_.front().lastUsed >= idleTime_) {
+            closing.push_back(connQueue_.front().sql);
+            connQueue_.pop_front();
+            --connCount_;
+        }
+        //4、保活：取出久未检查的空闲连接ping，失效则关闭，由下一轮补建
+        std::vector<IdleConn> checking;
+        for(auto iter = connQueue_.begin(); iter != connQueue_.end();) {
+            if(now - iter->lastChecked >= keepalive_) {
+                checking.push_back(*iter);
+                iter = connQueue_.erase(iter);
+            }
+            else {
+                ++iter;
+            }
+        }
+        if(ready.empty() && closing.empty() && checking.empty()) {
+            continue;
+        }
+        locker.unlock();
+        for(auto& item : ready) {
+            item.first(item.second);
+        }
+        ready.clear();
+        for(MYSQL* sql : closing) {
+            Close_(sql);
+        }
+        std::vector<IdleConn> alive;
+        int deadCount = 0;
+        for(IdleConn& conn : checking) {
+            if(mysql_ping(conn.sql) == 0) {
+                conn.lastChecked = Clock::now();
+                alive.push_back(conn);
+                continue;
+            }
+            LOG_WARN("SQL keepalive failed: %s", mysql_error(conn.sql));
+            Close_(conn.sql);
+            ++deadCount;
+        }
+        locker.lock();
+        if(!closing.empty()) {
+            LOG_INFO("SQLPool shrink to %d connections", connCount_);
+        }
+        closes_ += closing.size() + deadCount;
+        pingFails_ += deadCount;
+        connCount_ -= deadCount;
+        //按归还时间放回原位，保持表头最久未用
+        for(IdleConn& conn : alive) {
+            auto pos = std::find_if(connQueue_.begin(), connQueue_.end(), [&conn](const IdleConn& other) {
+                return other.lastUsed > conn.lastUsed;
+            });
+            connQueue_.insert(pos, conn);
+        }
+        //保活期间到来的等待者优先拿到这些连接
+        Dispatch_(ready);
+        if(!ready.empty()) {
+            locker.unlock();
+            for(auto& item : ready) {
+                item.first(item.second);
+            }
+            locker.lock();
+        }
+    }
+}
+
+MYSQL* SqlConnPool::Connect_() {
+    //api内部构建对象在堆区返回句柄
+    MYSQL* sql = mysql_init(nullptr);
+    if(!sql) {
+        return nullptr;
+    }
+    unsigned int timeout = CONNECT_TIMEOUT_S;
+    mysql_options(sql, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
+    //用句柄连接，失败返回空
+    if(!mysql_real_connect(sql, host_.c_str(), user_.c_str(), passwd_.c_str(), dbName_.c_str(), port_, nullptr, 0)) {
+        LOG_ERROR("SQL connect error: %s", mysql_error(sql));
+        mysql_close(sql);
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> locker(mtx_);
+    stmts_[sql] = ConnStmts{0, {}};
+    return sql;
+}
+
+void SqlConnPool::Close_(MYSQL* sql) {
+    ConnStmts stmts;
+    {
+        std::lock_guard<std::mutex> locker(mtx_);
+        auto iter = stmts_.find(sql);
+        assert(iter != stmts_.end());
+        stmts = iter->second;
+        stmts_.erase(iter);
+    }
+    for(MYSQL_STMT* stmt : stmts.stmts) {
+        if(stmt) {
+            mysql_stmt_close(stmt);
+        }
+    }
+    //调用mysqlAPI释放连接实例
+    mysql_close(sql);
+}
+
+void SqlConnPool::Dispatch_(std::vector<std::pair<std::function<void(MYSQL*)>, MYSQL*>>& ready) {
+    while(!waiters_.empty() && !connQueue_.empty()) {
+        MYSQL* sql = connQueue_.back().sql;
+        connQueue_.pop_back();
+        Lend_(waiters_.front());
+        ready.emplace_back(std::move(waiters_.front().callback), sql);
+        waiters_.pop_front();
+    }
+}
+
+void SqlConnPool::Lend_(const Waiter& waiter) {
+    uint64_t waitUs = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - waiter.enqueued).count();
+    ++inUseCount_;
+    ++acquires_;
+    ++waits_;
+    waitUs_ += waitUs;
+    maxWaitUs_ = std::max(maxWaitUs_, waitUs);
+}
+
+int SqlConnPool::NeedConnect_() const {
+    //建连中的连接也计入，已有空闲连接时等待者队列必为空
+    int want = std::max(minSqlCount_, inUseCount_ + static_cast<int>(waiters_.size()));
+    want = std::min(want, maxSqlCount_);
+    return want - connCount_ - connectingCount_;
+}
+
+SqlConnPool::ConnStmts& SqlConnPool::GetConnStmts_(MYSQL* sql) {
+    //unordered_map的元素引用在其他键增删后仍然有效
     std::lock_guard<std::mutex> locker(mtx_);
-    while(!connQueue_.empty()) {
-        auto sql = connQueue_.front();
-        connQueue_.pop();
-        //调用mysqlAPI释放连接实例
-        mysql_close(sql);  
+    auto iter = stmts_.find(sql);
+    assert(iter != stmts_.end());
+    return iter->second;
+}
+
+bool SqlConnPool::IsDead_(MYSQL* sql) {
+    unsigned int err = mysql_errno(sql);
+    return err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST;
+}
+
+MYSQL_STMT* SqlConnPool::GetStmt(MYSQL* sql, SQL_STMT_ID id) {
+    ConnStmts& conn = GetConnStmts_(sql);
+    //客户端库自动重连后服务端已丢弃全部语句，旧句柄只能关闭
+    if(conn.threadId != mysql_thread_id(sql)) {
+        for(int i = 0; i < STMT_COUNT; ++i) {
+            if(conn.stmts[i]) {
+                mysql_stmt_close(conn.stmts[i]);
+                conn.stmts[i] = nullptr;
+            }
+        }
+        conn.threadId = mysql_thread_id(sql);
+    }
+    return conn.stmts[id];
+}
+
+void SqlConnPool::PutStmt(MYSQL* sql, SQL_STMT_ID id, MYSQL_STMT* stmt) {
+    ConnStmts& conn = GetConnStmts_(sql);
+    assert(conn.stmts[id] == nullptr);
+    conn.stmts[id] = stmt;
+}
+
+void SqlConnPool::DropStmt(MYSQL* sql, SQL_STMT_ID id) {
+    ConnStmts& conn = GetConnStmts_(sql);
+    if(conn.stmts[id]) {
+        mysql_stmt_close(conn.stmts[id]);
+        conn.stmts[id] = nullptr;
+    }
+}
+
+bool SqlConnPool::ExecStmt(MYSQL* sql, SqlStmtCall& call) {
+    SQL_STMT_ID id = call.GetId();
+    for(int attempt = 0; attempt < 2; ++attempt) {
+        MYSQL_STMT* stmt = GetStmt(sql, id);
+        if(!stmt) {
+            stmt = mysql_stmt_init(sql);
+            if(!stmt) {
+                return false;
+            }
+            if(mysql_stmt_prepare(stmt, SQL_STMT_TEXT[id], strlen(SQL_STMT_TEXT[id])) != 0) {
+                LOG_ERROR("Prepare stmt %d error: %s", (int)id, mysql_stmt_error(stmt));
+                mysql_stmt_close(stmt);
+                return false;
+            }
+            PutStmt(sql, id, stmt);
+        }
+        if(call.BindParams(stmt) && mysql_stmt_execute(stmt) == 0 &&
+           call.BindResult(stmt) && mysql_stmt_store_result(stmt) == 0) {
+            return call.FetchAll(stmt);
+        }
+        unsigned int err = mysql_stmt_errno(stmt);
+        LOG_ERROR("Exec stmt %d error: %s", (int)id, mysql_stmt_error(stmt));
+        if(!SqlStmtCall::IsStale(err)) {
+            return false;
+        }
+        DropStmt(sql, id);
+    }
+    return false;
+}
+
+void SqlConnPool::CloseSqlConnPool() {
+    std::deque<IdleConn> idle;
+    std::deque<Waiter> waiters;
+    {
+        std::lock_guard<std::mutex> locker(mtx_);
+        if(isClose_ || !maintainer_.joinable()) {
+            return;
+        }
+        isClose_ = true;
+        idle.swap(connQueue_);
+        waiters.swap(waiters_);
+        connCount_ -= idle.size();
+    }
+    maintainCond_.notify_one();
+    maintainer_.join();
+    for(Waiter& waiter : waiters) {
+        waiter.callback(nullptr);
+    }
+    //借出中的连接在归还时关闭
+    for(IdleConn& conn : idle) {
+        Close_(conn.sql);
     }
     mysql_library_end();
 }
@@ -115,4 +677,4 @@ SqlConnPool::~SqlConnPool() {
     CloseSqlConnPool();
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,157 @@
+#ifndef SQLSTMT_HPP
+#define SQLSTMT_HPP
+
+#include <mysql/mysql.h>
+#include <mysql/errmsg.h>
+#include <mysql/mysqld_error.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+#include <string.h>
+#include <assert.h>
+
+//预编译语句编号，每个池内连接按编号缓存语句句柄
+enum SQL_STMT_ID {
+    STMT_USER_SELECT = 0,
+    STMT_USER_INSERT,
+    STMT_COUNT,
+};
+
+static const char* const SQL_STMT_TEXT[STMT_COUNT] = {
+    "SELECT username, password FROM user WHERE username = ? LIMIT 1",
+    "INSERT INTO user(username, password) VALUES(?, ?)",
+};
+
+/*
+    一次预编译语句执行：参数与结果列都按字符串走二进制协议绑定
+    1、参数只保存指针，执行完成前须保持有效
+    2、结果在store_result后全部拷出并释放语句结果集，连接归还后仍可读取
+*/
+class SqlStmtCall final {
+public:
+    static const int MAX_PARAMS = 4;
+    static const int MAX_COLUMNS = 4;
+    //结果列缓冲，超长部分截断
+    static const size_t COLUMN_SIZE = 256;
+
+    explicit SqlStmtCall(SQL_STMT_ID id);
+
+    SQL_STMT_ID GetId() const;
+    void AddParam(const char* value);
+
+    //执行前绑定参数
+    bool BindParams(MYSQL_STMT* stmt);
+    //执行后按结果元数据绑定结果列，无结果集的语句直接返回true
+    bool BindResult(MYSQL_STMT* stmt);
+    //store_result之后取出全部行并释放结果集，不再访问网络
+    bool FetchAll(MYSQL_STMT* stmt);
+
+    int GetRowCount() const;
+    const std::string& GetValue(int row, int col) const;
+
+    //语句句柄已失效，需要重新预编译（重连或服务器丢弃了语句）
+    static bool IsStale(unsigned int err);
+
+private:
+    //MySQL 8为bool，MariaDB为my_bool
+    typedef std::remove_pointer<decltype(MYSQL_BIND::is_null)>::type BindBool;
+
+    SQL_STMT_ID id_;
+    int paramCnt_;
+    const char* params_[MAX_PARAMS];
+    unsigned long paramLens_[MAX_PARAMS];
+    MYSQL_BIND paramBinds_[MAX_PARAMS];
+
+    int columnCnt_;
+    MYSQL_BIND resultBinds_[MAX_COLUMNS];
+    char columns_[MAX_COLUMNS][COLUMN_SIZE];
+    unsigned long columnLens_[MAX_COLUMNS];
+    BindBool columnNulls_[MAX_COLUMNS];
+    //按行存放的结果
+    std::vector<std::string> values_;
+};
+
+const int SqlStmtCall::MAX_PARAMS;
+const int SqlStmtCall::MAX_COLUMNS;
+const size_t SqlStmtCall::COLUMN_SIZE;
+
+SqlStmtCall::SqlStmtCall(SQL_STMT_ID id) : id_(id), paramCnt_(0), columnCnt_(0) {
+    assert(id >= 0 && id < STMT_COUNT);
+}
+
+SQL_STMT_ID SqlStmtCall::GetId() const {
+    return id_;
+}
+
+void SqlStmtCall::AddParam(const char* value) {
+    assert(paramCnt_ < MAX_PARAMS && value);
+    params_[paramCnt_] = value;
+    paramLens_[paramCnt_] = strlen(value);
+    ++paramCnt_;
+}
+
+bool SqlStmtCall::BindParams(MYSQL_STMT* stmt) {
+    if(mysql_stmt_param_count(stmt) != static_cast<unsigned long>(paramCnt_)) {
+        return false;
+    }
+    memset(paramBinds_, 0, sizeof(paramBinds_));
+    for(int i = 0; i < paramCnt_; ++i) {
+        paramBinds_[i].buffer_type = MYSQL_TYPE_STRING;
+        paramBinds_[i].buffer = const_cast<char*>(params_[i]);
+        paramBinds_[i].buffer_length = paramLens_[i];
+        paramBinds_[i].length = &paramLens_[i];
+    }
+    return paramCnt_ == 0 || mysql_stmt_bind_param(stmt, paramBinds_) == 0;
+}
+
+bool SqlStmtCall::BindResult(MYSQL_STMT* stmt) {
+    columnCnt_ = static_cast<int>(mysql_stmt_field_count(stmt));
+    if(columnCnt_ == 0) {
+        return true;
+    }
+    if(columnCnt_ > MAX_COLUMNS) {
+        return false;
+    }
+    memset(resultBinds_, 0, sizeof(resultBinds_));
+    for(int i = 0; i < columnCnt_; ++i) {
+        resultBinds_[i].buffer_type = MYSQL_TYPE_STRING;
+        resultBinds_[i].buffer = columns_[i];
+        resultBinds_[i].buffer_length = COLUMN_SIZE;
+        resultBinds_[i].length = &columnLens_[i];
+        resultBinds_[i].is_null = &columnNulls_[i];
+    }
+    return mysql_stmt_bind_result(stmt, resultBinds_) == 0;
+}
+
+bool SqlStmtCall::FetchAll(MYSQL_STMT* stmt) {
+    values_.clear();
+    if(columnCnt_ == 0) {
+        return true;
+    }
+    int ret = 0;
+    while((ret = mysql_stmt_fetch(stmt)) == 0 || ret == MYSQL_DATA_TRUNCATED) {
+        for(int i = 0; i < columnCnt_; ++i) {
+            size_t len = columnNulls_[i] ? 0 : std::min<size_t>(columnLens_[i], COLUMN_SIZE);
+            values_.emplace_back(columns_[i], len);
+        }
+    }
+    mysql_stmt_free_result(stmt);
+    return ret == MYSQL_NO_DATA;
+}
+
+int SqlStmtCall::GetRowCount() const {
+    return columnCnt_ == 0 ? 0 : static_cast<int>(values_.size()) / columnCnt_;
+}
+
+const std::string& SqlStmtCall::GetValue(int row, int col) const {
+    assert(row < GetRowCount() && col < columnCnt_);
+    return values_[row * columnCnt_ + col];
+}
+
+bool SqlStmtCall::IsStale(unsigned int err) {
+    return err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST ||
+           err == ER_UNKNOWN_STMT_HANDLER || err == ER_NEED_REPREPARE;
+}
+
+#endif
@@ -2,93 +2,306 @@
 #define THREADPOOL_HPP
 
 #include <queue>
+#include <vector>
 #include <mutex>
 #include <condition_variable>
 #include <functional>
 #include <thread>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <algorithm>
+#include <stdint.h>
 #include <assert.h>
 
 #include "../logger/logger.hpp"
 
+//任务排队等待时间直方图的桶上界（微秒），最后一桶为其余全部
+static const int WAIT_BUCKETS = 11;
+static const uint64_t WAIT_BOUNDS_US[WAIT_BUCKETS - 1] = {
+    10, 50, 100, 500, 1000, 5000, 10000, 50000, 100000, 500000
+};
+
+//单个工作线程槽位的累计计数，线程退出后槽位复用，计数继续累加
+struct WorkerCounter {
+    std::atomic<uint64_t> tasks{0};
+    std::atomic<uint64_t> busyUs{0};
+    std::atomic<uint64_t> waitHist[WAIT_BUCKETS] = {};
+};
+
+//排队中的任务，记录入队时间用于统计等待
+struct PoolTask {
+    std::function<void()> func;
+    std::chrono::steady_clock::time_point enqueued;
+};
+
 //线程池最小单元
 struct Pool {
+    //执行器名，也是线程名前缀
+    std::string name = "thread";
     //关池标志
-    bool isClose;
+    bool isClose = false;
     //锁
     std::mutex mtx;
     //条件变量
     std::condition_variable cond;
     //队列管理任务方法
-    std::queue<std::function<void()>> tasks;
+    std::queue<PoolTask> tasks;
+    //排队任务上限，0为不限；超限的任务被拒绝
+    size_t maxQueue = 0;
+    uint64_t rejects = 0;
+
+    //常驻线程数与弹性上限，上限等于常驻数时不伸缩
+    int coreNum = 0;
+    int maxNum = 0;
+    //存活线程数与空闲等待中的线程数
+    int threadNum = 0;
+    int idleNum = 0;
+    //队首任务等待超过growWait且无空闲线程时扩容，多余线程空闲idleTime后退出
+    std::chrono::microseconds growWait{5000};
+    std::chrono::milliseconds idleTime{30000};
+    uint64_t grows = 0;
+    uint64_t shrinks = 0;
+    //相邻两次扩容至少间隔growWait，新线程就绪前不重复扩容
+    std::chrono::steady_clock::time_point lastGrow;
+
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+    //按槽位存放计数，槽位数不超过maxNum
+    std::vector<std::unique_ptr<WorkerCounter>> counters;
+    std::vector<bool> slotUsed;
+};
+
+//线程池运行状态快照
+struct ThreadPoolStats {
+    std::string name;
+    struct Worker {
+        int id;
+        bool isAlive;
+        uint64_t tasks;
+        uint64_t busyUs;
+        uint64_t waitHist[WAIT_BUCKETS];
+    };
+    int coreNum;
+    int maxNum;
+    int threadNum;
+    int idleNum;
+    size_t queueLen;
+    uint64_t grows;
+    uint64_t shrinks;
+    uint64_t rejects;
+    uint64_t uptimeUs;
+    std::vector<Worker> workers;
 };
 
 
 //线程池
 class ThreadPool final {
 public:
-    //线程池初始化，及线程内部实现
-    explicit ThreadPool(int threadNum = 5);
+    //线程池初始化，及线程内部实现；name为线程名前缀，maxQueue为排队上限（0不限）
+    explicit ThreadPool(int threadNum = 5, size_t maxQueue = 0, const std::string& name = "thread");
     ThreadPool() = default;
     ~ThreadPool();
 
-    //添加队列处理任务
+    //开启弹性伸缩：排队延迟升高时扩容到maxThreadNum，空闲后缩回常驻线程数
+    void SetElastic(int maxThreadNum, int growWaitMs, int idleMs);
+    //调整常驻线程数与排队上限：调大时立即补足线程，调小时多出的线程空闲idleTime后退出
+    void Resize(int threadNum, size_t maxQueue);
+    ThreadPoolStats GetStats() const;
+
+    //添加队列处理任务，队列已满返回false
     template<typename T>
-    void AddTask(T&& task);
+    bool AddTask(T&& task);
 
 private:
+    typedef std::chrono::steady_clock Clock;
+
+    //须持有pool->mtx
+    static void Spawn_(const std::shared_ptr<Pool>& pool);
+    static void TryGrow_(const std::shared_ptr<Pool>& pool);
+    static void Work_(std::shared_ptr<Pool> pool, int slot);
+    static void RecordWait_(WorkerCounter& counter, Clock::duration wait);
+
     //share指针管理池
     std::shared_ptr<Pool> pool_;
 };
 
 
-ThreadPool::ThreadPool(int threadNum) : pool_(std::make_shared<Pool>()) {
+ThreadPool::ThreadPool(int threadNum, size_t maxQueue, const std::string& name) : pool_(std::make_shared<Pool>()) {
     assert(threadNum > 0);
+    std::lock_guard<std::mutex> locker(pool_->mtx);
+    pool_->name = name;
+    pool_->maxQueue = maxQueue;
+    pool_->coreNum = pool_->maxNum = threadNum;
     for(int i = 0; i < threadNum; ++i) {
-        std::string threadName("thread" + std::to_string(i + 1));
-        auto newThread = std::thread([pool = pool_]() {
-            //创建独占锁，构造时自动锁，析构解锁
-            std::unique_lock<std::mutex> locker(pool->mtx);
-            while(true) {
-                if(!pool->tasks.empty()) {
-                    auto task = std::move(pool->tasks.front());
-                    pool->tasks.pop();
-                    locker.unlock();
-                    task();
-                    locker.lock();
-                }
-                else if(pool->isClose) {
-                    break;
-                }
-                else {
-                    pool->cond.wait(locker);
-                }
-            }
-        });
-        pthread_t nativeId = newThread.native_handle();
-        pthread_setname_np(nativeId, threadName.c_str());
-        newThread.detach();
+        Spawn_(pool_);
     }
 }
 
 ThreadPool::~ThreadPool() {
-    if(pool_) { 
+    if(pool_) {
         //将guard放在一个作用域中当离开后解锁，保证条件变量广播后其他线程正常获得独占锁
         {
             std::lock_guard<std::mutex> locker(pool_->mtx);
-            pool_->isClose = true;            
+            pool_->isClose = true;
         }
         pool_->cond.notify_all();
     }
 }
 
+void ThreadPool::SetElastic(int maxThreadNum, int growWaitMs, int idleMs) {
+    assert(pool_);
+    std::lock_guard<std::mutex> locker(pool_->mtx);
+    pool_->maxNum = std::max(maxThreadNum, pool_->coreNum);
+    pool_->growWait = std::chrono::milliseconds(std::max(growWaitMs, 0));
+    pool_->idleTime = std::chrono::milliseconds(std::max(idleMs, 1));
+    //空闲线程重新按新的超时等待
+    pool_->cond.notify_all();
+}
+
+void ThreadPool::Resize(int threadNum, size_t maxQueue) {
+    assert(pool_ && threadNum > 0);
+    std::lock_guard<std::mutex> locker(pool_->mtx);
+    pool_->coreNum = threadNum;
+    pool_->maxNum = std::max(pool_->maxNum, threadNum);
+    pool_->maxQueue = maxQueue;
+    while(pool_->threadNum < pool_->coreNum) {
+        Spawn_(pool_);
+    }
+    //常驻线程醒来后按新的常驻数决定是否转为弹性线程
+    pool_->cond.notify_all();
+}
+
+void ThreadPool::Spawn_(const std::shared_ptr<Pool>& pool) {
+    //取第一个空闲槽位，槽位号即线程名序号
+    int slot = 0;
+    while(slot < static_cast<int>(pool->slotUsed.size()) && pool->slotUsed[slot]) {
+        ++slot;
+    }
+    if(slot == static_cast<int>(pool->slotUsed.size())) {
+        pool->slotUsed.push_back(false);
+        pool->counters.emplace_back(new WorkerCounter());
+    }
+    pool->slotUsed[slot] = true;
+    ++pool->threadNum;
+
+    std::string threadName(pool->name + std::to_string(slot + 1));
+    auto newThread = std::thread(&ThreadPool::Work_, pool, slot);
+    pthread_t nativeId = newThread.native_handle();
+    pthread_setname_np(nativeId, threadName.c_str());
+    newThread.detach();
+}
+
+void ThreadPool::TryGrow_(const std::shared_ptr<Pool>& pool) {
+    if(pool->idleNum > 0 || pool->threadNum >= pool->maxNum || pool->tasks.empty() || pool->isClose) {
+        return;
+    }
+    Clock::time_point now = Clock::now();
+    if(now - pool->tasks.front().enqueued < pool->growWait || now - pool->lastGrow < pool->growWait) {
+        return;
+    }
+    Spawn_(pool);
+    pool->lastGrow = now;
+    ++pool->grows;
+    LOG_INFO("ThreadPool %s grow to %d threads, queue: %d", pool->name.c_str(), pool->threadNum, (int)pool->tasks.size());
+}
+
+void ThreadPool::RecordWait_(WorkerCounter& counter, Clock::duration wait) {
+    uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(wait).count();
+    int bucket = 0;
+    while(bucket < WAIT_BUCKETS - 1 && us >= WAIT_BOUNDS_US[bucket]) {
+        ++bucket;
+    }
+    counter.waitHist[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+void ThreadPool::Work_(std::shared_ptr<Pool> pool, int slot) {
+    //创建独占锁，构造时自动锁，析构解锁
+    std::unique_lock<std::mutex> locker(pool->mtx);
+    WorkerCounter& counter = *pool->counters[slot];
+    while(true) {
+        if(!pool->tasks.empty()) {
+            PoolTask task = std::move(pool->tasks.front());
+            pool->tasks.pop();
+            //本线程取走一个任务后仍有积压，可能需要扩容
+            TryGrow_(pool);
+            locker.unlock();
+
+            Clock::time_point start = Clock::now();
+            RecordWait_(counter, start - task.enqueued);
+            task.func();
+            counter.tasks.fetch_add(1, std::memory_order_relaxed);
+            counter.busyUs.fetch_add(std::chrono::duration_cast<std::chrono::microseconds>(
+                                     Clock::now() - start).count(), std::memory_order_relaxed);
+            locker.lock();
+        }
+        else if(pool->isClose) {
+            break;
+        }
+        else if(pool->threadNum > pool->coreNum) {
+            //弹性线程空闲超时后退出
+            ++pool->idleNum;
+            std::cv_status status = pool->cond.wait_for(locker, pool->idleTime);
+            --pool->idleNum;
+            if(status == std::cv_status::timeout && pool->tasks.empty() && pool->threadNum > pool->coreNum) {
+                ++pool->shrinks;
+                LOG_INFO("ThreadPool %s shrink to %d threads", pool->name.c_str(), pool->threadNum - 1);
+                break;
+            }
+        }
+        else {
+            ++pool->idleNum;
+            pool->cond.wait(locker);
+            --pool->idleNum;
+        }
+    }
+    --pool->threadNum;
+    pool->slotUsed[slot] = false;
+}
+
+ThreadPoolStats ThreadPool::GetStats() const {
+    assert(pool_);
+    ThreadPoolStats stats;
+    std::lock_guard<std::mutex> locker(pool_->mtx);
+    stats.name = pool_->name;
+    stats.coreNum = pool_->coreNum;
+    stats.maxNum = pool_->maxNum;
+    stats.threadNum = pool_->threadNum;
+    stats.idleNum = pool_->idleNum;
+    stats.queueLen = pool_->tasks.size();
+    stats.grows = pool_->grows;
+    stats.shrinks = pool_->shrinks;
+    stats.rejects = pool_->rejects;
+    stats.uptimeUs = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - pool_->startTime).count();
+    for(size_t i = 0; i < pool_->counters.size(); ++i) {
+        const WorkerCounter& counter = *pool_->counters[i];
+        ThreadPoolStats::Worker worker;
+        worker.id = static_cast<int>(i) + 1;
+        worker.isAlive = pool_->slotUsed[i];
+        worker.tasks = counter.tasks.load(std::memory_order_relaxed);
+        worker.busyUs = counter.busyUs.load(std::memory_order_relaxed);
+        for(int j = 0; j < WAIT_BUCKETS; ++j) {
+            worker.waitHist[j] = counter.waitHist[j].load(std::memory_order_relaxed);
+        }
+        stats.workers.push_back(worker);
+    }
+    return stats;
+}
+
 template<typename T>
-void ThreadPool::AddTask(T&& task) {
+bool ThreadPool::AddTask(T&& task) {
     {
         std::lock_guard<std::mutex> locker(pool_->mtx);
+        if(pool_->maxQueue > 0 && pool_->tasks.size() >= pool_->maxQueue) {
+            ++pool_->rejects;
+            return false;
+        }
         //完美转发应用
-        pool_->tasks.emplace(std::forward<T>(task));
+        pool_->tasks.push({std::forward<T>(task), Clock::now()});
+        TryGrow_(pool_);
     }
     pool_->cond.notify_one();
+    return true;
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,781 @@
+#ifndef PROXYRELAY_HPP
+#define PROXYRELAY_HPP
+
+#include <fcntl.h>       // splice, pipe2
+#include <unistd.h>
+#include <sys/socket.h>  // sendmsg
+#include <netinet/in.h>  // INET_ADDRSTRLEN
+#include <errno.h>
+#include <string.h>      // strcmp
+#include <strings.h>     // strncasecmp
+#include <ctype.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "../buffer/buffer.hpp"
+#include "../http/httprequest.hpp"
+#include "../tls/tlsconn.hpp"
+#include "proxyrouter.hpp"
+
+/*
+    单个客户端连接上的代理转发状态，全程由反应器驱动，不在工作线程上等待上游
+    1、连接、发送请求、读取响应头：上游未就绪时返回等待的方向，由连接登记上游fd（带超时），就绪后调用Continue继续
+    2、响应体：上游不可读时登记上游fd等待EPOLLIN，客户端不可写时等待EPOLLOUT
+*/
+class ProxyRelay final {
+public:
+    //Start与Continue的结果
+    enum STEP {
+        STEP_READY,         //改写后的响应头及已读到的响应体已写入buff
+        STEP_WAIT_READ,     //等待上游可读（响应头）
+        STEP_WAIT_WRITE,    //等待上游可写（连接完成或继续发送请求）
+        STEP_FAIL,          //无可用上游或上游出错
+    };
+
+    ProxyRelay();
+    ~ProxyRelay();
+
+    //选定上游并开始转发，request须在转发期间保持有效
+    STEP Start(ProxyRoute* route, const HttpRequest& request, const char* clientIp,
+               bool isKeepAlive, Buffer& buff);
+    //等待的上游fd就绪或超时（isTimeout）后继续，失败时按需换连接重试
+    STEP Continue(bool isTimeout, Buffer& buff);
+    //将剩余响应体从上游搬运到客户端，阻塞时*saveErrno为EAGAIN
+    //tls非空且未启用kTLS时经SSL_write加密发送
+    ssize_t Relay(int clientFd, TlsConn* tls, int* saveErrno);
+    //放弃转发，上游连接直接关闭
+    void Abort();
+
+    bool IsActive() const;
+    bool IsKeepAlive() const;
+    //阻塞在上游不可读（否则阻塞在客户端不可写）
+    bool IsWaitUpstream() const;
+    int GetUpstreamFd() const;
+    //剩余待搬运字节数，未知长度时返回1
+    size_t PendingBytes() const;
+    //上游响应的状态码
+    int GetStatus() const;
+    //本次转发已由Relay发给客户端的响应体字节数，不含Start写入buff的部分
+    size_t GetRelayedBytes() const;
+
+private:
+    //响应头就绪之前所处的阶段
+    enum STAGE {
+        STAGE_CONNECT,
+        STAGE_SEND,
+        STAGE_HEAD,
+    };
+
+    //响应体分帧方式
+    enum BODY_MODE {
+        BODY_NONE,
+        BODY_LENGTH,
+        BODY_CHUNKED,
+        BODY_EOF,
+    };
+
+    //chunked解析状态机
+    enum CHUNK_STATE {
+        CHUNK_SIZE,
+        CHUNK_EXT,
+        CHUNK_SIZE_LF,
+        CHUNK_DATA,
+        CHUNK_DATA_CR,
+        CHUNK_DATA_LF,
+        CHUNK_TRAILER,
+        CHUNK_DONE,
+    };
+
+    //取下一个上游连接并开始本次尝试
+    STEP Connect_(Buffer& buff);
+    //从当前阶段推进到等待上游或响应头就绪
+    STEP Advance_(Buffer& buff);
+    //本次尝试失败，关闭上游连接，返回能否换连接重试
+    bool Fail_();
+    //重发不改变上游状态的方法
+    static bool IsIdempotent_(const char* method);
+    //改写后的请求头写入relayBuff_，请求体发送时直接取自请求
+    void BuildRequest_();
+    STEP SendRequest_();
+    STEP ReadHead_();
+    //丢弃开头的100 Continue、103 Early Hints等临时响应，返回最终响应头是否已完整
+    bool SkipInterim_();
+    bool ParseHead_(const char* method, Buffer& buff);
+    ssize_t RelaySplice_(int clientFd, int* saveErrno);
+    ssize_t RelayCopy_(int clientFd, TlsConn* tls, int* saveErrno);
+    //扫描chunked数据，返回属于本响应的字节数
+    size_t ScanChunked_(const char* data, size_t len);
+    bool OpenPipe_();
+    void ClosePipe_();
+    //转发结束，归还或关闭上游连接
+    void Finish_(bool reusable);
+
+    static bool HeaderIs_(const char* name, const char* target);
+
+    static const size_t MAX_HEAD_LEN = 16384;
+    static const size_t SPLICE_LEN = 65536;
+    //拷贝路径一次读写的最多分段数，与Buffer::ReadFd的分散读一致
+    static const int RELAY_IOV = 17;
+    //一次转发最多尝试的上游连接数
+    static const int MAX_ATTEMPTS = 3;
+
+    ProxyRoute* route_;
+    const HttpRequest* request_;
+    char clientIp_[INET_ADDRSTRLEN];
+    std::vector<Upstream*> tried_;
+    int attempts_;
+    bool isReused_;
+    bool isIdempotent_;
+    STAGE stage_;
+    //请求头与请求体已写出的字节数
+    size_t sent_;
+
+    Upstream* upstream_;
+    int upFd_;
+    int pipe_[2];
+    size_t pipeBytes_;
+
+    bool isActive_;
+    bool isKeepAlive_;
+    bool upKeepAlive_;
+    bool isWaitUpstream_;
+    int status_;
+    size_t relayedBytes_;
+
+    BODY_MODE bodyMode_;
+    size_t remaining_;
+    CHUNK_STATE chunkState_;
+    size_t chunkLeft_;
+    size_t lineLen_;
+    size_t sendable_;
+
+    //发送中的请求头、上游响应头及拷贝路径响应体共用的缓冲
+    Buffer relayBuff_;
+};
+
+const size_t ProxyRelay::MAX_HEAD_LEN;
+const size_t ProxyRelay::SPLICE_LEN;
+const int ProxyRelay::MAX_ATTEMPTS;
+
+ProxyRelay::ProxyRelay() : route_(nullptr), request_(nullptr), clientIp_{0}, attempts_(0), isReused_(false),
+                           isIdempotent_(false), stage_(STAGE_CONNECT), sent_(0),
+                           upstream_(nullptr), upFd_(-1), pipe_{-1, -1}, pipeBytes_(0),
+                           isActive_(false), isKeepAlive_(false), upKeepAlive_(false),
+                           isWaitUpstream_(false), status_(0), relayedBytes_(0),
+                           bodyMode_(BODY_NONE),
+                           remaining_(0), chunkState_(CHUNK_SIZE), chunkLeft_(0), lineLen_(0),
+                           sendable_(0) {}
+
+ProxyRelay::~ProxyRelay() {
+    Abort();
+    ClosePipe_();
+}
+
+ProxyRelay::STEP ProxyRelay::Start(ProxyRoute* route, const HttpRequest& request, const char* clientIp,
+                                   bool isKeepAlive, Buffer& buff) {
+    assert(route);
+    if(isActive_ || upFd_ >= 0) {
+        Abort();
+    }
+    route_ = route;
+    request_ = &request;
+    isIdempotent_ = IsIdempotent_(request.GetMethod().c_str());
+    snprintf(clientIp_, sizeof(clientIp_), "%s", clientIp);
+    isKeepAlive_ = isKeepAlive;
+    status_ = 0;
+    relayedBytes_ = 0;
+    attempts_ = 0;
+    tried_.clear();
+    return Connect_(buff);
+}
+
+ProxyRelay::STEP ProxyRelay::Continue(bool isTimeout, Buffer& buff) {
+    assert(upFd_ >= 0 && !isActive_);
+    STEP step = STEP_FAIL;
+    if(isTimeout) {
+        LOG_WARN("Proxy upstream %s timeout", upstream_->Name().c_str());
+    }
+    else {
+        step = Advance_(buff);
+    }
+    if(step != STEP_FAIL) {
+        return step;
+    }
+    if(!Fail_()) {
+        LOG_WARN("Proxy %s: upstream failed", request_->GetTarget().c_str());
+        return STEP_FAIL;
+    }
+    return Connect_(buff);
+}
+
+ProxyRelay::STEP ProxyRelay::Connect_(Buffer& buff) {
+    //复用的空闲连接可能已被上游关闭，失败时换新连接或换节点重试
+    while(attempts_ < MAX_ATTEMPTS) {
+        ++attempts_;
+        Upstream* up = ProxyRouter::GetInstance()->Pick(route_, tried_);
+        if(up == nullptr) {
+            break;
+        }
+        bool isConnecting = false;
+        int fd = up->Acquire(&isReused_, &isConnecting);
+        if(fd < 0) {
+            tried_.push_back(up);
+            continue;
+        }
+        upstream_ = up;
+        upFd_ = fd;
+        sent_ = 0;
+        relayBuff_.RetrieveAll();
+        BuildRequest_();
+        //连接尚未完成时须等可写后再确认结果
+        if(isConnecting) {
+            stage_ = STAGE_CONNECT;
+            return STEP_WAIT_WRITE;
+        }
+        stage_ = STAGE_SEND;
+        STEP step = Advance_(buff);
+        if(step != STEP_FAIL) {
+            return step;
+        }
+        if(!Fail_()) {
+            break;
+        }
+    }
+    LOG_WARN("Proxy %s: upstream failed", request_->GetTarget().c_str());
+    return STEP_FAIL;
+}
+
+ProxyRelay::STEP ProxyRelay::Advance_(Buffer& buff) {
+    if(stage_ == STAGE_CONNECT) {
+        if(!Upstream::IsConnected(upFd_)) {
+            LOG_WARN("Upstream %s connect error", upstream_->Name().c_str());
+            return STEP_FAIL;
+        }
+        stage_ = STAGE_SEND;
+    }
+    if(stage_ == STAGE_SEND) {
+        STEP step = SendRequest_();
+        if(step != STEP_READY) {
+            return step;
+        }
+        //请求已全部写出，缓冲改为接收响应头
+        relayBuff_.RetrieveAll();
+        stage_ = STAGE_HEAD;
+    }
+    STEP step = ReadHead_();
+    if(step == STEP_READY && !ParseHead_(request_->GetMethod().c_str(), buff)) {
+        Finish_(false);
+        return STEP_FAIL;
+    }
+    return step;
+}
+
+bool ProxyRelay::Fail_() {
+    //响应头不合法时连接已关闭，换节点也无意义
+    if(upFd_ < 0) {
+        return false;
+    }
+    //连接失败或请求未写出时总可重试；已写出的非幂等请求可能已在上游生效，重发会使副作用执行两次
+    bool canRetry = sent_ == 0 || isIdempotent_;
+    if(!isReused_) {
+        tried_.push_back(upstream_);
+    }
+    Finish_(false);
+    return canRetry;
+}
+
+bool ProxyRelay::IsIdempotent_(const char* method) {
+    return strcmp(method, "GET") == 0 || strcmp(method, "HEAD") == 0 || strcmp(method, "PUT") == 0 ||
+           strcmp(method, "DELETE") == 0 || strcmp(method, "OPTIONS") == 0 || strcmp(method, "TRACE") == 0;
+}
+
+void ProxyRelay::BuildRequest_() {
+    const HttpRequest& request = *request_;
+    relayBuff_.Append(request.GetMethod().data(), request.GetMethod().size());
+    relayBuff_.Append(" ", 1);
+    relayBuff_.Append(request.GetTarget().data(), request.GetTarget().size());
+    relayBuff_.Append(" HTTP/1.1\r\n");
+    const ArenaString* forwardedFor = nullptr;
+    for(const auto& header : request.GetHeaders()) {
+        const char* name = header.first.c_str();
+        //已有的X-Forwarded-For在其后追加客户端地址，合并为一个头部
+        if(HeaderIs_(name, "X-Forwarded-For")) {
+            forwardedFor = &header.second;
+            continue;
+        }
+        //逐跳头部不转发；请求体已按Content-Length收全（chunked已回复411），长度按收到的重写；
+        //100-continue已由本端回复，不再转给上游
+        if(HeaderIs_(name, "Connection") || HeaderIs_(name, "Keep-Alive") ||
+           HeaderIs_(name, "Proxy-Connection") || HeaderIs_(name, "Expect") ||
+           HeaderIs_(name, "Content-Length") || HeaderIs_(name, "Transfer-Encoding")) {
+            continue;
+        }
+        relayBuff_.Append(header.first.data(), header.first.size());
+        relayBuff_.Append(": ", 2);
+        relayBuff_.Append(header.second.data(), header.second.size());
+        relayBuff_.Append("\r\n", 2);
+    }
+    relayBuff_.Append("X-Forwarded-For: ");
+    if(forwardedFor && !forwardedFor->empty()) {
+        relayBuff_.Append(forwardedFor->data(), forwardedFor->size());
+        relayBuff_.Append(", ", 2);
+    }
+    relayBuff_.Append(clientIp_, strlen(clientIp_));
+    relayBuff_.Append("\r\nConnection: keep-alive\r\n");
+    if(!request.GetBody().empty()) {
+        char length[64];
+        snprintf(length, sizeof(length), "Content-Length: %zu\r\n", request.GetBody().size());
+        relayBuff_.Append(length, strlen(length));
+    }
+    relayBuff_.Append("\r\n", 2);
+}
+
+ProxyRelay::STEP ProxyRelay::SendRequest_() {
+    //请求头在relayBuff_中，请求体直接从请求的arena发出，不再拷贝
+    const ArenaString& body = request_->GetBody();
+    size_t headLen = relayBuff_.ReadableBytes();
+    while(sent_ < headLen + body.size()) {
+        struct iovec iov[2];
+        int iovCnt = 0;
+        if(sent_ < headLen) {
+            iov[iovCnt].iov_base = const_cast<char*>(relayBuff_.Peek()) + sent_;
+            iov[iovCnt++].iov_len = headLen - sent_;
+        }
+        size_t bodySent = sent_ > headLen ? sent_ - headLen : 0;
+        if(bodySent < body.size()) {
+            iov[iovCnt].iov_base = const_cast<char*>(body.data()) + bodySent;
+            iov[iovCnt++].iov_len = body.size() - bodySent;
+        }
+        struct msghdr msg = {};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovCnt;
+        ssize_t len = sendmsg(upFd_, &msg, MSG_NOSIGNAL);
+        if(len > 0) {
+            sent_ += len;
+        }
+        else if(len < 0 && errno == EAGAIN) {
+            return STEP_WAIT_WRITE;
+        }
+        else {
+            return STEP_FAIL;
+        }
+    }
+    return STEP_READY;
+}
+
+ProxyRelay::STEP ProxyRelay::ReadHead_() {
+    while(true) {
+        int err = 0;
+        ssize_t len = relayBuff_.ReadFd(upFd_, &err);
+        if(len > 0) {
+            if(SkipInterim_()) {
+                return STEP_READY;
+            }
+            if(relayBuff_.ReadableBytes() > MAX_HEAD_LEN) {
+                return STEP_FAIL;
+            }
+        }
+        else if(len < 0 && err == EAGAIN) {
+            return STEP_WAIT_READ;
+        }
+        else {
+            return STEP_FAIL;
+        }
+    }
+}
+
+bool ProxyRelay::SkipInterim_() {
+    const char CRLF2[] = "\r\n\r\n";
+    while(true) {
+        const char* begin = relayBuff_.Peek();
+        const char* end = begin + relayBuff_.ReadableBytes();
+        const char* headEnd = std::search(begin, end, CRLF2, CRLF2 + 4);
+        if(headEnd == end) {
+            return false;
+        }
+        //HTTP/1.1 1xx：临时响应没有响应体，最终响应紧随其后；101之后换协议，按最终响应处理
+        bool isInterim = headEnd - begin >= 12 && memcmp(begin, "HTTP/", 5) == 0 && begin[9] == '1' &&
+                         isdigit(begin[10]) && isdigit(begin[11]) && memcmp(begin + 9, "101", 3) != 0;
+        if(!isInterim) {
+            return true;
+        }
+        relayBuff_.RetrieveUntil(headEnd + 4);
+    }
+}
+
+bool ProxyRelay::ParseHead_(const char* method, Buffer& buff) {
+    const char CRLF[] = "\r\n";
+    const char* begin = relayBuff_.Peek();
+    const char* headEnd = std::search(begin, begin + relayBuff_.ReadableBytes(), CRLF, CRLF + 2);
+    std::string statusLine(begin, headEnd);
+    //HTTP/1.1 200 OK
+    if(statusLine.size() < 12 || statusLine.compare(0, 5, "HTTP/") != 0) {
+        return false;
+    }
+    int code = atoi(statusLine.c_str() + 9);
+    status_ = code;
+    bool isHttp10 = statusLine.compare(0, 8, "HTTP/1.0") == 0;
+    relayBuff_.RetrieveUntil(headEnd + 2);
+
+    bool hasLength = false, isChunked = false;
+    size_t contentLen = 0;
+    upKeepAlive_ = !isHttp10;
+    buff.Append(statusLine + "\r\n");
+    while(true) {
+        begin = relayBuff_.Peek();
+        const char* lineEnd = std::search(begin, begin + relayBuff_.ReadableBytes(), CRLF, CRLF + 2);
+        std::string line(begin, lineEnd);
+        relayBuff_.RetrieveUntil(lineEnd + 2);
+        if(line.empty()) {
+            break;
+        }
+        size_t colon = line.find(':');
+        if(colon == std::string::npos) {
+            continue;
+        }
+        std::string name = line.substr(0, colon);
+        size_t valuePos = line.find_first_not_of(' ', colon + 1);
+        std::string value = valuePos == std::string::npos ? "" : line.substr(valuePos);
+        if(HeaderIs_(name.c_str(), "Connection")) {
+            if(strncasecmp(value.c_str(), "close", 5) == 0) upKeepAlive_ = false;
+            else if(strncasecmp(value.c_str(), "keep-alive", 10) == 0) upKeepAlive_ = true;
+            continue;
+        }
+        if(HeaderIs_(name.c_str(), "Keep-Alive") || HeaderIs_(name.c_str(), "Proxy-Connection")) {
+            continue;
+        }
+        if(HeaderIs_(name.c_str(), "Content-Length")) {
+            hasLength = true;
+            contentLen = strtoull(value.c_str(), nullptr, 10);
+        }
+        else if(HeaderIs_(name.c_str(), "Transfer-Encoding") && strcasestr(value.c_str(), "chunked")) {
+            isChunked = true;
+        }
+        buff.Append(line + "\r\n");
+    }
+
+    if(code == 101) {
+        //不转发升级后的协议，两端连接都不能再按HTTP复用
+        bodyMode_ = BODY_NONE;
+        upKeepAlive_ = false;
+        isKeepAlive_ = false;
+    }
+    else if(strcmp(method, "HEAD") == 0 || code == 204 || code == 304) {
+        bodyMode_ = BODY_NONE;
+    }
+    else if(isChunked) {
+        bodyMode_ = BODY_CHUNKED;
+        chunkState_ = CHUNK_SIZE;
+        chunkLeft_ = 0;
+        lineLen_ = 0;
+    }
+    else if(hasLength) {
+        bodyMode_ = BODY_LENGTH;
+        remaining_ = contentLen;
+    }
+    else {
+        //以关闭连接界定响应体，客户端连接也只能随之关闭
+        bodyMode_ = BODY_EOF;
+        upKeepAlive_ = false;
+        isKeepAlive_ = false;
+    }
+    buff.Append(isKeepAlive_ ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n");
+
+    //响应头之后已读到的响应体直接跟随响应头发送
+    size_t extra = relayBuff_.ReadableBytes();
+    isActive_ = true;
+    isWaitUpstream_ = false;
+    pipeBytes_ = 0;
+    sendable_ = 0;
+    if(bodyMode_ == BODY_LENGTH) {
+        size_t len = std::min(extra, remaining_);
+        buff.Append(relayBuff_.Peek(), len);
+        remaining_ -= len;
+        if(extra > len) upKeepAlive_ = false;
+        if(remaining_ == 0) Finish_(upKeepAlive_);
+    }
+    else if(bodyMode_ == BODY_CHUNKED) {
+        size_t len = ScanChunked_(relayBuff_.Peek(), extra);
+        buff.Append(relayBuff_.Peek(), len);
+        if(extra > len) upKeepAlive_ = false;
+        if(chunkState_ == CHUNK_DONE) Finish_(upKeepAlive_);
+    }
+    else if(bodyMode_ == BODY_EOF) {
+        buff.Append(relayBuff_.Peek(), extra);
+    }
+    else {
+        Finish_(upKeepAlive_ && extra == 0);
+    }
+    relayBuff_.RetrieveAll();
+    return true;
+}
+
+ssize_t ProxyRelay::Relay(int clientFd, TlsConn* tls, int* saveErrno) {
+    assert(isActive_);
+    //TLS连接只有内核接管加密后才能splice
+    bool canSplice = tls == nullptr || tls->IsKtlsSend();
+    if(bodyMode_ == BODY_CHUNKED || !canSplice || sendable_ > 0) {
+        return RelayCopy_(clientFd, canSplice ? nullptr : tls, saveErrno);
+    }
+    return RelaySplice_(clientFd, saveErrno);
+}
+
+ssize_t ProxyRelay::RelaySplice_(int clientFd, int* saveErrno) {
+    if(pipe_[0] < 0 && !OpenPipe_()) {
+        *saveErrno = errno;
+        Abort();
+        return -1;
+    }
+    ssize_t total = 0;
+    //上游 -> 管道 -> 客户端，数据不经过用户态
+    while(bodyMode_ == BODY_EOF || remaining_ > 0) {
+        if(pipeBytes_ == 0) {
+            size_t want = bodyMode_ == BODY_EOF ? SPLICE_LEN : std::min(remaining_, SPLICE_LEN);
+            ssize_t len = splice(upFd_, nullptr, pipe_[1], nullptr, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if(len == 0 && bodyMode_ == BODY_EOF) {
+                break;
+            }
+            if(len < 0 && errno == EAGAIN) {
+                isWaitUpstream_ = true;
+                *saveErrno = EAGAIN;
+                return -1;
+            }
+            if(len <= 0) {
+                *saveErrno = len == 0 ? EPIPE : errno;
+                Abort();
+                return -1;
+            }
+            pipeBytes_ = len;
+        }
+        ssize_t len = splice(pipe_[0], nullptr, clientFd, nullptr, pipeBytes_, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if(len < 0) {
+            *saveErrno = errno;
+            if(errno == EAGAIN) {
+                isWaitUpstream_ = false;
+            }
+            else {
+                Abort();
+            }
+            return -1;
+        }
+        pipeBytes_ -= len;
+        if(bodyMode_ == BODY_LENGTH) {
+            remaining_ -= len;
+        }
+        total += len;
+        relayedBytes_ += len;
+    }
+    Finish_(upKeepAlive_);
+    return total;
+}
+
+ssize_t ProxyRelay::RelayCopy_(int clientFd, TlsConn* tls, int* saveErrno) {
+    //chunked需要识别结束块，未启用kTLS的TLS连接需要用户态加密，均走用户态拷贝
+    ssize_t total = 0;
+    while(true) {
+        if(sendable_ == 0) {
+            if((bodyMode_ == BODY_CHUNKED && chunkState_ == CHUNK_DONE) ||
+               (bodyMode_ == BODY_LENGTH && remaining_ == 0)) {
+                break;
+            }
+            relayBuff_.RetrieveAll();
+            ssize_t len = relayBuff_.ReadFd(upFd_, saveErrno);
+            if(len == 0 && bodyMode_ == BODY_EOF) {
+                break;
+            }
+            if(len < 0 && *saveErrno == EAGAIN) {
+                isWaitUpstream_ = true;
+                return -1;
+            }
+            if(len <= 0) {
+                *saveErrno = len == 0 ? EPIPE : *saveErrno;
+                Abort();
+                return -1;
+            }
+            if(bodyMode_ == BODY_CHUNKED) {
+                //逐块扫描，不合并缓冲区
+                struct iovec iov[RELAY_IOV];
+                int iovCnt = relayBuff_.ReadableIov(iov, RELAY_IOV);
+                for(int i = 0; i < iovCnt && chunkState_ != CHUNK_DONE; ++i) {
+                    sendable_ += ScanChunked_(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+                }
+            }
+            else if(bodyMode_ == BODY_LENGTH) {
+                sendable_ = std::min(static_cast<size_t>(len), remaining_);
+                remaining_ -= sendable_;
+            }
+            else {
+                sendable_ = len;
+            }
+            if(static_cast<size_t>(len) > sendable_) {
+                upKeepAlive_ = false;
+            }
+        }
+        struct iovec iov[RELAY_IOV];
+        int iovCnt = relayBuff_.ReadableIov(iov, RELAY_IOV, sendable_);
+        ssize_t len = tls ? tls->Writev(iov, iovCnt, saveErrno) : writev(clientFd, iov, iovCnt);
+        if(len < 0) {
+            if(!tls) {
+                *saveErrno = errno;
+            }
+            if(*saveErrno == EAGAIN) {
+                isWaitUpstream_ = false;
+            }
+            else {
+                Abort();
+            }
+            return -1;
+        }
+        relayBuff_.Retrieve(len);
+        sendable_ -= len;
+        total += len;
+        relayedBytes_ += len;
+    }
+    Finish_(upKeepAlive_);
+    return total;
+}
+
+size_t ProxyRelay::ScanChunked_(const char* data, size_t len) {
+    size_t i = 0;
+    while(i < len && chunkState_ != CHUNK_DONE) {
+        char ch = data[i];
+        switch (chunkState_)
+        {
+        case CHUNK_SIZE:
+            if(isxdigit(ch)) {
+                chunkLeft_ = chunkLeft_ * 16 + (isdigit(ch) ? ch - '0' : (tolower(ch) - 'a' + 10));
+            }
+            else if(ch == '\r') {
+                chunkState_ = CHUNK_SIZE_LF;
+            }
+            else if(ch == '\n') {
+                chunkState_ = chunkLeft_ ? CHUNK_DATA : CHUNK_TRAILER;
+            }
+            else {
+                chunkState_ = CHUNK_EXT;
+            }
+            break;
+        case CHUNK_EXT:
+            if(ch == '\r') chunkState_ = CHUNK_SIZE_LF;
+            else if(ch == '\n') chunkState_ = chunkLeft_ ? CHUNK_DATA : CHUNK_TRAILER;
+            break;
+        case CHUNK_SIZE_LF:
+            chunkState_ = chunkLeft_ ? CHUNK_DATA : CHUNK_TRAILER;
+            lineLen_ = 0;
+            break;
+        case CHUNK_DATA: {
+            size_t skip = std::min(chunkLeft_, len - i);
+            chunkLeft_ -= skip;
+            i += skip;
+            if(chunkLeft_ == 0) {
+                chunkState_ = CHUNK_DATA_CR;
+            }
+            continue;
+        }
+        case CHUNK_DATA_CR:
+            chunkState_ = ch == '\r' ? CHUNK_DATA_LF : CHUNK_SIZE;
+            break;
+        case CHUNK_DATA_LF:
+            chunkState_ = CHUNK_SIZE;
+            break;
+        case CHUNK_TRAILER:
+            //trailer逐行读取，空行结束
+            if(ch == '\n') {
+                if(lineLen_ == 0) chunkState_ = CHUNK_DONE;
+                lineLen_ = 0;
+            }
+            else if(ch != '\r') {
+                lineLen_++;
+            }
+            break;
+        default:
+            break;
+        }
+        ++i;
+    }
+    return i;
+}
+
+bool ProxyRelay::OpenPipe_() {
+    if(pipe2(pipe_, O_NONBLOCK | O_CLOEXEC) < 0) {
+        pipe_[0] = pipe_[1] = -1;
+        return false;
+    }
+    return true;
+}
+
+void ProxyRelay::ClosePipe_() {
+    if(pipe_[0] >= 0) {
+        close(pipe_[0]);
+        close(pipe_[1]);
+        pipe_[0] = pipe_[1] = -1;
+    }
+    pipeBytes_ = 0;
+}
+
+void ProxyRelay::Finish_(bool reusable) {
+    if(upstream_) {
+        upstream_->Release(upFd_, reusable);
+    }
+    upstream_ = nullptr;
+    upFd_ = -1;
+    isActive_ = false;
+    isWaitUpstream_ = false;
+    remaining_ = 0;
+    sendable_ = 0;
+}
+
+void ProxyRelay::Abort() {
+    if(!isActive_ && upFd_ < 0) {
+        return;
+    }
+    //管道中残留的数据属于被放弃的响应，不能留给下一次转发
+    if(pipeBytes_ > 0) {
+        ClosePipe_();
+    }
+    isKeepAlive_ = false;
+    Finish_(false);
+}
+
+bool ProxyRelay::IsActive() const {
+    return isActive_;
+}
+
+bool ProxyRelay::IsKeepAlive() const {
+    return isKeepAlive_;
+}
+
+bool ProxyRelay::IsWaitUpstream() const {
+    return isActive_ && isWaitUpstream_;
+}
+
+int ProxyRelay::GetUpstreamFd() const {
+    return upFd_;
+}
+
+size_t ProxyRelay::PendingBytes() const {
+    if(!isActive_) {
+        return 0;
+    }
+    if(bodyMode_ == BODY_LENGTH) {
+        return remaining_ + sendable_;
+    }
+    return 1;
+}
+
+int ProxyRelay::GetStatus() const {
+    return status_;
+}
+
+size_t ProxyRelay::GetRelayedBytes() const {
+    return relayedBytes_;
+}
+
+bool ProxyRelay::HeaderIs_(const char* name, const char* target) {
+    return strcasecmp(name, target) == 0;
+}
+
+#endif
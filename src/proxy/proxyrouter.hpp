@@ -0,0 +1,107 @@
+#ifndef PROXYROUTER_HPP
+#define PROXYROUTER_HPP
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+
+#include "upstream.hpp"
+#include "../cfg/ymlconfig.hpp"
+#include "../logger/logger.hpp"
+#include "../cfg/runtimeconfig.hpp"
+
+//代理路由：请求路径前缀 -> 上游节点组
+struct ProxyRoute {
+    std::string prefix;
+    std::vector<std::unique_ptr<Upstream>> upstreams;
+    //在途数相同时轮转起点，避免总压在第一个节点
+    std::atomic<unsigned> cursor{0};
+};
+
+class ProxyRouter final {
+public:
+    static ProxyRouter* GetInstance();
+
+    void Init(const std::vector<ProxyRouteCfg>& routes, int poolSize);
+    //最长前缀匹配，未命中返回nullptr
+    ProxyRoute* Match(const char* target) const;
+    //最少在途请求负载均衡，跳过tried中已失败的节点
+    Upstream* Pick(ProxyRoute* route, const std::vector<Upstream*>& tried) const;
+    //连接与收发超时，取自RuntimeConfig快照，可热加载
+    int GetTimeOutMs() const;
+
+private:
+    ProxyRouter() = default;
+    ~ProxyRouter() = default;
+
+    std::vector<std::unique_ptr<ProxyRoute>> routes_;
+};
+
+ProxyRouter* ProxyRouter::GetInstance() {
+    static ProxyRouter router;
+    return &router;
+}
+
+void ProxyRouter::Init(const std::vector<ProxyRouteCfg>& routes, int poolSize) {
+    routes_.clear();
+    for(const auto& cfg : routes) {
+        std::unique_ptr<ProxyRoute> route(new ProxyRoute());
+        route->prefix = cfg.prefix;
+        for(const auto& addr : cfg.upstreams) {
+            //host:port
+            size_t colon = addr.find_last_of(':');
+            if(colon == std::string::npos) {
+                LOG_ERROR("Proxy upstream %s format error", addr.c_str());
+                continue;
+            }
+            int port = atoi(addr.c_str() + colon + 1);
+            route->upstreams.emplace_back(new Upstream(addr.substr(0, colon), port, poolSize));
+        }
+        if(route->prefix.empty() || route->upstreams.empty()) {
+            LOG_ERROR("Proxy route %s ignored", route->prefix.c_str());
+            continue;
+        }
+        LOG_INFO("Proxy route: %s -> %d upstream(s)", route->prefix.c_str(), (int)route->upstreams.size());
+        routes_.push_back(std::move(route));
+    }
+    std::sort(routes_.begin(), routes_.end(),
+              [](const std::unique_ptr<ProxyRoute>& a, const std::unique_ptr<ProxyRoute>& b) {
+                  return a->prefix.size() > b->prefix.size();
+              });
+}
+
+ProxyRoute* ProxyRouter::Match(const char* target) const {
+    for(const auto& route : routes_) {
+        if(strncmp(target, route->prefix.c_str(), route->prefix.size()) == 0) {
+            return route.get();
+        }
+    }
+    return nullptr;
+}
+
+Upstream* ProxyRouter::Pick(ProxyRoute* route, const std::vector<Upstream*>& tried) const {
+    assert(route);
+    size_t count = route->upstreams.size();
+    size_t start = route->cursor++ % count;
+    Upstream* best = nullptr;
+    for(size_t i = 0; i < count; ++i) {
+        Upstream* up = route->upstreams[(start + i) % count].get();
+        if(!up->IsValid() || std::find(tried.begin(), tried.end(), up) != tried.end()) {
+            continue;
+        }
+        if(best == nullptr || up->Outstanding() < best->Outstanding()) {
+            best = up;
+        }
+    }
+    return best;
+}
+
+int ProxyRouter::GetTimeOutMs() const {
+    return RuntimeConfig::Get()->proxyTimeOutMs;
+}
+
+#endif
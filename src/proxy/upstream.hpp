@@ -0,0 +1,174 @@
+#ifndef UPSTREAM_HPP
+#define UPSTREAM_HPP
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h> // TCP_NODELAY
+#include <netdb.h>       // getaddrinfo
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <assert.h>
+
+#include "../logger/logger.hpp"
+
+//上游服务节点，维护空闲长连接池与在途请求数
+class Upstream final {
+public:
+    Upstream(const std::string& host, int port, int maxIdle);
+    ~Upstream();
+
+    //取出连接，优先复用空闲长连接，reused标记是否为复用连接
+    //新建的连接connecting为true时连接尚未完成，须等待可写后由IsConnected确认
+    int Acquire(bool* reused, bool* connecting);
+    //归还连接，不可复用或池满则直接关闭
+    void Release(int fd, bool reusable);
+
+    //在途请求数，负载均衡依据
+    int Outstanding() const;
+    bool IsValid() const;
+    const std::string& Name() const;
+
+    //非阻塞connect是否已成功建立
+    static bool IsConnected(int fd);
+
+private:
+    //发起非阻塞connect，不等待完成，失败返回-1
+    int Connect_(bool* connecting);
+    //空闲连接是否已被对端关闭
+    static bool IsAlive_(int fd);
+
+    std::string name_;
+    bool isValid_;
+    size_t maxIdle_;
+    sockaddr_in addr_;
+    std::atomic<int> outstanding_;
+    std::vector<int> idle_;
+    std::mutex mtx_;
+};
+
+Upstream::Upstream(const std::string& host, int port, int maxIdle)
+    : name_(host + ":" + std::to_string(port)), isValid_(false),
+      maxIdle_(maxIdle > 0 ? maxIdle : 0), addr_({0}), outstanding_(0) {
+    //启动时解析一次地址，转发时不再查询DNS
+    addrinfo hints = {0};
+    addrinfo* result = nullptr;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if(getaddrinfo(host.c_str(), nullptr, &hints, &result) == 0 && result) {
+        addr_ = *reinterpret_cast<sockaddr_in*>(result->ai_addr);
+        addr_.sin_port = htons(port);
+        isValid_ = true;
+        freeaddrinfo(result);
+    }
+    else {
+        LOG_ERROR("Upstream %s resolve error", name_.c_str());
+    }
+}
+
+Upstream::~Upstream() {
+    std::lock_guard<std::mutex> locker(mtx_);
+    for(int fd : idle_) {
+        close(fd);
+    }
+    idle_.clear();
+}
+
+int Upstream::Acquire(bool* reused, bool* connecting) {
+    assert(reused && connecting);
+    *reused = false;
+    *connecting = false;
+    if(!isValid_) {
+        return -1;
+    }
+    int fd = -1;
+    {
+        std::lock_guard<std::mutex> locker(mtx_);
+        while(!idle_.empty()) {
+            fd = idle_.back();
+            idle_.pop_back();
+            if(IsAlive_(fd)) {
+                *reused = true;
+                break;
+            }
+            close(fd);
+            fd = -1;
+        }
+    }
+    if(fd < 0) {
+        fd = Connect_(connecting);
+    }
+    if(fd >= 0) {
+        outstanding_++;
+    }
+    return fd;
+}
+
+void Upstream::Release(int fd, bool reusable) {
+    if(fd < 0) {
+        return;
+    }
+    outstanding_--;
+    if(reusable) {
+        std::lock_guard<std::mutex> locker(mtx_);
+        if(idle_.size() < maxIdle_) {
+            idle_.push_back(fd);
+            return;
+        }
+    }
+    close(fd);
+}
+
+int Upstream::Outstanding() const {
+    return outstanding_;
+}
+
+bool Upstream::IsValid() const {
+    return isValid_;
+}
+
+const std::string& Upstream::Name() const {
+    return name_;
+}
+
+bool Upstream::IsConnected(int fd) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    return getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err == 0;
+}
+
+int Upstream::Connect_(bool* connecting) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0) {
+        return -1;
+    }
+    int optval = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval));
+
+    //连接的完成交给reactor等待，不在工作线程上阻塞
+    int ret = connect(fd, (const sockaddr*)&addr_, sizeof(addr_));
+    if(ret < 0 && errno == EINPROGRESS) {
+        *connecting = true;
+        ret = 0;
+    }
+    if(ret < 0) {
+        LOG_WARN("Upstream %s connect error", name_.c_str());
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool Upstream::IsAlive_(int fd) {
+    //空闲连接上不应有数据，可读即意味着对端关闭或协议错乱
+    char ch;
+    ssize_t len = recv(fd, &ch, 1, MSG_PEEK | MSG_DONTWAIT);
+    return len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+#endif
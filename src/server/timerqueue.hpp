@@ -0,0 +1,123 @@
+#ifndef TIMERQUEUE_HPP
+#define TIMERQUEUE_HPP
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <queue>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <functional>
+#include <stdint.h>
+#include <assert.h>
+
+/*
+    reactor线程上的定时任务
+    1、任意线程可登记，到期后由reactor线程在epoll_wait返回后执行，回调应只做投递等轻量操作
+    2、epoll_wait的超时取最近的到期时间；新任务早于当前最早到期时写eventfd唤醒reactor
+*/
+class TimerQueue final {
+public:
+    TimerQueue();
+    ~TimerQueue();
+    TimerQueue(const TimerQueue&) = delete;
+    TimerQueue& operator=(const TimerQueue&) = delete;
+
+    //ms毫秒后在reactor线程执行task
+    void RunAfter(int ms, std::function<void()> task);
+    //距最近一个任务到期的毫秒数，没有任务返回-1
+    int NextTimeoutMs();
+    //执行全部已到期任务
+    void RunExpired();
+
+    //唤醒fd，reactor以EPOLLIN登记
+    int GetWakeFd() const;
+    //读空唤醒计数
+    void OnWake();
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Timer {
+        Clock::time_point expires;
+        //同一时刻到期的任务按登记顺序执行
+        uint64_t seq;
+        std::function<void()> task;
+    };
+    struct Later {
+        bool operator()(const Timer& lhs, const Timer& rhs) const {
+            return lhs.expires > rhs.expires || (lhs.expires == rhs.expires && lhs.seq > rhs.seq);
+        }
+    };
+
+    std::mutex mtx_;
+    std::priority_queue<Timer, std::vector<Timer>, Later> timers_;
+    uint64_t seq_;
+    int wakeFd_;
+};
+
+TimerQueue::TimerQueue() : seq_(0), wakeFd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {
+    assert(wakeFd_ >= 0);
+}
+
+TimerQueue::~TimerQueue() {
+    close(wakeFd_);
+}
+
+void TimerQueue::RunAfter(int ms, std::function<void()> task) {
+    Clock::time_point expires = Clock::now() + std::chrono::milliseconds(ms > 0 ? ms : 0);
+    bool isEarliest = false;
+    {
+        std::lock_guard<std::mutex> locker(mtx_);
+        isEarliest = timers_.empty() || expires < timers_.top().expires;
+        timers_.push({expires, seq_++, std::move(task)});
+    }
+    //reactor可能正按更晚的超时阻塞在epoll_wait
+    if (isEarliest) {
+        uint64_t one = 1;
+        ssize_t ret = write(wakeFd_, &one, sizeof(one));
+        (void)ret;
+    }
+}
+
+int TimerQueue::NextTimeoutMs() {
+    std::lock_guard<std::mutex> locker(mtx_);
+    if (timers_.empty()) {
+        return -1;
+    }
+    Clock::duration left = timers_.top().expires - Clock::now();
+    if (left <= Clock::duration::zero()) {
+        return 0;
+    }
+    //向上取整，避免提前醒来后空转
+    return static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                            left + std::chrono::milliseconds(1) - Clock::duration(1)).count());
+}
+
+void TimerQueue::RunExpired() {
+    std::vector<std::function<void()>> expired;
+    {
+        std::lock_guard<std::mutex> locker(mtx_);
+        Clock::time_point now = Clock::now();
+        while (!timers_.empty() && timers_.top().expires <= now) {
+            expired.push_back(std::move(const_cast<Timer&>(timers_.top()).task));
+            timers_.pop();
+        }
+    }
+    //锁外执行，任务中可以再登记定时
+    for (auto& task : expired) {
+        task();
+    }
+}
+
+int TimerQueue::GetWakeFd() const {
+    return wakeFd_;
+}
+
+void TimerQueue::OnWake() {
+    uint64_t cnt = 0;
+    ssize_t ret = read(wakeFd_, &cnt, sizeof(cnt));
+    (void)ret;
+}
+
+#endif
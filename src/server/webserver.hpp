@@ -3,51 +3,120 @@
 
 #include <sys/socket.h>
 #include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/inotify.h>
+#include <signal.h>
 #include <netinet/in.h>
 #include <unistd.h>
 #include <assert.h>
 #include <string.h>
 #include <fcntl.h>
 #include <memory>
+#include <mutex>
+#include <map>
 
 #include "../pool/threadpool.hpp"
 #include "../http/httpconn.hpp"
 #include "epoller.hpp"
+#include "timerqueue.hpp"
 #include "../pool/sqlconnpool.hpp"
-#include "../pool/sqlconnRAII.hpp"
+#include "../pool/sqlasync.hpp"
+#include "../pool/sqlbatch.hpp"
 #include "../logger/logger.hpp"
+#include "../logger/accesslog.hpp"
 #include "../cfg/ymlconfig.hpp"
+#include "../cfg/runtimeconfig.hpp"
+#include "../proxy/proxyrouter.hpp"
+#include "../cache/microcache.hpp"
+#include "../cache/usercache.hpp"
+#include "../cache/userfilter.hpp"
+#include "../tls/tlscontext.hpp"
+#include "../upload/uploadstore.hpp"
+#include "../http/assetbundle.hpp"
+#include "../metrics/metrics.hpp"
+#include "../metrics/slowlog.hpp"
+#include "../store/mysqluserstore.hpp"
+#include "../store/memoryuserstore.hpp"
 
 class WebServer final {
 public:
     /* 端口 ET模式 timeoutMs 优雅退出  */
     /* Mysql配置 */
-    /* 连接池数量 线程池数量 日志开关 日志等级 日志异步队列容量 */
+    /* 连接池数量 线程池数量 日志开关 日志等级 日志异步队列容量 二进制日志 */
     WebServer(int port, int trigMode, int timeOutMs, bool optLinger,
               int sqlPort, const char *sqlUser, const char *sqlPwd,
               const char *dbName, int connPoolNum, int threadNum,
-              bool openLog, int logLevel, int logQueSize);
+              bool openLog, int logLevel, int logQueSize, bool logBinary = false);
 
     //委托构造
     WebServer(YmlConfig& ymlConfig) : WebServer(ymlConfig.serverPort, ymlConfig.trigMode, ymlConfig.timeOutMs, ymlConfig.optLinger,
                                                 ymlConfig.sqlPort, ymlConfig.sqlUser.get()->c_str(), ymlConfig.sqlPwd.get()->c_str(),
                                                 ymlConfig.dbName.get()->c_str(), ymlConfig.connPoolNum, ymlConfig.threadNum,
-                                                ymlConfig.openLog, ymlConfig.logLevel, ymlConfig.logQueSize) {}
+                                                ymlConfig.openLog, ymlConfig.logLevel, ymlConfig.logQueSize, ymlConfig.logBinary) {
+        //可热加载的参数先发布，以下模块初始化时从快照读取
+        if (!RuntimeConfig::Validate(ymlConfig)) {
+            isClose_ = true;
+        }
+        RuntimeConfig::Publish(std::make_unique<RuntimeConfig>(ymlConfig));
+        restartOnly_ = RuntimeConfig::RestartOnly(ymlConfig);
+        Logger::GetInstance()->SetRotation(ymlConfig.logMaxFileMb, ymlConfig.logCompress, ymlConfig.logMaxFiles,
+                                           ymlConfig.logMaxAgeDays, ymlConfig.logMaxTotalMb);
+        ProxyRouter::GetInstance()->Init(ymlConfig.proxyRoutes, ymlConfig.proxyPoolSize);
+        MicroCache::GetInstance()->Init(ymlConfig.microCacheOpen, ymlConfig.microCacheVary, ymlConfig.microCachePaths);
+        UserCache::GetInstance()->Init(ymlConfig.userCacheOpen);
+        InitTls_(ymlConfig);
+        InitMaxConn_(ymlConfig.maxConn);
+        InitExecutors_(ymlConfig);
+        InitSqlAsync_(ymlConfig.sqlAsync);
+        InitUserStore_(ymlConfig);
+        UploadStore::GetInstance()->Init(ymlConfig.uploadOpen, ymlConfig.uploadDir, ymlConfig.uploadMaxBodyMb,
+                                         ymlConfig.uploadPaths);
+        AccessLog::GetInstance()->Init(ymlConfig.accessLogOpen, "./log", ymlConfig.accessLogSampleRate,
+                                       ymlConfig.accessLogStatusRates);
+        if (ymlConfig.assetBundleOpen) {
+            AssetBundle::GetInstance()->Open(ymlConfig.assetBundleFile);
+        }
+        InitMetrics_(ymlConfig);
+        SlowLog::GetInstance()->Init(ymlConfig.slowLogOpen, ymlConfig.slowLogCapacity, ymlConfig.slowLogPath);
+        InitReload_(ymlConfig.configWatch);
+    }
     //析构
     ~WebServer();
     //启动服务入口
     void StartServer();
+    //各执行器的计数快照，io在前
+    std::vector<ThreadPoolStats> GetExecutorStats() const;
 
 private:
     /*----------------------数据交互前初始化-----------------*/
-    //创建FD
-    bool InitSocket_();
+    //创建监听FD
+    bool InitSocket_(int port, int& listenFd);
     //初始化事件处理模式
     void InitEventMode_(int trigMode);
     //处理监听流程
-    void DealListen_();
+    void DealListen_(int listenFd, bool isTls);
     //保存客户端信息
-    void AddClient_(int fd, sockaddr_in addr);
+    void AddClient_(int fd, sockaddr_in addr, bool isTls);
+    //开启TLS监听端口
+    void InitTls_(const YmlConfig& ymlConfig);
+    //设置最大连接数，并按需提高进程fd上限
+    void InitMaxConn_(int maxConn);
+    //按配置创建具名执行器，查库任务交给db执行器
+    void InitExecutors_(const YmlConfig& ymlConfig);
+    //开启非阻塞查库，查询由reactor驱动而不占db执行器线程
+    void InitSqlAsync_(bool isAsync);
+    //按配置选定用户数据后端，并登记定期维护
+    void InitUserStore_(const YmlConfig& ymlConfig);
+    //启动时扫表建立用户名过滤器
+    void InitUserFilter_(const YmlConfig& ymlConfig);
+    //到期后在db执行器上执行后端维护，完成后登记下一次
+    void ScheduleStoreMaintain_();
+    //开启指标输出，抓取时追加执行器、连接池与连接数
+    void InitMetrics_(const YmlConfig& ymlConfig);
+    void CollectMetrics_(std::string& out) const;
+    //SIGHUP与properties.yml的修改经epoll交给reactor，触发重新加载
+    void InitReload_(bool isWatch);
     //更改FD为非阻塞状态
     static int SetFdNonBlock(int fd);
 
@@ -63,31 +132,80 @@ private:
     void OnWrite_(HttpConn* client);
     //处理过程
     void OnProcess(HttpConn* client);
+    //挂起的请求被唤醒后继续处理
+    void OnResume_(HttpConn* client);
     //接收错误信息
     void SendError_(int fd, const char *info);
     //void ExtentTime_(HttpConn* client);
+    //读出SIGHUP后重新加载配置
+    void OnSignal_();
+    //properties.yml写入完成或被替换，合并短时间内的多次修改后重新加载
+    void OnConfigChange_();
+    //在reactor线程上重新读取配置：读取或校验失败保留当前配置，否则发布新快照并应用到各模块
+    void ReloadConfig_();
+    //按配置调整已有执行器的线程数、伸缩上限与排队上限
+    void ResizeExecutors_(const YmlConfig& ymlConfig);
+    //代理响应体等待上游可读，上游fd一次性登记到epoll
+    void WatchUpstream_(HttpConn* client);
+    //上游fd就绪，取回对应客户端连接，未登记返回nullptr
+    HttpConn* TakeUpstream_(int fd);
+    //非阻塞查库与代理请求的上游连接、发送及响应头等待fd，一次性登记到epoll，需要时同时登记超时
+    //waitFor与回调参数均为SqlAsyncQuery::WAIT_EVENT组合
+    void WatchFd_(int fd, int waitFor, unsigned timeoutMs, std::function<void(int)> ready);
+    //等待的fd就绪或超时，id不为0时只取回该次登记；在io执行器上执行回调，未登记返回false
+    bool TakeFd_(int fd, uint64_t id, int ready);
 
     /*-----------------------交互后释放资源------------------*/    
     //关闭连接
     void CloseConn_(HttpConn *client);
 
 private:
-    //最大连接FD数
+    //默认最大连接FD数
     static const int MAX_FD = 65536;
+    //配置文件修改后延迟加载，合并编辑器保存产生的多次事件
+    static const int RELOAD_DELAY_MS = 200;
+    int maxConn_;
 
     int port_;
     int timeOutMs_;
     bool openLinger_;
     bool isClose_;
     int listenFd_;
+    int tlsListenFd_;
     char *srcDir_;
 
     uint32_t listenEvent_;
     uint32_t connEvent_;
 
     std::unique_ptr<Epoller> epoller_;
+    //reactor线程上的定时任务，决定epoll_wait超时
+    std::unique_ptr<TimerQueue> timers_;
+    //io执行器：连接读写与请求处理；不设排队上限，投递的任务总会执行（EPOLLONESHOT的fd靠它重新注册）
     std::unique_ptr<ThreadPool> threadpool_;
+    //其余具名执行器，与io隔离，互不占用线程
+    std::unordered_map<std::string, std::unique_ptr<ThreadPool>> executors_;
+    //查库任务的执行器，未配置db时为io
+    ThreadPool* dbExecutor_;
     std::unordered_map<int, HttpConn> users_;
+    //上游fd -> 等待该上游数据的客户端连接
+    std::unordered_map<int, HttpConn*> upstreams_;
+    std::mutex upstreamMtx_;
+    //mysql连接fd或上游fd -> 等待中的非阻塞查询或代理请求
+    struct FdWait {
+        uint64_t id;
+        std::function<void(int)> ready;
+    };
+    std::unordered_map<int, FdWait> fdWaits_;
+    uint64_t fdWaitSeq_;
+    std::mutex fdMtx_;
+    //SIGHUP的signalfd与监视配置所在目录的inotify fd，未开启为-1
+    int signalFd_;
+    int watchFd_;
+    bool isReloadPending_;
+    //启动时重启才生效的配置项，重新加载时比较
+    std::map<std::string, std::string> restartOnly_;
+    //memory后端不常驻数据库连接
+    bool isMemoryStore_;
 };
 
 int WebServer::SetFdNonBlock(int fd) {
@@ -100,10 +218,16 @@ WebServer::WebServer(
             int port, int trigMode, int timeOutMs, bool optLinger,
             int sqlPort, const char *sqlUser, const char *sqlPwd,
             const char *dbName, int connPoolNum, int threadNum,
-            bool openLog, int logLevel, int logQueSize) 
+            bool openLog, int logLevel, int logQueSize, bool logBinary) 
 {   
+    //SIGHUP由reactor经signalfd读取，须在创建日志等线程之前屏蔽，之后创建的线程继承屏蔽字
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+
     if(openLog) {
-        Logger::GetInstance()->Init(logLevel, "./log", ".log", logQueSize);
+        Logger::GetInstance()->Init(logLevel, "./log", ".log", logQueSize, logBinary);
         if(isClose_) {LOG_ERROR("========== Server init error!==========");}
         else {LOG_INFO("========== Server init success!==========");}
     }
@@ -113,9 +237,19 @@ WebServer::WebServer(
     openLinger_ = optLinger;
     isClose_ = false;
     listenFd_ = -1;
+    tlsListenFd_ = -1;
+    maxConn_ = MAX_FD;
+    fdWaitSeq_ = 0;
+    signalFd_ = -1;
+    watchFd_ = -1;
+    isReloadPending_ = false;
+    isMemoryStore_ = false;
     srcDir_ = nullptr;
     threadpool_ = std::make_unique<ThreadPool>(threadNum);
+    dbExecutor_ = threadpool_.get();
     epoller_ = std::make_unique<Epoller>();
+    timers_ = std::make_unique<TimerQueue>();
+    epoller_->AddFd(timers_->GetWakeFd(), EPOLLIN);
 
     //1、初始化资源绝对路径
     srcDir_ = getcwd(nullptr, 256);
@@ -125,6 +259,24 @@ WebServer::WebServer(
     HttpConn::userCount = 0;
     HttpConn::isET = trigMode;
     HttpConn::srcDir = srcDir_;
+    HttpConn::onResume = [this](HttpConn* client) {
+        threadpool_->AddTask(std::bind(&WebServer::OnResume_, this, client));
+    };
+    HttpConn::postDbTask = [this](std::function<void()> task) {
+        return dbExecutor_->AddTask(std::move(task));
+    };
+    HttpConn::runAfter = [this](int ms, std::function<void()> task) {
+        timers_->RunAfter(ms, std::move(task));
+    };
+    HttpConn::awaitFd = [this](int fd, bool isWrite, int timeoutMs, std::function<void(bool)> ready) {
+        int waitFor = (isWrite ? SqlAsyncQuery::WAIT_WRITE : SqlAsyncQuery::WAIT_READ) | SqlAsyncQuery::WAIT_TIMEOUT;
+        WatchFd_(fd, waitFor, timeoutMs, [ready](int status) {
+            ready(!(status & SqlAsyncQuery::WAIT_TIMEOUT));
+        });
+    };
+    SqlAsyncQuery::wait = [this](int fd, int waitFor, unsigned timeoutMs, std::function<void(int)> ready) {
+        WatchFd_(fd, waitFor, timeoutMs, std::move(ready));
+    };
 
     //3、sql初始化
     SqlConnPool::GetInstance()->InitSqlPool("localhost", sqlPort, sqlUser, sqlPwd, dbName, connPoolNum);
@@ -132,7 +284,7 @@ WebServer::WebServer(
     InitEventMode_(trigMode);
 
     //5、初始化socket
-    if (!InitSocket_()) {
+    if (!InitSocket_(port_, listenFd_)) {
         isClose_ = true;
     }
 
@@ -145,21 +297,140 @@ WebServer::WebServer(
 
 WebServer::~WebServer() {
     close(listenFd_);
+    if (tlsListenFd_ >= 0) {
+        close(tlsListenFd_);
+    }
+    if (signalFd_ >= 0) {
+        close(signalFd_);
+    }
+    if (watchFd_ >= 0) {
+        close(watchFd_);
+    }
     isClose_ = true;
+    //先完成后端排队中的写入，再关闭连接池
+    UserStore::GetInstance()->Close();
     SqlConnPool::GetInstance()->CloseSqlConnPool();
+    AccessLog::GetInstance()->Close();
     LOG_INFO("========== ~WebServer success!==========");
 }
 
+std::vector<ThreadPoolStats> WebServer::GetExecutorStats() const {
+    std::vector<ThreadPoolStats> stats;
+    stats.push_back(threadpool_->GetStats());
+    for (const auto& executor : executors_) {
+        stats.push_back(executor.second->GetStats());
+    }
+    return stats;
+}
+
+void WebServer::InitMetrics_(const YmlConfig& ymlConfig) {
+    Metrics::GetInstance()->Init(ymlConfig.metricsOpen, ymlConfig.metricsPath);
+    if (!Metrics::GetInstance()->IsOpen()) {
+        return;
+    }
+    Metrics::GetInstance()->AddCollector([this](std::string& out) {
+        CollectMetrics_(out);
+    });
+}
+
+void WebServer::CollectMetrics_(std::string& out) const {
+    char labels[128];
+    Metrics::AppendHeader(out, "webserver_connections_active", "gauge", "Open client connections.");
+    Metrics::AppendLine(out, "webserver_connections_active", nullptr, HttpConn::userCount.load());
+
+    std::vector<ThreadPoolStats> executors = GetExecutorStats();
+    Metrics::AppendHeader(out, "webserver_executor_threads", "gauge", "Live threads per executor.");
+    for (const auto& stats : executors) {
+        snprintf(labels, sizeof(labels), "executor=\"%s\"", stats.name.c_str());
+        Metrics::AppendLine(out, "webserver_executor_threads", labels, stats.threadNum);
+    }
+    Metrics::AppendHeader(out, "webserver_executor_idle_threads", "gauge", "Idle threads per executor.");
+    for (const auto& stats : executors) {
+        snprintf(labels, sizeof(labels), "executor=\"%s\"", stats.name.c_str());
+        Metrics::AppendLine(out, "webserver_executor_idle_threads", labels, stats.idleNum);
+    }
+    Metrics::AppendHeader(out, "webserver_executor_queue_length", "gauge", "Tasks waiting per executor.");
+    for (const auto& stats : executors) {
+        snprintf(labels, sizeof(labels), "executor=\"%s\"", stats.name.c_str());
+        Metrics::AppendLine(out, "webserver_executor_queue_length", labels, stats.queueLen);
+    }
+    Metrics::AppendHeader(out, "webserver_executor_rejects_total", "counter", "Tasks rejected at queueMax.");
+    for (const auto& stats : executors) {
+        snprintf(labels, sizeof(labels), "executor=\"%s\"", stats.name.c_str());
+        Metrics::AppendLine(out, "webserver_executor_rejects_total", labels, stats.rejects);
+    }
+    Metrics::AppendHeader(out, "webserver_executor_tasks_total", "counter", "Tasks run per executor.");
+    for (const auto& stats : executors) {
+        uint64_t tasks = 0;
+        for (const auto& worker : stats.workers) {
+            tasks += worker.tasks;
+        }
+        snprintf(labels, sizeof(labels), "executor=\"%s\"", stats.name.c_str());
+        Metrics::AppendLine(out, "webserver_executor_tasks_total", labels, tasks);
+    }
+    Metrics::AppendHeader(out, "webserver_executor_busy_seconds_total", "counter", "Thread time spent running tasks.");
+    for (const auto& stats : executors) {
+        uint64_t busyUs = 0;
+        for (const auto& worker : stats.workers) {
+            busyUs += worker.busyUs;
+        }
+        snprintf(labels, sizeof(labels), "executor=\"%s\"", stats.name.c_str());
+        Metrics::AppendLine(out, "webserver_executor_busy_seconds_total", labels, busyUs / 1e6);
+    }
+
+    //memory后端不使用连接池
+    if (isMemoryStore_) {
+        return;
+    }
+    SqlConnPoolStats sql = SqlConnPool::GetInstance()->GetStats();
+    Metrics::AppendHeader(out, "webserver_sql_connections", "gauge", "MySQL pool connections by state.");
+    Metrics::AppendLine(out, "webserver_sql_connections", "state=\"idle\"", sql.idleNum);
+    Metrics::AppendLine(out, "webserver_sql_connections", "state=\"in_use\"", sql.inUseNum);
+    Metrics::AppendLine(out, "webserver_sql_connections", "state=\"connecting\"", sql.connectingNum);
+    Metrics::AppendHeader(out, "webserver_sql_waiters", "gauge", "Requests waiting for a MySQL connection.");
+    Metrics::AppendLine(out, "webserver_sql_waiters", nullptr, sql.waiterNum);
+    Metrics::AppendHeader(out, "webserver_sql_down", "gauge", "1 when MySQL is unreachable and acquires fail fast.");
+    Metrics::AppendLine(out, "webserver_sql_down", nullptr, sql.isDown ? 1 : 0);
+    Metrics::AppendHeader(out, "webserver_sql_acquires_total", "counter", "Connection acquires.");
+    Metrics::AppendLine(out, "webserver_sql_acquires_total", nullptr, sql.acquires);
+    Metrics::AppendHeader(out, "webserver_sql_acquire_waits_total", "counter", "Acquires that had to wait.");
+    Metrics::AppendLine(out, "webserver_sql_acquire_waits_total", nullptr, sql.waits);
+    Metrics::AppendHeader(out, "webserver_sql_acquire_wait_seconds_total", "counter", "Time spent waiting to acquire.");
+    Metrics::AppendLine(out, "webserver_sql_acquire_wait_seconds_total", nullptr, sql.waitUs / 1e6);
+    Metrics::AppendHeader(out, "webserver_sql_acquire_timeouts_total", "counter", "Acquires that timed out.");
+    Metrics::AppendLine(out, "webserver_sql_acquire_timeouts_total", nullptr, sql.timeouts);
+}
+
 void WebServer::StartServer() {
     LOG_INFO("========== Server Start success!==========");
     int timeMS = -1;
     while(!isClose_) {
+        //无定时任务时一直阻塞到有事件
+        timeMS = timers_->NextTimeoutMs();
         int eventCnt = epoller_->WaitEvent(timeMS);
         for (int i = 0; i < eventCnt; ++i) {
             int clientFd = epoller_->GetEventFd(i);
             uint32_t event = epoller_->GetEvent(i);
-            if(clientFd == listenFd_) {
-                DealListen_();
+            if(clientFd == timers_->GetWakeFd()) {
+                timers_->OnWake();
+            }
+            else if(clientFd == listenFd_) {
+                DealListen_(listenFd_, false);
+            }
+            else if (clientFd == tlsListenFd_) {
+                DealListen_(tlsListenFd_, true);
+            }
+            else if (clientFd == signalFd_) {
+                OnSignal_();
+            }
+            else if (clientFd == watchFd_) {
+                OnConfigChange_();
+            }
+            else if (HttpConn* client = TakeUpstream_(clientFd)) {
+                DealWrite_(client);
+            }
+            else if (TakeFd_(clientFd, 0, event)) {
+                continue;
             }
             else if (event & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
                 assert(users_.count(clientFd) > 0);
@@ -178,80 +449,325 @@ void WebServer::StartServer() {
                 continue;
             }
         }
+        timers_->RunExpired();
     }
 }
 
-bool WebServer::InitSocket_() {
+bool WebServer::InitSocket_(int port, int &listenFd) {
     //1、绑定本地socket信息
     int ret = 0;
     sockaddr_in add;
-    if (port_ < 1024 || port_ > 65535) {
+    if (port < 1024 || port > 65535) {
         LOG_ERROR("Port error");
         return false;
     }
     add.sin_family = AF_INET;
     add.sin_addr.s_addr = htonl(INADDR_ANY);
-    add.sin_port = htons(port_);
+    add.sin_port = htons(port);
 
     //2、socket生成监听lfd
-    listenFd_ = socket(AF_INET, SOCK_STREAM, 0);
-    if (listenFd_ == -1) {
+    listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenFd == -1) {
         LOG_ERROR("ListenFd error");
-        close(listenFd_);
+        close(listenFd);
         return false;
     }
 
-    //3、setsockopt配置listenFd_属性
+    //3、setsockopt配置listenFd属性
     //SO_LINGER 添加等待数据处理结束或超10s后再关闭lfd
     struct linger optLinger = { 0 };
     if (openLinger_) {
         optLinger.l_onoff = 1;
         optLinger.l_linger = 10;
     }
-    ret = setsockopt(listenFd_, SOL_SOCKET, SO_LINGER, &optLinger, sizeof(linger));
+    ret = setsockopt(listenFd, SOL_SOCKET, SO_LINGER, &optLinger, sizeof(linger));
     if (ret == -1) {
         LOG_ERROR("Set SO_LINGER error");
-        close(listenFd_);
+        close(listenFd);
         return false;
     }      
 
     //SO_REUSEADDR 端口复用,防止s端处于time_wait无法重启
     int optval = 1;
-    ret = setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, (const void*)&optval, sizeof(int));
+    ret = setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, (const void*)&optval, sizeof(int));
     if (ret == -1) {
         LOG_ERROR("Set SO_REUSEADDR error");
-        close(listenFd_);
+        close(listenFd);
         return false;
     }      
 
-    //4、bind绑定listenFd_信息
-    ret = bind(listenFd_, (const sockaddr *)&add, sizeof(add));
+    //4、bind绑定listenFd信息
+    ret = bind(listenFd, (const sockaddr *)&add, sizeof(add));
     if (ret < 0) {
         LOG_ERROR("Set Bind error");
-        close(listenFd_);
+        close(listenFd);
         return false;
     }   
 
-    //5、listen开启listenFd_监听
-    ret = listen(listenFd_, 5);
+    //5、listen开启listenFd监听，大量客户端同时建连时队列过短会丢弃握手
+    ret = listen(listenFd, SOMAXCONN);
     if (ret == -1) {
         LOG_ERROR("Set Listen error");
-        close(listenFd_);
+        close(listenFd);
         return false;
     }   
 
     //6、调整监听fd属性
-    ret = epoller_->AddFd(listenFd_, listenEvent_ | EPOLLIN);
+    ret = epoller_->AddFd(listenFd, listenEvent_ | EPOLLIN);
     if (!ret) {
         LOG_ERROR("AddFd error");
-        close(listenFd_);
+        close(listenFd);
         return false;
     }       
-    SetFdNonBlock(listenFd_);
+    SetFdNonBlock(listenFd);
 
     return true;
 }
 
+void WebServer::InitExecutors_(const YmlConfig& ymlConfig) {
+    int ioMax = ymlConfig.maxThreadNum;
+    for (const auto& cfg : ymlConfig.executors) {
+        if (cfg.threadNum <= 0) {
+            LOG_ERROR("Executor %s: threadNum must be positive", cfg.name.c_str());
+            continue;
+        }
+        //io执行器不限排队（Validate已检查），读写与唤醒任务不会被拒绝
+        int queueMax = cfg.name == "io" ? 0 : cfg.queueMax;
+        std::unique_ptr<ThreadPool> pool = std::make_unique<ThreadPool>(cfg.threadNum, queueMax, cfg.name);
+        if (cfg.maxThreadNum > cfg.threadNum) {
+            pool->SetElastic(cfg.maxThreadNum, ymlConfig.threadGrowWaitMs, ymlConfig.threadIdleMs);
+        }
+        LOG_INFO("Executor %s: %d ~ %d threads, queueMax: %d", cfg.name.c_str(), cfg.threadNum,
+                 std::max(cfg.threadNum, cfg.maxThreadNum), queueMax);
+        //io执行器由此替换，此时服务尚未启动，旧线程池没有任务
+        if (cfg.name == "io") {
+            threadpool_ = std::move(pool);
+            ioMax = 0;
+        }
+        else {
+            executors_[cfg.name] = std::move(pool);
+        }
+    }
+    if (ioMax > ymlConfig.threadNum) {
+        threadpool_->SetElastic(ioMax, ymlConfig.threadGrowWaitMs, ymlConfig.threadIdleMs);
+        LOG_INFO("ThreadPool elastic: %d ~ %d threads", ymlConfig.threadNum, ioMax);
+    }
+    auto db = executors_.find("db");
+    dbExecutor_ = db != executors_.end() ? db->second.get() : threadpool_.get();
+}
+
+void WebServer::InitSqlAsync_(bool isAsync) {
+    if (!SqlConnPool::GetInstance()->SetNonBlocking(isAsync)) {
+        LOG_WARN("MySQL client has no non-blocking API, queries run on db executor");
+        return;
+    }
+    LOG_INFO("MySQL non-blocking: %s", SqlConnPool::GetInstance()->IsNonBlocking() ? "true" : "false");
+}
+
+void WebServer::InitUserStore_(const YmlConfig& ymlConfig) {
+    if (ymlConfig.userStoreType == "memory") {
+        std::unique_ptr<MemoryUserStore> store = std::make_unique<MemoryUserStore>(ymlConfig.userStoreSnapshotFile,
+                                                                                   ymlConfig.userStoreSnapshotSec);
+        //快照读不出来时不启动，以免之后的快照覆盖原有数据
+        if (!store->Load()) {
+            isClose_ = true;
+        }
+        LOG_INFO("UserStore: memory, %zu users", store->GetUserCount());
+        UserStore::SetInstance(std::move(store));
+        isMemoryStore_ = true;
+        //不常驻连接，连接池不会主动连库
+        SqlConnPool::GetInstance()->SetElastic(0, ymlConfig.sqlIdleMs, ymlConfig.sqlKeepaliveMs,
+                                               ymlConfig.sqlAcquireTimeoutMs, ymlConfig.sqlRetryMs);
+    }
+    else {
+        if (ymlConfig.userStoreType != "mysql") {
+            LOG_WARN("Unknown userStore type %s, use mysql", ymlConfig.userStoreType.c_str());
+        }
+        SqlConnPool::GetInstance()->SetElastic(ymlConfig.sqlMinConn, ymlConfig.sqlIdleMs, ymlConfig.sqlKeepaliveMs,
+                                               ymlConfig.sqlAcquireTimeoutMs, ymlConfig.sqlRetryMs);
+        InitUserFilter_(ymlConfig);
+        UserInsertBatch::GetInstance()->Init(ymlConfig.userBatchOpen, ymlConfig.userBatchMaxRows,
+                                             ymlConfig.userBatchMaxDelayMs);
+        UserStore::SetInstance(std::make_unique<MysqlUserStore>());
+        LOG_INFO("UserStore: mysql");
+    }
+    ScheduleStoreMaintain_();
+}
+
+void WebServer::InitUserFilter_(const YmlConfig& ymlConfig) {
+    UserFilter* filter = UserFilter::GetInstance();
+    filter->Init(ymlConfig.userFilterOpen, ymlConfig.userFilterFpRate,
+                 ymlConfig.userFilterMinCapacity, ymlConfig.userFilterRebuildSec);
+    if (!filter->IsOpen()) {
+        return;
+    }
+    //建立失败时注册照常查重，等下次重建
+    if (!filter->Rebuild()) {
+        LOG_WARN("UserFilter not ready, register always checks db");
+    }
+}
+
+void WebServer::ScheduleStoreMaintain_() {
+    int maintainMs = UserStore::GetInstance()->GetMaintainMs();
+    if (maintainMs <= 0) {
+        return;
+    }
+    timers_->RunAfter(maintainMs, [this]() {
+        bool isPosted = dbExecutor_->AddTask([this]() {
+            UserStore::GetInstance()->Maintain();
+            ScheduleStoreMaintain_();
+        });
+        //db执行器已满，本轮跳过
+        if (!isPosted) {
+            ScheduleStoreMaintain_();
+        }
+    });
+}
+
+void WebServer::InitReload_(bool isWatch) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGHUP);
+    signalFd_ = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signalFd_ < 0 || !epoller_->AddFd(signalFd_, EPOLLIN)) {
+        LOG_ERROR("SIGHUP reload disabled");
+    }
+    if (!isWatch) {
+        return;
+    }
+    //监视所在目录而非文件本身：编辑器写临时文件再改名替换后仍能收到事件
+    watchFd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watchFd_ < 0 || inotify_add_watch(watchFd_, ".", IN_CLOSE_WRITE | IN_MOVED_TO) < 0 ||
+        !epoller_->AddFd(watchFd_, EPOLLIN)) {
+        LOG_ERROR("Watch properties.yml error");
+        if (watchFd_ >= 0) {
+            close(watchFd_);
+            watchFd_ = -1;
+        }
+        return;
+    }
+    LOG_INFO("Watch properties.yml for reload");
+}
+
+void WebServer::OnSignal_() {
+    signalfd_siginfo info;
+    bool isHup = false;
+    while (read(signalFd_, &info, sizeof(info)) == sizeof(info)) {
+        isHup = isHup || info.ssi_signo == SIGHUP;
+    }
+    if (isHup) {
+        LOG_INFO("SIGHUP, reload properties.yml");
+        ReloadConfig_();
+    }
+}
+
+void WebServer::OnConfigChange_() {
+    //事件为变长记录，按inotify_event对齐
+    char buf[4096] __attribute__((aligned(__alignof__(inotify_event))));
+    bool isChanged = false;
+    ssize_t len = 0;
+    while ((len = read(watchFd_, buf, sizeof(buf))) > 0) {
+        for (char* ptr = buf; ptr < buf + len; ) {
+            const inotify_event* event = reinterpret_cast<const inotify_event*>(ptr);
+            if (event->len > 0 && strcmp(event->name, "properties.yml") == 0) {
+                isChanged = true;
+            }
+            ptr += sizeof(inotify_event) + event->len;
+        }
+    }
+    if (!isChanged || isReloadPending_) {
+        return;
+    }
+    isReloadPending_ = true;
+    timers_->RunAfter(RELOAD_DELAY_MS, [this]() {
+        isReloadPending_ = false;
+        LOG_INFO("properties.yml changed, reload");
+        ReloadConfig_();
+    });
+}
+
+void WebServer::ReloadConfig_() {
+    YmlConfig ymlConfig;
+    if (!ymlConfig.ymlInit() || !RuntimeConfig::Validate(ymlConfig)) {
+        LOG_ERROR("Reload properties.yml failed, keep current config");
+        return;
+    }
+    for (const auto& field : RuntimeConfig::RestartOnly(ymlConfig)) {
+        auto iter = restartOnly_.find(field.first);
+        if (iter != restartOnly_.end() && iter->second != field.second) {
+            LOG_WARN("Reload: %s changed, takes effect after restart", field.first.c_str());
+        }
+    }
+    RuntimeConfig::Publish(std::make_unique<RuntimeConfig>(ymlConfig));
+    Logger::GetInstance()->SetLevel(ymlConfig.logLevel);
+    Logger::GetInstance()->SetRotation(ymlConfig.logMaxFileMb, ymlConfig.logCompress, ymlConfig.logMaxFiles,
+                                       ymlConfig.logMaxAgeDays, ymlConfig.logMaxTotalMb);
+    AccessLog::GetInstance()->SetSampling(ymlConfig.accessLogSampleRate, ymlConfig.accessLogStatusRates);
+    ResizeExecutors_(ymlConfig);
+    SqlConnPool::GetInstance()->SetElastic(isMemoryStore_ ? 0 : ymlConfig.sqlMinConn, ymlConfig.sqlIdleMs,
+                                           ymlConfig.sqlKeepaliveMs, ymlConfig.sqlAcquireTimeoutMs, ymlConfig.sqlRetryMs);
+    InitMaxConn_(ymlConfig.maxConn);
+    //重新打包后发SIGHUP即切换到新包，包文件未变化时不重新映射
+    if (AssetBundle::GetInstance()->IsOpen()) {
+        AssetBundle::GetInstance()->Open(ymlConfig.assetBundleFile);
+    }
+    LOG_INFO("Reload properties.yml done, logLevel: %d, keepAliveMax: %d", ymlConfig.logLevel, ymlConfig.keepAliveMax);
+}
+
+void WebServer::ResizeExecutors_(const YmlConfig& ymlConfig) {
+    int ioNum = ymlConfig.threadNum;
+    int ioMax = ymlConfig.maxThreadNum;
+    for (const auto& cfg : ymlConfig.executors) {
+        if (cfg.name == "io") {
+            ioNum = cfg.threadNum;
+            ioMax = cfg.maxThreadNum;
+            continue;
+        }
+        //新增的执行器需要重启
+        auto iter = executors_.find(cfg.name);
+        if (iter == executors_.end()) {
+            continue;
+        }
+        iter->second->Resize(cfg.threadNum, cfg.queueMax);
+        iter->second->SetElastic(cfg.maxThreadNum, ymlConfig.threadGrowWaitMs, ymlConfig.threadIdleMs);
+        LOG_INFO("Executor %s: %d ~ %d threads, queueMax: %d", cfg.name.c_str(), cfg.threadNum,
+                 std::max(cfg.threadNum, cfg.maxThreadNum), cfg.queueMax);
+    }
+    threadpool_->Resize(ioNum, 0);
+    threadpool_->SetElastic(ioMax, ymlConfig.threadGrowWaitMs, ymlConfig.threadIdleMs);
+    LOG_INFO("ThreadPool: %d ~ %d threads", ioNum, std::max(ioNum, ioMax));
+}
+
+void WebServer::InitMaxConn_(int maxConn) {
+    assert(maxConn > 0);
+    maxConn_ = maxConn;
+    //连接fd之外预留监听、epoll、日志、数据库与上游连接所需
+    rlim_t need = static_cast<rlim_t>(maxConn) + 1024;
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < need) {
+        limit.rlim_cur = std::min(need, limit.rlim_max);
+        if (setrlimit(RLIMIT_NOFILE, &limit) < 0 || limit.rlim_cur < need) {
+            LOG_WARN("RLIMIT_NOFILE %ld below maxConn %d", (long)limit.rlim_cur, maxConn);
+        }
+    }
+    LOG_INFO("maxConn: %d", maxConn_);
+}
+
+void WebServer::InitTls_(const YmlConfig& ymlConfig) {
+    if (!ymlConfig.tlsOpen) {
+        return;
+    }
+    if (!TlsContext::GetInstance()->Init(ymlConfig.tlsCertFile, ymlConfig.tlsKeyFile, ymlConfig.tlsKtls)) {
+        LOG_ERROR("TLS disabled");
+        return;
+    }
+    if (!InitSocket_(ymlConfig.tlsPort, tlsListenFd_)) {
+        tlsListenFd_ = -1;
+        return;
+    }
+    LOG_INFO("TLS Port: %d", ymlConfig.tlsPort);
+}
+
 void WebServer::InitEventMode_(int trigMode) {
     listenEvent_ = EPOLLRDHUP;
     connEvent_ = EPOLLONESHOT | EPOLLRDHUP;
@@ -273,20 +789,22 @@ void WebServer::InitEventMode_(int trigMode) {
     HttpConn::isET = (connEvent_ & EPOLLET);
 }
 
-void WebServer::DealListen_() {
+void WebServer::DealListen_(int listenFd, bool isTls) {
     sockaddr_in clientAddr;
     socklen_t len = sizeof(clientAddr);
     do {
-        int clientFd = accept(listenFd_, (sockaddr*)&clientAddr, &len);
+        int clientFd = accept(listenFd, (sockaddr*)&clientAddr, &len);
         if (clientFd <= 0) {
             return;
         } 
-        else if (HttpConn::userCount >= MAX_FD) {
-            SendError_(listenFd_, "server busy!");
+        else if (HttpConn::userCount >= static_cast<unsigned>(maxConn_)) {
+            Metrics::GetInstance()->RecordReject();
+            SendError_(clientFd, "server busy!");
             LOG_WARN("Server busy!");
             return;
         }
-        AddClient_(clientFd, clientAddr);
+        Metrics::GetInstance()->RecordAccept();
+        AddClient_(clientFd, clientAddr, isTls);
         LOG_INFO("clientFd in: %d", clientFd);
     } while (listenEvent_ & EPOLLET);
 }
@@ -297,10 +815,13 @@ void WebServer::SendError_(int fd, const char *info) {
     close(fd);
 }
 
-void WebServer::AddClient_(int fd, sockaddr_in addr) {
+void WebServer::AddClient_(int fd, sockaddr_in addr, bool isTls) {
     //accept后的步骤
     assert(fd > 0);
-    users_[fd].Init(fd, addr);
+    //TLS端口上的连接建立不了TLS状态时已关闭，不能按明文服务
+    if (!users_[fd].Init(fd, addr, isTls)) {
+        return;
+    }
     epoller_->AddFd(fd, EPOLLIN | connEvent_);
     SetFdNonBlock(fd);
 }
@@ -317,7 +838,6 @@ void WebServer::DealRead_(HttpConn *client) {
 }
 
 void WebServer::OnRead_(HttpConn *client) {
-    LOG_WARN("OnRead");
     assert(client);
     int err = 0;
     int ret = client->Read(&err);
@@ -333,6 +853,27 @@ void WebServer::OnProcess(HttpConn *client) {
     if (client->Process()) {
         epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);
     }
+    //挂起等待缓存、查库或定时，不监听任何事件，由完成方唤醒
+    else if (client->IsParked()) {
+        client->Park();
+    }
+    //TLS握手要写出的数据积压在发送缓冲，等可写而不是可读
+    else if (client->IsHandshakeWantWrite()) {
+        epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);
+    }
+    else {
+        epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLIN);
+    }
+}
+
+void WebServer::OnResume_(HttpConn *client) {
+    assert(client);
+    if (client->Resume()) {
+        epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);
+    }
+    else if (client->IsParked()) {
+        client->Park();
+    }
     else {
         epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLIN);
     }
@@ -345,20 +886,134 @@ void WebServer::DealWrite_(HttpConn *client) {
 
 void WebServer::OnWrite_(HttpConn *client) {
     assert(client);
+    //可写事件来自阻塞在写出的握手，按读流程继续握手
+    if (client->IsHandshakeWantWrite()) {
+        OnRead_(client);
+        return;
+    }
     int err = 0;
     int ret = client->Write(&err);
     if (client->ToWriteBytes() == 0) {
-//printf("%s: %d--%d\n", __FILE__ , __LINE__, client->IsKeepAlive());
+        //响应发完，下一个请求开始前记录
+        client->FinishResponse();
         if(client->IsKeepAlive()) {
             OnProcess(client);
             return;
         }
     }
-    else if (ret > 0 && err == EAGAIN) {
-        epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);
+    else if (ret > 0 || err == EAGAIN) {
+        //代理响应体阻塞在上游时等待上游可读，否则等待客户端可写
+        if (client->IsWaitUpstream()) {
+            WatchUpstream_(client);
+        }
+        else {
+            epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);
+        }
         return;
     }
     CloseConn_(client);
 }
 
+void WebServer::WatchUpstream_(HttpConn *client) {
+    assert(client);
+    int fd = client->GetUpstreamFd();
+    {
+        //先登记映射再加入epoll，防止事件先于映射到达主线程
+        std::lock_guard<std::mutex> locker(upstreamMtx_);
+        upstreams_[fd] = client;
+    }
+    if (!epoller_->AddFd(fd, EPOLLIN | EPOLLRDHUP | EPOLLONESHOT)) {
+        {
+            std::lock_guard<std::mutex> locker(upstreamMtx_);
+            upstreams_.erase(fd);
+        }
+        CloseConn_(client);
+    }
+}
+
+void WebServer::WatchFd_(int fd, int waitFor, unsigned timeoutMs, std::function<void(int)> ready) {
+    uint32_t events = EPOLLONESHOT;
+    if (waitFor & SqlAsyncQuery::WAIT_READ) {
+        events |= EPOLLIN;
+    }
+    if (waitFor & SqlAsyncQuery::WAIT_WRITE) {
+        events |= EPOLLOUT;
+    }
+    if (waitFor & SqlAsyncQuery::WAIT_EXCEPT) {
+        events |= EPOLLPRI;
+    }
+    uint64_t id = 0;
+    {
+        //同WatchUpstream_，先登记再加入epoll
+        std::lock_guard<std::mutex> locker(fdMtx_);
+        id = ++fdWaitSeq_;
+        fdWaits_[fd] = {id, std::move(ready)};
+    }
+    if (!epoller_->AddFd(fd, events)) {
+        //按出错交回，由查询或代理自行结束
+        LOG_ERROR("Watch fd %d error", fd);
+        TakeFd_(fd, id, EPOLLERR);
+        return;
+    }
+    if (waitFor & SqlAsyncQuery::WAIT_TIMEOUT) {
+        timers_->RunAfter(timeoutMs, [this, fd, id]() {
+            TakeFd_(fd, id, 0);
+        });
+    }
+}
+
+bool WebServer::TakeFd_(int fd, uint64_t id, int ready) {
+    std::function<void(int)> callback;
+    {
+        std::lock_guard<std::mutex> locker(fdMtx_);
+        if (fdWaits_.empty()) {
+            return false;
+        }
+        auto iter = fdWaits_.find(fd);
+        //定时到期前fd已就绪并重新登记时，id不同
+        if (iter == fdWaits_.end() || (id != 0 && iter->second.id != id)) {
+            return false;
+        }
+        callback = std::move(iter->second.ready);
+        fdWaits_.erase(iter);
+    }
+    epoller_->DelFd(fd);
+    int status = 0;
+    if (ready & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+        status |= SqlAsyncQuery::WAIT_READ;
+    }
+    if (ready & (EPOLLOUT | EPOLLHUP | EPOLLERR)) {
+        status |= SqlAsyncQuery::WAIT_WRITE;
+    }
+    if (ready & EPOLLPRI) {
+        status |= SqlAsyncQuery::WAIT_EXCEPT;
+    }
+    if (status == 0) {
+        status = SqlAsyncQuery::WAIT_TIMEOUT;
+    }
+    threadpool_->AddTask([callback, status]() {
+        callback(status);
+    });
+    return true;
+}
+
+HttpConn* WebServer::TakeUpstream_(int fd) {
+    HttpConn* client = nullptr;
+    {
+        std::lock_guard<std::mutex> locker(upstreamMtx_);
+        if (upstreams_.empty()) {
+            return nullptr;
+        }
+        auto iter = upstreams_.find(fd);
+        if (iter == upstreams_.end()) {
+            return nullptr;
+        }
+        client = iter->second;
+        upstreams_.erase(iter);
+    }
+    //移出epoll，工作线程可随时将该连接归还上游连接池
+    epoller_->DelFd(fd);
+    return client;
+}
+
 #endif
\ No newline at end of file
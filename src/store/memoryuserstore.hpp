@@ -0,0 +1,296 @@
+#ifndef MEMORYUSERSTORE_HPP
+#define MEMORYUSERSTORE_HPP
+
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/crypto.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <mutex>
+#include <atomic>
+#include <assert.h>
+
+#include "userstore.hpp"
+#include "../logger/logger.hpp"
+
+/*
+    进程内用户数据后端，不需要数据库
+    1、按用户名哈希分片，每片一把锁，不同用户的登录注册互不阻塞
+    2、只保存每个用户的随机盐与SHA-256(盐 + 密码)，不保存明文
+    3、配置了快照文件时启动加载，之后定期及停止时整表写入临时文件，fsync后rename并fsync所在目录，数据未变化则跳过
+    快照格式：魔数，之后每条为 用户名长度(u16) 用户名 盐 摘要，整数按本机字节序
+*/
+class MemoryUserStore final : public UserStore {
+public:
+    //snapshotFile为空时只在内存中保存
+    MemoryUserStore(const std::string& snapshotFile, int snapshotSec);
+
+    EXEC_MODE GetExecMode() const override;
+    bool Verify(const char* user, const char* pw, bool isLogin) override;
+    int GetMaintainMs() const override;
+    void Maintain() override;
+    void Close() override;
+
+    //读取快照，文件不存在视为空表
+    bool Load();
+    //数据有变化时写快照
+    bool Snapshot();
+    size_t GetUserCount();
+
+private:
+    static const int SHARD_NUM = 16;
+    static const int SALT_LEN = 16;
+    static const int DIGEST_LEN = 32;
+    static const size_t MAX_NAME_LEN = 0xffff;
+    static const char MAGIC[8];
+
+    struct Record {
+        unsigned char salt[SALT_LEN];
+        unsigned char digest[DIGEST_LEN];
+    };
+
+    struct Shard {
+        std::mutex mtx;
+        std::unordered_map<std::string, Record> users;
+    };
+
+    Shard& GetShard_(const std::string& user);
+    //生成新盐并计算摘要
+    static bool MakeRecord_(const char* pw, Record& record);
+    static bool Digest_(const unsigned char* salt, const char* pw, unsigned char* digest);
+    //fsync文件所在目录，使rename后的目录项落盘
+    static bool SyncDir_(const std::string& file);
+    bool Login_(const char* user, const char* pw);
+    bool Register_(const char* user, const char* pw);
+
+    std::string snapshotFile_;
+    int snapshotMs_;
+    Shard shards_[SHARD_NUM];
+    //每次注册成功加一，与上次快照时的值比较判断是否需要写快照
+    std::atomic<uint64_t> version_{0};
+    uint64_t savedVersion_ = 0;
+    //同一时刻只有一次快照
+    std::mutex snapshotMtx_;
+};
+
+const int MemoryUserStore::SHARD_NUM;
+const int MemoryUserStore::SALT_LEN;
+const int MemoryUserStore::DIGEST_LEN;
+const size_t MemoryUserStore::MAX_NAME_LEN;
+const char MemoryUserStore::MAGIC[8] = {'W', 'S', 'U', 'S', 'E', 'R', '0', '1'};
+
+MemoryUserStore::MemoryUserStore(const std::string& snapshotFile, int snapshotSec)
+    : snapshotFile_(snapshotFile), snapshotMs_(snapshotSec * 1000) {
+    assert(snapshotSec >= 0);
+}
+
+UserStore::EXEC_MODE MemoryUserStore::GetExecMode() const {
+    return EXEC_INLINE;
+}
+
+bool MemoryUserStore::Verify(const char* user, const char* pw, bool isLogin) {
+    return isLogin ? Login_(user, pw) : Register_(user, pw);
+}
+
+int MemoryUserStore::GetMaintainMs() const {
+    return snapshotFile_.empty() ? 0 : snapshotMs_;
+}
+
+void MemoryUserStore::Maintain() {
+    Snapshot();
+}
+
+void MemoryUserStore::Close() {
+    Snapshot();
+}
+
+bool MemoryUserStore::Login_(const char* user, const char* pw) {
+    std::string key(user);
+    Shard& shard = GetShard_(key);
+    Record record;
+    {
+        std::lock_guard<std::mutex> locker(shard.mtx);
+        auto iter = shard.users.find(key);
+        if(iter == shard.users.end()) {
+            LOG_DEBUG("MemoryUserStore no user: %s", user);
+            return false;
+        }
+        record = iter->second;
+    }
+    //摘要计算放在锁外
+    unsigned char digest[DIGEST_LEN];
+    if(!Digest_(record.salt, pw, digest)) {
+        return false;
+    }
+    return CRYPTO_memcmp(digest, record.digest, DIGEST_LEN) == 0;
+}
+
+bool MemoryUserStore::Register_(const char* user, const char* pw) {
+    std::string key(user);
+    if(key.size() > MAX_NAME_LEN) {
+        return false;
+    }
+    Record record;
+    if(!MakeRecord_(pw, record)) {
+        return false;
+    }
+    Shard& shard = GetShard_(key);
+    {
+        std::lock_guard<std::mutex> locker(shard.mtx);
+        if(!shard.users.emplace(std::move(key), record).second) {
+            LOG_DEBUG("MemoryUserStore user used: %s", user);
+            return false;
+        }
+    }
+    version_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+size_t MemoryUserStore::GetUserCount() {
+    size_t count = 0;
+    for(Shard& shard : shards_) {
+        std::lock_guard<std::mutex> locker(shard.mtx);
+        count += shard.users.size();
+    }
+    return count;
+}
+
+bool MemoryUserStore::Load() {
+    if(snapshotFile_.empty()) {
+        return true;
+    }
+    FILE* fp = fopen(snapshotFile_.c_str(), "rb");
+    if(!fp) {
+        if(errno == ENOENT) {
+            LOG_INFO("MemoryUserStore no snapshot %s, start empty", snapshotFile_.c_str());
+            return true;
+        }
+        LOG_ERROR("MemoryUserStore open %s error: %s", snapshotFile_.c_str(), strerror(errno));
+        return false;
+    }
+    char magic[sizeof(MAGIC)];
+    bool isOk = fread(magic, 1, sizeof(magic), fp) == sizeof(magic) && memcmp(magic, MAGIC, sizeof(MAGIC)) == 0;
+    size_t loaded = 0;
+    std::string name;
+    while(isOk) {
+        uint16_t len;
+        size_t n = fread(&len, 1, sizeof(len), fp);
+        if(n == 0 && feof(fp)) {
+            break;
+        }
+        Record record;
+        name.resize(len);
+        isOk = n == sizeof(len) && len > 0 &&
+               fread(&name[0], 1, len, fp) == len &&
+               fread(record.salt, 1, SALT_LEN, fp) == static_cast<size_t>(SALT_LEN) &&
+               fread(record.digest, 1, DIGEST_LEN, fp) == static_cast<size_t>(DIGEST_LEN);
+        if(isOk) {
+            Shard& shard = GetShard_(name);
+            std::lock_guard<std::mutex> locker(shard.mtx);
+            loaded += shard.users.emplace(name, record).second ? 1 : 0;
+        }
+    }
+    fclose(fp);
+    if(!isOk) {
+        LOG_ERROR("MemoryUserStore snapshot %s corrupted", snapshotFile_.c_str());
+        return false;
+    }
+    LOG_INFO("MemoryUserStore loaded %zu users from %s", loaded, snapshotFile_.c_str());
+    return true;
+}
+
+bool MemoryUserStore::Snapshot() {
+    if(snapshotFile_.empty()) {
+        return true;
+    }
+    std::lock_guard<std::mutex> snapshotLocker(snapshotMtx_);
+    uint64_t version = version_.load(std::memory_order_relaxed);
+    if(version == savedVersion_) {
+        return true;
+    }
+    //逐片拷出后在锁外写文件，快照期间的注册留到下一次
+    std::string data(MAGIC, sizeof(MAGIC));
+    size_t count = 0;
+    for(Shard& shard : shards_) {
+        std::lock_guard<std::mutex> locker(shard.mtx);
+        for(const auto& user : shard.users) {
+            uint16_t len = static_cast<uint16_t>(user.first.size());
+            data.append(reinterpret_cast<const char*>(&len), sizeof(len));
+            data.append(user.first);
+            data.append(reinterpret_cast<const char*>(user.second.salt), SALT_LEN);
+            data.append(reinterpret_cast<const char*>(user.second.digest), DIGEST_LEN);
+        }
+        count += shard.users.size();
+    }
+
+    //先写临时文件再rename，中途退出不会留下半个快照
+    //rename前不fsync，掉电后可能留下新名字指向未落盘的空文件，旧快照也已被替换
+    std::string tmpFile = snapshotFile_ + ".tmp";
+    FILE* fp = fopen(tmpFile.c_str(), "wb");
+    if(!fp) {
+        LOG_ERROR("MemoryUserStore open %s error: %s", tmpFile.c_str(), strerror(errno));
+        return false;
+    }
+    bool isOk = fwrite(data.data(), 1, data.size(), fp) == data.size();
+    isOk = fflush(fp) == 0 && isOk;
+    isOk = isOk && fsync(fileno(fp)) == 0;
+    isOk = fclose(fp) == 0 && isOk;
+    if(!isOk || rename(tmpFile.c_str(), snapshotFile_.c_str()) < 0) {
+        LOG_ERROR("MemoryUserStore write %s error: %s", snapshotFile_.c_str(), strerror(errno));
+        remove(tmpFile.c_str());
+        return false;
+    }
+    //目录项未落盘时掉电会回到旧快照，版本不记为已保存，下次重写
+    if(!SyncDir_(snapshotFile_)) {
+        LOG_ERROR("MemoryUserStore sync dir of %s error: %s", snapshotFile_.c_str(), strerror(errno));
+        return false;
+    }
+    savedVersion_ = version;
+    LOG_INFO("MemoryUserStore snapshot %zu users to %s", count, snapshotFile_.c_str());
+    return true;
+}
+
+bool MemoryUserStore::SyncDir_(const std::string& file) {
+    size_t slash = file.find_last_of('/');
+    std::string dir = slash == std::string::npos ? "." : (slash == 0 ? "/" : file.substr(0, slash));
+    int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if(fd < 0) {
+        return false;
+    }
+    bool isOk = fsync(fd) == 0;
+    close(fd);
+    return isOk;
+}
+
+MemoryUserStore::Shard& MemoryUserStore::GetShard_(const std::string& user) {
+    return shards_[std::hash<std::string>()(user) % SHARD_NUM];
+}
+
+bool MemoryUserStore::MakeRecord_(const char* pw, Record& record) {
+    if(RAND_bytes(record.salt, SALT_LEN) != 1) {
+        LOG_ERROR("MemoryUserStore salt error");
+        return false;
+    }
+    return Digest_(record.salt, pw, record.digest);
+}
+
+bool MemoryUserStore::Digest_(const unsigned char* salt, const char* pw, unsigned char* digest) {
+    EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+    unsigned int len = 0;
+    bool isOk = ctx && EVP_DigestInit_ex(ctx, EVP_sha256(), nullptr) == 1 &&
+                EVP_DigestUpdate(ctx, salt, SALT_LEN) == 1 &&
+                EVP_DigestUpdate(ctx, pw, strlen(pw)) == 1 &&
+                EVP_DigestFinal_ex(ctx, digest, &len) == 1;
+    EVP_MD_CTX_free(ctx);
+    return isOk && len == static_cast<unsigned int>(DIGEST_LEN);
+}
+
+#endif
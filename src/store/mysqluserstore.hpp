@@ -0,0 +1,223 @@
+#ifndef MYSQLUSERSTORE_HPP
+#define MYSQLUSERSTORE_HPP
+
+#include <mysql/mysql.h>
+#include <string>
+#include <memory>
+#include <functional>
+#include <assert.h>
+
+#include "userstore.hpp"
+#include "../logger/logger.hpp"
+#include "../pool/sqlconnpool.hpp"
+#include "../pool/sqlconnRAII.hpp"
+#include "../pool/sqlasync.hpp"
+#include "../pool/sqlbatch.hpp"
+#include "../cache/usercache.hpp"
+#include "../cache/userfilter.hpp"
+
+/*
+    MySQL用户数据后端
+    1、先查凭据缓存，登录与已注册用户名的判定可不查库
+    2、注册时用户名过滤器判定一定未注册则跳过查重（过滤器只在username有唯一键时启用），INSERT按配置走组提交
+    3、连接池开启非阻塞时VerifyAsync由reactor驱动，否则交给db执行器阻塞执行
+    4、定期维护为重建用户名过滤器
+*/
+class MysqlUserStore final : public UserStore {
+public:
+    EXEC_MODE GetExecMode() const override;
+    bool Verify(const char* user, const char* pw, bool isLogin) override;
+    void VerifyAsync(const char* user, const char* pw, bool isLogin, std::function<void(bool)> done) override;
+    int GetMaintainMs() const override;
+    void Maintain() override;
+    void Close() override;
+
+private:
+    //登录校验：查询到的用户密码与pw一致，查询结果同时写入凭据缓存
+    static bool IsPasswordMatch_(const char* user, const SqlStmtCall& select, const char* pw);
+    //写入新用户，开启组提交时交给批处理线程
+    static bool InsertUser_(const char* user, const char* pw);
+    //sql为调用方已取得的连接（可为nullptr），由本函数负责归还；done在插入完成并更新缓存后调用
+    static void InsertUserAsync_(MYSQL* sql, const char* user, const char* pw, std::function<void(bool)> done);
+    //注册查重：查询到用户时写入凭据缓存并返回true
+    static bool IsNameTaken_(const SqlStmtCall& select, const char* user);
+    //注册时用户名过滤器判定一定未注册，可跳过查重直接INSERT
+    static bool IsNameFree_(const char* user, bool isLogin);
+    //凭据缓存能直接给出登录或注册结果时返回true
+    static bool VerifyCached_(const char* user, const char* pw, bool isLogin, bool* isOk);
+    //注册完成，成功时写穿凭据缓存并加入用户名过滤器，失败时用户可能已存在，删除缓存条目
+    static void OnRegistered_(const char* user, const char* pw, bool isInserted);
+};
+
+UserStore::EXEC_MODE MysqlUserStore::GetExecMode() const {
+    return SqlConnPool::GetInstance()->IsNonBlocking() ? EXEC_ASYNC : EXEC_BLOCKING;
+}
+
+int MysqlUserStore::GetMaintainMs() const {
+    return UserFilter::GetInstance()->GetRebuildMs();
+}
+
+void MysqlUserStore::Maintain() {
+    UserFilter::GetInstance()->Rebuild();
+}
+
+void MysqlUserStore::Close() {
+    //先提交排队中的注册，之后才能关闭连接池
+    UserInsertBatch::GetInstance()->Close();
+}
+
+bool MysqlUserStore::Verify(const char* user, const char* pw, bool isLogin) {
+    bool isCachedOk = false;
+    if(VerifyCached_(user, pw, isLogin, &isCachedOk)) {
+        return isCachedOk;
+    }
+    //预编译语句按参数绑定，用户输入不再拼入SQL
+    if(!IsNameFree_(user, isLogin)) {
+        MYSQL* sql = nullptr;
+        //具名对象，离开作用域时才归还连接
+        SqlConnRAII sqlRAII(&sql, SqlConnPool::GetInstance());
+        if(!sql) {
+            return false;
+        }
+        SqlStmtCall select(STMT_USER_SELECT);
+        select.AddParam(user);
+        if(!SqlConnPool::GetInstance()->ExecStmt(sql, select)) {
+            return false;
+        }
+        if(isLogin) {
+            return IsPasswordMatch_(user, select, pw);
+        }
+        if(IsNameTaken_(select, user)) {
+            return false;
+        }
+    }
+    bool isInserted = InsertUser_(user, pw);
+    OnRegistered_(user, pw, isInserted);
+    return isInserted;
+}
+
+bool MysqlUserStore::InsertUser_(const char* user, const char* pw) {
+    //组提交时不占用连接等待
+    if(UserInsertBatch::GetInstance()->IsOpen()) {
+        return UserInsertBatch::GetInstance()->Insert(user, pw);
+    }
+    MYSQL* sql = nullptr;
+    SqlConnRAII sqlRAII(&sql, SqlConnPool::GetInstance());
+    if(!sql) {
+        return false;
+    }
+    //查重与插入之间的并发注册由唯一键拒绝
+    SqlStmtCall insert(STMT_USER_INSERT);
+    insert.AddParam(user);
+    insert.AddParam(pw);
+    return SqlConnPool::GetInstance()->ExecStmt(sql, insert);
+}
+
+void MysqlUserStore::InsertUserAsync_(MYSQL* sql, const char* user, const char* pw, std::function<void(bool)> done) {
+    auto finish = [user, pw, done](bool isInserted) {
+        OnRegistered_(user, pw, isInserted);
+        done(isInserted);
+    };
+    if(UserInsertBatch::GetInstance()->IsOpen()) {
+        if(sql) {
+            SqlConnPool::GetInstance()->FreeSqlConn(sql);
+        }
+        UserInsertBatch::GetInstance()->Submit(user, pw, finish);
+        return;
+    }
+    assert(sql);
+    std::shared_ptr<SqlStmtCall> insert = std::make_shared<SqlStmtCall>(STMT_USER_INSERT);
+    insert->AddParam(user);
+    insert->AddParam(pw);
+    SqlAsyncQuery::RunStmt(sql, insert, [sql, insert, finish](bool isInserted) {
+        SqlConnPool::GetInstance()->FreeSqlConn(sql);
+        finish(isInserted);
+    });
+}
+
+bool MysqlUserStore::IsPasswordMatch_(const char* user, const SqlStmtCall& select, const char* pw) {
+    if(select.GetRowCount() == 0) {
+        UserCache::GetInstance()->PutUnknown(user);
+        return false;
+    }
+    const std::string& password = select.GetValue(select.GetRowCount() - 1, 1);
+    UserCache::GetInstance()->Put(user, password.c_str());
+    return password == pw;
+}
+
+bool MysqlUserStore::IsNameTaken_(const SqlStmtCall& select, const char* user) {
+    if(select.GetRowCount() == 0) {
+        return false;
+    }
+    //之后对该用户名的登录与重复注册都可在内存中判定
+    UserCache::GetInstance()->Put(user, select.GetValue(select.GetRowCount() - 1, 1).c_str());
+    return true;
+}
+
+bool MysqlUserStore::IsNameFree_(const char* user, bool isLogin) {
+    return !isLogin && UserFilter::GetInstance()->IsDefinitelyFree(user);
+}
+
+bool MysqlUserStore::VerifyCached_(const char* user, const char* pw, bool isLogin, bool* isOk) {
+    switch(UserCache::GetInstance()->Lookup(user, pw)) {
+    case UserCache::USER_MATCH:
+        *isOk = isLogin;
+        return true;
+    case UserCache::USER_MISMATCH:
+        //用户名已被注册
+        *isOk = false;
+        return true;
+    case UserCache::USER_UNKNOWN:
+        //负缓存可能已过时，注册仍要写库
+        *isOk = false;
+        return isLogin;
+    default:
+        return false;
+    }
+}
+
+void MysqlUserStore::OnRegistered_(const char* user, const char* pw, bool isInserted) {
+    if(isInserted) {
+        UserCache::GetInstance()->Put(user, pw);
+        UserFilter::GetInstance()->Add(user);
+    }
+    else {
+        UserCache::GetInstance()->Invalidate(user);
+    }
+}
+
+void MysqlUserStore::VerifyAsync(const char* user, const char* pw, bool isLogin, std::function<void(bool)> done) {
+    bool isCachedOk = false;
+    if(VerifyCached_(user, pw, isLogin, &isCachedOk)) {
+        done(isCachedOk);
+        return;
+    }
+    //组提交时一定未注册的用户名不必取连接
+    if(IsNameFree_(user, isLogin) && UserInsertBatch::GetInstance()->IsOpen()) {
+        InsertUserAsync_(nullptr, user, pw, std::move(done));
+        return;
+    }
+    //与Verify相同的语句与判定，每步查询完成后在回调中继续
+    SqlConnPool::GetInstance()->GetSqlConnAsync([user, pw, isLogin, done](MYSQL* sql) {
+        if(!sql) {
+            done(false);
+            return;
+        }
+        if(IsNameFree_(user, isLogin)) {
+            InsertUserAsync_(sql, user, pw, done);
+            return;
+        }
+        std::shared_ptr<SqlStmtCall> select = std::make_shared<SqlStmtCall>(STMT_USER_SELECT);
+        select->AddParam(user);
+        SqlAsyncQuery::RunStmt(sql, select, [sql, select, user, pw, isLogin, done](bool isOk) {
+            if(!isOk || isLogin || IsNameTaken_(*select, user)) {
+                SqlConnPool::GetInstance()->FreeSqlConn(sql);
+                done(isOk && isLogin && IsPasswordMatch_(user, *select, pw));
+                return;
+            }
+            InsertUserAsync_(sql, user, pw, done);
+        });
+    });
+}
+
+#endif
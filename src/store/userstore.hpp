@@ -0,0 +1,63 @@
+#ifndef USERSTORE_HPP
+#define USERSTORE_HPP
+
+#include <memory>
+#include <functional>
+#include <assert.h>
+
+/*
+    用户数据后端：登录校验与注册
+    1、mysql：经连接池查库，前置凭据缓存、用户名过滤器与注册组提交
+    2、memory：进程内分片哈希表，可定期快照到磁盘，不需要数据库
+    启动时按配置选定一个后端，之后不再更换
+*/
+class UserStore {
+public:
+    //后端的调用方式，决定请求在哪个线程上校验
+    enum EXEC_MODE {
+        EXEC_INLINE,    //纯内存操作，在io线程上直接完成
+        EXEC_BLOCKING,  //会阻塞，交给db执行器
+        EXEC_ASYNC,     //非阻塞发起，完成后回调
+    };
+
+    virtual ~UserStore() = default;
+
+    virtual EXEC_MODE GetExecMode() const = 0;
+    //登录校验（isLogin）或注册，阻塞直到有结果
+    virtual bool Verify(const char* user, const char* pw, bool isLogin) = 0;
+    //user、pw须在回调前保持有效；默认当场同步完成
+    virtual void VerifyAsync(const char* user, const char* pw, bool isLogin, std::function<void(bool)> done) {
+        done(Verify(user, pw, isLogin));
+    }
+    //定期维护的间隔毫秒，0为不需要
+    virtual int GetMaintainMs() const {
+        return 0;
+    }
+    //定期维护（重建索引、写快照等），在db执行器上调用
+    virtual void Maintain() {}
+    //停止服务前调用，完成排队中的写入
+    virtual void Close() {}
+
+    static UserStore* GetInstance();
+    static void SetInstance(std::unique_ptr<UserStore> store);
+
+private:
+    static std::unique_ptr<UserStore>& Instance_();
+};
+
+UserStore* UserStore::GetInstance() {
+    assert(Instance_());
+    return Instance_().get();
+}
+
+void UserStore::SetInstance(std::unique_ptr<UserStore> store) {
+    assert(store && !Instance_());
+    Instance_() = std::move(store);
+}
+
+std::unique_ptr<UserStore>& UserStore::Instance_() {
+    static std::unique_ptr<UserStore> store;
+    return store;
+}
+
+#endif
@@ -0,0 +1,238 @@
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+/*
+    空闲长连接内存测试
+    1、向本机服务器建立count个连接，每个连接完成一次keep-alive请求后保持空闲
+    2、对比建连前后服务器进程的VmRSS，输出每连接平均常驻内存
+    3、另按后一半连接的RSS增量计算边际值，排除工作线程处理请求时的峰值内存（malloc不归还的arena）
+    4、以边际值（未取得时用平均值）对照每连接内存预算maxBytes判定通过与否，超出时退出码为3
+    源地址在127.0.0.0/8内轮换，单个源地址的临时端口不足以建立百万连接
+    用法：make idletest && ./bin/idleconntest <server pid> [port=1316] [count=1000000] [path=/] [maxBytes=512]
+    服务器与本进程都需要足够的fd上限(ulimit -n)，服务器properties.yml中maxConn不小于count
+    退出码：0通过，1参数或读取RSS出错，2有连接未保持空闲，3每连接内存超出预算
+
+    实测：1核、6GB内存的沙箱，fd硬上限20000，服务器与本进程同机，因而只能建18000而非百万连接
+        make && make idletest
+        cd <含properties.yml与resources的目录> && <repo>/bin/main &     # properties.yml中maxConn: 20000
+        <repo>/bin/idleconntest $(pidof main) 1316 18000 / 512
+    连续4次：18000/18000保持空闲，VmRSS约11MB -> 34~37MB；
+    平均1330~1490字节/连接（含工作线程处理请求时留下的malloc arena），边际312~401字节/连接，均在512字节预算内
+*/
+
+static long ReadRssKb(int pid) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    FILE* fp = fopen(path, "r");
+    if(fp == nullptr) {
+        return -1;
+    }
+    char line[256];
+    long rss = -1;
+    while(fgets(line, sizeof(line), fp)) {
+        if(strncmp(line, "VmRSS:", 6) == 0) {
+            rss = atol(line + 6);
+            break;
+        }
+    }
+    fclose(fp);
+    return rss;
+}
+
+static void RaiseFdLimit(size_t need) {
+    struct rlimit limit;
+    getrlimit(RLIMIT_NOFILE, &limit);
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    if(limit.rlim_cur < need) {
+        fprintf(stderr, "fd limit %ld < %zu, connections will be capped\n", (long)limit.rlim_cur, need);
+    }
+}
+
+//非阻塞建连，源地址127.0.0.(2 + index / 50000)
+static int Connect(int port, size_t index) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if(fd < 0) {
+        return -1;
+    }
+    struct sockaddr_in local = {};
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl((127u << 24) | static_cast<uint32_t>(2 + index / 50000));
+    if(bind(fd, (struct sockaddr*)&local, sizeof(local)) < 0) {
+        close(fd);
+        return -1;
+    }
+    struct sockaddr_in server = {};
+    server.sin_family = AF_INET;
+    server.sin_port = htons(port);
+    server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(connect(fd, (struct sockaddr*)&server, sizeof(server)) < 0 && errno != EINPROGRESS) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+//一批连接发出请求并读完响应头与响应体
+static size_t RequestBatch(const std::vector<int>& fds, const std::string& request) {
+    struct Pending {
+        int fd;
+        bool isSent;
+        std::string resp;
+    };
+    std::vector<Pending> pending;
+    for(int fd : fds) {
+        pending.push_back({fd, false, std::string()});
+    }
+    size_t done = 0;
+    std::vector<struct pollfd> pfds;
+    while(done < pending.size()) {
+        pfds.clear();
+        for(auto& item : pending) {
+            if(item.fd >= 0) {
+                pfds.push_back({item.fd, static_cast<short>(item.isSent ? POLLIN : POLLOUT), 0});
+            }
+        }
+        //服务器accept队列满时握手靠SYN重传(1s、3s、7s...)，超时要覆盖几次重传
+        if(poll(pfds.data(), pfds.size(), 30000) <= 0) {
+            break;
+        }
+        size_t j = 0;
+        for(auto& item : pending) {
+            if(item.fd < 0) {
+                continue;
+            }
+            struct pollfd& pfd = pfds[j++];
+            if(pfd.revents == 0) {
+                continue;
+            }
+            if(!item.isSent) {
+                if(write(item.fd, request.data(), request.size()) == (ssize_t)request.size()) {
+                    item.isSent = true;
+                }
+                else {
+                    item.fd = -1;
+                    ++done;
+                }
+                continue;
+            }
+            char buf[8192];
+            ssize_t len = read(item.fd, buf, sizeof(buf));
+            if(len <= 0) {
+                item.fd = -1;
+                ++done;
+                continue;
+            }
+            item.resp.append(buf, len);
+            size_t headEnd = item.resp.find("\r\n\r\n");
+            size_t lenPos = item.resp.find("Content-length: ");
+            if(headEnd != std::string::npos && lenPos != std::string::npos &&
+               item.resp.size() >= headEnd + 4 + atol(item.resp.c_str() + lenPos + 16)) {
+                item.fd = -1;
+                ++done;
+            }
+        }
+    }
+    return done;
+}
+
+int main(int argc, char* argv[]) {
+    if(argc < 2) {
+        fprintf(stderr, "usage: %s <server pid> [port=1316] [count=1000000] [path=/] [maxBytes=512]\n", argv[0]);
+        return 1;
+    }
+    int pid = atoi(argv[1]);
+    int port = argc > 2 ? atoi(argv[2]) : 1316;
+    size_t count = argc > 3 ? strtoul(argv[3], nullptr, 10) : 1000000;
+    std::string path = argc > 4 ? argv[4] : "/";
+    //每个空闲连接允许占用的服务器常驻内存
+    double maxBytes = argc > 5 ? atof(argv[5]) : 512;
+    std::string request = "GET " + path + " HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: keep-alive\r\n\r\n";
+
+    RaiseFdLimit(count + 64);
+    long before = ReadRssKb(pid);
+    if(before < 0) {
+        fprintf(stderr, "cannot read VmRSS of pid %d\n", pid);
+        return 1;
+    }
+
+    const size_t BATCH = 2000;
+    std::vector<int> conns;
+    conns.reserve(count);
+    long half = -1;
+    size_t halfCnt = 0;
+    while(conns.size() < count) {
+        if(half < 0 && conns.size() >= count / 2 && conns.size() > 0) {
+            sleep(2);
+            half = ReadRssKb(pid);
+            halfCnt = conns.size();
+        }
+        std::vector<int> batch;
+        for(size_t i = 0; i < BATCH && conns.size() + batch.size() < count; ++i) {
+            int fd = Connect(port, conns.size() + batch.size());
+            if(fd < 0) {
+                break;
+            }
+            batch.push_back(fd);
+        }
+        if(batch.empty()) {
+            perror("connect");
+            break;
+        }
+        RequestBatch(batch, request);
+        conns.insert(conns.end(), batch.begin(), batch.end());
+        if(conns.size() % 100000 < BATCH) {
+            printf("connections: %zu, server VmRSS: %ld kB\n", conns.size(), ReadRssKb(pid));
+        }
+    }
+
+    //等待服务器处理完写事件并回到空闲
+    sleep(2);
+    long after = ReadRssKb(pid);
+    size_t alive = 0;
+    for(int fd : conns) {
+        char ch;
+        ssize_t len = recv(fd, &ch, 1, MSG_PEEK | MSG_DONTWAIT);
+        if(len < 0 && errno == EAGAIN) {
+            ++alive;
+        }
+    }
+    printf("idle connections: %zu/%zu\n", alive, conns.size());
+    printf("server VmRSS: %ld kB -> %ld kB\n", before, after);
+    //以RST关闭，源端口不进入TIME_WAIT，紧接着重跑时不会绑定失败
+    struct linger reset = {1, 0};
+    double perConn = -1;
+    if(alive > 0) {
+        perConn = (after - before) * 1024.0 / alive;
+        printf("resident memory per idle connection: %.1f bytes\n", perConn);
+    }
+    if(half >= 0 && conns.size() > halfCnt) {
+        perConn = (after - half) * 1024.0 / (conns.size() - halfCnt);
+        printf("marginal memory per idle connection: %.1f bytes\n", perConn);
+    }
+    for(int fd : conns) {
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+        close(fd);
+    }
+    if(alive != count) {
+        printf("FAIL: %zu of %zu connections not idle\n", count - alive, count);
+        return 2;
+    }
+    if(perConn > maxBytes) {
+        printf("FAIL: %.1f bytes per idle connection exceeds budget %.0f\n", perConn, maxBytes);
+        return 3;
+    }
+    printf("PASS: %.1f bytes per idle connection, budget %.0f\n", perConn, maxBytes);
+    return 0;
+}
@@ -0,0 +1,186 @@
+#ifndef TLSCONN_HPP
+#define TLSCONN_HPP
+
+#include <sys/uio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <algorithm>
+
+#include "tlscontext.hpp"
+#include "../buffer/buffer.hpp"
+
+/*
+    单个连接上的TLS状态
+    握手在首次读时推进；握手完成后若内核接管了发送方向(kTLS)，
+    发送直接走writev/splice，由内核加密，否则退回SSL_write
+*/
+class TlsConn final {
+public:
+    TlsConn();
+    ~TlsConn();
+
+    bool Init(int fd);
+    void Close();
+    bool IsOpen() const;
+    bool IsKtlsSend() const;
+    //握手未完成且阻塞在写出（发送缓冲已满），须等待可写而不是可读后再推进
+    bool IsHandshakeWantWrite() const;
+
+    //推进握手并读出全部可读明文，握手未完成时*saveErrno为EAGAIN
+    ssize_t Read(Buffer& buff, int* saveErrno);
+    //语义同writev，一次只写出一个iov中的一段
+    ssize_t Writev(const struct iovec* iov, int iovCnt, int* saveErrno);
+    ssize_t Write(const char* data, size_t len, int* saveErrno);
+
+private:
+    bool Handshake_(int* saveErrno);
+    //将SSL错误转换为errno语义
+    int ToErrno_(int ret);
+
+    //单次SSL_write上限，重试时参数保持一致
+    static const size_t MAX_WRITE = 65536;
+    //按缓冲区块大小读，SSL内部缓存的剩余记录在循环中读完
+    static const size_t READ_SIZE = Buffer::BLOCK_SIZE;
+
+    int fd_;
+    SSL* ssl_;
+    bool isHandshaked_;
+    bool isKtlsSend_;
+    bool isWantWrite_;
+};
+
+const size_t TlsConn::MAX_WRITE;
+const size_t TlsConn::READ_SIZE;
+
+TlsConn::TlsConn() : fd_(-1), ssl_(nullptr), isHandshaked_(false), isKtlsSend_(false),
+                     isWantWrite_(false) {}
+
+TlsConn::~TlsConn() {
+    Close();
+}
+
+bool TlsConn::Init(int fd) {
+    Close();
+    ssl_ = TlsContext::GetInstance()->NewSsl(fd);
+    fd_ = fd;
+    return ssl_ != nullptr;
+}
+
+void TlsConn::Close() {
+    if(ssl_) {
+        //尽力发送close_notify，不等待对端回应
+        if(isHandshaked_) {
+            SSL_shutdown(ssl_);
+        }
+        SSL_free(ssl_);
+        ssl_ = nullptr;
+    }
+    fd_ = -1;
+    isHandshaked_ = false;
+    isKtlsSend_ = false;
+    isWantWrite_ = false;
+}
+
+bool TlsConn::IsOpen() const {
+    return ssl_ != nullptr;
+}
+
+bool TlsConn::IsKtlsSend() const {
+    return isKtlsSend_;
+}
+
+bool TlsConn::IsHandshakeWantWrite() const {
+    return ssl_ && !isHandshaked_ && isWantWrite_;
+}
+
+bool TlsConn::Handshake_(int* saveErrno) {
+    int ret = SSL_do_handshake(ssl_);
+    if(ret != 1) {
+        //WANT_WRITE与WANT_READ同样转为EAGAIN，由isWantWrite_告知调用方等待的方向
+        isWantWrite_ = SSL_get_error(ssl_, ret) == SSL_ERROR_WANT_WRITE;
+        *saveErrno = ToErrno_(ret);
+        return false;
+    }
+    isWantWrite_ = false;
+    isHandshaked_ = true;
+    isKtlsSend_ = BIO_get_ktls_send(SSL_get_wbio(ssl_));
+    LOG_DEBUG("TLS handshake fd: %d, %s, %s, resumed: %d, kTLS send: %d", fd_, SSL_get_version(ssl_),
+              SSL_get_cipher_name(ssl_), SSL_session_reused(ssl_), isKtlsSend_);
+    return true;
+}
+
+ssize_t TlsConn::Read(Buffer& buff, int* saveErrno) {
+    assert(ssl_);
+    if(!isHandshaked_ && !Handshake_(saveErrno)) {
+        return -1;
+    }
+    ssize_t total = 0;
+    //SSL内部可能缓存了已解密数据，epoll感知不到，必须读到WANT_READ为止
+    while(true) {
+        buff.EnsureWriteable(READ_SIZE);
+        int len = SSL_read(ssl_, buff.BeginWrite(), static_cast<int>(buff.WritableBytes()));
+        if(len > 0) {
+            buff.HasWritten(len);
+            total += len;
+            continue;
+        }
+        int err = SSL_get_error(ssl_, len);
+        if(err == SSL_ERROR_ZERO_RETURN) {
+            return total;
+        }
+        *saveErrno = ToErrno_(len);
+        return total > 0 ? total : -1;
+    }
+}
+
+ssize_t TlsConn::Writev(const struct iovec* iov, int iovCnt, int* saveErrno) {
+    assert(ssl_ && isHandshaked_);
+    if(isKtlsSend_) {
+        ssize_t len = writev(fd_, iov, iovCnt);
+        if(len < 0) {
+            *saveErrno = errno;
+        }
+        return len;
+    }
+    for(int i = 0; i < iovCnt; ++i) {
+        if(iov[i].iov_len > 0) {
+            return Write(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len, saveErrno);
+        }
+    }
+    return 0;
+}
+
+ssize_t TlsConn::Write(const char* data, size_t len, int* saveErrno) {
+    assert(ssl_ && isHandshaked_);
+    if(isKtlsSend_) {
+        ssize_t ret = write(fd_, data, len);
+        if(ret < 0) {
+            *saveErrno = errno;
+        }
+        return ret;
+    }
+    int ret = SSL_write(ssl_, data, static_cast<int>(std::min(len, MAX_WRITE)));
+    if(ret > 0) {
+        return ret;
+    }
+    *saveErrno = ToErrno_(ret);
+    errno = *saveErrno;
+    return -1;
+}
+
+int TlsConn::ToErrno_(int ret) {
+    switch (SSL_get_error(ssl_, ret))
+    {
+    case SSL_ERROR_WANT_READ:
+    case SSL_ERROR_WANT_WRITE:
+        return EAGAIN;
+    case SSL_ERROR_SYSCALL:
+        ERR_clear_error();
+        return errno ? errno : EPIPE;
+    default:
+        ERR_clear_error();
+        return EPROTO;
+    }
+}
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef TLSCONTEXT_HPP
+#define TLSCONTEXT_HPP
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <string>
+
+#include "../logger/logger.hpp"
+
+//全局TLS上下文：证书、会话票据与kTLS开关
+class TlsContext final {
+public:
+    static TlsContext* GetInstance();
+
+    bool Init(const std::string& certFile, const std::string& keyFile, bool enableKtls);
+    //为已accept的fd创建服务端SSL对象
+    SSL* NewSsl(int fd);
+    bool IsOpen() const;
+
+private:
+    TlsContext() = default;
+    ~TlsContext();
+
+    static void LogError_(const char* what);
+
+    SSL_CTX* ctx_ = nullptr;
+};
+
+TlsContext* TlsContext::GetInstance() {
+    static TlsContext context;
+    return &context;
+}
+
+TlsContext::~TlsContext() {
+    if(ctx_) {
+        SSL_CTX_free(ctx_);
+        ctx_ = nullptr;
+    }
+}
+
+bool TlsContext::Init(const std::string& certFile, const std::string& keyFile, bool enableKtls) {
+    ctx_ = SSL_CTX_new(TLS_server_method());
+    if(ctx_ == nullptr) {
+        LogError_("SSL_CTX_new");
+        return false;
+    }
+    SSL_CTX_set_min_proto_version(ctx_, TLS1_2_VERSION);
+    //部分写+移动写缓冲，配合iov逐块发送与非阻塞重试
+    SSL_CTX_set_mode(ctx_, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER |
+                           SSL_MODE_RELEASE_BUFFERS);
+    //会话票据恢复：票据密钥随进程生成，服务端不保存会话状态
+    SSL_CTX_set_session_cache_mode(ctx_, SSL_SESS_CACHE_OFF);
+    SSL_CTX_clear_options(ctx_, SSL_OP_NO_TICKET);
+    SSL_CTX_set_num_tickets(ctx_, 1);
+    if(enableKtls) {
+        //握手完成后由OpenSSL把密钥交给内核，之后writev/splice直接产生密文
+        SSL_CTX_set_options(ctx_, SSL_OP_ENABLE_KTLS);
+        //kTLS只支持AEAD套件
+        SSL_CTX_set_cipher_list(ctx_, "ECDHE+AESGCM:ECDHE+CHACHA20");
+    }
+
+    if(SSL_CTX_use_certificate_chain_file(ctx_, certFile.c_str()) != 1 ||
+       SSL_CTX_use_PrivateKey_file(ctx_, keyFile.c_str(), SSL_FILETYPE_PEM) != 1 ||
+       SSL_CTX_check_private_key(ctx_) != 1) {
+        LogError_("load cert/key");
+        SSL_CTX_free(ctx_);
+        ctx_ = nullptr;
+        return false;
+    }
+    LOG_INFO("TLS init success, cert: %s, kTLS: %s", certFile.c_str(), enableKtls ? "on" : "off");
+    return true;
+}
+
+SSL* TlsContext::NewSsl(int fd) {
+    assert(ctx_);
+    SSL* ssl = SSL_new(ctx_);
+    if(ssl == nullptr) {
+        LogError_("SSL_new");
+        return nullptr;
+    }
+    SSL_set_fd(ssl, fd);
+    SSL_set_accept_state(ssl);
+    return ssl;
+}
+
+bool TlsContext::IsOpen() const {
+    return ctx_ != nullptr;
+}
+
+void TlsContext::LogError_(const char* what) {
+    char errBuf[256] = {0};
+    ERR_error_string_n(ERR_get_error(), errBuf, sizeof(errBuf));
+    LOG_ERROR("TLS %s error: %s", what, errBuf);
+}
+
+#endif
@@ -0,0 +1,247 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <zlib.h>
+
+#include "../http/bundleformat.hpp"
+#include "../http/mimetype.hpp"
+
+/*
+    静态资源打包
+    1、递归收集资源目录下其他用户可读的普通文件，跳过隐藏文件与-x排除的目录（如上传目录）
+    2、按路径排序建立索引，预先算好Content-type与ETag；文本类内容另存gzip变体（-n不压缩），压缩后不足原大小90%时不保留
+    3、先写临时文件再改名，服务端任何时候读到的都是完整的包
+    用法：make bundle，或 ./bin/bundlepack [-n] [-x upload]... resources resources.bundle
+*/
+
+struct Item {
+    std::string path;
+    std::string file;
+    std::string data;
+    std::string gz;
+    const std::string* type;
+    std::string etag;
+};
+
+static bool ReadFile(const std::string& file, std::string& data) {
+    FILE* fp = fopen(file.c_str(), "rb");
+    if(!fp) {
+        perror(file.c_str());
+        return false;
+    }
+    char buf[65536];
+    size_t len = 0;
+    while((len = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        data.append(buf, len);
+    }
+    bool isOk = !ferror(fp);
+    fclose(fp);
+    return isOk;
+}
+
+static bool Collect(const std::string& dir, const std::string& prefix, const std::vector<std::string>& excludes,
+                    std::vector<Item>& items) {
+    DIR* dp = opendir(dir.c_str());
+    if(!dp) {
+        perror(dir.c_str());
+        return false;
+    }
+    bool isOk = true;
+    while(dirent* ent = readdir(dp)) {
+        if(ent->d_name[0] == '.') {
+            continue;
+        }
+        std::string file = dir + "/" + ent->d_name;
+        std::string path = prefix + "/" + ent->d_name;
+        struct stat st;
+        if(stat(file.c_str(), &st) < 0) {
+            perror(file.c_str());
+            isOk = false;
+            continue;
+        }
+        if(S_ISDIR(st.st_mode)) {
+            if(std::find(excludes.begin(), excludes.end(), path.substr(1)) == excludes.end()) {
+                isOk = Collect(file, path, excludes, items) && isOk;
+            }
+            continue;
+        }
+        //其他用户不可读的文件仍由服务端按磁盘流程回复403
+        if(!S_ISREG(st.st_mode) || !(st.st_mode & S_IROTH)) {
+            continue;
+        }
+        Item item;
+        item.path = path;
+        item.file = file;
+        items.push_back(item);
+    }
+    closedir(dp);
+    return isOk;
+}
+
+static bool IsCompressible(const std::string& type) {
+    return type.compare(0, 5, "text/") == 0 || type.find("xml") != std::string::npos ||
+           type.find("javascript") != std::string::npos || type.find("json") != std::string::npos;
+}
+
+static bool Gzip(const std::string& data, std::string& gz) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    //窗口位数加16输出gzip格式
+    if(deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+    gz.resize(deflateBound(&stream, data.size()));
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    stream.avail_in = data.size();
+    stream.next_out = reinterpret_cast<Bytef*>(&gz[0]);
+    stream.avail_out = gz.size();
+    int ret = deflate(&stream, Z_FINISH);
+    gz.resize(stream.total_out);
+    deflateEnd(&stream);
+    return ret == Z_STREAM_END;
+}
+
+static bool WriteAll(FILE* fp, const void* data, size_t len) {
+    return len == 0 || fwrite(data, 1, len, fp) == len;
+}
+
+static bool Pad(FILE* fp, uint64_t& off) {
+    static const char ZERO[BundleFormat::BLOB_ALIGN] = {};
+    uint64_t aligned = BundleFormat::Align(off);
+    bool isOk = WriteAll(fp, ZERO, aligned - off);
+    off = aligned;
+    return isOk;
+}
+
+int main(int argc, char* argv[]) {
+    bool isCompress = true;
+    std::vector<std::string> excludes;
+    int opt = 0;
+    while((opt = getopt(argc, argv, "nx:")) != -1) {
+        if(opt == 'n') {
+            isCompress = false;
+        }
+        else if(opt == 'x') {
+            excludes.push_back(optarg);
+        }
+        else {
+            optind = argc;
+            break;
+        }
+    }
+    if(argc - optind != 2) {
+        fprintf(stderr, "usage: %s [-n] [-x dir]... <resources dir> <out.bundle>\n", argv[0]);
+        return 1;
+    }
+    std::string srcDir = argv[optind];
+    std::string outFile = argv[optind + 1];
+    while(srcDir.size() > 1 && srcDir.back() == '/') {
+        srcDir.pop_back();
+    }
+
+    std::vector<Item> items;
+    if(!Collect(srcDir, "", excludes, items)) {
+        return 1;
+    }
+    std::sort(items.begin(), items.end(), [](const Item& a, const Item& b) {
+        return BundleFormat::Compare(a.path.data(), a.path.size(), b.path.data(), b.path.size()) < 0;
+    });
+
+    //字符串区：路径、类型与ETag依次排列
+    std::string strings;
+    std::vector<BundleEntry> entries(items.size());
+    size_t rawBytes = 0;
+    size_t gzCount = 0;
+    for(size_t i = 0; i < items.size(); ++i) {
+        Item& item = items[i];
+        if(!ReadFile(item.file, item.data)) {
+            return 1;
+        }
+        item.type = &MimeType::Get(item.path.data(), item.path.size());
+        char etag[32];
+        snprintf(etag, sizeof(etag), "\"%016llx\"",
+                 static_cast<unsigned long long>(BundleFormat::Digest(item.data.data(), item.data.size())));
+        item.etag = etag;
+        if(isCompress && IsCompressible(*item.type) && Gzip(item.data, item.gz) &&
+           item.gz.size() * 10 < item.data.size() * 9) {
+            ++gzCount;
+        }
+        else {
+            item.gz.clear();
+        }
+        rawBytes += item.data.size();
+
+        BundleEntry& entry = entries[i];
+        memset(&entry, 0, sizeof(entry));
+        entry.pathOff = strings.size();
+        entry.pathLen = item.path.size();
+        strings += item.path;
+        entry.typeOff = strings.size();
+        entry.typeLen = item.type->size();
+        strings += *item.type;
+        entry.etagOff = strings.size();
+        entry.etagLen = item.etag.size();
+        strings += item.etag;
+    }
+
+    //布局：头部之后依次为索引、字符串区、对齐的数据区
+    BundleHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BundleFormat::MAGIC, sizeof(header.magic));
+    header.version = BundleFormat::VERSION;
+    header.count = entries.size();
+    header.indexOff = sizeof(BundleHeader);
+    header.stringOff = header.indexOff + entries.size() * sizeof(BundleEntry);
+    header.stringLen = strings.size();
+    header.buildTime = time(nullptr);
+    uint64_t off = BundleFormat::Align(header.stringOff + header.stringLen);
+    for(size_t i = 0; i < items.size(); ++i) {
+        entries[i].dataOff = off;
+        entries[i].dataLen = items[i].data.size();
+        off = BundleFormat::Align(off + items[i].data.size());
+        if(!items[i].gz.empty()) {
+            entries[i].gzOff = off;
+            entries[i].gzLen = items[i].gz.size();
+            off = BundleFormat::Align(off + items[i].gz.size());
+        }
+    }
+    header.fileSize = off;
+
+    std::string tmpFile = outFile + ".tmp";
+    FILE* fp = fopen(tmpFile.c_str(), "wb");
+    if(!fp) {
+        perror(tmpFile.c_str());
+        return 1;
+    }
+    uint64_t pos = 0;
+    bool isOk = WriteAll(fp, &header, sizeof(header)) && WriteAll(fp, entries.data(), entries.size() * sizeof(BundleEntry)) &&
+                WriteAll(fp, strings.data(), strings.size());
+    pos = header.stringOff + header.stringLen;
+    for(size_t i = 0; isOk && i < items.size(); ++i) {
+        isOk = Pad(fp, pos) && WriteAll(fp, items[i].data.data(), items[i].data.size());
+        pos += items[i].data.size();
+        if(isOk && !items[i].gz.empty()) {
+            isOk = Pad(fp, pos) && WriteAll(fp, items[i].gz.data(), items[i].gz.size());
+            pos += items[i].gz.size();
+        }
+    }
+    isOk = isOk && Pad(fp, pos) && pos == header.fileSize;
+    isOk = (fflush(fp) == 0 && fsync(fileno(fp)) == 0 && isOk);
+    isOk = (fclose(fp) == 0 && isOk);
+    if(!isOk || rename(tmpFile.c_str(), outFile.c_str()) < 0) {
+        perror(outFile.c_str());
+        unlink(tmpFile.c_str());
+        return 1;
+    }
+    printf("%s: %zu assets, %zu bytes raw, %zu gzip variants, %llu bytes total\n", outFile.c_str(), items.size(),
+           rawBytes, gzCount, static_cast<unsigned long long>(header.fileSize));
+    return 0;
+}
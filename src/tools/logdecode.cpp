@@ -0,0 +1,351 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <zlib.h>
+
+#include "../logger/binlog.hpp"
+
+/*
+    二进制日志解码
+    1、按文件中的格式表还原每条记录，输出与文本日志相同的行格式
+    2、记录时间由其前最近的对时点（tsc, unix纳秒）与文件头中的tsc频率换算
+    3、同一文件中出现新的文件头（同一天重启追加）时换用新的格式与线程表
+    4、可直接读取后台压缩后的 .blog.gz
+    用法：make logdecode && ./bin/logdecode log/2024_01_01.blog [更多文件...] > out.log
+*/
+
+struct Arg {
+    uint8_t type;
+    int64_t i;
+    uint64_t u;
+    double f;
+    std::string s;
+};
+
+struct DecodeState {
+    double tscPerNs = 1.0;
+    bool hasSync = false;
+    uint64_t syncTsc = 0;
+    int64_t syncNs = 0;
+    std::unordered_map<uint32_t, std::pair<int, std::string>> formats;
+    std::unordered_map<uint32_t, std::pair<uint64_t, std::string>> threads;
+};
+
+static const char* LevelTitle(int level) {
+    switch (level) {
+    case 0:
+        return "[debug]: ";
+    case 2:
+        return "[warn] : ";
+    case 3:
+        return "[error]: ";
+    case 4:
+        return "[fetal]: ";
+    default:
+        return "[info] : ";
+    }
+}
+
+static bool ReadBytes(gzFile fp, void* data, size_t len) {
+    return gzread(fp, data, static_cast<unsigned>(len)) == static_cast<int>(len);
+}
+
+static bool ReadString(gzFile fp, std::string& str) {
+    uint32_t len;
+    if(!ReadBytes(fp, &len, 4)) {
+        return false;
+    }
+    str.resize(len);
+    return len == 0 || ReadBytes(fp, &str[0], len);
+}
+
+static bool ParseArgs(const char* p, size_t len, std::vector<Arg>& args) {
+    args.clear();
+    const char* end = p + len;
+    while(p < end) {
+        Arg arg;
+        arg.type = static_cast<uint8_t>(*p++);
+        arg.i = 0;
+        arg.u = 0;
+        arg.f = 0;
+        if(arg.type == BinLog::ARG_STR) {
+            uint32_t strLen;
+            if(end - p < 4) {
+                return false;
+            }
+            memcpy(&strLen, p, 4);
+            p += 4;
+            if(static_cast<size_t>(end - p) < strLen) {
+                return false;
+            }
+            arg.s.assign(p, strLen);
+            p += strLen;
+        }
+        else {
+            if(end - p < 8) {
+                return false;
+            }
+            memcpy(&arg.u, p, 8);
+            memcpy(&arg.i, p, 8);
+            memcpy(&arg.f, p, 8);
+            if(arg.type == BinLog::ARG_DOUBLE) {
+                arg.i = static_cast<int64_t>(arg.f);
+                arg.u = static_cast<uint64_t>(arg.f);
+            }
+            p += 8;
+        }
+        args.push_back(std::move(arg));
+    }
+    return true;
+}
+
+template<class T>
+static void AppendFormat(std::string& out, const std::string& spec, T value) {
+    char buf[256];
+    int len = snprintf(buf, sizeof(buf), spec.c_str(), value);
+    if(len < 0) {
+        return;
+    }
+    if(static_cast<size_t>(len) < sizeof(buf)) {
+        out.append(buf, len);
+        return;
+    }
+    std::string big(len + 1, '\0');
+    snprintf(&big[0], big.size(), spec.c_str(), value);
+    out.append(big.data(), len);
+}
+
+//按printf规则还原，长度修饰统一换成与参数编码一致的宽度
+static std::string Render(const std::string& format, const std::vector<Arg>& args) {
+    std::string out;
+    size_t next = 0;
+    for(size_t i = 0; i < format.size(); ++i) {
+        if(format[i] != '%') {
+            out.push_back(format[i]);
+            continue;
+        }
+        if(i + 1 < format.size() && format[i + 1] == '%') {
+            out.push_back('%');
+            ++i;
+            continue;
+        }
+        std::string spec = "%";
+        size_t j = i + 1;
+        while(j < format.size() && strchr("-+ #0'", format[j])) {
+            spec.push_back(format[j++]);
+        }
+        //宽度与精度，*从参数中取
+        for(int part = 0; part < 2; ++part) {
+            if(part == 1) {
+                if(j >= format.size() || format[j] != '.') {
+                    break;
+                }
+                spec.push_back(format[j++]);
+            }
+            if(j < format.size() && format[j] == '*') {
+                spec += std::to_string(next < args.size() ? args[next++].i : 0);
+                ++j;
+            }
+            while(j < format.size() && format[j] >= '0' && format[j] <= '9') {
+                spec.push_back(format[j++]);
+            }
+        }
+        while(j < format.size() && strchr("hlLqjzt", format[j])) {
+            ++j;
+        }
+        if(j >= format.size()) {
+            out += format.substr(i);
+            break;
+        }
+        char conv = format[j];
+        i = j;
+        if(next >= args.size()) {
+            out += "<missing>";
+            continue;
+        }
+        const Arg& arg = args[next++];
+        switch (conv) {
+        case 'd':
+        case 'i':
+            AppendFormat(out, spec + "lld", static_cast<long long>(arg.i));
+            break;
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+            AppendFormat(out, spec + "ll" + conv, static_cast<unsigned long long>(arg.u));
+            break;
+        case 'c':
+            AppendFormat(out, spec + "c", static_cast<int>(arg.i));
+            break;
+        case 'e':
+        case 'E':
+        case 'f':
+        case 'F':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            AppendFormat(out, spec + conv, arg.type == BinLog::ARG_DOUBLE ? arg.f : static_cast<double>(arg.i));
+            break;
+        case 's':
+            if(arg.type == BinLog::ARG_STR) {
+                AppendFormat(out, spec + "s", arg.s.c_str());
+            }
+            else {
+                out += "<?>";
+            }
+            break;
+        case 'p':
+            AppendFormat(out, spec + "p", reinterpret_cast<void*>(static_cast<uintptr_t>(arg.u)));
+            break;
+        default:
+            out += spec + conv;
+            break;
+        }
+    }
+    return out;
+}
+
+//记录时间：对时点的unix时间加上tsc差换算的纳秒
+static void AppendTime(std::string& line, const DecodeState& state, uint64_t tsc) {
+    int64_t ns = state.syncNs;
+    if(state.hasSync) {
+        ns += static_cast<int64_t>(static_cast<double>(static_cast<int64_t>(tsc - state.syncTsc)) / state.tscPerNs);
+    }
+    time_t sec = static_cast<time_t>(ns / 1000000000LL);
+    long usec = static_cast<long>(ns % 1000000000LL / 1000);
+    if(usec < 0) {
+        --sec;
+        usec += 1000000;
+    }
+    tm sysTime;
+    localtime_r(&sec, &sysTime);
+    char buf[64];
+    int len = snprintf(buf, sizeof(buf), "%04d-%02d-%02d %02d:%02d:%02d.%06ld ",
+                       sysTime.tm_year + 1900, sysTime.tm_mon + 1, sysTime.tm_mday,
+                       sysTime.tm_hour, sysTime.tm_min, sysTime.tm_sec, usec);
+    line.append(buf, len);
+}
+
+static void AppendThread(std::string& line, const DecodeState& state, uint32_t index) {
+    auto iter = state.threads.find(index);
+    char buf[96];
+    int len = iter == state.threads.end() ?
+              snprintf(buf, sizeof(buf), "[?\t-%u] ", index) :
+              snprintf(buf, sizeof(buf), "[%s\t-%ld] ", iter->second.second.c_str(), static_cast<long>(iter->second.first));
+    line.append(buf, len);
+}
+
+static bool Decode(gzFile fp, const char* fileName) {
+    DecodeState state;
+    std::string record;
+    std::vector<Arg> args;
+    std::string line;
+    int type;
+    while((type = gzgetc(fp)) != -1) {
+        long offset = static_cast<long>(gztell(fp)) - 1;
+        bool isOk = true;
+        if(type == BinLog::MAGIC[0]) {
+            char magic[sizeof(BinLog::MAGIC)];
+            magic[0] = static_cast<char>(type);
+            isOk = ReadBytes(fp, magic + 1, sizeof(magic) - 1) &&
+                   memcmp(magic, BinLog::MAGIC, sizeof(magic)) == 0 &&
+                   ReadBytes(fp, &state.tscPerNs, sizeof(state.tscPerNs)) && state.tscPerNs > 0;
+            state.hasSync = false;
+            state.formats.clear();
+            state.threads.clear();
+        }
+        else if(type == BinLog::ENTRY_FORMAT) {
+            uint32_t id;
+            uint8_t level;
+            std::string format;
+            isOk = ReadBytes(fp, &id, 4) && ReadBytes(fp, &level, 1) && ReadString(fp, format);
+            state.formats[id] = std::make_pair(static_cast<int>(level), format);
+        }
+        else if(type == BinLog::ENTRY_THREAD) {
+            uint32_t index;
+            uint64_t threadId;
+            std::string name;
+            isOk = ReadBytes(fp, &index, 4) && ReadBytes(fp, &threadId, 8) && ReadString(fp, name);
+            state.threads[index] = std::make_pair(threadId, name);
+        }
+        else if(type == BinLog::ENTRY_SYNC) {
+            isOk = ReadBytes(fp, &state.syncTsc, 8) && ReadBytes(fp, &state.syncNs, 8);
+            state.hasSync = true;
+        }
+        else if(type == BinLog::ENTRY_DROP) {
+            uint32_t index;
+            uint64_t count;
+            isOk = ReadBytes(fp, &index, 4) && ReadBytes(fp, &count, 8);
+            if(isOk) {
+                line.clear();
+                AppendTime(line, state, state.syncTsc);
+                AppendThread(line, state, index);
+                line += LevelTitle(2);
+                line += "logger ring full, " + std::to_string(count) + " lines dropped\n";
+                fputs(line.c_str(), stdout);
+            }
+        }
+        else if(type == BinLog::ENTRY_LOG) {
+            uint32_t index, len, formatId;
+            uint64_t tsc;
+            isOk = ReadBytes(fp, &index, 4) && ReadBytes(fp, &len, 4) && len >= BinLog::HEAD_LEN;
+            if(isOk) {
+                record.resize(len - 4);
+                isOk = ReadBytes(fp, &record[0], record.size());
+            }
+            if(isOk) {
+                memcpy(&formatId, record.data(), 4);
+                memcpy(&tsc, record.data() + 4, 8);
+                auto format = state.formats.find(formatId);
+                isOk = format != state.formats.end() &&
+                       ParseArgs(record.data() + BinLog::HEAD_LEN - 4, len - BinLog::HEAD_LEN, args);
+                if(isOk) {
+                    line.clear();
+                    AppendTime(line, state, tsc);
+                    AppendThread(line, state, index);
+                    line += LevelTitle(format->second.first);
+                    line += Render(format->second.second, args);
+                    line.push_back('\n');
+                    fputs(line.c_str(), stdout);
+                }
+            }
+        }
+        else {
+            isOk = false;
+        }
+        if(!isOk) {
+            fprintf(stderr, "%s: corrupted entry at offset %ld\n", fileName, offset);
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    if(argc < 2) {
+        fprintf(stderr, "usage: %s <file.blog[.gz]> [file.blog[.gz]...]\n", argv[0]);
+        return 1;
+    }
+    int ret = 0;
+    for(int i = 1; i < argc; ++i) {
+        //未压缩的文件gzread按原样读出
+        gzFile fp = gzopen(argv[i], "rb");
+        if(!fp) {
+            perror(argv[i]);
+            ret = 1;
+            continue;
+        }
+        if(!Decode(fp, argv[i])) {
+            ret = 1;
+        }
+        gzclose(fp);
+    }
+    return ret;
+}
@@ -0,0 +1,480 @@
+#ifndef MULTIPARTPARSER_HPP
+#define MULTIPARTPARSER_HPP
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+
+#include "uploadstore.hpp"
+#include "../buffer/buffer.hpp"
+#include "../logger/logger.hpp"
+
+/*
+    multipart/form-data请求体流式解析
+    1、文件部分直接写入上传目录下的临时文件，完成后改名
+    2、普通表单字段缓存在内存中，单个字段有上限
+    3、明文连接上，文件内容先MSG_PEEK到线程共用的窥视缓冲区查找分隔符，确认不含分隔符的区段经管道splice落盘，
+       不经过readBuff_；分隔符附近的少量字节才读入缓冲区解析
+       这不是零拷贝：分隔符可能出现在任意位置，每个字节仍要拷贝到用户态扫描一次，
+       省掉的是recv到缓冲区再write回内核中的写回那一次拷贝，以及readBuff_随请求体增长
+*/
+class MultipartParser final {
+public:
+    enum PARSE_STATE {
+        IDLE,
+        PREAMBLE,       //首个分隔符之前
+        AFTER_DELIM,    //分隔符之后：结束标记或下一部分
+        PART_HEADER,
+        PART_BODY,
+        EPILOGUE,       //结束分隔符之后，丢弃剩余请求体
+        FINISH,
+        ERROR,
+    };
+
+    MultipartParser();
+    ~MultipartParser();
+
+    //从Content-Type取boundary，并按Content-Length限制请求体大小
+    bool Init(const char* contentType, const char* contentLength);
+    //关闭未完成的临时文件与管道
+    void Reset();
+    //Init之后、Reset之前
+    bool IsActive() const;
+    bool IsFinish() const;
+    bool IsError() const;
+
+    //消费buff中属于请求体的字节
+    void Feed(Buffer& buff);
+    //从socket读取请求体直到EAGAIN或请求体读完
+    ssize_t ReadFrom(int fd, Buffer& buff, int* saveErrno);
+
+    const std::vector<std::string>& GetFiles() const;
+    const std::unordered_map<std::string, std::string>& GetFields() const;
+
+private:
+    bool IsParsing_() const;
+    //返回data中可安全交给当前部分的字节数：在分隔符之前，且不含可能是分隔符前缀的尾部
+    size_t SafeLen_(const char* data, size_t len, bool* found) const;
+    //窥视扫描分隔符后，当前文件部分不含分隔符的区段socket->管道->文件，返回搬运字节数，0表示需走复制路径
+    ssize_t SpliceBody_(int fd, size_t sockLeft, int* saveErrno);
+    bool ParsePartHeader_(const char* begin, const char* end);
+    bool Emit_(const char* data, size_t len);
+    void EndPart_();
+    void CloseFile_();
+    void Fail_(const char* reason);
+    static bool GetParam_(const std::string& line, const char* key, std::string* value);
+
+    static const size_t MAX_PART_HEADER = 8192;
+    static const size_t MAX_FIELD = 65536;
+    static const size_t PEEK_SIZE = 65536;
+    static const size_t COPY_SIZE = 4096;
+
+    PARSE_STATE state_;
+    //"\r\n--" + boundary
+    std::string delim_;
+    //尚未被解析器消费的请求体字节，包括已读入buff的部分
+    size_t bodyLeft_;
+
+    bool isFile_;
+    int fileFd_;
+    size_t fileLen_;
+    std::string tmpPath_;
+    std::string fileName_;
+    std::string fieldName_;
+    std::string fieldValue_;
+    int pipe_[2];
+
+    std::vector<std::string> files_;
+    std::unordered_map<std::string, std::string> fields_;
+};
+
+const size_t MultipartParser::MAX_PART_HEADER;
+const size_t MultipartParser::MAX_FIELD;
+const size_t MultipartParser::PEEK_SIZE;
+const size_t MultipartParser::COPY_SIZE;
+
+MultipartParser::MultipartParser() : state_(IDLE), bodyLeft_(0), isFile_(false), fileFd_(-1), fileLen_(0) {
+    pipe_[0] = pipe_[1] = -1;
+}
+
+MultipartParser::~MultipartParser() {
+    Reset();
+}
+
+bool MultipartParser::Init(const char* contentType, const char* contentLength) {
+    Reset();
+    const char* pos = strstr(contentType, "boundary=");
+    if(pos == nullptr) {
+        return false;
+    }
+    std::string boundary(pos + 9);
+    boundary = boundary.substr(0, boundary.find(';'));
+    if(boundary.size() >= 2 && boundary.front() == '"' && boundary.back() == '"') {
+        boundary = boundary.substr(1, boundary.size() - 2);
+    }
+    //RFC 2046：boundary为1~70个字符
+    if(boundary.empty() || boundary.size() > 70) {
+        return false;
+    }
+    //不支持chunked上传，必须给出请求体长度
+    long long len = *contentLength == '\0' ? -1 : strtoll(contentLength, nullptr, 10);
+    if(len <= 0 || static_cast<size_t>(len) > UploadStore::GetInstance()->GetMaxBody()) {
+        LOG_WARN("Upload Content-Length %s rejected", contentLength);
+        return false;
+    }
+    delim_ = "\r\n--" + boundary;
+    bodyLeft_ = len;
+    state_ = PREAMBLE;
+    return true;
+}
+
+void MultipartParser::Reset() {
+    CloseFile_();
+    if(pipe_[0] >= 0) {
+        close(pipe_[0]);
+        close(pipe_[1]);
+        pipe_[0] = pipe_[1] = -1;
+    }
+    state_ = IDLE;
+    delim_.clear();
+    bodyLeft_ = 0;
+    isFile_ = false;
+    fileName_.clear();
+    fieldName_.clear();
+    fieldValue_.clear();
+    files_.clear();
+    fields_.clear();
+}
+
+bool MultipartParser::IsActive() const {
+    return state_ != IDLE;
+}
+
+bool MultipartParser::IsFinish() const {
+    return state_ == FINISH;
+}
+
+bool MultipartParser::IsError() const {
+    return state_ == ERROR;
+}
+
+bool MultipartParser::IsParsing_() const {
+    return state_ != IDLE && state_ != FINISH && state_ != ERROR;
+}
+
+const std::vector<std::string>& MultipartParser::GetFiles() const {
+    return files_;
+}
+
+const std::unordered_map<std::string, std::string>& MultipartParser::GetFields() const {
+    return fields_;
+}
+
+void MultipartParser::Feed(Buffer& buff) {
+    while(IsParsing_()) {
+        if(state_ == EPILOGUE && bodyLeft_ == 0) {
+            state_ = FINISH;
+            break;
+        }
+        //buff中超出请求体的部分属于下一个请求
+        const char* data = buff.Peek();
+        size_t avail = std::min(buff.ReadableBytes(), bodyLeft_);
+        size_t used = 0;
+        bool found = false;
+        switch (state_)
+        {
+        case PREAMBLE: {
+            //请求体通常直接以"--boundary"开头，否则跳过前导内容
+            size_t dashLen = delim_.size() - 2;
+            if(avail < dashLen) {
+                break;
+            }
+            if(memcmp(data, delim_.data() + 2, dashLen) == 0) {
+                used = dashLen;
+                state_ = AFTER_DELIM;
+                break;
+            }
+            used = SafeLen_(data, avail, &found);
+            if(found) {
+                used += delim_.size();
+                state_ = AFTER_DELIM;
+            }
+            break;
+        }
+        case AFTER_DELIM:
+            if(avail < 2) {
+                break;
+            }
+            used = 2;
+            if(data[0] == '-' && data[1] == '-') {
+                state_ = EPILOGUE;
+            }
+            else if(data[0] == '\r' && data[1] == '\n') {
+                state_ = PART_HEADER;
+            }
+            else {
+                Fail_("bad delimiter");
+            }
+            break;
+        case PART_HEADER: {
+            const char CRLF2[] = "\r\n\r\n";
+            const char* end = nullptr;
+            //部分头为空时紧跟一个空行
+            if(avail >= 2 && data[0] == '\r' && data[1] == '\n') {
+                end = data - 2;
+            }
+            else {
+                end = std::search(data, data + avail, CRLF2, CRLF2 + 4);
+                if(end == data + avail) {
+                    if(avail > MAX_PART_HEADER) {
+                        Fail_("part header too large");
+                    }
+                    break;
+                }
+            }
+            if(!ParsePartHeader_(data, std::max(data, end))) {
+                break;
+            }
+            used = end + 4 - data;
+            state_ = PART_BODY;
+            break;
+        }
+        case PART_BODY:
+            used = SafeLen_(data, avail, &found);
+            if(!Emit_(data, used)) {
+                break;
+            }
+            if(found) {
+                used += delim_.size();
+                EndPart_();
+                state_ = AFTER_DELIM;
+            }
+            break;
+        case EPILOGUE:
+            used = avail;
+            break;
+        default:
+            break;
+        }
+        if(state_ == ERROR) {
+            break;
+        }
+        buff.Retrieve(used);
+        bodyLeft_ -= used;
+        if(used == 0) {
+            break;
+        }
+    }
+    if(bodyLeft_ == 0 && IsParsing_() && state_ != EPILOGUE) {
+        Fail_("body truncated");
+    }
+}
+
+ssize_t MultipartParser::ReadFrom(int fd, Buffer& buff, int* saveErrno) {
+    ssize_t total = 0;
+    while(IsParsing_()) {
+        size_t buffered = std::min(buff.ReadableBytes(), bodyLeft_);
+        size_t sockLeft = bodyLeft_ - buffered;
+        if(sockLeft == 0) {
+            *saveErrno = EAGAIN;
+            break;
+        }
+        if(state_ == PART_BODY && fileFd_ >= 0 && buffered == 0) {
+            ssize_t len = SpliceBody_(fd, sockLeft, saveErrno);
+            if(len > 0) {
+                total += len;
+                continue;
+            }
+            if(len < 0) {
+                break;
+            }
+            //分隔符在开头或尾部无法确定，读入缓冲区解析
+        }
+        buff.EnsureWriteable(COPY_SIZE);
+        ssize_t len = recv(fd, buff.BeginWrite(), std::min(COPY_SIZE, sockLeft), 0);
+        if(len <= 0) {
+            if(len < 0) {
+                *saveErrno = errno;
+            }
+            return total > 0 ? total : len;
+        }
+        buff.HasWritten(len);
+        total += len;
+        Feed(buff);
+    }
+    return total > 0 ? total : -1;
+}
+
+ssize_t MultipartParser::SpliceBody_(int fd, size_t sockLeft, int* saveErrno) {
+    //窥视缓冲区按线程复用，连接不额外持有内存；窥视本身是一次拷贝，只用于扫描分隔符
+    static thread_local char peekBuff[PEEK_SIZE];
+    ssize_t len = recv(fd, peekBuff, std::min(PEEK_SIZE, sockLeft), MSG_PEEK);
+    if(len <= 0) {
+        if(len < 0 && errno == EAGAIN) {
+            *saveErrno = EAGAIN;
+            return -1;
+        }
+        return 0;
+    }
+    bool found = false;
+    size_t safe = SafeLen_(peekBuff, len, &found);
+    if(safe == 0) {
+        return 0;
+    }
+    if(pipe_[0] < 0 && pipe2(pipe_, O_NONBLOCK | O_CLOEXEC) < 0) {
+        pipe_[0] = pipe_[1] = -1;
+        return 0;
+    }
+    //管道为空，窥视长度不超过管道默认容量，一次即可全部搬入
+    ssize_t in = splice(fd, nullptr, pipe_[1], nullptr, safe, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if(in <= 0) {
+        return 0;
+    }
+    size_t left = in;
+    while(left > 0) {
+        ssize_t out = splice(pipe_[0], nullptr, fileFd_, nullptr, left, SPLICE_F_MOVE);
+        if(out <= 0) {
+            Fail_("write upload file");
+            break;
+        }
+        left -= out;
+    }
+    fileLen_ += in;
+    bodyLeft_ -= in;
+    return in;
+}
+
+size_t MultipartParser::SafeLen_(const char* data, size_t len, bool* found) const {
+    const char* end = data + len;
+    const char* pos = data;
+    size_t delimLen = delim_.size();
+    *found = false;
+    //memchr定位候选起点'\r'，再比较整个分隔符
+    while((pos = static_cast<const char*>(memchr(pos, '\r', end - pos))) != nullptr) {
+        size_t rest = end - pos;
+        if(rest >= delimLen) {
+            if(memcmp(pos, delim_.data(), delimLen) == 0) {
+                *found = true;
+                return pos - data;
+            }
+        }
+        else if(memcmp(pos, delim_.data(), rest) == 0) {
+            //尾部可能是分隔符前缀，等待更多数据
+            return pos - data;
+        }
+        ++pos;
+    }
+    return len;
+}
+
+bool MultipartParser::ParsePartHeader_(const char* begin, const char* end) {
+    isFile_ = false;
+    fileName_.clear();
+    fieldName_.clear();
+    fieldValue_.clear();
+    const char CRLF[] = "\r\n";
+    while(begin < end) {
+        const char* lineEnd = std::search(begin, end, CRLF, CRLF + 2);
+        std::string line(begin, lineEnd);
+        if(strncasecmp(line.c_str(), "Content-Disposition:", 20) == 0) {
+            GetParam_(line, "name", &fieldName_);
+            isFile_ = GetParam_(line, "filename", &fileName_);
+        }
+        begin = (lineEnd == end) ? end : lineEnd + 2;
+    }
+    //未选择文件时浏览器发送空文件名，内容丢弃
+    if(isFile_ && !fileName_.empty()) {
+        fileFd_ = UploadStore::GetInstance()->OpenTemp(&tmpPath_);
+        if(fileFd_ < 0) {
+            Fail_("open upload file");
+            return false;
+        }
+        fileLen_ = 0;
+    }
+    return true;
+}
+
+bool MultipartParser::Emit_(const char* data, size_t len) {
+    if(len == 0) {
+        return true;
+    }
+    if(isFile_) {
+        while(fileFd_ >= 0 && len > 0) {
+            ssize_t ret = write(fileFd_, data, len);
+            if(ret <= 0) {
+                Fail_("write upload file");
+                return false;
+            }
+            data += ret;
+            len -= ret;
+            fileLen_ += ret;
+        }
+        return true;
+    }
+    if(fieldValue_.size() + len > MAX_FIELD) {
+        Fail_("form field too large");
+        return false;
+    }
+    fieldValue_.append(data, len);
+    return true;
+}
+
+void MultipartParser::EndPart_() {
+    if(isFile_ && fileFd_ >= 0) {
+        close(fileFd_);
+        fileFd_ = -1;
+        std::string savedName;
+        if(UploadStore::GetInstance()->Commit(tmpPath_, fileName_, &savedName)) {
+            LOG_INFO("Upload file: %s, %d bytes", savedName.c_str(), (int)fileLen_);
+            files_.push_back(savedName);
+        }
+    }
+    else if(!isFile_ && !fieldName_.empty()) {
+        fields_[fieldName_] = std::move(fieldValue_);
+    }
+    isFile_ = false;
+    fieldValue_.clear();
+}
+
+void MultipartParser::CloseFile_() {
+    if(fileFd_ >= 0) {
+        close(fileFd_);
+        unlink(tmpPath_.c_str());
+        fileFd_ = -1;
+    }
+}
+
+void MultipartParser::Fail_(const char* reason) {
+    LOG_WARN("Multipart upload error: %s", reason);
+    CloseFile_();
+    state_ = ERROR;
+}
+
+bool MultipartParser::GetParam_(const std::string& line, const char* key, std::string* value) {
+    //key="value"，要求前面是分隔符，避免name匹配到filename
+    std::string pattern = std::string(key) + "=\"";
+    size_t pos = 0;
+    while((pos = line.find(pattern, pos)) != std::string::npos) {
+        if(pos > 0 && (line[pos - 1] == ' ' || line[pos - 1] == ';')) {
+            size_t begin = pos + pattern.size();
+            size_t end = line.find('"', begin);
+            if(end == std::string::npos) {
+                return false;
+            }
+            *value = line.substr(begin, end - begin);
+            return true;
+        }
+        pos += pattern.size();
+    }
+    return false;
+}
+
+#endif
@@ -0,0 +1,178 @@
+#ifndef UPLOADSTORE_HPP
+#define UPLOADSTORE_HPP
+
+#include <string>
+#include <vector>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <ctype.h>
+#include <sys/stat.h>
+#include <assert.h>
+
+#include "../logger/logger.hpp"
+
+//上传文件的落盘目录与接收规则
+class UploadStore final {
+public:
+    static UploadStore* GetInstance();
+
+    void Init(bool open, const std::string& dir, int maxBodyMb, const std::vector<std::string>& paths);
+    bool IsOpen() const;
+    //请求目标是否命中配置的上传路径前缀
+    bool IsUploadPath(const char* target) const;
+    size_t GetMaxBody() const;
+    //在上传目录下创建临时文件，返回fd
+    int OpenTemp(std::string* tmpPath) const;
+    //接收完成，临时文件以清洗后的客户端文件名保存，不覆盖已有文件：重名时加序号，返回最终文件名
+    bool Commit(const std::string& tmpPath, const std::string& fileName, std::string* savedName) const;
+
+private:
+    //同名文件最多尝试的序号，用尽后改用临时文件名的随机后缀
+    static const int MAX_SAME_NAME = 100;
+
+    UploadStore() = default;
+    ~UploadStore() = default;
+
+    //去掉客户端路径，只保留安全字符，不在白名单的扩展名改为.bin
+    static std::string Sanitize_(const std::string& fileName);
+    static bool IsSafeExt_(const char* ext);
+
+    //浏览器不会当作页面或脚本执行的扩展名
+    static const char* const SAFE_EXTS[];
+
+    bool isOpen_ = false;
+    std::string dir_;
+    size_t maxBody_ = 0;
+    std::vector<std::string> paths_;
+};
+
+const int UploadStore::MAX_SAME_NAME;
+const char* const UploadStore::SAFE_EXTS[] = {
+    ".jpg", ".jpeg", ".png", ".gif", ".webp", ".bmp", ".mp3", ".au", ".mp4", ".webm",
+    ".mpeg", ".mpg", ".avi", ".pdf", ".txt", ".zip", ".gz", ".tar", ".bin",
+};
+
+UploadStore* UploadStore::GetInstance() {
+    static UploadStore store;
+    return &store;
+}
+
+void UploadStore::Init(bool open, const std::string& dir, int maxBodyMb, const std::vector<std::string>& paths) {
+    assert(maxBodyMb > 0);
+    isOpen_ = open && !paths.empty() && !dir.empty();
+    dir_ = dir;
+    maxBody_ = static_cast<size_t>(maxBodyMb) << 20;
+    paths_ = paths;
+    if(!isOpen_) {
+        return;
+    }
+    if(mkdir(dir_.c_str(), 0755) < 0 && errno != EEXIST) {
+        LOG_ERROR("Upload dir %s create error: %d", dir_.c_str(), errno);
+        isOpen_ = false;
+        return;
+    }
+    LOG_INFO("Upload dir: %s, maxBody: %dMB", dir_.c_str(), maxBodyMb);
+}
+
+bool UploadStore::IsOpen() const {
+    return isOpen_;
+}
+
+bool UploadStore::IsUploadPath(const char* target) const {
+    if(!isOpen_) {
+        return false;
+    }
+    for(const auto& path : paths_) {
+        if(strncmp(target, path.c_str(), path.size()) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t UploadStore::GetMaxBody() const {
+    return maxBody_;
+}
+
+int UploadStore::OpenTemp(std::string* tmpPath) const {
+    assert(tmpPath);
+    *tmpPath = dir_ + "/.upload-XXXXXX";
+    int fd = mkstemp(&(*tmpPath)[0]);
+    if(fd < 0) {
+        LOG_ERROR("Upload temp file create error: %d", errno);
+    }
+    return fd;
+}
+
+bool UploadStore::Commit(const std::string& tmpPath, const std::string& fileName, std::string* savedName) const {
+    assert(savedName);
+    std::string name = Sanitize_(fileName);
+    //清洗后的名字不以'.'开头，找到的'.'即扩展名的起点，序号加在它前面
+    size_t dot = name.find_last_of('.');
+    std::string stem = name.substr(0, dot);
+    std::string ext = dot == std::string::npos ? "" : name.substr(dot);
+    chmod(tmpPath.c_str(), 0644);
+    //rename会静默替换同名文件，link遇到已有文件返回EEXIST
+    for(int seq = 0; seq <= MAX_SAME_NAME + 1; ++seq) {
+        if(seq == 0) {
+            *savedName = name;
+        }
+        else if(seq <= MAX_SAME_NAME) {
+            *savedName = stem + "-" + std::to_string(seq) + ext;
+        }
+        else {
+            //.upload-XXXXXX的随机后缀
+            *savedName = stem + "-" + tmpPath.substr(tmpPath.size() - 6) + ext;
+        }
+        if(link(tmpPath.c_str(), (dir_ + "/" + *savedName).c_str()) == 0) {
+            unlink(tmpPath.c_str());
+            return true;
+        }
+        if(errno != EEXIST) {
+            break;
+        }
+    }
+    LOG_ERROR("Upload save %s error: %d", name.c_str(), errno);
+    unlink(tmpPath.c_str());
+    return false;
+}
+
+std::string UploadStore::Sanitize_(const std::string& fileName) {
+    //浏览器可能带上客户端完整路径
+    size_t slash = fileName.find_last_of("/\\");
+    std::string name = (slash == std::string::npos) ? fileName : fileName.substr(slash + 1);
+    for(auto& ch : name) {
+        if(!isalnum(static_cast<unsigned char>(ch)) && ch != '.' && ch != '-' && ch != '_') {
+            ch = '_';
+        }
+    }
+    //不允许隐藏文件与目录名
+    if(name.empty() || name[0] == '.') {
+        name = "upload" + name;
+    }
+    //x.html、x.svg等若落在静态目录下会以text/html等类型同源返回，改为x_html.bin；无扩展名的也补.bin，按下载返回
+    size_t dot = name.find_last_of('.');
+    if(dot == std::string::npos) {
+        name += ".bin";
+    }
+    else if(!IsSafeExt_(name.c_str() + dot)) {
+        name[dot] = '_';
+        name += ".bin";
+    }
+    return name;
+}
+
+bool UploadStore::IsSafeExt_(const char* ext) {
+    for(const char* safe : SAFE_EXTS) {
+        if(strcasecmp(ext, safe) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+#endif